@@ -0,0 +1,247 @@
+#include "headers/Bitmap.h"
+#include <algorithm>
+#include <cstring>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BITMAP_HAVE_AVX2 1
+#endif
+
+// The loops over whole byte ranges, in one table per instruction set so that
+// the choice is made once instead of on every call.
+struct BitmapKernels {
+    const char* name;
+    uint64_t (*popcount)(const uint8_t* p, size_t n);
+    // the index of the first byte that is not skip, n if there is none
+    size_t (*find_byte_not)(const uint8_t* p, size_t n, uint8_t skip);
+    void (*combine[3])(uint8_t* dst, const uint8_t* src, size_t n);   // by BitOp
+    void (*invert)(uint8_t* dst, size_t n);
+};
+
+template <BitOp op, typename T>
+static inline T apply_op(T a, T b) {
+    return op == BITOP_AND ? (T)(a & b) : op == BITOP_OR ? (T)(a | b) : (T)(a ^ b);
+}
+
+static uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static void store64(uint8_t* p, uint64_t v) {
+    memcpy(p, &v, 8);
+}
+
+static uint64_t popcount_scalar(const uint8_t* p, size_t n) {
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        count += __builtin_popcountll(load64(p + i));
+    }
+    for (; i < n; i++) {
+        count += __builtin_popcount(p[i]);
+    }
+    return count;
+}
+
+static size_t find_byte_not_scalar(const uint8_t* p, size_t n, uint8_t skip) {
+    uint64_t pattern = skip * 0x0101010101010101ULL;
+    size_t i = 0;
+    while (i + 8 <= n && load64(p + i) == pattern) {
+        i += 8;
+    }
+    while (i < n && p[i] == skip) {
+        i++;
+    }
+    return i;
+}
+
+template <BitOp op>
+static void combine_scalar(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        store64(dst + i, apply_op<op>(load64(dst + i), load64(src + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = apply_op<op>(dst[i], src[i]);
+    }
+}
+
+static void invert_scalar(uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        store64(dst + i, ~load64(dst + i));
+    }
+    for (; i < n; i++) {
+        dst[i] = (uint8_t)~dst[i];
+    }
+}
+
+static const BitmapKernels scalar_kernels = {
+    "scalar",
+    &popcount_scalar,
+    &find_byte_not_scalar,
+    {&combine_scalar<BITOP_AND>, &combine_scalar<BITOP_OR>, &combine_scalar<BITOP_XOR>},
+    &invert_scalar,
+};
+
+#if defined(BITMAP_HAVE_AVX2)
+// the number of set bits in each byte of v
+__attribute__((target("avx2")))
+static inline __m256i popcount_bytes_avx2(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+}
+
+// Counts with the nibble lookup of Mula et al. ("Faster population counts
+// using AVX2 instructions"): a byte shuffle looks up the bits of each half
+// byte, and a sum of absolute differences adds the bytes up into 64 bit
+// lanes. Two accumulators keep two blocks in flight.
+__attribute__((target("avx2")))
+static uint64_t popcount_avx2(const uint8_t* p, size_t n) {
+    __m256i total = _mm256_setzero_si256();
+    size_t blocks_end = n & ~(size_t)63;
+    size_t i = 0;
+    while (i < blocks_end) {
+        // a byte counts at most 8 per block, so 31 blocks fit in the byte
+        // counters before they have to be widened
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        size_t end = std::min(blocks_end, i + 31 * 64);
+        for (; i < end; i += 64) {
+            acc0 = _mm256_add_epi8(acc0, popcount_bytes_avx2(_mm256_loadu_si256((const __m256i*)(p + i))));
+            acc1 = _mm256_add_epi8(acc1, popcount_bytes_avx2(_mm256_loadu_si256((const __m256i*)(p + i + 32))));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc0, _mm256_setzero_si256()));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc1, _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcount_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_not_avx2(const uint8_t* p, size_t n, uint8_t skip) {
+    const __m256i pattern = _mm256_set1_epi8((char)skip);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern));
+        if (equal != 0xFFFFFFFFu) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    return i + find_byte_not_scalar(p + i, n - i, skip);
+}
+
+template <BitOp op>
+__attribute__((target("avx2")))
+static inline __m256i apply_op256(__m256i a, __m256i b) {
+    return op == BITOP_AND ? _mm256_and_si256(a, b)
+        : op == BITOP_OR ? _mm256_or_si256(a, b) : _mm256_xor_si256(a, b);
+}
+
+template <BitOp op>
+__attribute__((target("avx2")))
+static void combine_avx2(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), apply_op256<op>(a, b));
+    }
+    combine_scalar<op>(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void invert_avx2(uint8_t* dst, size_t n) {
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(v, ones));
+    }
+    invert_scalar(dst + i, n - i);
+}
+
+static const BitmapKernels avx2_kernels = {
+    "avx2",
+    &popcount_avx2,
+    &find_byte_not_avx2,
+    {&combine_avx2<BITOP_AND>, &combine_avx2<BITOP_OR>, &combine_avx2<BITOP_XOR>},
+    &invert_avx2,
+};
+#endif
+
+static const BitmapKernels* best_kernels() {
+#if defined(BITMAP_HAVE_AVX2)
+    __builtin_cpu_init();   // may run before the constructors that would do it
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    }
+#endif
+    return &scalar_kernels;
+}
+
+static const BitmapKernels* kernels = best_kernels();
+
+void bitmap_use_simd(bool enable) {
+    kernels = enable ? best_kernels() : &scalar_kernels;
+}
+
+const char* bitmap_impl() {
+    return kernels->name;
+}
+
+// the position of the highest set bit of b, counted from bit 0 of byte idx
+static int64_t first_set(uint64_t idx, uint8_t b) {
+    return b == 0 ? -1 : (int64_t)(idx * 8 + __builtin_clz((unsigned)b) - 24);
+}
+
+uint64_t bitmap_count(const uint8_t* data, uint64_t first, uint64_t last) {
+    uint64_t first_byte = first / 8;
+    uint64_t last_byte = last / 8;
+    uint8_t head = (uint8_t)(0xFF >> (first % 8));
+    uint8_t tail = (uint8_t)(0xFF << (7 - last % 8));
+    if (first_byte == last_byte) {
+        return __builtin_popcount(data[first_byte] & head & tail);
+    }
+    return __builtin_popcount(data[first_byte] & head)
+        + kernels->popcount(data + first_byte + 1, last_byte - first_byte - 1)
+        + __builtin_popcount(data[last_byte] & tail);
+}
+
+int64_t bitmap_find(const uint8_t* data, uint64_t first, uint64_t last, int bit) {
+    // looks for a set bit in data ^ flip
+    uint8_t flip = bit ? 0 : 0xFF;
+    uint64_t first_byte = first / 8;
+    uint64_t last_byte = last / 8;
+    uint8_t head = (uint8_t)(0xFF >> (first % 8));
+    uint8_t tail = (uint8_t)(0xFF << (7 - last % 8));
+    if (first_byte == last_byte) {
+        return first_set(first_byte, (data[first_byte] ^ flip) & head & tail);
+    }
+    uint8_t b = (data[first_byte] ^ flip) & head;
+    if (b != 0) {
+        return first_set(first_byte, b);
+    }
+    size_t n = last_byte - first_byte - 1;
+    size_t idx = kernels->find_byte_not(data + first_byte + 1, n, flip);
+    if (idx < n) {
+        return first_set(first_byte + 1 + idx, data[first_byte + 1 + idx] ^ flip);
+    }
+    return first_set(last_byte, (data[last_byte] ^ flip) & tail);
+}
+
+void bitmap_combine(BitOp op, uint8_t* dst, const uint8_t* src, size_t n) {
+    kernels->combine[op](dst, src, n);
+}
+
+void bitmap_not(uint8_t* dst, size_t n) {
+    kernels->invert(dst, n);
+}
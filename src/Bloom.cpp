@@ -0,0 +1,246 @@
+#include "headers/Bloom.h"
+#include "headers/UtilFuncs.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+static const size_t k_block_bits = sizeof(BloomBlock) * 8;
+static const size_t k_cache_line = 64;
+static const size_t k_batch_group = 16;
+static const double k_tightening_ratio = 0.5;     // error rate of a new layer relative to the last
+static const uint64_t k_hash_seed = 0x9747b28cULL;
+
+// one odd multiplier per word of a block; the top 5 bits of key * salt pick
+// the bit of that word
+static const uint32_t k_salt[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+// The false positive rate of a split block filter holding lambda items per
+// block on average. The items in a block are about Poisson distributed, and
+// with k of them a word has a given bit set with probability 1 - (31/32)^k.
+static double block_false_positive_rate(double lambda) {
+    double p_k = std::exp(-lambda);     // probability of k items in the block
+    double rate = 0;
+    size_t limit = (size_t)(lambda + 12 * std::sqrt(lambda) + 32);
+    for (size_t k = 0; k <= limit; k++) {
+        rate += p_k * std::pow(1 - std::pow(31.0 / 32, (double)k), 8);
+        p_k *= lambda / (double)(k + 1);
+    }
+    return rate;
+}
+
+size_t bloom_layer_bytes(double error_rate, uint64_t capacity) {
+    // the most items per block that keep the rate within error_rate. The
+    // usual closed form ignores how unevenly items spread over the blocks,
+    // and a filter sized by it errs about 1.5 times as often as asked.
+    double lo = 0;
+    double hi = (double)k_block_bits;
+    for (int i = 0; i < 50; i++) {
+        double mid = (lo + hi) / 2;
+        if (block_false_positive_rate(mid) <= error_rate) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    double blocks = std::max(1.0, std::ceil((double)capacity / std::max(lo, 1e-9)));
+    if (blocks > (double)(SIZE_MAX / sizeof(BloomBlock))) {
+        return SIZE_MAX;
+    }
+    return (size_t)blocks * sizeof(BloomBlock);
+}
+
+// the block an item goes to, by the high half of its hash
+static BloomBlock* block_of(const BloomLayer& layer, uint64_t hash) {
+    return &layer.blocks[((hash >> 32) * layer.num_blocks) >> 32];
+}
+
+static uint32_t bit_mask(uint64_t hash, size_t word) {
+    return 1U << (((uint32_t)hash * k_salt[word]) >> 27);
+}
+
+static bool block_test(const BloomBlock* block, uint64_t hash) {
+    uint32_t missing = 0;
+    for (size_t i = 0; i < 8; i++) {
+        missing |= ~block->words[i] & bit_mask(hash, i);
+    }
+    return missing == 0;
+}
+
+static void block_set(BloomBlock* block, uint64_t hash) {
+    for (size_t i = 0; i < 8; i++) {
+        block->words[i] |= bit_mask(hash, i);
+    }
+}
+
+BloomFilter::BloomFilter(double error_rate, uint64_t capacity, uint32_t expansion)
+    : error_rate(error_rate), expansion(expansion) {
+    add_layer(capacity, error_rate);
+}
+
+BloomFilter::~BloomFilter() {
+    for (BloomLayer& layer : layers) {
+        free(layer.alloc);
+    }
+}
+
+uint64_t BloomFilter::hash(const uint8_t* data, size_t len) {
+    return murmur_hash64(data, len, k_hash_seed);
+}
+
+bool BloomFilter::add_layer(uint64_t capacity, double rate) {
+    size_t layer_bytes = bloom_layer_bytes(rate, capacity);
+    if (layer_bytes > k_bloom_max_layer_bytes) {
+        return false;
+    }
+    // calloc gets large blocks as fresh pages, zeroed as they are touched
+    BloomLayer layer;
+    layer.alloc = calloc(1, layer_bytes + k_cache_line);
+    if (layer.alloc == nullptr) {
+        return false;
+    }
+    uintptr_t aligned = ((uintptr_t)layer.alloc + k_cache_line - 1) & ~(uintptr_t)(k_cache_line - 1);
+    layer.blocks = (BloomBlock*)aligned;
+    layer.num_blocks = layer_bytes / sizeof(BloomBlock);
+    layer.capacity = capacity;
+    layers.push_back(layer);
+    bytes += layer_bytes + k_cache_line;
+    error_rate = rate;
+    return true;
+}
+
+uint64_t BloomFilter::capacity() {
+    uint64_t total = 0;
+    for (BloomLayer& layer : layers) {
+        total += layer.capacity;
+    }
+    return total;
+}
+
+void BloomFilter::add(const uint64_t* hashes, size_t n, int* results) {
+    for (size_t base = 0; base < n; base += k_batch_group) {
+        size_t end = std::min(n, base + k_batch_group);
+        for (size_t i = base; i < end; i++) {
+            for (BloomLayer& layer : layers) {
+                __builtin_prefetch(block_of(layer, hashes[i]), 1);
+            }
+        }
+        for (size_t i = base; i < end; i++) {
+            uint64_t hash = hashes[i];
+            // the newest layer is the largest, so the likeliest to have it
+            bool found = false;
+            for (size_t j = layers.size(); !found && j-- > 0;) {
+                found = block_test(block_of(layers[j], hash), hash);
+            }
+            if (found) {
+                results[i] = 0;
+                continue;
+            }
+            BloomLayer* last = &layers.back();
+            if (last->items >= last->capacity) {
+                if (expansion == 0 || last->capacity > UINT64_MAX / expansion
+                        || !add_layer(last->capacity * expansion, error_rate * k_tightening_ratio)) {
+                    results[i] = -1;
+                    continue;
+                }
+                last = &layers.back();
+            }
+            block_set(block_of(*last, hash), hash);
+            last->items++;
+            items++;
+            results[i] = 1;
+        }
+    }
+}
+
+void BloomFilter::contains(const uint64_t* hashes, size_t n, int* results) {
+    for (size_t base = 0; base < n; base += k_batch_group) {
+        size_t end = std::min(n, base + k_batch_group);
+        for (size_t i = base; i < end; i++) {
+            for (BloomLayer& layer : layers) {
+                __builtin_prefetch(block_of(layer, hashes[i]));
+            }
+        }
+        for (size_t i = base; i < end; i++) {
+            bool found = false;
+            for (size_t j = layers.size(); !found && j-- > 0;) {
+                found = block_test(block_of(layers[j], hashes[i]), hashes[i]);
+            }
+            results[i] = found ? 1 : 0;
+        }
+    }
+}
+
+// error rate, expansion, items and the layer count, then each layer's
+// capacity, items, block count and blocks
+struct BloomHeader {
+    double error_rate;
+    uint32_t expansion;
+    uint32_t num_layers;
+    uint64_t items;
+};
+
+struct BloomLayerHeader {
+    uint64_t capacity;
+    uint64_t items;
+    uint64_t num_blocks;
+};
+
+void BloomFilter::serialize(std::string& out) {
+    BloomHeader header = {error_rate, expansion, (uint32_t)layers.size(), items};
+    out.append((const char*)&header, sizeof(header));
+    for (BloomLayer& layer : layers) {
+        BloomLayerHeader lh = {layer.capacity, layer.items, layer.num_blocks};
+        out.append((const char*)&lh, sizeof(lh));
+        out.append((const char*)layer.blocks, layer.num_blocks * sizeof(BloomBlock));
+    }
+}
+
+BloomFilter* BloomFilter::deserialize(const char* data, size_t len) {
+    BloomHeader header;
+    if (len < sizeof(header)) {
+        return nullptr;
+    }
+    memcpy(&header, data, sizeof(header));
+    data += sizeof(header);
+    len -= sizeof(header);
+    if (!(header.error_rate > 0 && header.error_rate < 1) || header.num_layers == 0) {
+        return nullptr;
+    }
+    std::unique_ptr<BloomFilter> filter(new BloomFilter(header.error_rate, header.expansion));
+    filter->items = header.items;
+    for (uint32_t i = 0; i < header.num_layers; i++) {
+        BloomLayerHeader lh;
+        if (len < sizeof(lh)) {
+            return nullptr;
+        }
+        memcpy(&lh, data, sizeof(lh));
+        data += sizeof(lh);
+        len -= sizeof(lh);
+        if (lh.num_blocks == 0 || lh.num_blocks > k_bloom_max_layer_bytes / sizeof(BloomBlock)
+                || len < lh.num_blocks * sizeof(BloomBlock)) {
+            return nullptr;
+        }
+        size_t layer_bytes = lh.num_blocks * sizeof(BloomBlock);
+        BloomLayer layer;
+        layer.alloc = malloc(layer_bytes + k_cache_line);
+        if (layer.alloc == nullptr) {
+            return nullptr;
+        }
+        uintptr_t aligned = ((uintptr_t)layer.alloc + k_cache_line - 1) & ~(uintptr_t)(k_cache_line - 1);
+        layer.blocks = (BloomBlock*)aligned;
+        layer.num_blocks = lh.num_blocks;
+        layer.capacity = lh.capacity;
+        layer.items = lh.items;
+        memcpy(layer.blocks, data, layer_bytes);
+        filter->layers.push_back(layer);
+        filter->bytes += layer_bytes + k_cache_line;
+        data += layer_bytes;
+        len -= layer_bytes;
+    }
+    return len == 0 ? filter.release() : nullptr;
+}
@@ -2,21 +2,74 @@
 #include <cstdint>
 #include <cstring>
 
-void Buffer::buffer_append(const uint8_t *new_data, int n) {
-    if (buffer_begin == nullptr) {
-        int size = std::max(n, 64);
-        buffer_begin = new uint8_t[size];
-        data_begin = buffer_begin;
-        data_end = data_begin;
-        buffer_end = buffer_begin + size;
+static thread_local std::vector<uint8_t*> free_chunks;
+static thread_local size_t chunks_in_use = 0;
+
+static uint8_t* chunk_get() {
+    chunks_in_use++;
+    if (free_chunks.empty()) {
+        return new uint8_t[k_buffer_chunk_size];
+    }
+    uint8_t* chunk = free_chunks.back();
+    free_chunks.pop_back();
+    return chunk;
+}
+
+static void chunk_put(uint8_t* chunk) {
+    chunks_in_use--;
+    if (free_chunks.size() >= k_buffer_pool_max_free) {
+        delete [] chunk;
+        return;
+    }
+    free_chunks.push_back(chunk);
+}
+
+BufferPoolStats buffer_pool_stats() {
+    BufferPoolStats stats;
+    stats.chunks_in_use = chunks_in_use;
+    stats.chunks_free = free_chunks.size();
+    return stats;
+}
+
+// heap buffers are always larger than a chunk, so the capacity tells the two apart
+static uint8_t* storage_alloc(size_t& capacity) {
+    if (capacity <= k_buffer_chunk_size) {
+        capacity = k_buffer_chunk_size;
+        return chunk_get();
     }
-    while (data_end + n > buffer_end) {
-        resize();
+    return new uint8_t[capacity];
+}
+
+static void storage_free(uint8_t* storage, size_t capacity) {
+    if (capacity == k_buffer_chunk_size) {
+        chunk_put(storage);
+    } else {
+        delete [] storage;
     }
-    memcpy(data_end, new_data, n);
+}
+
+void Buffer::buffer_append(const uint8_t *new_data, int n) {
+    memcpy(reserve(n), new_data, n);
     data_end += n;
 }
 
+uint8_t* Buffer::reserve(size_t n) {
+    if (buffer_begin == nullptr) {
+        resize(n);
+    } else if (data_end + n > buffer_end) {
+        size_t data_size = data_end - data_begin;
+        if (data_size + n <= capacity() && data_begin - buffer_begin >= (ptrdiff_t)data_size) {
+            // enough room once the consumed head is reclaimed, and cheap to move
+            memmove(buffer_begin, data_begin, data_size);
+            data_begin = buffer_begin;
+            data_end = buffer_begin + data_size;
+        } else {
+            resize(data_size + n);
+        }
+    }
+    return data_end;
+}
+
 void Buffer::buffer_consume(int n) {
     data_begin += n;
     if (data_begin >= data_end) {
@@ -25,19 +78,50 @@ void Buffer::buffer_consume(int n) {
     }
 }
 
-void Buffer::resize() {
-    // double the size
-    size_t total_size = buffer_end - buffer_begin;
-    size_t data_size  = data_end - data_begin;
+// moves the data into new storage of at least min_capacity bytes, doubling
+// the current capacity when that is larger
+void Buffer::resize(size_t min_capacity) {
+    size_t data_size = data_end - data_begin;
+    size_t new_capacity = std::max(min_capacity, 2 * capacity());
+    uint8_t* new_buffer_begin = storage_alloc(new_capacity);
+    if (data_size > 0) {
+        memcpy(new_buffer_begin, data_begin, data_size);
+    }
+    release_storage();
+
+    buffer_begin = new_buffer_begin;
+    data_begin = buffer_begin;
+    data_end = data_begin + data_size;
+    buffer_end = buffer_begin + new_capacity;
+}
+
+void Buffer::release_storage() {
+    if (buffer_begin != nullptr) {
+        storage_free(buffer_begin, capacity());
+    }
+    buffer_begin = data_begin = data_end = buffer_end = nullptr;
+}
 
-    uint8_t* new_buffer_begin = new uint8_t[2 * total_size];
+void Buffer::shrink() {
+    size_t data_size = data_end - data_begin;
+    if (data_size == 0) {
+        release_storage();
+        return;
+    }
+    // only heap buffers that are at most a quarter full; the copy is then
+    // paid for by the bytes consumed since the buffer was last this size
+    if (capacity() <= k_buffer_chunk_size || data_size * 4 > capacity()) {
+        return;
+    }
+    size_t new_capacity = std::max(data_size * 2, k_buffer_chunk_size);
+    uint8_t* new_buffer_begin = storage_alloc(new_capacity);
     memcpy(new_buffer_begin, data_begin, data_size);
-    delete [] buffer_begin;
+    release_storage();
 
     buffer_begin = new_buffer_begin;
     data_begin = buffer_begin;
     data_end = data_begin + data_size;
-    buffer_end = buffer_begin + (2 * total_size);
+    buffer_end = buffer_begin + new_capacity;
 }
 
 int Buffer::size() {
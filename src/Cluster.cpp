@@ -0,0 +1,125 @@
+#include "headers/Cluster.h"
+#include <stdlib.h>
+#include <string.h>
+
+// CRC16-CCITT (XMODEM), the slot hash of Redis Cluster, a byte at a time
+struct Crc16Table {
+    uint16_t t[256];
+
+    Crc16Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+            t[i] = crc;
+        }
+    }
+};
+
+static const Crc16Table k_crc16;
+
+static uint16_t crc16(const char* data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)((crc << 8) ^ k_crc16.t[((crc >> 8) ^ (uint8_t)data[i]) & 0xff]);
+    }
+    return crc;
+}
+
+uint16_t key_hash_slot(const char* key, size_t len) {
+    const char* open = (const char*)memchr(key, '{', len);
+    if (open != nullptr) {
+        size_t rest = len - (size_t)(open + 1 - key);
+        const char* close = (const char*)memchr(open + 1, '}', rest);
+        if (close != nullptr && close > open + 1) {
+            key = open + 1;
+            len = (size_t)(close - key);
+        }
+    }
+    return crc16(key, len) & (k_cluster_slots - 1);
+}
+
+void ClusterState::init(const std::string& ip, uint16_t port) {
+    nodes.reset(new ClusterNode[k_cluster_max_nodes]);
+    owner.reset(new std::atomic<int16_t>[k_cluster_slots]);
+    migrating_to.reset(new std::atomic<int16_t>[k_cluster_slots]);
+    importing_from.reset(new int16_t[k_cluster_slots]);
+    for (uint32_t slot = 0; slot < k_cluster_slots; slot++) {
+        owner[slot].store(-1, std::memory_order_relaxed);
+        migrating_to[slot].store(-1, std::memory_order_relaxed);
+        importing_from[slot] = -1;
+    }
+    nodes[0].ip = ip;
+    nodes[0].port = port;
+    nodes[0].addr = ip + ":" + std::to_string(port);
+    num_nodes.store(1, std::memory_order_release);
+}
+
+int16_t ClusterState::node_index(const std::string& addr) {
+    size_t n = num_nodes.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; i++) {
+        if (nodes[i].addr == addr) {
+            return (int16_t)i;
+        }
+    }
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos || colon == 0 || n == k_cluster_max_nodes) {
+        return -1;
+    }
+    char* end = nullptr;
+    long port = strtol(addr.c_str() + colon + 1, &end, 10);
+    if (colon + 1 == addr.size() || *end != '\0' || port <= 0 || port > 65535) {
+        return -1;
+    }
+    nodes[n].ip = addr.substr(0, colon);
+    nodes[n].port = (uint16_t)port;
+    nodes[n].addr = addr;
+    num_nodes.store(n + 1, std::memory_order_release);
+    return (int16_t)n;
+}
+
+SlotRoute ClusterState::route(uint16_t slot, bool asking, int16_t& node) const {
+    int16_t slot_node = slot_owner(slot);
+    if (slot_node == 0) {
+        node = slot_migrating_to(slot);
+        return node >= 0 ? SLOT_MIGRATING : SLOT_SERVE;
+    }
+    if (asking && importing_from[slot] >= 0) {
+        return SLOT_SERVE;
+    }
+    node = slot_node;
+    return slot_node < 0 ? SLOT_UNASSIGNED : SLOT_MOVED;
+}
+
+void ClusterState::set_owner(uint16_t slot, int16_t node) {
+    int16_t old = slot_owner(slot);
+    slots_owned += (node == 0) - (old == 0);
+    owner[slot].store(node, std::memory_order_release);
+    migrating_to[slot].store(-1, std::memory_order_release);
+    importing_from[slot] = -1;
+}
+
+void ClusterState::set_migrating(uint16_t slot, int16_t node) {
+    migrating_to[slot].store(node, std::memory_order_release);
+}
+
+void ClusterState::set_importing(uint16_t slot, int16_t node) {
+    importing_from[slot] = node;
+}
+
+size_t ClusterState::migrating() const {
+    size_t n = 0;
+    for (uint32_t slot = 0; slot < k_cluster_slots; slot++) {
+        n += slot_migrating_to(slot) >= 0;
+    }
+    return n;
+}
+
+size_t ClusterState::importing() const {
+    size_t n = 0;
+    for (uint32_t slot = 0; slot < k_cluster_slots; slot++) {
+        n += importing_from[slot] >= 0;
+    }
+    return n;
+}
@@ -0,0 +1,91 @@
+#include "headers/Commands.h"
+#include <algorithm>
+#include <unordered_map>
+
+static const CommandSpec k_commands[] = {
+    // name                 args     keys       flags
+    {"get",                 2, 0,    1, -1, 1,  0},
+    {"set",                 3, 0,    1, 1, 1,   CMD_WRITE},
+    {"getex",               2, 0,    1, 1, 1,   CMD_WRITE},
+    {"getdel",              2, 2,    1, 1, 1,   CMD_WRITE},
+    {"del",                 2, 2,    1, -1, 1,  CMD_WRITE},     // RESP del runs as mdel
+    {"mdel",                2, 0,    1, -1, 1,  CMD_WRITE},
+    {"unlink",              2, 0,    1, -1, 1,  CMD_WRITE},
+    {"expire",              3, 3,    1, 1, 1,   CMD_WRITE},
+    {"persist",             2, 2,    1, 1, 1,   CMD_WRITE},
+    {"mset",                3, 0,    1, -1, 2,  CMD_WRITE},
+    {"msetex",              4, 0,    2, -1, 2,  CMD_WRITE},
+    {"append",              3, 3,    1, 1, 1,   CMD_WRITE},
+    {"strlen",              2, 2,    1, 1, 1,   0},
+    {"getrange",            4, 4,    1, 1, 1,   0},
+    {"setrange",            4, 4,    1, 1, 1,   CMD_WRITE},
+    {"incr",                2, 2,    1, 1, 1,   CMD_WRITE},
+    {"decr",                2, 2,    1, 1, 1,   CMD_WRITE},
+    {"incrby",              3, 3,    1, 1, 1,   CMD_WRITE},
+    {"decrby",              3, 3,    1, 1, 1,   CMD_WRITE},
+    {"incrbyfloat",         3, 3,    1, 1, 1,   CMD_WRITE},
+    {"zadd",                4, 0,    1, 1, 1,   CMD_WRITE},
+    {"zrem",                3, 0,    1, 1, 1,   CMD_WRITE},
+    {"zscore",              3, 3,    1, 1, 1,   0},
+    {"zrank",               3, 3,    1, 1, 1,   0},
+    {"zcard",               2, 2,    1, 1, 1,   0},
+    {"zrange",              4, 5,    1, 1, 1,   0},
+    {"zrangebyscore",       4, 0,    1, 1, 1,   0},
+    {"pfadd",               2, 0,    1, 1, 1,   CMD_WRITE},
+    {"pfcount",             2, 0,    1, -1, 1,  0},
+    {"pfmerge",             2, 0,    1, -1, 1,  CMD_WRITE_FIRST},
+    {"setbit",              4, 4,    1, 1, 1,   CMD_WRITE},
+    {"getbit",              3, 3,    1, 1, 1,   0},
+    {"bitcount",            2, 0,    1, 1, 1,   0},
+    {"bitpos",              3, 0,    1, 1, 1,   0},
+    {"bitop",               4, 0,    2, -1, 1,  CMD_WRITE_FIRST},
+    {"bf.reserve",          4, 0,    1, 1, 1,   CMD_WRITE},
+    {"bf.add",              3, 3,    1, 1, 1,   CMD_WRITE},
+    {"bf.madd",             3, 0,    1, 1, 1,   CMD_WRITE},
+    {"bf.exists",           3, 3,    1, 1, 1,   0},
+    {"bf.mexists",          3, 0,    1, 1, 1,   0},
+    {"bf.info",             2, 2,    1, 1, 1,   0},
+    {"dump",                2, 2,    1, 1, 1,   0},
+    {"restore",             4, 5,    1, 1, 1,   CMD_WRITE},
+    {"restore-asking",      4, 5,    1, 1, 1,   CMD_WRITE},
+    {"migrate",             5, 0,    0, 0, 0,   CMD_WRITE},
+    {"flushall",            1, 2,    0, 0, 0,   CMD_WRITE},
+    {"scan",                2, 0,    0, 0, 0,   0},
+    {"prefix.keys",         2, 0,    0, 0, 0,   0},
+    {"prefix.range",        3, 0,    0, 0, 0,   0},
+    {"prefix.del",          2, 2,    0, 0, 0,   CMD_WRITE},
+    {"info",                1, 2,    0, 0, 0,   0},
+    {"config",              3, 4,    0, 0, 0,   0},
+    {"publish",             3, 3,    0, 0, 0,   0},
+    {"hotkeys",             1, 3,    0, 0, 0,   0},
+    {"cluster",             2, 0,    0, 0, 0,   0},
+    {"mget",                2, 0,    1, -1, 1,  CMD_RESP_ONLY},
+    {"ping",                1, 2,    0, 0, 0,   CMD_RESP_ONLY},
+    {"hello",               1, 2,    0, 0, 0,   CMD_RESP_ONLY},
+    {"select",              2, 2,    0, 0, 0,   CMD_RESP_ONLY},
+    {"command",             1, 0,    0, 0, 0,   CMD_RESP_ONLY},
+    {"watch",               2, 0,    1, -1, 1,  CMD_TRANSACTION},
+};
+
+const CommandSpec* command_spec(const std::string& name) {
+    static const std::unordered_map<std::string, const CommandSpec*> by_name = [] {
+        std::unordered_map<std::string, const CommandSpec*> specs;
+        for (const CommandSpec& spec : k_commands) {
+            specs[spec.name] = &spec;
+        }
+        return specs;
+    }();
+    auto it = by_name.find(name);
+    return it == by_name.end() ? nullptr : it->second;
+}
+
+bool command_keys(const std::vector<std::string>& cmd, size_t& first, size_t& end, size_t& step) {
+    const CommandSpec* spec = command_spec(cmd[0]);
+    if (spec == nullptr || spec->first_key == 0) {
+        return false;
+    }
+    first = spec->first_key;
+    end = spec->last_key < 0 ? cmd.size() : std::min(cmd.size(), (size_t)spec->last_key + 1);
+    step = spec->key_step;
+    return first < end;
+}
@@ -0,0 +1,124 @@
+#include "headers/Evict.h"
+#include "headers/UtilFuncs.h"
+#include <stdlib.h>
+#include <utility>
+
+bool parse_eviction_policy(const std::string& name, EvictionPolicy& out) {
+    if (name == "noeviction") {
+        out = EVICT_NOEVICTION;
+    } else if (name == "allkeys-lru") {
+        out = EVICT_ALLKEYS_LRU;
+    } else if (name == "allkeys-lfu") {
+        out = EVICT_ALLKEYS_LFU;
+    } else if (name == "volatile-ttl") {
+        out = EVICT_VOLATILE_TTL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* eviction_policy_name(EvictionPolicy policy) {
+    switch (policy) {
+        case EVICT_ALLKEYS_LRU: return "allkeys-lru";
+        case EVICT_ALLKEYS_LFU: return "allkeys-lfu";
+        case EVICT_VOLATILE_TTL: return "volatile-ttl";
+        default: return "noeviction";
+    }
+}
+
+uint32_t lru_clock() {
+    return (uint32_t)(get_monotonic_msec() / k_lru_clock_resolution_ms) & k_lru_clock_max;
+}
+
+uint64_t lru_idle_ms(uint32_t lru) {
+    uint32_t now = lru_clock();
+    uint64_t ticks;
+    if (now >= lru) {
+        ticks = now - lru;
+    } else {
+        ticks = (k_lru_clock_max - lru) + now;  // the clock wrapped around
+    }
+    return ticks * k_lru_clock_resolution_ms;
+}
+
+static uint32_t lfu_time_minutes() {
+    return (uint32_t)(get_monotonic_msec() / 60000) & 0xFFFF;
+}
+
+static uint32_t lfu_elapsed_minutes(uint32_t ldt) {
+    uint32_t now = lfu_time_minutes();
+    if (now >= ldt) {
+        return now - ldt;
+    }
+    return 0xFFFF - ldt + now;
+}
+
+uint64_t lfu_idle_ms(uint32_t lru) {
+    return (uint64_t)lfu_elapsed_minutes(lru >> 8) * 60000;
+}
+
+uint32_t lfu_init() {
+    return (lfu_time_minutes() << 8) | k_lfu_init_val;
+}
+
+uint8_t lfu_decayed_counter(uint32_t lru) {
+    uint32_t ldt = lru >> 8;
+    uint32_t counter = lru & 255;
+    uint32_t periods = lfu_elapsed_minutes(ldt) / k_lfu_decay_minutes;
+    return (uint8_t)(periods > counter ? 0 : counter - periods);
+}
+
+uint32_t lfu_touch(uint32_t lru) {
+    uint32_t counter = lfu_decayed_counter(lru);
+    // logarithmic increment: the higher the counter, the less likely it grows
+    if (counter < 255) {
+        double r = (double)rand() / RAND_MAX;
+        double base = counter > k_lfu_init_val ? counter - k_lfu_init_val : 0;
+        double p = 1.0 / (base * k_lfu_log_factor + 1);
+        if (r < p) {
+            counter++;
+        }
+    }
+    return (lfu_time_minutes() << 8) | counter;
+}
+
+void EvictionPool::insert(uint64_t idle, const std::string& key) {
+    // find the first slot with a higher score than ours
+    size_t pos = 0;
+    while (pos < count && pool[pos].idle < idle) {
+        pos++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (pool[i].key == key) {
+            return;     // already a candidate
+        }
+    }
+    if (count == k_pool_size) {
+        if (pos == 0) {
+            return;     // worse than everything in a full pool
+        }
+        // drop the worst candidate to make room
+        for (size_t i = 0; i + 1 < pos; i++) {
+            std::swap(pool[i], pool[i + 1]);
+        }
+        pos--;
+    } else {
+        for (size_t i = count; i > pos; i--) {
+            std::swap(pool[i], pool[i - 1]);
+        }
+        count++;
+    }
+    pool[pos].idle = idle;
+    pool[pos].key = key;
+}
+
+bool EvictionPool::pop_best(std::string& key) {
+    if (count == 0) {
+        return false;
+    }
+    count--;
+    key.swap(pool[count].key);
+    pool[count].key.clear();
+    return true;
+}
@@ -1,4 +1,7 @@
 #include "headers/HashTable.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
 
 HTable::HTable(size_t cap) {
     assert((cap & (cap - 1)) == 0);
@@ -43,10 +46,12 @@ HNode* HTable::hm_delete(HNode* target, bool (*eq)(HNode*, HNode*)) {
 void HTable::h_insert(HNode* node) {
     int idx = node->hash_code & this->mask;
     node->next = htable[idx];
+    // a lock-free reader that finds the node must also see it initialized
+    std::atomic_thread_fence(std::memory_order_release);
     htable[idx] = node;
     size++;
     if (1.0 * size / cap >= max_load_factor) {
-        h_resize();
+        h_resize(cap << 1);
     }
 }
 
@@ -58,16 +63,113 @@ HNode* HTable::hm_lookup(HNode* target, bool (*eq)(HNode*, HNode*)) {
     return *from;
 }
 
+// Looks up n nodes in groups so that their cache misses overlap instead of
+// being paid one after another: first every bucket slot of the group is
+// prefetched, then every chain head, and only then are the chains walked.
+void HTable::hm_lookup_batch(HNode** targets, size_t n, bool (*eq)(HNode*, HNode*), HNode** out) {
+    for (size_t base = 0; base < n; base += k_batch_group) {
+        size_t end = std::min(n, base + k_batch_group);
+        for (size_t i = base; i < end; i++) {
+            __builtin_prefetch(&htable[targets[i]->hash_code & this->mask]);
+        }
+        for (size_t i = base; i < end; i++) {
+            HNode* head = htable[targets[i]->hash_code & this->mask];
+            if (head != nullptr) {
+                __builtin_prefetch(head);
+            }
+        }
+        for (size_t i = base; i < end; i++) {
+            HNode** from = h_lookup(targets[i], eq);
+            out[i] = from == nullptr ? nullptr : *from;
+        }
+    }
+}
+
 void HTable::hm_insert(HNode* new_node) {
     h_insert(new_node);
 }
 
-void HTable::h_resize() {
+// Picks the first non empty bucket from a random one on, then a random node
+// of its chain. The table does not shrink when keys are deleted, so it may be
+// almost empty: the walk gives up after k_random_walk buckets, as Redis's
+// dictGetSomeKeys does, and returns nullptr rather than stall the caller.
+HNode* HTable::hm_random() {
+    if (size == 0) {
+        return nullptr;
+    }
+    size_t start = random();
+    HNode* head = nullptr;
+    for (size_t i = 0; head == nullptr && i < k_random_walk && i <= mask; i++) {
+        head = htable[(start + i) & mask];
+    }
+    if (head == nullptr) {
+        return nullptr;
+    }
+    size_t chain_len = 0;
+    for (HNode* node = head; node != nullptr; node = node->next) {
+        chain_len++;
+    }
+    size_t pick = random() % chain_len;
+    while (pick--) {
+        head = head->next;
+    }
+    return head;
+}
+
+// grows the table once so that n more nodes fit below the max load factor,
+// letting a batch of inserts skip the intermediate doublings
+void HTable::hm_reserve(size_t n) {
+    size_t new_cap = cap;
+    while (1.0 * (size + n) / new_cap >= max_load_factor) {
+        new_cap <<= 1;
+    }
+    if (new_cap != cap) {
+        h_resize(new_cap);
+    }
+}
+
+static size_t rev_bits(size_t v) {
+    size_t s = 8 * sizeof(v);
+    size_t mask = ~(size_t)0;
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+// Visits the bucket the cursor points at and returns the next cursor, 0 once
+// every bucket has been seen. The cursor is incremented in reverse binary
+// order: the high bits of the bucket index change first. When the table
+// doubles, bucket i splits into i and i + old_cap, which share their low bits,
+// so buckets already visited stay visited and no key present for the whole
+// scan is ever missed (a key may still be reported twice).
+size_t HTable::hm_scan(size_t cursor, void (*fn)(HNode*, void*), void* arg) {
+    HNode* next_node = nullptr;
+    for (HNode* node = htable[cursor & mask]; node != nullptr; node = next_node) {
+        next_node = node->next;     // fn is allowed to free the node
+        fn(node, arg);
+    }
+    cursor |= ~mask;
+    cursor = rev_bits(cursor);
+    cursor++;
+    cursor = rev_bits(cursor);
+    return cursor;
+}
+
+void HTable::hm_swap(HTable& other) {
+    std::swap(htable, other.htable);
+    std::swap(size, other.size);
+    std::swap(mask, other.mask);
+    std::swap(cap, other.cap);
+}
+
+void HTable::h_resize(size_t new_cap) {
     std::cout<< "RESIZE TRIGGERED" << std::endl;
     size_t old_cap = cap;
     HNode** old_table = htable;
 
-    cap = cap << 1;
+    cap = new_cap;
     mask = cap - 1;
     size = 0;
 
@@ -81,5 +183,9 @@ void HTable::h_resize() {
             node = next_node;
         }
     }
-    delete [] old_table;
+    if (retire_buckets != nullptr) {
+        retire_buckets(old_table, old_cap, retire_arg);
+    } else {
+        delete [] old_table;
+    }
 }
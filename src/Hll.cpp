@@ -0,0 +1,378 @@
+#include "headers/Hll.h"
+#include "headers/UtilFuncs.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// header: "HYLL", the encoding, 3 unused bytes and the cached cardinality,
+// little endian, whose top bit marks it stale
+static const uint8_t k_encoding_dense = 0;
+static const uint8_t k_encoding_sparse = 1;
+static const size_t k_encoding_offset = 4;
+static const size_t k_card_offset = 8;
+
+static const int k_hash_bits = 64 - (int)k_hll_precision;   // hash bits left for the run of zeros
+static const size_t k_dense_bytes = k_hll_registers * 6 / 8;
+
+// sparse opcodes:
+//   00xxxxxx            ZERO:  xxxxxx + 1 (1-64) registers that are 0
+//   01xxxxxx yyyyyyyy   XZERO: xxxxxxyyyyyyyy + 1 (1-16384) registers that are 0
+//   1vvvvvxx            VAL:   xx + 1 (1-4) registers of value vvvvv + 1 (1-32)
+static const uint8_t k_sparse_val_max_value = 32;
+static const size_t k_sparse_val_max_len = 4;
+static const size_t k_sparse_zero_max_len = 64;
+static const size_t k_sparse_xzero_max_len = 16384;
+
+struct SparseOp {
+    size_t len;         // registers covered
+    uint8_t value;
+    size_t size;        // bytes of the opcode
+};
+
+// the register an element goes to, and the value it offers for it: the
+// position of the first 1 bit in the rest of the hash
+static void hll_pattern(const uint8_t* data, size_t len, size_t& index, uint8_t& count) {
+    uint64_t hash = murmur_hash64(data, len, 0xadc83b19ULL);
+    index = hash & (k_hll_registers - 1);
+    hash >>= k_hll_precision;
+    hash |= 1ULL << k_hash_bits;    // bounds count at k_hash_bits + 1
+    count = (uint8_t)(__builtin_ctzll(hash) + 1);
+}
+
+static uint8_t* registers(std::string& hll) {
+    return (uint8_t*)&hll[k_hll_header_size];
+}
+
+static void write_header(std::string& out, uint8_t encoding) {
+    out.assign("HYLL", 4);
+    out.push_back((char)encoding);
+    out.append(11, '\0');   // 3 unused bytes and a cardinality of 0
+}
+
+static void set_stale(std::string& hll) {
+    hll[k_card_offset + 7] = (char)(hll[k_card_offset + 7] | 0x80);
+}
+
+// register i starts at bit 6 * i, low bits first
+static uint8_t dense_get(const uint8_t* regs, size_t i) {
+    size_t bit = i * 6;
+    size_t b = bit / 8;
+    unsigned fb = bit & 7;
+    unsigned v = regs[b] >> fb;
+    if (fb > 2) {
+        v |= (unsigned)regs[b + 1] << (8 - fb);
+    }
+    return v & 63;
+}
+
+static void dense_set(uint8_t* regs, size_t i, uint8_t val) {
+    size_t bit = i * 6;
+    size_t b = bit / 8;
+    unsigned fb = bit & 7;
+    regs[b] = (uint8_t)((regs[b] & ~(63u << fb)) | ((unsigned)val << fb));
+    if (fb > 2) {
+        regs[b + 1] = (uint8_t)((regs[b + 1] & ~(63u >> (8 - fb))) | ((unsigned)val >> (8 - fb)));
+    }
+}
+
+// every 3 bytes hold 4 whole registers
+static void dense_unpack(const uint8_t* p, uint8_t* regs) {
+    for (size_t i = 0; i < k_hll_registers; i += 4, p += 3) {
+        regs[i] = p[0] & 63;
+        regs[i + 1] = (uint8_t)((p[0] >> 6) | ((p[1] & 15) << 2));
+        regs[i + 2] = (uint8_t)((p[1] >> 4) | ((p[2] & 3) << 4));
+        regs[i + 3] = p[2] >> 2;
+    }
+}
+
+static void dense_pack(const uint8_t* regs, uint8_t* p) {
+    for (size_t i = 0; i < k_hll_registers; i += 4, p += 3) {
+        p[0] = (uint8_t)(regs[i] | (regs[i + 1] << 6));
+        p[1] = (uint8_t)((regs[i + 1] >> 2) | (regs[i + 2] << 4));
+        p[2] = (uint8_t)((regs[i + 2] >> 4) | (regs[i + 3] << 2));
+    }
+}
+
+static bool sparse_decode(const uint8_t* p, const uint8_t* end, SparseOp& op) {
+    if (*p & 0x80) {
+        op.value = (uint8_t)(((*p >> 2) & 31) + 1);
+        op.len = (*p & 3) + 1;
+        op.size = 1;
+    } else if (*p & 0x40) {
+        if (p + 1 >= end) {
+            return false;
+        }
+        op.value = 0;
+        op.len = (((size_t)(*p & 63) << 8) | p[1]) + 1;
+        op.size = 2;
+    } else {
+        op.value = 0;
+        op.len = (*p & 63) + 1;
+        op.size = 1;
+    }
+    return true;
+}
+
+// appends the opcodes for len registers of value, which is at most 32
+static void sparse_emit(std::string& out, uint8_t value, size_t len) {
+    while (len > 0) {
+        size_t n;
+        if (value == 0) {
+            n = std::min(len, k_sparse_xzero_max_len);
+            if (n <= k_sparse_zero_max_len) {
+                out.push_back((char)(n - 1));
+            } else {
+                out.push_back((char)(0x40 | ((n - 1) >> 8)));
+                out.push_back((char)((n - 1) & 0xff));
+            }
+        } else {
+            n = std::min(len, k_sparse_val_max_len);
+            out.push_back((char)(0x80 | ((value - 1) << 2) | (n - 1)));
+        }
+        len -= n;
+    }
+}
+
+static void sparse_unpack(const std::string& hll, uint8_t* regs) {
+    const uint8_t* p = (const uint8_t*)hll.data() + k_hll_header_size;
+    const uint8_t* end = (const uint8_t*)hll.data() + hll.size();
+    size_t idx = 0;
+    SparseOp op;
+    while (p < end && sparse_decode(p, end, op)) {
+        memset(regs + idx, op.value, op.len);
+        idx += op.len;
+        p += op.size;
+    }
+}
+
+static void sparse_to_dense(std::string& hll) {
+    uint8_t regs[k_hll_registers] = {};
+    sparse_unpack(hll, regs);
+    hll = hll_from_registers(regs);
+}
+
+bool hll_valid(const std::string& s) {
+    if (s.size() < k_hll_header_size || memcmp(s.data(), "HYLL", 4) != 0) {
+        return false;
+    }
+    uint8_t encoding = (uint8_t)s[k_encoding_offset];
+    if (encoding == k_encoding_dense) {
+        return s.size() == k_hll_dense_size;
+    }
+    if (encoding != k_encoding_sparse) {
+        return false;
+    }
+    const uint8_t* p = (const uint8_t*)s.data() + k_hll_header_size;
+    const uint8_t* end = (const uint8_t*)s.data() + s.size();
+    size_t covered = 0;
+    SparseOp op;
+    while (p < end) {
+        if (!sparse_decode(p, end, op)) {
+            return false;
+        }
+        covered += op.len;
+        p += op.size;
+    }
+    return covered == k_hll_registers;
+}
+
+bool hll_is_dense(const std::string& hll) {
+    return (uint8_t)hll[k_encoding_offset] == k_encoding_dense;
+}
+
+std::string hll_new() {
+    std::string hll;
+    write_header(hll, k_encoding_sparse);
+    sparse_emit(hll, 0, k_hll_registers);
+    return hll;
+}
+
+static bool dense_add(std::string& hll, size_t index, uint8_t count) {
+    uint8_t* regs = registers(hll);
+    if (dense_get(regs, index) >= count) {
+        return false;
+    }
+    dense_set(regs, index, count);
+    return true;
+}
+
+// Replaces the opcode that covers index with up to three runs: the registers
+// before it, the new value and the registers after it.
+static bool sparse_add(std::string& hll, size_t index, uint8_t count) {
+    const uint8_t* data = (const uint8_t*)hll.data();
+    const uint8_t* p = data + k_hll_header_size;
+    const uint8_t* end = data + hll.size();
+    size_t first = 0;
+    SparseOp op = {0, 0, 0};
+    while (p < end && sparse_decode(p, end, op) && first + op.len <= index) {
+        first += op.len;
+        p += op.size;
+    }
+    if (op.value >= count) {
+        return false;
+    }
+    if (count > k_sparse_val_max_value) {
+        sparse_to_dense(hll);
+        return dense_add(hll, index, count);
+    }
+    std::string runs;
+    sparse_emit(runs, op.value, index - first);
+    sparse_emit(runs, count, 1);
+    sparse_emit(runs, op.value, first + op.len - index - 1);
+    hll.replace(p - data, op.size, runs);
+    if (hll.size() - k_hll_header_size > k_hll_sparse_max_bytes) {
+        sparse_to_dense(hll);
+    }
+    return true;
+}
+
+bool hll_add(std::string& hll, const uint8_t* data, size_t len) {
+    size_t index = 0;
+    uint8_t count = 0;
+    hll_pattern(data, len, index, count);
+    bool changed = hll_is_dense(hll) ? dense_add(hll, index, count) : sparse_add(hll, index, count);
+    if (changed) {
+        set_stale(hll);
+    }
+    return changed;
+}
+
+static double hll_sigma(double x) {
+    if (x == 1.0) {
+        return INFINITY;
+    }
+    double z_prev;
+    double y = 1;
+    double z = x;
+    do {
+        x *= x;
+        z_prev = z;
+        z += x * y;
+        y += y;
+    } while (z_prev != z);
+    return z;
+}
+
+static double hll_tau(double x) {
+    if (x == 0.0 || x == 1.0) {
+        return 0.0;
+    }
+    double z_prev;
+    double y = 1.0;
+    double z = 1 - x;
+    do {
+        x = std::sqrt(x);
+        z_prev = z;
+        y *= 0.5;
+        z -= std::pow(1 - x, 2) * y;
+    } while (z_prev != z);
+    return z / 3;
+}
+
+// The estimator of Otmar Ertl, "New cardinality estimation algorithms for
+// HyperLogLog sketches" (2017), from the histogram of register values. It
+// needs neither the small range correction nor bias tables.
+static uint64_t estimate(const uint32_t* histo) {
+    const double m = (double)k_hll_registers;
+    double z = m * hll_tau((m - histo[k_hash_bits + 1]) / m);
+    for (int j = k_hash_bits; j >= 1; j--) {
+        z += histo[j];
+        z *= 0.5;
+    }
+    z += m * hll_sigma(histo[0] / m);
+    const double alpha_inf = 0.5 / std::log(2.0);
+    return (uint64_t)std::llround(alpha_inf * m * m / z);
+}
+
+uint64_t hll_count(std::string& hll) {
+    uint8_t* card = (uint8_t*)&hll[k_card_offset];
+    uint64_t cached = 0;
+    memcpy(&cached, card, 8);
+    if ((card[7] & 0x80) == 0) {
+        return cached;
+    }
+    uint32_t histo[64] = {};
+    if (hll_is_dense(hll)) {
+        const uint8_t* p = registers(hll);
+        for (size_t i = 0; i < k_hll_registers; i += 4, p += 3) {
+            histo[p[0] & 63]++;
+            histo[(p[0] >> 6) | ((p[1] & 15) << 2)]++;
+            histo[(p[1] >> 4) | ((p[2] & 3) << 4)]++;
+            histo[p[2] >> 2]++;
+        }
+    } else {
+        const uint8_t* p = (const uint8_t*)hll.data() + k_hll_header_size;
+        const uint8_t* end = (const uint8_t*)hll.data() + hll.size();
+        SparseOp op;
+        while (p < end && sparse_decode(p, end, op)) {
+            histo[op.value] += (uint32_t)op.len;
+            p += op.size;
+        }
+    }
+    uint64_t result = estimate(histo);
+    memcpy(card, &result, 8);   // far below 2^63, so not stale
+    return result;
+}
+
+// dst[i] = max(dst[i], src[i]) over all registers, 16 at a time where the
+// CPU has byte-wise max in its baseline vector instructions
+static void registers_max(uint8_t* dst, const uint8_t* src) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= k_hll_registers; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_max_epu8(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= k_hll_registers; i += 16) {
+        vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+    }
+#endif
+    for (; i < k_hll_registers; i++) {
+        dst[i] = std::max(dst[i], src[i]);
+    }
+}
+
+void hll_merge(uint8_t* regs, const std::string& hll) {
+    if (hll_is_dense(hll)) {
+        uint8_t unpacked[k_hll_registers];
+        dense_unpack((const uint8_t*)hll.data() + k_hll_header_size, unpacked);
+        registers_max(regs, unpacked);
+        return;
+    }
+    // a sparse one is mostly zero runs, only its values need looking at
+    const uint8_t* p = (const uint8_t*)hll.data() + k_hll_header_size;
+    const uint8_t* end = (const uint8_t*)hll.data() + hll.size();
+    size_t idx = 0;
+    SparseOp op;
+    while (p < end && sparse_decode(p, end, op)) {
+        for (size_t i = 0; op.value != 0 && i < op.len; i++) {
+            regs[idx + i] = std::max(regs[idx + i], op.value);
+        }
+        idx += op.len;
+        p += op.size;
+    }
+}
+
+uint64_t hll_count_registers(const uint8_t* regs) {
+    uint32_t histo[64] = {};
+    for (size_t i = 0; i < k_hll_registers; i++) {
+        histo[regs[i]]++;
+    }
+    return estimate(histo);
+}
+
+std::string hll_from_registers(const uint8_t* regs) {
+    std::string hll;
+    write_header(hll, k_encoding_dense);
+    hll.resize(k_hll_dense_size);
+    dense_pack(regs, registers(hll));
+    set_stale(hll);
+    return hll;
+}
@@ -0,0 +1,154 @@
+#include "headers/HotKeys.h"
+#include "headers/UtilFuncs.h"
+#include <algorithm>
+#include <cstring>
+
+// xorshift64, the countdown is uniform in [1, 2 * sample_rate - 1] so that
+// one in sample_rate accesses is sampled on average without locking onto a
+// periodic access pattern
+uint32_t HotKeys::next_countdown() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return 1 + (uint32_t)(rng % (2 * (uint64_t)sample_rate - 1));
+}
+
+void HotKeys::record(const std::string& key) {
+    // the clock is only read every so many samples, a decay that is late by
+    // that many samples does not matter
+    if (samples++ % k_hotkeys_clock_every == 0) {
+        uint64_t now = get_monotonic_msec();
+        if (now - last_decay_ms >= k_hotkeys_decay_ms) {
+            decay(now);
+        }
+    }
+
+    // one row index per hash function, derived from two halves of a hash
+    uint64_t hash_code = fnv_hash((const uint8_t*)key.data(), key.size());
+    uint64_t h1 = hash_code;
+    uint64_t h2 = ((hash_code * 0x9E3779B97F4A7C15ULL) >> 32) | 1;
+    uint32_t* counters[k_hotkeys_depth];
+    uint32_t estimate = UINT32_MAX;
+    for (size_t i = 0; i < k_hotkeys_depth; i++) {
+        counters[i] = &sketch[i][(h1 + i * h2) & (k_hotkeys_width - 1)];
+        estimate = std::min(estimate, *counters[i]);
+    }
+    if (estimate == UINT32_MAX) {
+        return;
+    }
+    // conservative update: only the counters at the minimum move, which keeps
+    // the overestimate from collisions small
+    for (size_t i = 0; i < k_hotkeys_depth; i++) {
+        if (*counters[i] == estimate) {
+            (*counters[i])++;
+        }
+    }
+    estimate++;
+
+    for (size_t i = 0; i < heap.size(); i++) {
+        if (heap[i].hash_code == hash_code && heap[i].key == key) {
+            heap[i].count = estimate;
+            sift_down(i);
+            return;
+        }
+    }
+    if (heap.size() < k_hotkeys_top) {
+        HotKey hot;
+        hot.key = key;
+        hot.hash_code = hash_code;
+        hot.count = estimate;
+        heap.push_back(hot);
+        sift_up(heap.size() - 1);
+    } else if (estimate > heap[0].count) {
+        heap[0].key = key;
+        heap[0].hash_code = hash_code;
+        heap[0].count = estimate;
+        sift_down(0);
+    }
+}
+
+// halves every count once per elapsed period; halving keeps the heap order
+void HotKeys::decay(uint64_t now_ms) {
+    uint64_t periods = (now_ms - last_decay_ms) / k_hotkeys_decay_ms;
+    last_decay_ms += periods * k_hotkeys_decay_ms;
+    uint32_t shift = (uint32_t)std::min(periods, (uint64_t)31);
+    for (size_t i = 0; i < k_hotkeys_depth; i++) {
+        for (size_t j = 0; j < k_hotkeys_width; j++) {
+            sketch[i][j] >>= shift;
+        }
+    }
+    for (HotKey& hot : heap) {
+        hot.count >>= shift;
+    }
+}
+
+void HotKeys::sift_up(size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap[parent].count <= heap[i].count) {
+            break;
+        }
+        std::swap(heap[parent], heap[i]);
+        i = parent;
+    }
+}
+
+void HotKeys::sift_down(size_t i) {
+    while (true) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < heap.size() && heap[left].count < heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < heap.size() && heap[right].count < heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        std::swap(heap[smallest], heap[i]);
+        i = smallest;
+    }
+}
+
+// A count that is halved every period P settles between rate * P right after
+// a decay and 2 * rate * P right before the next one, so dividing by P plus
+// the time since the last decay gives the rate at any point in between.
+void HotKeys::top(std::vector<HotKeyRate>& out, size_t limit) {
+    uint64_t now = get_monotonic_msec();
+    if (now - last_decay_ms >= k_hotkeys_decay_ms) {
+        decay(now);
+    }
+    double window_sec = (double)(k_hotkeys_decay_ms + (now - last_decay_ms)) / 1000;
+    std::vector<HotKey> sorted;
+    for (const HotKey& hot : heap) {
+        if (hot.count > 0) {
+            sorted.push_back(hot);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const HotKey& a, const HotKey& b) {
+        return a.count > b.count;
+    });
+    for (size_t i = 0; i < sorted.size() && i < limit; i++) {
+        HotKeyRate rate;
+        rate.key = sorted[i].key;
+        rate.per_sec = (double)sorted[i].count * sample_rate / window_sec;
+        out.push_back(rate);
+    }
+}
+
+void HotKeys::set_sample_rate(uint32_t rate) {
+    if (rate == sample_rate) {
+        return;
+    }
+    sample_rate = rate;
+    countdown = rate == 0 ? 1 : next_countdown();
+    clear();
+}
+
+void HotKeys::clear() {
+    memset(sketch, 0, sizeof(sketch));
+    heap.clear();
+    last_decay_ms = get_monotonic_msec();
+}
@@ -0,0 +1,56 @@
+#include "headers/LazyFree.h"
+
+LazyFreer::LazyFreer() : head(nullptr), pending_bytes(0), freed_jobs(0) {
+    worker = std::thread(&LazyFreer::run, this);
+}
+
+LazyFreer::~LazyFreer() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    worker.join();
+}
+
+void LazyFreer::submit(void (*fn)(void*), void* arg, size_t bytes) {
+    LazyFreeJob* job = new LazyFreeJob();
+    job->fn = fn;
+    job->arg = arg;
+    job->bytes = bytes;
+    pending_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    LazyFreeJob* old_head = head.load(std::memory_order_relaxed);
+    do {
+        job->next = old_head;
+    } while (!head.compare_exchange_weak(old_head, job, std::memory_order_release, std::memory_order_relaxed));
+    if (old_head == nullptr) {
+        // the worker may be sleeping on an empty stack. Notifying under the
+        // mutex means it either sees the job before waiting or gets woken.
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        wakeup.notify_one();
+    }
+}
+
+void LazyFreer::run() {
+    while (true) {
+        LazyFreeJob* job = head.exchange(nullptr, std::memory_order_acquire);
+        if (job == nullptr) {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (stopping && head.load(std::memory_order_acquire) == nullptr) {
+                return;
+            }
+            wakeup.wait(lock, [this] {
+                return stopping || head.load(std::memory_order_acquire) != nullptr;
+            });
+            continue;
+        }
+        while (job != nullptr) {
+            LazyFreeJob* next_job = job->next;
+            job->fn(job->arg);
+            pending_bytes.fetch_sub(job->bytes, std::memory_order_relaxed);
+            freed_jobs.fetch_add(1, std::memory_order_relaxed);
+            delete job;
+            job = next_job;
+        }
+    }
+}
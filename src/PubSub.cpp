@@ -0,0 +1,152 @@
+#include "headers/PubSub.h"
+#include "headers/UtilTypes.h"
+#include "headers/UtilFuncs.h"
+#include <cstdlib>
+#include <cstring>
+
+static size_t message_bytes = 0;
+
+SharedMessage* message_new(Buffer& buf) {
+    size_t size = buf.size();
+    SharedMessage* msg = (SharedMessage*)malloc(sizeof(SharedMessage) + size);
+    msg->refs = 1;
+    msg->size = size;
+    memcpy(msg->data(), buf.data_begin, size);
+    message_bytes += sizeof(SharedMessage) + size;
+    return msg;
+}
+
+void message_unref(SharedMessage* msg) {
+    if (--msg->refs == 0) {
+        message_bytes -= sizeof(SharedMessage) + msg->size;
+        free(msg);
+    }
+}
+
+size_t message_bytes_allocated() {
+    return message_bytes;
+}
+
+// lookup key for the channel tables
+struct ChannelProbe {
+    HNode node;
+    const std::string* name;
+};
+
+static bool channel_eq(HNode* node, HNode* target) {
+    Channel* channel = (Channel*)((char*)node - offsetof(Channel, node));
+    ChannelProbe* probe = (ChannelProbe*)((char*)target - offsetof(ChannelProbe, node));
+    return node->hash_code == target->hash_code && channel->name == *probe->name;
+}
+
+static bool channel_eq_self(HNode* node, HNode* target) {
+    return node == target;
+}
+
+// a subscription is identified by its connection and channel object
+static bool subscription_eq(HNode* node, HNode* target) {
+    Subscription* sub = (Subscription*)((char*)node - offsetof(Subscription, node));
+    Subscription* probe = (Subscription*)((char*)target - offsetof(Subscription, node));
+    return sub->conn == probe->conn && sub->channel == probe->channel;
+}
+
+static uint64_t subscription_hash(Conn* conn, Channel* channel) {
+    uint64_t h = (uint64_t)(uintptr_t)conn * 0x9E3779B97F4A7C15ULL;
+    return h ^ ((uint64_t)(uintptr_t)channel * 0xC2B2AE3D27D4EB4FULL);
+}
+
+Channel* PubSub::find(HTable& table, const std::string& name) {
+    ChannelProbe probe;
+    probe.node.hash_code = fnv_hash((const uint8_t*)name.data(), name.size());
+    probe.name = &name;
+    HNode* node = table.hm_lookup(&probe.node, &channel_eq);
+    return node == nullptr ? nullptr : (Channel*)((char*)node - offsetof(Channel, node));
+}
+
+Subscription* PubSub::find_subscription(Conn* conn, Channel* channel) {
+    Subscription probe;
+    probe.node.hash_code = subscription_hash(conn, channel);
+    probe.conn = conn;
+    probe.channel = channel;
+    HNode* node = subscriptions.hm_lookup(&probe.node, &subscription_eq);
+    return node == nullptr ? nullptr : (Subscription*)((char*)node - offsetof(Subscription, node));
+}
+
+bool PubSub::subscribe(Conn* conn, const std::string& name, bool pattern) {
+    HTable& table = pattern ? pattern_index : channels;
+    Channel* channel = find(table, name);
+    if (channel != nullptr && find_subscription(conn, channel) != nullptr) {
+        return false;
+    }
+    if (channel == nullptr) {
+        channel = new Channel();
+        channel->name = name;
+        channel->is_pattern = pattern;
+        channel->node.hash_code = fnv_hash((const uint8_t*)name.data(), name.size());
+        table.hm_insert(&channel->node);
+        if (pattern) {
+            channel->pattern_idx = patterns.size();
+            patterns.push_back(channel);
+        }
+    }
+    Subscription* sub = new Subscription();
+    sub->conn = conn;
+    sub->channel = channel;
+    sub->node.hash_code = subscription_hash(conn, channel);
+    sub->channel_idx = channel->subscribers.size();
+    channel->subscribers.push_back(sub);
+    sub->conn_idx = conn->subscriptions.size();
+    conn->subscriptions.push_back(sub);
+    subscriptions.hm_insert(&sub->node);
+    return true;
+}
+
+// takes the element at idx out of an index-tracked vector by moving the last
+// one into its place
+static void swap_remove(std::vector<Subscription*>& vec, size_t idx, size_t Subscription::*idx_field) {
+    vec[idx] = vec.back();
+    vec[idx]->*idx_field = idx;
+    vec.pop_back();
+}
+
+void PubSub::remove(Subscription* sub) {
+    Channel* channel = sub->channel;
+    subscriptions.hm_delete(&sub->node, &subscription_eq);
+    swap_remove(channel->subscribers, sub->channel_idx, &Subscription::channel_idx);
+    swap_remove(sub->conn->subscriptions, sub->conn_idx, &Subscription::conn_idx);
+    delete sub;
+
+    if (!channel->subscribers.empty()) {
+        return;
+    }
+    if (channel->is_pattern) {
+        pattern_index.hm_delete(&channel->node, &channel_eq_self);
+        patterns[channel->pattern_idx] = patterns.back();
+        patterns[channel->pattern_idx]->pattern_idx = channel->pattern_idx;
+        patterns.pop_back();
+    } else {
+        channels.hm_delete(&channel->node, &channel_eq_self);
+    }
+    delete channel;
+}
+
+bool PubSub::unsubscribe(Conn* conn, const std::string& name, bool pattern) {
+    Channel* channel = find(pattern ? pattern_index : channels, name);
+    Subscription* sub = channel == nullptr ? nullptr : find_subscription(conn, channel);
+    if (sub == nullptr) {
+        return false;
+    }
+    remove(sub);
+    return true;
+}
+
+void PubSub::unsubscribe_all(Conn* conn, bool pattern, std::vector<std::string>& out) {
+    // walking backwards, a removal only moves entries that were already visited
+    for (size_t i = conn->subscriptions.size(); i-- > 0;) {
+        Subscription* sub = conn->subscriptions[i];
+        if (sub->channel->is_pattern == pattern) {
+            out.push_back(sub->channel->name);
+            remove(sub);
+        }
+    }
+}
@@ -0,0 +1,620 @@
+#include "headers/RadixTree.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+enum {
+    ART_NODE4 = 0,
+    ART_NODE16 = 1,
+    ART_NODE48 = 2,
+    ART_NODE256 = 3,
+};
+
+// Node4 and Node16 keep their keys sorted. Node48 maps a byte to slot + 1
+// (0 means no child) and Node256 is indexed by the byte directly.
+struct ArtNode4 {
+    ArtNode n;
+    uint8_t keys[4];
+    void* children[4];
+};
+
+struct ArtNode16 {
+    ArtNode n;
+    uint8_t keys[16];
+    void* children[16];
+};
+
+struct ArtNode48 {
+    ArtNode n;
+    uint8_t child_index[256];
+    void* children[48];
+};
+
+struct ArtNode256 {
+    ArtNode n;
+    void* children[256];
+};
+
+static bool is_leaf(void* n) {
+    return ((uintptr_t)n & 1) != 0;
+}
+
+static Entry* leaf_entry(void* n) {
+    return (Entry*)((uintptr_t)n & ~(uintptr_t)1);
+}
+
+static void* make_leaf(Entry* e) {
+    return (void*)((uintptr_t)e | 1);
+}
+
+static size_t node_size(uint8_t type) {
+    switch (type) {
+        case ART_NODE4: return sizeof(ArtNode4);
+        case ART_NODE16: return sizeof(ArtNode16);
+        case ART_NODE48: return sizeof(ArtNode48);
+        default: return sizeof(ArtNode256);
+    }
+}
+
+static void copy_header(ArtNode* dst, ArtNode* src) {
+    dst->num_children = src->num_children;
+    dst->prefix_len = src->prefix_len;
+    memcpy(dst->prefix, src->prefix, std::min(src->prefix_len, k_art_max_prefix));
+    dst->terminal = src->terminal;
+}
+
+// smallest key below n; its bytes also spell out every prefix on the way down
+static Entry* minimum(void* n) {
+    while (n != nullptr && !is_leaf(n)) {
+        ArtNode* node = (ArtNode*)n;
+        if (node->terminal != nullptr) {
+            return node->terminal;
+        }
+        switch (node->type) {
+            case ART_NODE4:
+                n = ((ArtNode4*)node)->children[0];
+                break;
+            case ART_NODE16:
+                n = ((ArtNode16*)node)->children[0];
+                break;
+            case ART_NODE48: {
+                ArtNode48* n48 = (ArtNode48*)node;
+                size_t idx = 0;
+                while (n48->child_index[idx] == 0) {
+                    idx++;
+                }
+                n = n48->children[n48->child_index[idx] - 1];
+                break;
+            }
+            default: {
+                ArtNode256* n256 = (ArtNode256*)node;
+                size_t idx = 0;
+                while (n256->children[idx] == nullptr) {
+                    idx++;
+                }
+                n = n256->children[idx];
+                break;
+            }
+        }
+    }
+    return n == nullptr ? nullptr : leaf_entry(n);
+}
+
+RadixTree::~RadixTree() {
+    free_subtree(root);
+}
+
+ArtNode* RadixTree::node_new(uint8_t type) {
+    size_t bytes = node_size(type);
+    ArtNode* node = (ArtNode*)calloc(1, bytes);
+    node->type = type;
+    node_bytes += bytes;
+    return node;
+}
+
+void RadixTree::node_free(ArtNode* node) {
+    node_bytes -= node_size(node->type);
+    free(node);
+}
+
+void RadixTree::free_subtree(void* n) {
+    if (n == nullptr || is_leaf(n)) {
+        return;
+    }
+    ArtNode* node = (ArtNode*)n;
+    switch (node->type) {
+        case ART_NODE4:
+            for (size_t i = 0; i < node->num_children; i++) {
+                free_subtree(((ArtNode4*)node)->children[i]);
+            }
+            break;
+        case ART_NODE16:
+            for (size_t i = 0; i < node->num_children; i++) {
+                free_subtree(((ArtNode16*)node)->children[i]);
+            }
+            break;
+        case ART_NODE48:
+            for (size_t i = 0; i < 48; i++) {
+                free_subtree(((ArtNode48*)node)->children[i]);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < 256; i++) {
+                free_subtree(((ArtNode256*)node)->children[i]);
+            }
+            break;
+    }
+    node_free(node);
+}
+
+void** RadixTree::find_child(ArtNode* node, uint8_t byte) {
+    switch (node->type) {
+        case ART_NODE4: {
+            ArtNode4* n4 = (ArtNode4*)node;
+            for (size_t i = 0; i < node->num_children; i++) {
+                if (n4->keys[i] == byte) {
+                    return &n4->children[i];
+                }
+            }
+            return nullptr;
+        }
+        case ART_NODE16: {
+            ArtNode16* n16 = (ArtNode16*)node;
+            for (size_t i = 0; i < node->num_children; i++) {
+                if (n16->keys[i] == byte) {
+                    return &n16->children[i];
+                }
+            }
+            return nullptr;
+        }
+        case ART_NODE48: {
+            ArtNode48* n48 = (ArtNode48*)node;
+            uint8_t idx = n48->child_index[byte];
+            return idx == 0 ? nullptr : &n48->children[idx - 1];
+        }
+        default: {
+            ArtNode256* n256 = (ArtNode256*)node;
+            return n256->children[byte] == nullptr ? nullptr : &n256->children[byte];
+        }
+    }
+}
+
+// inserts into a sorted key/child array with room for one more
+static void sorted_insert(uint8_t* keys, void** children, uint16_t& num, uint8_t byte, void* child) {
+    size_t pos = 0;
+    while (pos < num && keys[pos] < byte) {
+        pos++;
+    }
+    memmove(keys + pos + 1, keys + pos, num - pos);
+    memmove(children + pos + 1, children + pos, (num - pos) * sizeof(void*));
+    keys[pos] = byte;
+    children[pos] = child;
+    num++;
+}
+
+// adds a child, growing the node into the next size class when it is full;
+// *ref is the parent's pointer to node and is updated when the node moves
+void RadixTree::add_child(ArtNode* node, void** ref, uint8_t byte, void* child) {
+    switch (node->type) {
+        case ART_NODE4: {
+            ArtNode4* n4 = (ArtNode4*)node;
+            if (node->num_children < 4) {
+                sorted_insert(n4->keys, n4->children, node->num_children, byte, child);
+                return;
+            }
+            ArtNode16* n16 = (ArtNode16*)node_new(ART_NODE16);
+            copy_header(&n16->n, node);
+            memcpy(n16->keys, n4->keys, 4);
+            memcpy(n16->children, n4->children, 4 * sizeof(void*));
+            *ref = n16;
+            node_free(node);
+            add_child(&n16->n, ref, byte, child);
+            return;
+        }
+        case ART_NODE16: {
+            ArtNode16* n16 = (ArtNode16*)node;
+            if (node->num_children < 16) {
+                sorted_insert(n16->keys, n16->children, node->num_children, byte, child);
+                return;
+            }
+            ArtNode48* n48 = (ArtNode48*)node_new(ART_NODE48);
+            copy_header(&n48->n, node);
+            for (size_t i = 0; i < 16; i++) {
+                n48->child_index[n16->keys[i]] = (uint8_t)(i + 1);
+                n48->children[i] = n16->children[i];
+            }
+            *ref = n48;
+            node_free(node);
+            add_child(&n48->n, ref, byte, child);
+            return;
+        }
+        case ART_NODE48: {
+            ArtNode48* n48 = (ArtNode48*)node;
+            if (node->num_children < 48) {
+                size_t pos = 0;
+                while (n48->children[pos] != nullptr) {
+                    pos++;
+                }
+                n48->children[pos] = child;
+                n48->child_index[byte] = (uint8_t)(pos + 1);
+                node->num_children++;
+                return;
+            }
+            ArtNode256* n256 = (ArtNode256*)node_new(ART_NODE256);
+            copy_header(&n256->n, node);
+            for (size_t b = 0; b < 256; b++) {
+                if (n48->child_index[b] != 0) {
+                    n256->children[b] = n48->children[n48->child_index[b] - 1];
+                }
+            }
+            *ref = n256;
+            node_free(node);
+            add_child(&n256->n, ref, byte, child);
+            return;
+        }
+        default: {
+            ArtNode256* n256 = (ArtNode256*)node;
+            n256->children[byte] = child;
+            node->num_children++;
+            return;
+        }
+    }
+}
+
+void RadixTree::remove_child(ArtNode* node, void** ref, uint8_t byte, void** child_ref) {
+    switch (node->type) {
+        case ART_NODE4: {
+            ArtNode4* n4 = (ArtNode4*)node;
+            size_t pos = child_ref - n4->children;
+            memmove(n4->keys + pos, n4->keys + pos + 1, node->num_children - 1 - pos);
+            memmove(n4->children + pos, n4->children + pos + 1, (node->num_children - 1 - pos) * sizeof(void*));
+            break;
+        }
+        case ART_NODE16: {
+            ArtNode16* n16 = (ArtNode16*)node;
+            size_t pos = child_ref - n16->children;
+            memmove(n16->keys + pos, n16->keys + pos + 1, node->num_children - 1 - pos);
+            memmove(n16->children + pos, n16->children + pos + 1, (node->num_children - 1 - pos) * sizeof(void*));
+            break;
+        }
+        case ART_NODE48: {
+            ArtNode48* n48 = (ArtNode48*)node;
+            n48->children[n48->child_index[byte] - 1] = nullptr;
+            n48->child_index[byte] = 0;
+            break;
+        }
+        default:
+            ((ArtNode256*)node)->children[byte] = nullptr;
+            break;
+    }
+    node->num_children--;
+    shrink(node, ref);
+}
+
+// moves the node into a smaller size class once it is sparse enough, and
+// folds a Node4 left with a single item into its parent slot
+void RadixTree::shrink(ArtNode* node, void** ref) {
+    switch (node->type) {
+        case ART_NODE4: {
+            ArtNode4* n4 = (ArtNode4*)node;
+            if (node->num_children + (node->terminal != nullptr) >= 2) {
+                return;
+            }
+            if (node->num_children == 0) {
+                *ref = node->terminal == nullptr ? nullptr : make_leaf(node->terminal);
+                node_free(node);
+                return;
+            }
+            void* child = n4->children[0];
+            if (!is_leaf(child)) {
+                // the child's prefix becomes ours + the edge byte + its own
+                ArtNode* c = (ArtNode*)child;
+                uint8_t merged[k_art_max_prefix];
+                uint32_t len = std::min(node->prefix_len, k_art_max_prefix);
+                memcpy(merged, node->prefix, len);
+                if (len < k_art_max_prefix) {
+                    merged[len++] = n4->keys[0];
+                }
+                if (len < k_art_max_prefix) {
+                    uint32_t sub = std::min(c->prefix_len, k_art_max_prefix - len);
+                    memcpy(merged + len, c->prefix, sub);
+                    len += sub;
+                }
+                memcpy(c->prefix, merged, len);
+                c->prefix_len += node->prefix_len + 1;
+            }
+            *ref = child;
+            node_free(node);
+            return;
+        }
+        case ART_NODE16: {
+            if (node->num_children > 3) {
+                return;
+            }
+            ArtNode16* n16 = (ArtNode16*)node;
+            ArtNode4* n4 = (ArtNode4*)node_new(ART_NODE4);
+            copy_header(&n4->n, node);
+            memcpy(n4->keys, n16->keys, node->num_children);
+            memcpy(n4->children, n16->children, node->num_children * sizeof(void*));
+            *ref = n4;
+            node_free(node);
+            return;
+        }
+        case ART_NODE48: {
+            if (node->num_children > 12) {
+                return;
+            }
+            ArtNode48* n48 = (ArtNode48*)node;
+            ArtNode16* n16 = (ArtNode16*)node_new(ART_NODE16);
+            copy_header(&n16->n, node);
+            size_t pos = 0;
+            for (size_t b = 0; b < 256; b++) {
+                if (n48->child_index[b] != 0) {
+                    n16->keys[pos] = (uint8_t)b;
+                    n16->children[pos] = n48->children[n48->child_index[b] - 1];
+                    pos++;
+                }
+            }
+            *ref = n16;
+            node_free(node);
+            return;
+        }
+        default: {
+            if (node->num_children > 37) {
+                return;
+            }
+            ArtNode256* n256 = (ArtNode256*)node;
+            ArtNode48* n48 = (ArtNode48*)node_new(ART_NODE48);
+            copy_header(&n48->n, node);
+            size_t pos = 0;
+            for (size_t b = 0; b < 256; b++) {
+                if (n256->children[b] != nullptr) {
+                    n48->child_index[b] = (uint8_t)(pos + 1);
+                    n48->children[pos] = n256->children[b];
+                    pos++;
+                }
+            }
+            *ref = n48;
+            node_free(node);
+            return;
+        }
+    }
+}
+
+// number of leading prefix bytes of node that match key from depth on; bytes
+// beyond the stored part of the prefix are read from the node's minimum leaf
+uint32_t RadixTree::prefix_mismatch(ArtNode* node, const std::string& key, size_t depth) {
+    size_t max_cmp = std::min((size_t)std::min(node->prefix_len, k_art_max_prefix), key.size() - depth);
+    size_t idx = 0;
+    for (; idx < max_cmp; idx++) {
+        if (node->prefix[idx] != (uint8_t)key[depth + idx]) {
+            return (uint32_t)idx;
+        }
+    }
+    if (node->prefix_len > k_art_max_prefix && idx == k_art_max_prefix) {
+        const std::string& leaf_key = minimum(node)->key;
+        max_cmp = std::min((size_t)node->prefix_len, std::min(leaf_key.size(), key.size()) - depth);
+        for (; idx < max_cmp; idx++) {
+            if (leaf_key[depth + idx] != key[depth + idx]) {
+                return (uint32_t)idx;
+            }
+        }
+    }
+    return (uint32_t)idx;
+}
+
+void RadixTree::insert_at(void** ref, Entry* e, size_t depth) {
+    const std::string& key = e->key;
+    void* n = *ref;
+    if (n == nullptr) {
+        *ref = make_leaf(e);
+        num_keys++;
+        return;
+    }
+    if (is_leaf(n)) {
+        Entry* other = leaf_entry(n);
+        if (other->key == key) {
+            *ref = make_leaf(e);
+            return;
+        }
+        // lazy expansion ends here: split into a Node4 holding both keys
+        size_t limit = std::min(other->key.size(), key.size());
+        size_t lcp = depth;
+        while (lcp < limit && other->key[lcp] == key[lcp]) {
+            lcp++;
+        }
+        ArtNode* node = node_new(ART_NODE4);
+        node->prefix_len = (uint32_t)(lcp - depth);
+        memcpy(node->prefix, key.data() + depth, std::min(node->prefix_len, k_art_max_prefix));
+        *ref = node;
+        Entry* both[2] = {other, e};
+        for (Entry* x : both) {
+            if (x->key.size() == lcp) {
+                node->terminal = x;
+            } else {
+                add_child(node, ref, (uint8_t)x->key[lcp], make_leaf(x));
+            }
+        }
+        num_keys++;
+        return;
+    }
+
+    ArtNode* node = (ArtNode*)n;
+    if (node->prefix_len > 0) {
+        uint32_t mismatch = prefix_mismatch(node, key, depth);
+        if (mismatch < node->prefix_len) {
+            // the key leaves the compressed path: split it at the mismatch
+            ArtNode* parent = node_new(ART_NODE4);
+            parent->prefix_len = mismatch;
+            memcpy(parent->prefix, node->prefix, std::min(mismatch, k_art_max_prefix));
+            *ref = parent;
+            uint8_t byte;
+            if (node->prefix_len <= k_art_max_prefix) {
+                byte = node->prefix[mismatch];
+                node->prefix_len -= mismatch + 1;
+                memmove(node->prefix, node->prefix + mismatch + 1, std::min(node->prefix_len, k_art_max_prefix));
+            } else {
+                const std::string& min_key = minimum(node)->key;
+                byte = (uint8_t)min_key[depth + mismatch];
+                node->prefix_len -= mismatch + 1;
+                memcpy(node->prefix, min_key.data() + depth + mismatch + 1,
+                    std::min(node->prefix_len, k_art_max_prefix));
+            }
+            add_child(parent, ref, byte, node);
+            size_t split = depth + mismatch;
+            if (key.size() == split) {
+                parent->terminal = e;
+            } else {
+                add_child(parent, ref, (uint8_t)key[split], make_leaf(e));
+            }
+            num_keys++;
+            return;
+        }
+        depth += node->prefix_len;
+    }
+    if (depth == key.size()) {
+        if (node->terminal == nullptr) {
+            num_keys++;
+        }
+        node->terminal = e;
+        return;
+    }
+    void** child = find_child(node, (uint8_t)key[depth]);
+    if (child != nullptr) {
+        insert_at(child, e, depth + 1);
+        return;
+    }
+    add_child(node, ref, (uint8_t)key[depth], make_leaf(e));
+    num_keys++;
+}
+
+Entry* RadixTree::remove_at(void** ref, const std::string& key, size_t depth) {
+    void* n = *ref;
+    if (n == nullptr) {
+        return nullptr;
+    }
+    if (is_leaf(n)) {
+        Entry* e = leaf_entry(n);
+        if (e->key != key) {
+            return nullptr;
+        }
+        *ref = nullptr;
+        num_keys--;
+        return e;
+    }
+    ArtNode* node = (ArtNode*)n;
+    if (node->prefix_len > 0) {
+        if (prefix_mismatch(node, key, depth) != node->prefix_len) {
+            return nullptr;
+        }
+        depth += node->prefix_len;
+    }
+    if (depth == key.size()) {
+        Entry* e = node->terminal;
+        if (e == nullptr) {
+            return nullptr;
+        }
+        node->terminal = nullptr;
+        num_keys--;
+        shrink(node, ref);
+        return e;
+    }
+    void** child = find_child(node, (uint8_t)key[depth]);
+    if (child == nullptr) {
+        return nullptr;
+    }
+    if (is_leaf(*child)) {
+        Entry* e = leaf_entry(*child);
+        if (e->key != key) {
+            return nullptr;
+        }
+        remove_child(node, ref, (uint8_t)key[depth], child);
+        num_keys--;
+        return e;
+    }
+    return remove_at(child, key, depth + 1);
+}
+
+// In order walk of the subtree at n. While `bounded`, the path to n equals
+// start[0..depth) and subtrees sorting before start are skipped.
+bool RadixTree::iterate_at(void* n, size_t depth, const std::string& start, bool bounded,
+                           bool (*fn)(Entry*, void*), void* arg) {
+    if (is_leaf(n)) {
+        Entry* e = leaf_entry(n);
+        if (bounded && e->key < start) {
+            return true;
+        }
+        return fn(e, arg);
+    }
+    ArtNode* node = (ArtNode*)n;
+    if (bounded && node->prefix_len > 0) {
+        const std::string& full = minimum(node)->key;
+        size_t cmp_len = std::min((size_t)node->prefix_len, start.size() - depth);
+        int cmp = memcmp(full.data() + depth, start.data() + depth, cmp_len);
+        if (cmp < 0) {
+            return true;
+        }
+        if (cmp > 0 || cmp_len < node->prefix_len) {
+            bounded = false;
+        }
+    }
+    depth += node->prefix_len;
+    if (bounded && depth == start.size()) {
+        bounded = false;
+    }
+    // a terminal key is a proper prefix of start while still bounded
+    if (node->terminal != nullptr && !bounded && !fn(node->terminal, arg)) {
+        return false;
+    }
+    uint8_t first = bounded ? (uint8_t)start[depth] : 0;
+    switch (node->type) {
+        case ART_NODE4:
+        case ART_NODE16: {
+            uint8_t* keys = node->type == ART_NODE4 ? ((ArtNode4*)node)->keys : ((ArtNode16*)node)->keys;
+            void** children = node->type == ART_NODE4 ? ((ArtNode4*)node)->children : ((ArtNode16*)node)->children;
+            for (size_t i = 0; i < node->num_children; i++) {
+                if (keys[i] < first) {
+                    continue;
+                }
+                if (!iterate_at(children[i], depth + 1, start, bounded && keys[i] == first, fn, arg)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case ART_NODE48: {
+            ArtNode48* n48 = (ArtNode48*)node;
+            for (size_t b = first; b < 256; b++) {
+                uint8_t idx = n48->child_index[b];
+                if (idx != 0 && !iterate_at(n48->children[idx - 1], depth + 1, start, bounded && b == first, fn, arg)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default: {
+            ArtNode256* n256 = (ArtNode256*)node;
+            for (size_t b = first; b < 256; b++) {
+                void* child = n256->children[b];
+                if (child != nullptr && !iterate_at(child, depth + 1, start, bounded && b == first, fn, arg)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+}
+
+void RadixTree::insert(Entry* e) {
+    insert_at(&root, e, 0);
+}
+
+bool RadixTree::remove(const std::string& key) {
+    return remove_at(&root, key, 0) != nullptr;
+}
+
+void RadixTree::iterate_from(const std::string& start, bool (*fn)(Entry*, void*), void* arg) {
+    if (root != nullptr) {
+        iterate_at(root, 0, start, !start.empty(), fn, arg);
+    }
+}
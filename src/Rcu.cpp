@@ -0,0 +1,45 @@
+#include "headers/Rcu.h"
+#include <algorithm>
+
+void EpochReclaimer::init(size_t readers) {
+    slots.reset(new Slot[readers]);
+    num_slots = readers;
+}
+
+void EpochReclaimer::retire(void (*fn)(void*), void* arg, size_t bytes) {
+    RetiredObject obj;
+    obj.fn = fn;
+    obj.arg = arg;
+    obj.bytes = bytes;
+    obj.epoch = global_epoch.load(std::memory_order_relaxed);
+    retired.push_back(obj);
+    retired_bytes += bytes;
+}
+
+void EpochReclaimer::collect(std::vector<RetiredObject>& out) {
+    if (retired.empty()) {
+        return;
+    }
+    // readers entering from now on see the new epoch, and everything retired
+    // so far was unlinked before they entered
+    global_epoch.fetch_add(1, std::memory_order_acq_rel);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = UINT64_MAX;
+    for (size_t i = 0; i < num_slots; i++) {
+        uint64_t epoch = slots[i].epoch.load(std::memory_order_acquire);
+        if (epoch != 0) {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    // a reader in epoch e may hold anything retired during e or later
+    size_t kept = 0;
+    for (RetiredObject& obj : retired) {
+        if (obj.epoch < oldest) {
+            out.push_back(obj);
+            retired_bytes -= obj.bytes;
+        } else {
+            retired[kept++] = obj;
+        }
+    }
+    retired.resize(kept);
+}
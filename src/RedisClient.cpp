@@ -0,0 +1,366 @@
+#include "headers/RedisClient.h"
+#include <algorithm>
+#include <deque>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+static const size_t k_read_chunk = 64 * 1024;
+
+// a socket in fd with the send and receive timeouts set; on Linux the send
+// timeout also bounds connect
+int32_t RedisClient::open_socket(int domain) {
+    fd = socket(domain, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (timeout_ms > 0) {
+        struct timeval tv;
+        tv.tv_sec = (time_t)(timeout_ms / 1000);
+        tv.tv_usec = (suseconds_t)(timeout_ms % 1000 * 1000);
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return 0;
+}
+
+int32_t RedisClient::connect_tcp(const char* host, uint16_t port) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &res) != 0 || res == nullptr) {
+        return -1;
+    }
+    struct sockaddr_in addr = *(struct sockaddr_in*)res->ai_addr;
+    freeaddrinfo(res);
+    addr.sin_port = htons(port);
+
+    if (open_socket(AF_INET)) {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close_conn();
+        return -1;
+    }
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    return 0;
+}
+
+int32_t RedisClient::connect_unix(const char* path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    size_t len = strlen(path);
+    if (len >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len);
+
+    if (open_socket(AF_UNIX)) {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close_conn();
+        return -1;
+    }
+    return 0;
+}
+
+void RedisClient::close_conn() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    wbuf.clear();
+    rbuf.clear();
+    rbuf_pos = 0;
+}
+
+void RedisClient::append_req(const std::vector<std::string>& cmd) {
+    size_t payload_len = 1 + 4;
+    for (const std::string& s : cmd) {
+        payload_len += 1 + 4 + s.size();
+    }
+    size_t pos = wbuf.size();
+    wbuf.resize(pos + 4 + payload_len);
+    uint8_t* cur = wbuf.data() + pos;
+
+    uint32_t len = (uint32_t)payload_len;
+    memcpy(cur, &len, 4);
+    cur += 4;
+    *cur++ = (uint8_t)JSON::TAG_ARR;
+    uint32_t n = (uint32_t)cmd.size();
+    memcpy(cur, &n, 4);
+    cur += 4;
+    for (const std::string& s : cmd) {
+        *cur++ = (uint8_t)JSON::TAG_STR;
+        uint32_t str_len = (uint32_t)s.size();
+        memcpy(cur, &str_len, 4);
+        cur += 4;
+        memcpy(cur, s.data(), str_len);
+        cur += str_len;
+    }
+}
+
+int32_t RedisClient::flush() {
+    const uint8_t* buf = wbuf.data();
+    size_t n = wbuf.size();
+    while (n > 0) {
+        ssize_t rv = write(fd, buf, n);
+        if (rv <= 0) {
+            if (rv < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+    wbuf.clear();
+    return 0;
+}
+
+// makes sure at least n unparsed bytes are buffered
+int32_t RedisClient::fill(size_t n) {
+    if (rbuf_pos > 0 && rbuf_pos == rbuf.size()) {
+        rbuf.clear();
+        rbuf_pos = 0;
+    }
+    while (rbuf.size() - rbuf_pos < n) {
+        if (rbuf_pos > 0) {
+            rbuf.erase(rbuf.begin(), rbuf.begin() + rbuf_pos);
+            rbuf_pos = 0;
+        }
+        size_t old_size = rbuf.size();
+        size_t want = std::max(k_read_chunk, n - old_size);
+        rbuf.resize(old_size + want);
+        ssize_t rv = read(fd, rbuf.data() + old_size, want);
+        if (rv < 0 && errno == EINTR) {
+            rbuf.resize(old_size);
+            continue;
+        }
+        if (rv <= 0) {
+            rbuf.resize(old_size);
+            return -1;  // error, or unexpected EOF
+        }
+        rbuf.resize(old_size + (size_t)rv);
+    }
+    return 0;
+}
+
+int32_t RedisClient::read_res(Reply& out) {
+    if (fill(4)) {
+        return -1;
+    }
+    uint32_t len = 0;
+    memcpy(&len, rbuf.data() + rbuf_pos, 4);
+    if (fill(4 + (size_t)len)) {
+        return -1;
+    }
+    const uint8_t* cur = rbuf.data() + rbuf_pos + 4;
+    const uint8_t* end = cur + len;
+    out = Reply();
+    if (!decode_reply(cur, end, out) || cur != end) {
+        return -1;
+    }
+    rbuf_pos += 4 + (size_t)len;
+    return 0;
+}
+
+int32_t RedisClient::call(const std::vector<std::string>& cmd, Reply& out) {
+    append_req(cmd);
+    if (flush()) {
+        return -1;
+    }
+    return read_res(out);
+}
+
+bool decode_reply(const uint8_t*& cur, const uint8_t* end, Reply& out) {
+    if (cur >= end) {
+        return false;
+    }
+    out.tag = (JSON)*cur++;
+    switch (out.tag) {
+        case JSON::TAG_NIL:
+            return true;
+        case JSON::TAG_INT:
+        case JSON::TAG_DBL: {
+            if (cur + 8 > end) {
+                return false;
+            }
+            if (out.tag == JSON::TAG_INT) {
+                memcpy(&out.int_val, cur, 8);
+            } else {
+                memcpy(&out.dbl_val, cur, 8);
+            }
+            cur += 8;
+            return true;
+        }
+        case JSON::TAG_STR:
+        case JSON::TAG_ERR: {
+            uint32_t len = 0;
+            if (cur + 4 > end) {
+                return false;
+            }
+            memcpy(&len, cur, 4);
+            cur += 4;
+            if (cur + len > end) {
+                return false;
+            }
+            out.str.assign((const char*)cur, len);
+            cur += len;
+            return true;
+        }
+        case JSON::TAG_ARR: {
+            uint32_t len = 0;
+            if (cur + 4 > end) {
+                return false;
+            }
+            memcpy(&len, cur, 4);
+            cur += 4;
+            out.arr.resize(len);
+            for (uint32_t i = 0; i < len; i++) {
+                if (!decode_reply(cur, end, out.arr[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// waits for the oldest request in flight; false if it failed
+static bool stream_reply(RedisClient& client, Reply& reply, size_t& in_flight, std::string& err) {
+    if (client.read_res(reply)) {
+        err = "connection lost";
+        return false;
+    }
+    in_flight--;
+    if (reply.tag == JSON::TAG_ERR) {
+        err = reply.str;
+        return false;
+    }
+    return true;
+}
+
+int32_t stream_put(RedisClient& client, const std::string& key,
+        const std::function<size_t(char*, size_t)>& source, uint64_t& total, std::string& err) {
+    std::string chunk;
+    Reply reply;
+    size_t in_flight = 0;
+    std::deque<uint64_t> lengths;   // the length each append in flight should leave
+    bool first = true;
+    bool done = false;
+    total = 0;
+    while (!done || in_flight > 0) {
+        if (done || in_flight == k_stream_window) {
+            if (!stream_reply(client, reply, in_flight, err)) {
+                return -1;
+            }
+            // an evicted, expired or deleted key would be started over by append
+            if (reply.tag == JSON::TAG_INT && (uint64_t)reply.int_val != lengths.front()) {
+                err = "the value changed during the upload";
+                return -1;
+            }
+            lengths.pop_front();
+            continue;
+        }
+        // a full chunk unless the source runs out, which short reads of a pipe do not mean
+        chunk.resize(k_stream_chunk);
+        size_t len = 0;
+        for (size_t n = 1; n > 0 && len < chunk.size(); len += n) {
+            n = source(&chunk[len], chunk.size() - len);
+        }
+        chunk.resize(len);
+        done = len < k_stream_chunk;
+        if (len == 0 && !first) {
+            continue;
+        }
+        if (first) {
+            client.append_req({"set", key, chunk, "persist"});
+        } else {
+            client.append_req({"append", key, chunk});
+        }
+        first = false;
+        total += len;
+        lengths.push_back(total);
+        in_flight++;
+        if (client.flush()) {
+            err = "connection lost";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int32_t stream_get(RedisClient& client, const std::string& key,
+        const std::function<bool(const char*, size_t)>& sink, uint64_t& total, std::string& err) {
+    Reply reply;
+    total = 0;
+    if (client.call({"strlen", key}, reply)) {
+        err = "connection lost";
+        return -1;
+    }
+    if (reply.tag != JSON::TAG_INT) {
+        err = reply.str;
+        return -1;
+    }
+    uint64_t len = (uint64_t)reply.int_val;
+    if (len == 0) {
+        // strlen does not tell a missing key from an empty value, get does
+        if (client.call({"get", key}, reply)) {
+            err = "connection lost";
+            return -1;
+        }
+        if (reply.tag == JSON::TAG_ARR && !reply.arr.empty()) {
+            reply = reply.arr[0];
+        }
+        if (reply.tag != JSON::TAG_STR) {
+            err = reply.tag == JSON::TAG_ERR && reply.str != "null" ? reply.str : "key not found";
+            return -1;
+        }
+    }
+    uint64_t next = 0;
+    size_t in_flight = 0;
+    std::deque<uint64_t> lengths;   // the bytes each getrange in flight asked for
+    while (next < len || in_flight > 0) {
+        if (next < len && in_flight < k_stream_window) {
+            uint64_t last = std::min(len, next + k_stream_chunk) - 1;
+            client.append_req({"getrange", key, std::to_string(next), std::to_string(last)});
+            lengths.push_back(last + 1 - next);
+            next = last + 1;
+            in_flight++;
+            // the requests of a window go out together
+            if ((next == len || in_flight == k_stream_window) && client.flush()) {
+                err = "connection lost";
+                return -1;
+            }
+            continue;
+        }
+        if (!stream_reply(client, reply, in_flight, err)) {
+            return -1;
+        }
+        if (reply.str.size() != lengths.front()) {
+            err = "the value changed during the download";
+            return -1;
+        }
+        lengths.pop_front();
+        total += reply.str.size();
+        if (!sink(reply.str.data(), reply.str.size())) {
+            err = "stopped";
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include "headers/Resp.h"
+#include "headers/UtilTypes.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// longest `*<n>` or `$<len>` line we accept, including the \r\n
+static const size_t k_max_header_line = 32;
+
+// parses the decimal number in [begin, end)
+static bool parse_resp_int(const uint8_t* begin, const uint8_t* end, int64_t& out) {
+    bool negative = false;
+    if (begin < end && *begin == '-') {
+        negative = true;
+        begin++;
+    }
+    if (begin == end || end - begin > 18) {
+        return false;
+    }
+    int64_t val = 0;
+    for (; begin < end; begin++) {
+        if (*begin < '0' || *begin > '9') {
+            return false;
+        }
+        val = val * 10 + (*begin - '0');
+    }
+    out = negative ? -val : val;
+    return true;
+}
+
+// Finds the header line starting at data + start. Returns the offset of its
+// \n, 0 if it is not complete yet and -1 if it is malformed or too long.
+static int64_t find_header_line(const uint8_t* data, size_t size, size_t start) {
+    size_t avail = std::min(size - start, k_max_header_line);
+    const uint8_t* nl = (const uint8_t*)memchr(data + start, '\n', avail);
+    if (nl == nullptr) {
+        return avail == k_max_header_line ? -1 : 0;
+    }
+    if (nl == data + start || nl[-1] != '\r') {
+        return -1;
+    }
+    return nl - data;
+}
+
+void RespParser::reset() {
+    pos = 0;
+    num_args = -1;
+    bulk_len = -1;
+    args.clear();
+}
+
+size_t RespParser::bytes_wanted(size_t size) {
+    if (bulk_len < 0 || pos + bulk_len + 2 <= size) {
+        return 0;
+    }
+    return pos + bulk_len + 2 - size;
+}
+
+// Inline commands are a line of arguments separated by spaces, the way they
+// are typed into telnet. Quoting is not supported.
+RespStatus RespParser::parse_inline(const uint8_t* data, size_t size, size_t& consumed) {
+    const uint8_t* nl = (const uint8_t*)memchr(data + pos, '\n', size - pos);
+    if (nl == nullptr) {
+        pos = size;     // the next call starts looking where this one stopped
+        return size > k_max_inline ? RESP_ERROR : RESP_INCOMPLETE;
+    }
+    size_t line_end = nl - data;
+    if (line_end > k_max_inline) {
+        return RESP_ERROR;
+    }
+    consumed = line_end + 1;
+    if (line_end > 0 && data[line_end - 1] == '\r') {
+        line_end--;
+    }
+    size_t i = 0;
+    while (i < line_end) {
+        while (i < line_end && (data[i] == ' ' || data[i] == '\t')) {
+            i++;
+        }
+        size_t start = i;
+        while (i < line_end && data[i] != ' ' && data[i] != '\t') {
+            i++;
+        }
+        if (i > start) {
+            args.push_back(RespSlice{start, i - start});
+        }
+    }
+    return RESP_DONE;
+}
+
+RespStatus RespParser::parse(const uint8_t* data, size_t size, size_t& consumed) {
+    if (num_args < 0) {
+        if (size == 0) {
+            return RESP_INCOMPLETE;
+        }
+        if (data[0] != '*') {
+            return parse_inline(data, size, consumed);
+        }
+        int64_t nl = find_header_line(data, size, 0);
+        if (nl <= 0) {
+            return nl < 0 ? RESP_ERROR : RESP_INCOMPLETE;
+        }
+        int64_t n = 0;
+        if (!parse_resp_int(data + 1, data + nl - 1, n) || n > k_max_args) {
+            return RESP_ERROR;
+        }
+        num_args = std::max(n, (int64_t)0);   // *0 and *-1 are empty requests
+        pos = nl + 1;
+        args.reserve(num_args);
+    }
+    while ((int64_t)args.size() < num_args) {
+        if (bulk_len < 0) {
+            if (pos == size) {
+                return RESP_INCOMPLETE;
+            }
+            if (data[pos] != '$') {
+                return RESP_ERROR;
+            }
+            int64_t nl = find_header_line(data, size, pos);
+            if (nl <= 0) {
+                return nl < 0 ? RESP_ERROR : RESP_INCOMPLETE;
+            }
+            int64_t len = 0;
+            if (!parse_resp_int(data + pos + 1, data + nl - 1, len) || len < 0 || (size_t)len > k_max_bulk) {
+                return RESP_ERROR;
+            }
+            bulk_len = len;
+            pos = nl + 1;
+        }
+        if (size - pos < (size_t)bulk_len + 2) {
+            return RESP_INCOMPLETE;
+        }
+        if (data[pos + bulk_len] != '\r' || data[pos + bulk_len + 1] != '\n') {
+            return RESP_ERROR;
+        }
+        args.push_back(RespSlice{pos, (size_t)bulk_len});
+        pos += bulk_len + 2;
+        bulk_len = -1;
+    }
+    consumed = pos;
+    return RESP_DONE;
+}
+
+Protocol detect_protocol(const uint8_t* data, size_t size) {
+    if (size >= 5) {
+        return data[4] == JSON::TAG_ARR ? PROTO_BINARY : PROTO_RESP2;
+    }
+    // a short inline command, e.g. "a\r\n"
+    return memchr(data, '\n', size) != nullptr ? PROTO_RESP2 : PROTO_UNKNOWN;
+}
+
+static void append_str(Buffer& out, const char* s, size_t len) {
+    out.buffer_append((const uint8_t*)s, (int)len);
+}
+
+static void write_header(Buffer& out, char type, int64_t val) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "%c%lld\r\n", type, (long long)val);
+    append_str(out, line, n);
+}
+
+void resp_write_simple(Buffer& out, const std::string& s) {
+    append_str(out, "+", 1);
+    append_str(out, s.data(), s.size());
+    append_str(out, "\r\n", 2);
+}
+
+// errors whose first word is their code, which clients act on
+static bool has_error_code(const std::string& msg) {
+    static const char* const codes[] = {"MOVED ", "ASK ", "TRYAGAIN ", "CROSSSLOT ", "CLUSTERDOWN ", "BUSYKEY ", "IOERR ", "EXECABORT "};
+    for (const char* code : codes) {
+        if (msg.compare(0, strlen(code), code) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the message goes on one line, so line breaks in it are replaced
+void resp_write_error(Buffer& out, const std::string& msg) {
+    std::string line = (has_error_code(msg) ? "-" : "-ERR ") + msg + "\r\n";
+    for (size_t i = 1; i + 2 < line.size(); i++) {
+        if (line[i] == '\r' || line[i] == '\n') {
+            line[i] = ' ';
+        }
+    }
+    append_str(out, line.data(), line.size());
+}
+
+void resp_write_bulk(Buffer& out, const uint8_t* data, size_t len) {
+    write_header(out, '$', (int64_t)len);
+    out.buffer_append(data, (int)len);
+    append_str(out, "\r\n", 2);
+}
+
+void resp_write_int(Buffer& out, int64_t val) {
+    write_header(out, ':', val);
+}
+
+void resp_write_double(Buffer& out, double val, Protocol proto) {
+    char num[32];
+    int n = snprintf(num, sizeof(num), "%.17g", val);
+    if (proto == PROTO_RESP3) {
+        append_str(out, ",", 1);
+        append_str(out, num, n);
+        append_str(out, "\r\n", 2);
+    } else {
+        resp_write_bulk(out, (const uint8_t*)num, n);
+    }
+}
+
+void resp_write_null(Buffer& out, Protocol proto) {
+    if (proto == PROTO_RESP3) {
+        append_str(out, "_\r\n", 3);
+    } else {
+        append_str(out, "$-1\r\n", 5);
+    }
+}
+
+void resp_write_array(Buffer& out, size_t n) {
+    write_header(out, '*', (int64_t)n);
+}
+
+void resp_write_map(Buffer& out, size_t n, Protocol proto) {
+    if (proto == PROTO_RESP3) {
+        write_header(out, '%', (int64_t)n);
+    } else {
+        write_header(out, '*', (int64_t)(2 * n));
+    }
+}
+
+void resp_write_push(Buffer& out, size_t n, Protocol proto) {
+    write_header(out, proto == PROTO_RESP3 ? '>' : '*', (int64_t)n);
+}
+
+static bool read_len(const uint8_t*& cur, const uint8_t* end, uint32_t& len) {
+    if (end - cur < 4) {
+        return false;
+    }
+    memcpy(&len, cur, 4);
+    cur += 4;
+    return true;
+}
+
+bool resp_transcode(const uint8_t*& cur, const uint8_t* end, Buffer& out, Protocol proto) {
+    if (cur >= end) {
+        return false;
+    }
+    uint8_t tag = *cur++;
+    uint32_t len = 0;
+    switch (tag) {
+        case JSON::TAG_NIL:
+            resp_write_simple(out, "OK");
+            return true;
+        case JSON::TAG_ERR:
+        case JSON::TAG_STR: {
+            if (!read_len(cur, end, len) || (size_t)(end - cur) < len) {
+                return false;
+            }
+            if (tag == JSON::TAG_STR) {
+                resp_write_bulk(out, cur, len);
+            } else if (len == 4 && memcmp(cur, "null", 4) == 0) {
+                resp_write_null(out, proto);
+            } else if (len == 0) {
+                resp_write_error(out, "unknown command or wrong number of arguments");
+            } else {
+                resp_write_error(out, std::string((const char*)cur, len));
+            }
+            cur += len;
+            return true;
+        }
+        case JSON::TAG_INT:
+        case JSON::TAG_DBL: {
+            if (end - cur < 8) {
+                return false;
+            }
+            if (tag == JSON::TAG_INT) {
+                int64_t val;
+                memcpy(&val, cur, 8);
+                resp_write_int(out, val);
+            } else {
+                double val;
+                memcpy(&val, cur, 8);
+                resp_write_double(out, val, proto);
+            }
+            cur += 8;
+            return true;
+        }
+        case JSON::TAG_ARR: {
+            if (!read_len(cur, end, len)) {
+                return false;
+            }
+            resp_write_array(out, len);
+            for (uint32_t i = 0; i < len; i++) {
+                if (!resp_transcode(cur, end, out, proto)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
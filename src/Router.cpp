@@ -0,0 +1,428 @@
+#include "headers/Router.h"
+#include "headers/Cluster.h"
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include <thread>
+
+// keys per sub-command, so that a large request does not turn into one
+// reply a node has to buffer whole
+static const size_t k_router_batch = 1000;
+static const size_t k_router_max_redirects = 5;
+static const int k_router_try_again_ms = 5;
+
+static const std::string CROSS_NODE_ERROR = "keys of the command map to different nodes";
+
+bool parse_router_node(const std::string& s, RouterNode& out) {
+    out = RouterNode();
+    if (s.find('/') != std::string::npos) {
+        out.unix_path = s;
+        return true;
+    }
+    size_t colon = s.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == s.size()) {
+        return false;
+    }
+    char* end = nullptr;
+    long port = strtol(s.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || port <= 0 || port > 65535) {
+        return false;
+    }
+    out.host = s.substr(0, colon);
+    out.port = (uint16_t)port;
+    return true;
+}
+
+bool parse_router_nodes(const std::string& s, std::vector<RouterNode>& out) {
+    out.clear();
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = s.size();
+        }
+        RouterNode node;
+        if (!parse_router_node(s.substr(pos, comma - pos), node)) {
+            return false;
+        }
+        out.push_back(node);
+        pos = comma + 1;
+    }
+    return !out.empty();
+}
+
+void router_hash_slice(const std::string& key, const char*& data, size_t& len) {
+    data = key.data();
+    len = key.size();
+    size_t open = key.find('{');
+    if (open == std::string::npos) {
+        return;
+    }
+    size_t close = key.find('}', open + 1);
+    if (close != std::string::npos && close > open + 1) {
+        data = key.data() + open + 1;
+        len = close - open - 1;
+    }
+}
+
+// 64 bit FNV-1a with a final mix, jump hashing wants all bits to vary
+static uint64_t key_hash(const char* data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Jumps from bucket to bucket as the number of buckets grows, each jump
+// taken with the probability that the key moves to the new bucket.
+static size_t jump_consistent_hash(uint64_t key, size_t num_buckets) {
+    int64_t b = -1;
+    int64_t j = 0;
+    while (j < (int64_t)num_buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (size_t)b;
+}
+
+size_t router_node_of(const std::string& key, size_t num_nodes) {
+    const char* data = nullptr;
+    size_t len = 0;
+    router_hash_slice(key, data, len);
+    return jump_consistent_hash(key_hash(data, len), num_nodes);
+}
+
+RouteSpec route_spec(const std::vector<std::string>& cmd) {
+    RouteSpec spec;
+    const std::string& name = cmd[0];
+    if (name == "get" || name == "mget") {
+        spec.to_end = true;
+        spec.merge = ROUTE_ARRAY;
+    } else if (name == "mset" || name == "msetex") {
+        spec.first = name == "mset" ? 1 : 2;
+        spec.step = 2;
+        spec.to_end = true;
+        spec.merge = ROUTE_STATUS;
+    } else if (name == "mdel" || name == "unlink") {
+        spec.to_end = true;
+        spec.merge = ROUTE_SUM;
+    } else if (name == "pfcount" || name == "pfmerge") {
+        spec.to_end = true;
+    } else if (name == "bitop") {
+        spec.first = 2;
+        spec.to_end = true;
+    } else if (name == "flushall" || (name == "config" && cmd.size() > 1 && cmd[1] == "set")) {
+        spec.first = 0;
+        spec.merge = ROUTE_ALL;
+    } else if (name == "info" || name == "config" || name == "scan" || name == "hotkeys"
+            || name.compare(0, 7, "prefix.") == 0) {
+        spec.first = 0;     // about one node, the first unless call_on is used
+    }
+    if (spec.first >= cmd.size()) {
+        spec.first = 0;
+    }
+    return spec;
+}
+
+Router::Router(const std::vector<RouterNode>& nodes) : nodes(nodes), pools(nodes.size()) {}
+
+size_t Router::node_index(const RouterNode& node) {
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].host == node.host && nodes[i].port == node.port && nodes[i].unix_path == node.unix_path) {
+            return i;
+        }
+    }
+    nodes.push_back(node);
+    pools.emplace_back();
+    return nodes.size() - 1;
+}
+
+size_t Router::group_of(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (slot_nodes.empty()) {
+        return router_node_of(key, nodes.size());
+    }
+    return key_hash_slot(key.data(), key.size());
+}
+
+size_t Router::group_node(size_t group) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return slot_nodes.empty() ? group : slot_nodes[group];
+}
+
+std::unique_ptr<RedisClient> Router::acquire(size_t node) {
+    RouterNode n;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Pool& pool = pools[node];
+        if (!pool.idle.empty()) {
+            std::unique_ptr<RedisClient> conn = std::move(pool.idle.back());
+            pool.idle.pop_back();
+            return conn;
+        }
+        n = nodes[node];
+    }
+    std::unique_ptr<RedisClient> conn(new RedisClient());
+    int32_t err = n.unix_path.empty() ? conn->connect_tcp(n.host.c_str(), n.port) : conn->connect_unix(n.unix_path.c_str());
+    if (err) {
+        return nullptr;
+    }
+    return conn;
+}
+
+// only connections that are in a known state go back: a failed one may
+// still have replies on the way
+void Router::release(size_t node, std::unique_ptr<RedisClient> conn) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pools[node].idle.push_back(std::move(conn));
+}
+
+int32_t Router::call_node(size_t node, const std::vector<std::string>& cmd, bool asking, Reply& out) {
+    std::unique_ptr<RedisClient> conn = acquire(node);
+    if (conn == nullptr) {
+        return -1;
+    }
+    if (asking) {
+        conn->append_req({"asking"});
+        if (conn->flush() || conn->read_res(out)) {
+            return -1;
+        }
+    }
+    if (conn->call(cmd, out)) {
+        return -1;
+    }
+    release(node, std::move(conn));
+    return 0;
+}
+
+// "MOVED <slot> <host:port>" or "ASK <slot> <host:port>"
+static bool parse_redirect(const Reply& reply, bool& ask, uint16_t& slot, RouterNode& node) {
+    if (reply.tag != JSON::TAG_ERR) {
+        return false;
+    }
+    ask = reply.str.compare(0, 4, "ASK ") == 0;
+    if (!ask && reply.str.compare(0, 6, "MOVED ") != 0) {
+        return false;
+    }
+    const char* p = reply.str.c_str() + (ask ? 4 : 6);
+    char* end = nullptr;
+    long n = strtol(p, &end, 10);
+    if (*end != ' ' || n < 0 || n >= (long)k_cluster_slots) {
+        return false;
+    }
+    slot = (uint16_t)n;
+    return parse_router_node(end + 1, node);
+}
+
+static bool is_try_again(const Reply& reply) {
+    return reply.tag == JSON::TAG_ERR && reply.str.compare(0, 9, "TRYAGAIN ") == 0;
+}
+
+int32_t Router::call_redirected(size_t node, const std::vector<std::string>& cmd, Reply& out) {
+    bool asking = false;
+    for (size_t hop = 0; ; hop++) {
+        if (call_node(node, cmd, asking, out)) {
+            return -1;
+        }
+        bool ask = false;
+        uint16_t slot = 0;
+        RouterNode target;
+        if (hop == k_router_max_redirects) {
+            return 0;
+        }
+        if (is_try_again(out)) {
+            // keys of a slot half way through a migration, which moves on quickly
+            std::this_thread::sleep_for(std::chrono::milliseconds(k_router_try_again_ms));
+            asking = false;
+            continue;
+        }
+        if (!parse_redirect(out, ask, slot, target)) {
+            return 0;
+        }
+        num_redirects.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        node = node_index(target);
+        if (!ask && !slot_nodes.empty()) {
+            slot_nodes[slot] = node;
+        }
+        asking = ask;
+    }
+}
+
+int32_t Router::load_slots() {
+    Reply reply;
+    if (call_node(0, {"cluster", "slots"}, false, reply) || reply.tag != JSON::TAG_ARR) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    slot_nodes.assign(k_cluster_slots, 0);     // unassigned slots get refused by the first node
+    for (const Reply& run : reply.arr) {
+        if (run.arr.size() < 3 || run.arr[2].arr.size() < 2) {
+            continue;
+        }
+        RouterNode node;
+        node.host = run.arr[2].arr[0].str;
+        node.port = (uint16_t)run.arr[2].arr[1].int_val;
+        size_t idx = node_index(node);
+        for (int64_t slot = run.arr[0].int_val; slot <= run.arr[1].int_val && slot < (int64_t)k_cluster_slots; slot++) {
+            slot_nodes[(size_t)slot] = idx;
+        }
+    }
+    return 0;
+}
+
+int32_t Router::call(const std::vector<std::string>& cmd, Reply& out) {
+    if (cmd.empty()) {
+        return -1;
+    }
+    RouteSpec spec = route_spec(cmd);
+    if (spec.merge == ROUTE_ALL) {
+        return call_all(cmd, out);
+    }
+    if (spec.first == 0) {
+        return call_node(0, cmd, false, out);
+    }
+    if (spec.merge != ROUTE_SINGLE) {
+        return call_split(cmd, spec, out);
+    }
+    size_t group = group_of(cmd[spec.first]);
+    for (size_t i = spec.first + spec.step; spec.to_end && i < cmd.size(); i += spec.step) {
+        if (group_of(cmd[i]) != group) {
+            out = Reply();
+            out.tag = JSON::TAG_ERR;
+            out.str = CROSS_NODE_ERROR;
+            return 0;
+        }
+    }
+    return call_redirected(group_node(group), cmd, out);
+}
+
+int32_t Router::call_all(const std::vector<std::string>& cmd, Reply& out) {
+    size_t n = num_nodes();
+    std::vector<std::unique_ptr<RedisClient>> conns(n);
+    for (size_t node = 0; node < n; node++) {
+        conns[node] = acquire(node);
+        if (conns[node] == nullptr) {
+            return -1;
+        }
+        conns[node]->append_req(cmd);
+        if (conns[node]->flush()) {
+            return -1;
+        }
+    }
+    out = Reply();
+    for (size_t node = 0; node < n; node++) {
+        Reply reply;
+        if (conns[node]->read_res(reply)) {
+            return -1;
+        }
+        if (node == 0 || (reply.tag == JSON::TAG_ERR && out.tag != JSON::TAG_ERR)) {
+            out = std::move(reply);
+        }
+        release(node, std::move(conns[node]));
+    }
+    return 0;
+}
+
+int32_t Router::call_split(const std::vector<std::string>& cmd, const RouteSpec& spec, Reply& out) {
+    // the key indexes of each group, in order
+    size_t num_keys = (cmd.size() - spec.first) / spec.step;
+    std::vector<size_t> key_groups(num_keys);
+    std::vector<size_t> group_order;    // groups by first key
+    std::vector<std::vector<size_t>> group_keys;
+    {
+        std::vector<std::pair<size_t, size_t>> sorted(num_keys);
+        for (size_t k = 0; k < num_keys; k++) {
+            sorted[k] = std::make_pair(group_of(cmd[spec.first + k * spec.step]), k);
+        }
+        std::stable_sort(sorted.begin(), sorted.end());
+        for (size_t k = 0; k < num_keys; k++) {
+            if (k == 0 || sorted[k].first != sorted[k - 1].first) {
+                group_order.push_back(sorted[k].first);
+                group_keys.emplace_back();
+            }
+            group_keys.back().push_back(sorted[k].second);
+        }
+    }
+    std::vector<SubCommand> subs;
+    for (size_t g = 0; g < group_order.size(); g++) {
+        const std::vector<size_t>& keys = group_keys[g];
+        size_t node = group_node(group_order[g]);
+        for (size_t base = 0; base < keys.size(); base += k_router_batch) {
+            subs.emplace_back();
+            SubCommand& sub = subs.back();
+            sub.node = node;
+            sub.cmd.assign(cmd.begin(), cmd.begin() + spec.first);
+            for (size_t i = base; i < std::min(keys.size(), base + k_router_batch); i++) {
+                size_t arg = spec.first + keys[i] * spec.step;
+                sub.cmd.insert(sub.cmd.end(), cmd.begin() + arg, cmd.begin() + arg + spec.step);
+                sub.keys.push_back(keys[i]);
+            }
+        }
+    }
+
+    // every node gets its sub-commands before any reply is read
+    size_t n = num_nodes();
+    std::vector<std::unique_ptr<RedisClient>> conns(n);
+    for (SubCommand& sub : subs) {
+        if (conns[sub.node] == nullptr && (conns[sub.node] = acquire(sub.node)) == nullptr) {
+            return -1;
+        }
+        conns[sub.node]->append_req(sub.cmd);
+    }
+    for (size_t node = 0; node < n; node++) {
+        if (conns[node] != nullptr && conns[node]->flush()) {
+            return -1;
+        }
+    }
+    for (SubCommand& sub : subs) {
+        if (conns[sub.node]->read_res(sub.reply)) {
+            return -1;
+        }
+    }
+    for (size_t node = 0; node < n; node++) {
+        if (conns[node] != nullptr) {
+            release(node, std::move(conns[node]));
+        }
+    }
+    // the few sub-commands that were redirected go again, one at a time
+    for (SubCommand& sub : subs) {
+        bool ask = false;
+        uint16_t slot = 0;
+        RouterNode target;
+        if ((is_try_again(sub.reply) || parse_redirect(sub.reply, ask, slot, target))
+                && call_redirected(sub.node, sub.cmd, sub.reply)) {
+            return -1;
+        }
+    }
+
+    out = Reply();
+    if (spec.merge == ROUTE_ARRAY) {
+        out.tag = JSON::TAG_ARR;
+        out.arr.resize(num_keys);
+    } else if (spec.merge == ROUTE_SUM) {
+        out.tag = JSON::TAG_INT;
+    }
+    for (SubCommand& sub : subs) {
+        Reply& reply = sub.reply;
+        if (spec.merge == ROUTE_ARRAY) {
+            // a sub-command that failed as a whole fails each of its keys
+            bool whole = reply.tag == JSON::TAG_ARR && reply.arr.size() == sub.keys.size();
+            for (size_t i = 0; i < sub.keys.size(); i++) {
+                out.arr[sub.keys[i]] = whole ? std::move(reply.arr[i]) : reply;
+            }
+        } else if (out.tag != JSON::TAG_ERR) {
+            if (reply.tag == JSON::TAG_ERR) {
+                out = std::move(reply);
+            } else if (spec.merge == ROUTE_SUM) {
+                out.int_val += reply.int_val;
+            }
+        }
+    }
+    return 0;
+}
@@ -97,5 +97,6 @@ void TTLHeap::expire_entry(size_t pos) {
 
 void TTLHeap::add_heap_entry(const HeapEntry& heap_entry) {
     heap.push_back(heap_entry);
+    update_entry_idx(&heap.back(), heap.size() - 1);
     heap_up(heap.size() - 1);
 }
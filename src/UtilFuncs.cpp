@@ -1,4 +1,11 @@
 #include "headers/UtilFuncs.h"
+#include "headers/ZSet.h"
+#include "headers/Bloom.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctype.h>
+#include <stdlib.h>
 
 void msg(const char *msg) {
     fprintf(stderr, "%s\n", msg);
@@ -28,6 +35,10 @@ Conn* get_connection(Node* node) {
     return connection;
 }
 
+Conn* get_ready_connection(Node* node) {
+    return (Conn*) ((char*)node - offsetof(Conn, ready_node));
+}
+
 uint64_t fnv_hash(const uint8_t *data, size_t len) {
     uint32_t h = 0x811C9DC5;
     for (size_t i = 0; i < len; i++) {
@@ -36,6 +47,38 @@ uint64_t fnv_hash(const uint8_t *data, size_t len) {
     return h;
 }
 
+// MurmurHash64A
+uint64_t murmur_hash64(const uint8_t* data, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const uint8_t* end = data + (len - (len & 7));
+    for (; data != end; data += 8) {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch (len & 7) {
+        case 7: h ^= (uint64_t)data[6] << 48;   /* fall through */
+        case 6: h ^= (uint64_t)data[5] << 40;   /* fall through */
+        case 5: h ^= (uint64_t)data[4] << 32;   /* fall through */
+        case 4: h ^= (uint64_t)data[3] << 24;   /* fall through */
+        case 3: h ^= (uint64_t)data[2] << 16;   /* fall through */
+        case 2: h ^= (uint64_t)data[1] << 8;    /* fall through */
+        case 1:
+            h ^= (uint64_t)data[0];
+            h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
 bool eq(HNode* left, HNode* right) {
     // check they have the same keys and hashcode
     Entry* e1 = get_entry(left);
@@ -48,3 +91,188 @@ int64_t get_monotonic_msec() {
     clock_gettime(CLOCK_MONOTONIC, &tv);
     return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
 }
+
+
+size_t string_mem_usage(const std::string& s) {
+    // short strings live inside the object itself (small string optimisation)
+    const char* data = s.data();
+    const char* obj = (const char*)&s;
+    if (data >= obj && data < obj + sizeof(s)) {
+        return 0;
+    }
+    return s.capacity() + 1;
+}
+
+size_t entry_mem_usage(Entry* e) {
+    size_t bytes = sizeof(Entry) + string_mem_usage(e->key) + string_mem_usage(e->value);
+    if (e->type == VAL_ZSET) {
+        bytes += e->zset->mem_usage();
+    } else if (e->type == VAL_BLOOM) {
+        bytes += e->bloom->mem_usage();
+    }
+    return bytes;
+}
+
+// sorted sets and Bloom filters, which are not strings or numbers
+bool entry_owns_object(Entry* e) {
+    return e->type == VAL_ZSET || e->type == VAL_BLOOM;
+}
+
+// releases whatever the entry's value owns, leaving an empty string
+void entry_free_value(Entry* e) {
+    if (e->type == VAL_ZSET) {
+        delete e->zset;
+    } else if (e->type == VAL_BLOOM) {
+        delete e->bloom;
+    }
+    e->type = VAL_STR;
+    std::string().swap(e->value);
+}
+
+// parses sizes such as "1048576", "512kb", "100mb" or "2gb"
+bool parse_memory(const std::string& s, size_t& out) {
+    size_t pos = 0;
+    while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9') {
+        pos++;
+    }
+    if (pos == 0) {
+        return false;
+    }
+    errno = 0;
+    size_t value = strtoull(s.substr(0, pos).c_str(), nullptr, 10);
+    if (errno != 0) {
+        return false;
+    }
+    std::string unit = s.substr(pos);
+    for (char& c : unit) {
+        c = (char)tolower(c);
+    }
+    if (unit == "" || unit == "b") {
+        out = value;
+    } else if (unit == "k" || unit == "kb") {
+        out = value << 10;
+    } else if (unit == "m" || unit == "mb") {
+        out = value << 20;
+    } else if (unit == "g" || unit == "gb") {
+        out = value << 30;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// strict base 10 parse, rejects empty input, trailing garbage and overflow
+bool parse_int(const std::string& s, int64_t& out) {
+    if (s.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    long long value = strtoll(s.c_str(), &end, 10);
+    if (errno != 0 || end != s.c_str() + s.size()) {
+        return false;
+    }
+    out = (int64_t)value;
+    return true;
+}
+
+// like parse_int, but only accepts the form std::to_string would print, so
+// that storing the number instead of the text never changes what `get` sees
+bool parse_canonical_int(const std::string& s, int64_t& out) {
+    if (s.empty() || s.size() > 20) {
+        return false;
+    }
+    int64_t value = 0;
+    if (!parse_int(s, value) || std::to_string(value) != s) {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
+bool parse_double(const std::string& s, double& out) {
+    if (s.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    double value = strtod(s.c_str(), &end);
+    if (errno != 0 || end != s.c_str() + s.size() || std::isnan(value)) {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
+// matches one [...] class starting after the '[', advancing p past the ']'
+static bool glob_class_match(const char*& p, const char* pend, char c) {
+    bool negate = p < pend && *p == '^';
+    if (negate) {
+        p++;
+    }
+    bool matched = false;
+    while (p < pend && *p != ']') {
+        if (*p == '\\' && p + 1 < pend) {
+            p++;
+            matched |= *p == c;
+        } else if (p + 2 < pend && p[1] == '-' && p[2] != ']') {
+            char lo = std::min(p[0], p[2]);
+            char hi = std::max(p[0], p[2]);
+            matched |= c >= lo && c <= hi;
+            p += 2;
+        } else {
+            matched |= *p == c;
+        }
+        p++;
+    }
+    if (p < pend) {
+        p++;    // skip ']'
+    }
+    return matched != negate;
+}
+
+bool glob_match(const char* pattern, size_t plen, const char* str, size_t slen) {
+    const char* p = pattern;
+    const char* pend = pattern + plen;
+    const char* s = str;
+    const char* send = str + slen;
+    // position to resume from when the last '*' has to absorb one more char
+    const char* star_p = nullptr;
+    const char* star_s = nullptr;
+    while (s < send) {
+        if (p < pend && *p == '*') {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+        if (p < pend) {
+            const char* next_p = p + 1;
+            bool matched;
+            if (*p == '?') {
+                matched = true;
+            } else if (*p == '[') {
+                next_p = p + 1;
+                matched = glob_class_match(next_p, pend, *s);
+            } else if (*p == '\\' && p + 1 < pend) {
+                matched = p[1] == *s;
+                next_p = p + 2;
+            } else {
+                matched = *p == *s;
+            }
+            if (matched) {
+                p = next_p;
+                s++;
+                continue;
+            }
+        }
+        if (star_p == nullptr) {
+            return false;
+        }
+        p = star_p;
+        s = ++star_s;
+    }
+    while (p < pend && *p == '*') {
+        p++;
+    }
+    return p == pend;
+}
@@ -0,0 +1,194 @@
+#include "headers/ValueLog.h"
+#include "headers/UtilFuncs.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const double k_compact_live_ratio = 0.5;     // segments less live than this get compacted
+
+// Makes the file as large as a segment. Where it can, the disk blocks are
+// allocated up front: a store into a mapped hole that finds the disk full
+// kills the process with SIGBUS, a failed allocation here is just a full log.
+static bool reserve_segment(int fd) {
+#if defined(__linux__)
+    return posix_fallocate(fd, 0, k_value_segment_bytes) == 0;
+#else
+    return ftruncate(fd, k_value_segment_bytes) == 0;
+#endif
+}
+
+ValueLog::~ValueLog() {
+    for (uint32_t id = 0; id < num_ids; id++) {
+        if (segments[id] != nullptr) {
+            free_segment(segments[id]);
+        }
+    }
+}
+
+bool ValueLog::open(const std::string& path) {
+    dir = path;
+    segments.reset(new ValueSegment*[k_max_value_segments]());
+    if (!add_segment()) {
+        segments.reset();
+        return false;
+    }
+    return true;
+}
+
+void ValueLog::free_segment(ValueSegment* seg) {
+    munmap(seg->base, k_value_segment_bytes);
+    close(seg->fd);
+    delete seg;
+}
+
+bool ValueLog::add_segment() {
+    uint32_t id;
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+    } else if (num_ids < k_max_value_segments) {
+        id = num_ids;
+    } else {
+        return false;
+    }
+    std::string path = dir + "/values." + std::to_string(getpid()) + "." + std::to_string(next_file++);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        msg_errno("value log segment");
+        return false;
+    }
+    unlink(path.c_str());   // goes away with the last reference
+    void* base = MAP_FAILED;
+    if (reserve_segment(fd)) {
+        base = mmap(nullptr, k_value_segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (base == MAP_FAILED) {
+        msg_errno("value log segment");
+        close(fd);
+        return false;
+    }
+    if (!free_ids.empty()) {
+        free_ids.pop_back();
+    } else {
+        num_ids++;
+    }
+    ValueSegment* seg = new ValueSegment();
+    seg->fd = fd;
+    seg->base = (char*)base;
+    segments[id] = seg;
+    head = id;
+    stats.segments++;
+    return true;
+}
+
+void ValueLog::drop_segment(uint32_t id) {
+    ValueSegment* seg = segments[id];
+    segments[id] = nullptr;
+    free_ids.push_back(id);
+    stats.segments--;
+    stats.live_bytes -= seg->live;
+    stats.reclaimed_bytes += k_value_segment_bytes;
+    if (retire_segment != nullptr) {
+        retire_segment(seg, retire_arg);
+    } else {
+        free_segment(seg);
+    }
+}
+
+bool ValueLog::append(const char* key, size_t key_len, const char* data, size_t len, ValueLoc& loc) {
+    size_t size = record_size(key_len, len);
+    if (size > k_value_segment_bytes) {
+        return false;
+    }
+    if (head < 0 || segments[head]->end + size > k_value_segment_bytes) {
+        if (!add_segment()) {
+            return false;
+        }
+    }
+    ValueSegment* seg = segments[head];
+    ValueRecord* rec = (ValueRecord*)(seg->base + seg->end);
+    rec->key_len = (uint32_t)key_len;
+    rec->value_len = (uint32_t)len;
+    memcpy(rec + 1, key, key_len);
+    memcpy((char*)(rec + 1) + key_len, data, len);
+    loc.segment = (uint32_t)head;
+    loc.offset = (uint32_t)seg->end;
+    seg->end += size;
+    seg->live += size;
+    stats.live_records++;
+    stats.live_bytes += size;
+    return true;
+}
+
+void ValueLog::release(ValueLoc loc) {
+    ValueSegment* seg = segments[loc.segment];
+    const ValueRecord* rec = (const ValueRecord*)(seg->base + loc.offset);
+    size_t size = record_size(rec->key_len, rec->value_len);
+    seg->live -= size;
+    stats.live_records--;
+    stats.live_bytes -= size;
+}
+
+void ValueLog::release_all() {
+    for (uint32_t id = 0; id < num_ids; id++) {
+        if (segments[id] != nullptr) {
+            segments[id]->live = 0;
+        }
+    }
+    stats.live_records = 0;
+    stats.live_bytes = 0;
+}
+
+// Chooses the least live segment below k_compact_live_ratio, other than the
+// head. Segments left without any live record are dropped on the way.
+bool ValueLog::pick_victim() {
+    double best_ratio = k_compact_live_ratio;
+    for (uint32_t id = 0; id < num_ids; id++) {
+        ValueSegment* seg = segments[id];
+        if (seg == nullptr || id == head) {
+            continue;
+        }
+        if (seg->live == 0) {
+            drop_segment(id);
+            continue;
+        }
+        double ratio = (double)seg->live / seg->end;
+        if (ratio < best_ratio) {
+            best_ratio = ratio;
+            compacting = id;
+        }
+    }
+    compact_offset = 0;
+    return compacting >= 0;
+}
+
+bool ValueLog::compact(size_t budget, ValueLiveFn live, void* arg) {
+    if (compacting < 0 && !pick_victim()) {
+        return false;
+    }
+    ValueSegment* seg = segments[compacting];
+    size_t done = 0;
+    while (compact_offset < seg->end && seg->live > 0 && done < budget) {
+        const ValueRecord* rec = (const ValueRecord*)(seg->base + compact_offset);
+        const char* key = (const char*)(rec + 1);
+        size_t size = record_size(rec->key_len, rec->value_len);
+        ValueLoc old_loc = {(uint32_t)compacting, (uint32_t)compact_offset};
+        ValueLoc* where = live(key, rec->key_len, old_loc, arg);
+        if (where != nullptr) {
+            ValueLoc new_loc;
+            if (!append(key, rec->key_len, key + rec->key_len, rec->value_len, new_loc)) {
+                return false;   // out of disk, the segment is picked up again later
+            }
+            *where = new_loc;
+            release(old_loc);
+            stats.compacted_bytes += size;
+        }
+        compact_offset += size;
+        done += size;
+    }
+    if (compact_offset >= seg->end || seg->live == 0) {
+        drop_segment((uint32_t)compacting);
+        compacting = -1;
+    }
+    return true;
+}
@@ -0,0 +1,272 @@
+#include "headers/ZSet.h"
+#include "headers/UtilFuncs.h"
+#include <cstdlib>
+#include <cstring>
+
+// lookup key for the member index, compared against ZNode names in place
+struct ZProbe {
+    HNode hnode;
+    const char* name;
+    size_t len;
+};
+
+static bool zeq(HNode* node, HNode* target) {
+    ZNode* znode = (ZNode*)((char*)node - offsetof(ZNode, hnode));
+    ZProbe* probe = (ZProbe*)((char*)target - offsetof(ZProbe, hnode));
+    return node->hash_code == target->hash_code && znode->name_len == probe->len
+        && memcmp(znode->name(), probe->name, probe->len) == 0;
+}
+
+static bool zeq_self(HNode* node, HNode* target) {
+    return node == target;
+}
+
+static int name_cmp(ZNode* node, const char* name, size_t len) {
+    size_t min_len = node->name_len < len ? node->name_len : len;
+    int rv = memcmp(node->name(), name, min_len);
+    if (rv != 0) {
+        return rv;
+    }
+    return node->name_len < len ? -1 : (node->name_len > len ? 1 : 0);
+}
+
+// skiplist order is (score, name)
+static bool node_less(ZNode* node, double score, const char* name, size_t len) {
+    return node->score < score || (node->score == score && name_cmp(node, name, len) < 0);
+}
+
+ZSet::ZSet() : index(4) {
+    header = node_new(k_max_level, 0, "", 0);
+    for (int i = 0; i < k_max_level; i++) {
+        header->levels()[i].forward = nullptr;
+        header->levels()[i].span = 0;
+    }
+    header->backward = nullptr;
+}
+
+ZSet::~ZSet() {
+    ZNode* node = header->levels()[0].forward;
+    while (node != nullptr) {
+        ZNode* next_node = node->levels()[0].forward;
+        node_free(node);
+        node = next_node;
+    }
+    node_free(header);
+}
+
+// each extra level is kept with probability 1/4
+int ZSet::random_level() {
+    int lvl = 1;
+    while (lvl < k_max_level) {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        if ((rng_state & 3) != 0) {
+            break;
+        }
+        lvl++;
+    }
+    return lvl;
+}
+
+ZNode* ZSet::node_new(int lvl, double score, const char* name, size_t len) {
+    size_t bytes = sizeof(ZNode) + lvl * sizeof(ZLevel) + len;
+    ZNode* node = (ZNode*)malloc(bytes);
+    node->hnode.next = nullptr;
+    node->hnode.hash_code = fnv_hash((const uint8_t*)name, len);
+    node->score = score;
+    node->backward = nullptr;
+    node->name_len = (uint32_t)len;
+    node->level = (uint32_t)lvl;
+    memcpy((char*)node->name(), name, len);
+    node_bytes += bytes;
+    return node;
+}
+
+void ZSet::node_free(ZNode* node) {
+    node_bytes -= sizeof(ZNode) + node->level * sizeof(ZLevel) + node->name_len;
+    free(node);
+}
+
+void ZSet::zsl_insert(ZNode* node) {
+    ZNode* update[k_max_level];
+    uint32_t rank[k_max_level];
+    ZNode* x = header;
+    for (int i = level - 1; i >= 0; i--) {
+        rank[i] = i == level - 1 ? 0 : rank[i + 1];
+        while (x->levels()[i].forward
+                && node_less(x->levels()[i].forward, node->score, node->name(), node->name_len)) {
+            rank[i] += x->levels()[i].span;
+            x = x->levels()[i].forward;
+        }
+        update[i] = x;
+    }
+    int lvl = (int)node->level;
+    if (lvl > level) {
+        for (int i = level; i < lvl; i++) {
+            rank[i] = 0;
+            update[i] = header;
+            header->levels()[i].span = (uint32_t)length;
+        }
+        level = lvl;
+    }
+    for (int i = 0; i < lvl; i++) {
+        ZLevel& prev = update[i]->levels()[i];
+        node->levels()[i].forward = prev.forward;
+        prev.forward = node;
+        node->levels()[i].span = prev.span - (rank[0] - rank[i]);
+        prev.span = (rank[0] - rank[i]) + 1;
+    }
+    for (int i = lvl; i < level; i++) {
+        update[i]->levels()[i].span++;
+    }
+    node->backward = update[0] == header ? nullptr : update[0];
+    if (node->levels()[0].forward) {
+        node->levels()[0].forward->backward = node;
+    } else {
+        tail = node;
+    }
+    length++;
+}
+
+void ZSet::zsl_unlink(ZNode* node) {
+    ZNode* update[k_max_level];
+    ZNode* x = header;
+    for (int i = level - 1; i >= 0; i--) {
+        while (x->levels()[i].forward
+                && node_less(x->levels()[i].forward, node->score, node->name(), node->name_len)) {
+            x = x->levels()[i].forward;
+        }
+        update[i] = x;
+    }
+    for (int i = 0; i < level; i++) {
+        ZLevel& prev = update[i]->levels()[i];
+        if (prev.forward == node) {
+            prev.span += node->levels()[i].span - 1;
+            prev.forward = node->levels()[i].forward;
+        } else {
+            prev.span -= 1;
+        }
+    }
+    if (node->levels()[0].forward) {
+        node->levels()[0].forward->backward = node->backward;
+    } else {
+        tail = node->backward;
+    }
+    while (level > 1 && header->levels()[level - 1].forward == nullptr) {
+        level--;
+    }
+    length--;
+}
+
+ZNode* ZSet::lookup(const std::string& name) {
+    ZProbe probe;
+    probe.name = name.data();
+    probe.len = name.size();
+    probe.hnode.hash_code = fnv_hash((const uint8_t*)name.data(), name.size());
+    HNode* node = index.hm_lookup(&probe.hnode, &zeq);
+    if (node == nullptr) {
+        return nullptr;
+    }
+    return (ZNode*)((char*)node - offsetof(ZNode, hnode));
+}
+
+bool ZSet::add(const std::string& name, double score) {
+    ZNode* node = lookup(name);
+    if (node != nullptr) {
+        if (node->score == score) {
+            return false;
+        }
+        ZNode* prev = node->backward;
+        ZNode* next_node = node->levels()[0].forward;
+        // the node keeps its place when the new score does not reorder it
+        if ((prev == nullptr || node_less(prev, score, node->name(), node->name_len))
+                && (next_node == nullptr || !node_less(next_node, score, node->name(), node->name_len))) {
+            node->score = score;
+            return false;
+        }
+        zsl_unlink(node);
+        node->score = score;
+        zsl_insert(node);
+        return false;
+    }
+    node = node_new(random_level(), score, name.data(), name.size());
+    zsl_insert(node);
+    index.hm_insert(&node->hnode);
+    return true;
+}
+
+bool ZSet::remove(const std::string& name) {
+    ZNode* node = lookup(name);
+    if (node == nullptr) {
+        return false;
+    }
+    index.hm_delete(&node->hnode, &zeq_self);
+    zsl_unlink(node);
+    node_free(node);
+    return true;
+}
+
+size_t ZSet::rank(ZNode* node) {
+    size_t rank = 0;
+    ZNode* x = header;
+    for (int i = level - 1; i >= 0; i--) {
+        while (x->levels()[i].forward
+                && (x->levels()[i].forward == node
+                    || node_less(x->levels()[i].forward, node->score, node->name(), node->name_len))) {
+            rank += x->levels()[i].span;
+            x = x->levels()[i].forward;
+        }
+        if (x == node) {
+            return rank - 1;
+        }
+    }
+    return rank - 1;
+}
+
+ZNode* ZSet::by_rank(size_t rank) {
+    if (rank >= length) {
+        return nullptr;
+    }
+    size_t target = rank + 1;
+    size_t traversed = 0;
+    ZNode* x = header;
+    for (int i = level - 1; i >= 0; i--) {
+        while (x->levels()[i].forward && traversed + x->levels()[i].span <= target) {
+            traversed += x->levels()[i].span;
+            x = x->levels()[i].forward;
+        }
+        if (traversed == target) {
+            return x;
+        }
+    }
+    return nullptr;
+}
+
+bool ZSet::score_gte_min(double score, const ZRangeSpec& range) {
+    return range.min_exclusive ? score > range.min : score >= range.min;
+}
+
+bool ZSet::score_lte_max(double score, const ZRangeSpec& range) {
+    return range.max_exclusive ? score < range.max : score <= range.max;
+}
+
+ZNode* ZSet::first_in_range(const ZRangeSpec& range) {
+    if (range.min > range.max || (range.min == range.max && (range.min_exclusive || range.max_exclusive))) {
+        return nullptr;
+    }
+    if (tail == nullptr || !score_gte_min(tail->score, range)) {
+        return nullptr;
+    }
+    ZNode* x = header;
+    for (int i = level - 1; i >= 0; i--) {
+        while (x->levels()[i].forward && !score_gte_min(x->levels()[i].forward->score, range)) {
+            x = x->levels()[i].forward;
+        }
+    }
+    x = x->levels()[0].forward;
+    if (x == nullptr || !score_lte_max(x->score, range)) {
+        return nullptr;
+    }
+    return x;
+}
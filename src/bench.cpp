@@ -0,0 +1,1785 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <poll.h>
+#include <sys/resource.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "headers/RedisClient.h"
+#include "headers/Cluster.h"
+#include "headers/Router.h"
+
+struct BenchOptions {
+    std::string host = "127.0.0.1";
+    uint16_t port = 1234;
+    std::string unix_path;          // connect over this unix socket instead of TCP
+    std::string nodes;              // host:port list, for the router workload
+    uint16_t reader_port = 0;       // the server's reader-port, for the readers workload
+    size_t clients = 1;
+    size_t requests = 100000;     // per client
+    size_t keyspace = 100000;
+    size_t value_size = 64;
+    double zipf_theta = 0.99;
+};
+
+struct BenchResult {
+    std::vector<uint64_t> latencies_us;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    bool failed = false;
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: ./bench [options] <workload>\n"
+        "workloads:\n"
+        "  zipf    cache-aside load: get, then set on a miss. reports the hit ratio\n"
+        "  mget    multi-key get with batches of 1..1000 keys. reports the cost per key\n"
+        "  zset    sorted set with -k members: zadd, zscore, zrank, zrange, zrangebyscore\n"
+        "  mixed   -c light clients doing get while one bulk loader pipelines mset\n"
+        "  transport  small-key gets over loopback TCP, then over the unix socket given with -u\n"
+        "  readers gets on the main port, then on the reader threads' port given with -r,\n"
+        "          then there again while a bulk loader writes on the main port\n"
+        "  pubsub  one publisher sends -n messages of -d bytes to -c subscribers of one channel\n"
+        "  bitmap  bitcount, bitpos and bitop over 128 MB bitmaps, -n calls each (at most 100),\n"
+        "          with the server's AVX2 loops and with its portable ones\n"
+        "  bloom   -k ids kept as set markers and in a Bloom filter: memory per id, false\n"
+        "          positive rate and -n checks of each kind\n"
+        "  tiered  -k keys of -d bytes with 90%% of them left to go cold, on a server with a\n"
+        "          tiered-dir: memory per key, gets of hot and cold keys, compaction\n"
+        "  router  -k keys sharded over the -N nodes: balance, -c clients doing gets of 100\n"
+        "          keys split across the nodes, keys that move when a node is added\n"
+        "  cluster -k keys over the -N nodes, fresh servers in cluster mode: moves a quarter\n"
+        "          of the first node's slots to the second while -c clients keep using them\n"
+        "  txn     -c clients doing -n read-modify-write increments of -k counters, as get\n"
+        "          then set and as watch, get, multi, set, exec: rate, retries, lost updates\n"
+        "  compound  -n ops each of set-if-absent, get-and-delete and set-persistent, made of\n"
+        "          plain commands and then of set nx/persist options and getdel\n"
+        "  stream  a 256 MB value streamed up and down in chunks, an 8 MB one built by get +\n"
+        "          set and by append, and -n setrange and getrange calls of 4 KB\n"
+        "options:\n"
+        "  -h <host>       server host (127.0.0.1)\n"
+        "  -p <port>       server port (1234)\n"
+        "  -u <path>       server unix socket, used instead of TCP\n"
+        "  -r <port>       server reader-port\n"
+        "  -N <nodes>      comma separated host:port list of sharded or cluster servers\n"
+        "  -c <clients>    concurrent connections (1)\n"
+        "  -n <requests>   requests per connection (100000)\n"
+        "  -k <keyspace>   number of distinct keys (100000)\n"
+        "  -d <bytes>      value size (64)\n"
+        "  -s <theta>      zipf skew, 0 < theta < 1 (0.99)\n");
+    exit(1);
+}
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Zipfian ranks in [0, n) using the method of Gray et al. ("Quickly generating
+// billion-record synthetic databases"), the same generator YCSB uses.
+class ZipfGenerator {
+private:
+    size_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+
+    static double zeta(size_t n, double theta) {
+        double sum = 0;
+        for (size_t i = 1; i <= n; i++) {
+            sum += 1.0 / std::pow((double)i, theta);
+        }
+        return sum;
+    }
+
+public:
+    ZipfGenerator(size_t n, double theta) : n(n), theta(theta) {
+        double zeta2 = zeta(2, theta);
+        zetan = zeta(n, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    size_t next(std::mt19937_64& rng) {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        size_t rank = (size_t)(n * std::pow(eta * u - eta + 1, alpha));
+        return std::min(rank, n - 1);
+    }
+};
+
+static bool connect_client(const BenchOptions& opts, RedisClient& client) {
+    if (!opts.unix_path.empty()) {
+        if (client.connect_unix(opts.unix_path.c_str())) {
+            fprintf(stderr, "cannot connect to %s\n", opts.unix_path.c_str());
+            return false;
+        }
+        return true;
+    }
+    if (client.connect_tcp(opts.host.c_str(), opts.port)) {
+        fprintf(stderr, "cannot connect to %s:%u\n", opts.host.c_str(), opts.port);
+        return false;
+    }
+    return true;
+}
+
+static std::string bench_key(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+static void run_zipf_client(const BenchOptions& opts, const ZipfGenerator& zipf_proto,
+                            size_t idx, BenchResult& result) {
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        result.failed = true;
+        return;
+    }
+    ZipfGenerator zipf = zipf_proto;
+    std::mt19937_64 rng(idx + 1);
+    std::string value(opts.value_size, 'x');
+    result.latencies_us.reserve(opts.requests);
+    Reply reply;
+    for (size_t i = 0; i < opts.requests; i++) {
+        std::string key = bench_key(zipf.next(rng));
+        uint64_t start = now_us();
+        if (client.call({"get", key}, reply)) {
+            result.failed = true;
+            return;
+        }
+        bool hit = reply.tag == JSON::TAG_ARR && reply.arr.size() == 1
+            && reply.arr[0].tag == JSON::TAG_STR;
+        if (hit) {
+            result.hits++;
+        } else {
+            result.misses++;
+            // cache-aside: populate the key after a miss
+            if (client.call({"set", key, value}, reply)) {
+                result.failed = true;
+                return;
+            }
+        }
+        result.latencies_us.push_back(now_us() - start);
+    }
+}
+
+static uint64_t percentile(std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[idx];
+}
+
+static void print_latencies(std::vector<uint64_t>& latencies, uint64_t elapsed_us) {
+    std::sort(latencies.begin(), latencies.end());
+    double secs = elapsed_us / 1e6;
+    printf("requests:    %zu in %.2f s\n", latencies.size(), secs);
+    printf("throughput:  %.0f ops/s\n", latencies.size() / (secs > 0 ? secs : 1));
+    printf("latency us:  p50=%llu p99=%llu p99.9=%llu max=%llu\n",
+        (unsigned long long)percentile(latencies, 0.50),
+        (unsigned long long)percentile(latencies, 0.99),
+        (unsigned long long)percentile(latencies, 0.999),
+        (unsigned long long)(latencies.empty() ? 0 : latencies.back()));
+}
+
+// prints the server side `info` fields that are relevant to a run
+static void print_server_info(const BenchOptions& opts, const std::vector<std::string>& fields) {
+    RedisClient client;
+    Reply reply;
+    if (!connect_client(opts, client) || client.call({"info"}, reply) || reply.tag != JSON::TAG_ARR) {
+        return;
+    }
+    for (const Reply& line : reply.arr) {
+        for (const std::string& field : fields) {
+            if (line.str.compare(0, field.size() + 1, field + ":") == 0) {
+                printf("server %s\n", line.str.c_str());
+            }
+        }
+    }
+}
+
+// loads keys [0, keyspace) with batched msetex and a long ttl so that they
+// outlive the run
+static bool preload_keys(RedisClient& client, const BenchOptions& opts) {
+    static const size_t k_batch = 1000;
+    std::string value(opts.value_size, 'x');
+    std::vector<std::string> cmd;
+    Reply reply;
+    for (size_t base = 0; base < opts.keyspace; base += k_batch) {
+        size_t end = std::min(opts.keyspace, base + k_batch);
+        cmd.assign({"msetex", "3600000"});
+        for (size_t i = base; i < end; i++) {
+            cmd.push_back(bench_key(i));
+            cmd.push_back(value);
+        }
+        if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int bench_mget(const BenchOptions& opts) {
+    RedisClient client;
+    if (!connect_client(opts, client) || !preload_keys(client, opts)) {
+        fprintf(stderr, "preload failed\n");
+        return 1;
+    }
+    printf("== mget: keyspace=%zu value=%zuB, ~%zu keys per batch size\n",
+        opts.keyspace, opts.value_size, opts.requests);
+    printf("%8s %10s %12s %12s %10s\n", "batch", "calls", "p50 us/call", "p99 us/call", "ns/key");
+    std::mt19937_64 rng(1);
+    std::uniform_int_distribution<size_t> pick(0, opts.keyspace - 1);
+    static const size_t batch_sizes[] = {1, 10, 50, 100, 500, 1000};
+    for (size_t batch : batch_sizes) {
+        size_t calls = std::max((size_t)1, opts.requests / batch);
+        std::vector<uint64_t> latencies;
+        std::vector<std::string> cmd;
+        Reply reply;
+        uint64_t start = now_us();
+        for (size_t c = 0; c < calls; c++) {
+            cmd.assign(1, "get");
+            for (size_t i = 0; i < batch; i++) {
+                cmd.push_back(bench_key(pick(rng)));
+            }
+            uint64_t call_start = now_us();
+            if (client.call(cmd, reply) || reply.arr.size() != batch) {
+                fprintf(stderr, "mget failed\n");
+                return 1;
+            }
+            latencies.push_back(now_us() - call_start);
+        }
+        uint64_t elapsed = now_us() - start;
+        std::sort(latencies.begin(), latencies.end());
+        printf("%8zu %10zu %12llu %12llu %10.0f\n", batch, calls,
+            (unsigned long long)percentile(latencies, 0.50),
+            (unsigned long long)percentile(latencies, 0.99),
+            1000.0 * elapsed / (calls * batch));
+    }
+    return 0;
+}
+
+// runs `requests` calls produced by make_cmd and prints their latency summary
+template <typename MakeCmd>
+static bool bench_calls(RedisClient& client, const char* name, size_t requests, MakeCmd make_cmd) {
+    std::vector<uint64_t> latencies;
+    latencies.reserve(requests);
+    Reply reply;
+    uint64_t start = now_us();
+    for (size_t i = 0; i < requests; i++) {
+        std::vector<std::string> cmd = make_cmd();
+        uint64_t call_start = now_us();
+        if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "%s failed: %s\n", name, reply.str.c_str());
+            return false;
+        }
+        latencies.push_back(now_us() - call_start);
+    }
+    uint64_t elapsed = now_us() - start;
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-16s %10.0f ops/s   p50=%llu us p99=%llu us\n", name,
+        requests / (elapsed / 1e6), (unsigned long long)percentile(latencies, 0.50),
+        (unsigned long long)percentile(latencies, 0.99));
+    return true;
+}
+
+static int bench_zset(const BenchOptions& opts) {
+    static const size_t k_batch = 1000;
+    static const double k_max_score = 1e6;
+    const std::string key = "zbench";
+    RedisClient client;
+    Reply reply;
+    if (!connect_client(opts, client) || client.call({"mdel", key}, reply)) {
+        return 1;
+    }
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> score(0, k_max_score);
+    std::uniform_int_distribution<size_t> member(0, opts.keyspace - 1);
+    auto member_name = [](size_t i) { return "member:" + std::to_string(i); };
+
+    uint64_t start = now_us();
+    std::vector<std::string> cmd;
+    for (size_t base = 0; base < opts.keyspace; base += k_batch) {
+        cmd.assign({"zadd", key});
+        for (size_t i = base; i < std::min(opts.keyspace, base + k_batch); i++) {
+            cmd.push_back(std::to_string(score(rng)));
+            cmd.push_back(member_name(i));
+        }
+        if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "zadd failed\n");
+            return 1;
+        }
+        if (base == 0) {
+            client.call({"persist", key}, reply);
+        }
+    }
+    double load_secs = (now_us() - start) / 1e6;
+    printf("== zset: %zu members, %zu requests per command\n", opts.keyspace, opts.requests);
+    printf("%-16s %10.0f members/s (%.2f s)\n", "zadd load", opts.keyspace / load_secs, load_secs);
+
+    bool ok = bench_calls(client, "zadd update", opts.requests, [&]() {
+            return std::vector<std::string>{"zadd", key, std::to_string(score(rng)), member_name(member(rng))};
+        })
+        && bench_calls(client, "zscore", opts.requests, [&]() {
+            return std::vector<std::string>{"zscore", key, member_name(member(rng))};
+        })
+        && bench_calls(client, "zrank", opts.requests, [&]() {
+            return std::vector<std::string>{"zrank", key, member_name(member(rng))};
+        })
+        && bench_calls(client, "zrange 10", opts.requests, [&]() {
+            size_t first = member(rng);
+            return std::vector<std::string>{"zrange", key, std::to_string(first), std::to_string(first + 9)};
+        })
+        && bench_calls(client, "zrangebyscore 10", opts.requests, [&]() {
+            double min = score(rng);
+            return std::vector<std::string>{"zrangebyscore", key, std::to_string(min), "+inf",
+                "withscores", "limit", "0", "10"};
+        });
+    client.call({"mdel", key}, reply);
+    return ok ? 0 : 1;
+}
+
+// Pipelines rounds of k_bulk_pipeline mset commands of k_bulk_keys keys each
+// over one connection until stop is set, the way a bulk import would.
+static void run_bulk_loader(const BenchOptions& opts, std::atomic<bool>& stop, BenchResult& result) {
+    static const size_t k_bulk_pipeline = 1000;
+    static const size_t k_bulk_keys = 10;
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        result.failed = true;
+        return;
+    }
+    std::string value(opts.value_size, 'x');
+    std::vector<std::string> cmd;
+    Reply reply;
+    size_t next_key = 0;
+    while (!stop.load()) {
+        for (size_t p = 0; p < k_bulk_pipeline; p++) {
+            cmd.assign(1, "mset");
+            for (size_t i = 0; i < k_bulk_keys; i++) {
+                cmd.push_back(bench_key(next_key++ % opts.keyspace));
+                cmd.push_back(value);
+            }
+            client.append_req(cmd);
+        }
+        if (client.flush()) {
+            result.failed = true;
+            return;
+        }
+        for (size_t p = 0; p < k_bulk_pipeline; p++) {
+            if (client.read_res(reply)) {
+                result.failed = true;
+                return;
+            }
+        }
+        result.hits += k_bulk_pipeline * k_bulk_keys;
+    }
+}
+
+static void run_light_client(const BenchOptions& opts, size_t idx, BenchResult& result) {
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        result.failed = true;
+        return;
+    }
+    std::mt19937_64 rng(idx + 1);
+    std::uniform_int_distribution<size_t> pick(0, opts.keyspace - 1);
+    result.latencies_us.reserve(opts.requests);
+    Reply reply;
+    for (size_t i = 0; i < opts.requests; i++) {
+        uint64_t start = now_us();
+        if (client.call({"get", bench_key(pick(rng))}, reply)) {
+            result.failed = true;
+            return;
+        }
+        result.latencies_us.push_back(now_us() - start);
+    }
+}
+
+// runs the light clients to completion, with the bulk loader going in the
+// background when with_bulk is set, and prints one row of results
+static bool mixed_phase(const BenchOptions& opts, const char* name, bool with_bulk) {
+    std::atomic<bool> stop(false);
+    BenchResult bulk;
+    std::thread bulk_thread;
+    if (with_bulk) {
+        bulk_thread = std::thread(run_bulk_loader, std::cref(opts), std::ref(stop), std::ref(bulk));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    uint64_t start = now_us();
+    std::vector<BenchResult> results(opts.clients);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < opts.clients; i++) {
+        threads.emplace_back(run_light_client, std::cref(opts), i, std::ref(results[i]));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    uint64_t elapsed = now_us() - start;
+    stop.store(true);
+    if (with_bulk) {
+        bulk_thread.join();
+    }
+    std::vector<uint64_t> latencies;
+    for (BenchResult& r : results) {
+        if (r.failed) {
+            fprintf(stderr, "a client failed\n");
+            return false;
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+    }
+    if (bulk.failed) {
+        fprintf(stderr, "the bulk loader failed\n");
+        return false;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-26s %8llu %8llu %9llu %12.0f\n", name,
+        (unsigned long long)percentile(latencies, 0.50),
+        (unsigned long long)percentile(latencies, 0.99),
+        (unsigned long long)percentile(latencies, 0.999),
+        bulk.hits / (elapsed / 1e6));
+    return true;
+}
+
+// Tail latency of light clients next to a bulk loader, with the server's
+// per-connection command budget as configured and with it switched off.
+static int bench_mixed(const BenchOptions& opts) {
+    RedisClient client;
+    Reply reply;
+    if (!connect_client(opts, client) || !preload_keys(client, opts)) {
+        fprintf(stderr, "preload failed\n");
+        return 1;
+    }
+    if (client.call({"config", "get", "client-command-budget"}, reply) || reply.tag != JSON::TAG_STR) {
+        fprintf(stderr, "cannot read client-command-budget\n");
+        return 1;
+    }
+    std::string budget = reply.str;
+    printf("== mixed: %zu light clients x %zu gets, bulk loader pipelining mset, value=%zuB\n",
+        opts.clients, opts.requests, opts.value_size);
+    printf("%-26s %8s %8s %9s %12s\n", "phase", "p50 us", "p99 us", "p99.9 us", "bulk keys/s");
+    std::string with_budget = "light + bulk (budget " + budget + ")";
+    bool ok = mixed_phase(opts, "light only", false)
+        && mixed_phase(opts, with_budget.c_str(), true)
+        && !client.call({"config", "set", "client-command-budget", "0"}, reply)
+        && mixed_phase(opts, "light + bulk (no budget)", true);
+    client.call({"config", "set", "client-command-budget", budget}, reply);
+    return ok ? 0 : 1;
+}
+
+// The same small-key get load from -c clients, first over loopback TCP and
+// then over the unix socket, to compare the two transports.
+static int bench_transport(const BenchOptions& opts) {
+    if (opts.unix_path.empty()) {
+        fprintf(stderr, "transport needs -u <unix socket path>\n");
+        return 1;
+    }
+    RedisClient client;
+    if (!connect_client(opts, client) || !preload_keys(client, opts)) {
+        fprintf(stderr, "preload failed\n");
+        return 1;
+    }
+    printf("== transport: %zu clients x %zu gets, keyspace=%zu value=%zuB\n",
+        opts.clients, opts.requests, opts.keyspace, opts.value_size);
+    printf("%-10s %12s %8s %8s %9s\n", "transport", "ops/s", "p50 us", "p99 us", "p99.9 us");
+    for (int use_unix = 0; use_unix < 2; use_unix++) {
+        BenchOptions run_opts = opts;
+        if (!use_unix) {
+            run_opts.unix_path.clear();
+        }
+        std::vector<BenchResult> results(opts.clients);
+        std::vector<std::thread> threads;
+        uint64_t start = now_us();
+        for (size_t i = 0; i < opts.clients; i++) {
+            threads.emplace_back(run_light_client, std::cref(run_opts), i, std::ref(results[i]));
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        uint64_t elapsed = now_us() - start;
+        std::vector<uint64_t> latencies;
+        for (BenchResult& r : results) {
+            if (r.failed) {
+                fprintf(stderr, "a client failed\n");
+                return 1;
+            }
+            latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        printf("%-10s %12.0f %8llu %8llu %9llu\n", use_unix ? "unix" : "tcp",
+            latencies.size() / (elapsed / 1e6),
+            (unsigned long long)percentile(latencies, 0.50),
+            (unsigned long long)percentile(latencies, 0.99),
+            (unsigned long long)percentile(latencies, 0.999));
+    }
+    return 0;
+}
+
+// runs -c light clients against read_opts, with the bulk loader writing
+// through write_opts when with_bulk is set, and prints one row of results
+static bool readers_phase(const BenchOptions& read_opts, const BenchOptions& write_opts,
+                          const char* name, bool with_bulk) {
+    std::atomic<bool> stop(false);
+    BenchResult bulk;
+    std::thread bulk_thread;
+    if (with_bulk) {
+        bulk_thread = std::thread(run_bulk_loader, std::cref(write_opts), std::ref(stop), std::ref(bulk));
+    }
+    std::vector<BenchResult> results(read_opts.clients);
+    std::vector<std::thread> threads;
+    uint64_t start = now_us();
+    for (size_t i = 0; i < read_opts.clients; i++) {
+        threads.emplace_back(run_light_client, std::cref(read_opts), i, std::ref(results[i]));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    uint64_t elapsed = now_us() - start;
+    stop.store(true);
+    if (with_bulk) {
+        bulk_thread.join();
+    }
+    std::vector<uint64_t> latencies;
+    for (BenchResult& r : results) {
+        if (r.failed) {
+            fprintf(stderr, "a client failed\n");
+            return false;
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+    }
+    if (bulk.failed) {
+        fprintf(stderr, "the bulk loader failed\n");
+        return false;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-26s %12.0f %8llu %8llu %9llu %12.0f\n", name,
+        latencies.size() / (elapsed / 1e6),
+        (unsigned long long)percentile(latencies, 0.50),
+        (unsigned long long)percentile(latencies, 0.99),
+        (unsigned long long)percentile(latencies, 0.999),
+        bulk.hits / (elapsed / 1e6));
+    return true;
+}
+
+// Get throughput of -c clients served by the event loop, then by the reader
+// threads (server started with --reader-threads n --reader-port p), then by
+// the reader threads while the event loop is busy with a bulk loader.
+static int bench_readers(const BenchOptions& opts) {
+    if (opts.reader_port == 0) {
+        fprintf(stderr, "readers needs -r <reader port>\n");
+        return 1;
+    }
+    RedisClient client;
+    if (!connect_client(opts, client) || !preload_keys(client, opts)) {
+        fprintf(stderr, "preload failed\n");
+        return 1;
+    }
+    BenchOptions reader_opts = opts;
+    reader_opts.port = opts.reader_port;
+    reader_opts.unix_path.clear();
+    printf("== readers: %zu clients x %zu gets, keyspace=%zu value=%zuB\n",
+        opts.clients, opts.requests, opts.keyspace, opts.value_size);
+    printf("%-26s %12s %8s %8s %9s %12s\n", "phase", "gets/s", "p50 us", "p99 us", "p99.9 us", "bulk keys/s");
+    bool ok = readers_phase(opts, opts, "event loop", false)
+        && readers_phase(reader_opts, opts, "reader threads", false)
+        && readers_phase(reader_opts, opts, "reader threads + bulk", true);
+    print_server_info(opts, {"reader_retries", "rcu_retired_bytes"});
+    return ok ? 0 : 1;
+}
+
+static const char* k_pubsub_channel = "bench:fanout";
+
+// size of the frame of one published message, the same for every message
+static size_t message_frame_size(size_t payload_size) {
+    return 4 + (1 + 4) + (1 + 4 + strlen("message")) + (1 + 4 + strlen(k_pubsub_channel))
+        + (1 + 4 + payload_size);
+}
+
+struct Subscriber {
+    RedisClient client;
+    size_t received = 0;        // bytes
+    bool sampled = false;       // its frames are parsed for the latency
+    std::string partial;        // bytes of an incomplete frame, sampled only
+};
+
+// Reads the messages of subs[begin, end) until each got expected bytes.
+// Every message carries its publish time in the first 8 bytes of the payload.
+static void run_subscribers(std::vector<std::unique_ptr<Subscriber>>& subs, size_t begin, size_t end,
+                            size_t expected, size_t frame_size, BenchResult& result) {
+    static const int k_stall_ms = 10000;
+    size_t payload_offset = message_frame_size(0);     // everything before the payload bytes
+    std::vector<uint8_t> buf(64 * 1024);
+    std::vector<struct pollfd> pfds;
+    std::vector<Subscriber*> polled;
+    while (true) {
+        pfds.clear();
+        polled.clear();
+        for (size_t i = begin; i < end; i++) {
+            if (subs[i]->received < expected) {
+                struct pollfd pfd = {subs[i]->client.get_fd(), POLLIN, 0};
+                pfds.push_back(pfd);
+                polled.push_back(subs[i].get());
+            }
+        }
+        if (pfds.empty()) {
+            return;
+        }
+        int rv = poll(pfds.data(), (nfds_t)pfds.size(), k_stall_ms);
+        if (rv <= 0) {
+            result.failed = true;
+            return;
+        }
+        for (size_t i = 0; i < pfds.size(); i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+            Subscriber* sub = polled[i];
+            ssize_t n = read(pfds[i].fd, buf.data(), buf.size());
+            if (n <= 0) {
+                result.failed = true;
+                return;
+            }
+            sub->received += (size_t)n;
+            if (!sub->sampled) {
+                continue;
+            }
+            uint64_t now = now_us();
+            sub->partial.append((const char*)buf.data(), (size_t)n);
+            size_t pos = 0;
+            for (; sub->partial.size() - pos >= frame_size; pos += frame_size) {
+                uint64_t sent = 0;
+                memcpy(&sent, sub->partial.data() + pos + payload_offset, 8);
+                result.latencies_us.push_back(now - sent);
+            }
+            sub->partial.erase(0, pos);
+        }
+    }
+}
+
+// Fan-out: -c subscribers of one channel and one publisher that sends -n
+// messages of -d bytes, one at a time. Reports the publish and delivery rates
+// and the publish-to-receive latency seen by every 64th subscriber.
+static int bench_pubsub(const BenchOptions& opts) {
+    static const size_t k_receiver_threads = 4;
+    static const size_t k_sample_every = 64;
+    size_t payload_size = std::max(opts.value_size, (size_t)8);
+    size_t frame_size = message_frame_size(payload_size);
+    std::vector<std::unique_ptr<Subscriber>> subs;
+    Reply reply;
+    for (size_t i = 0; i < opts.clients; i++) {
+        subs.emplace_back(new Subscriber());
+        Subscriber& sub = *subs.back();
+        sub.sampled = i % k_sample_every == 0;
+        if (!connect_client(opts, sub.client) || sub.client.call({"subscribe", k_pubsub_channel}, reply)) {
+            fprintf(stderr, "subscriber %zu failed\n", i);
+            return 1;
+        }
+    }
+    RedisClient publisher;
+    if (!connect_client(opts, publisher)) {
+        return 1;
+    }
+    size_t expected = opts.requests * frame_size;
+    size_t threads_used = std::min(k_receiver_threads, opts.clients);
+    std::vector<BenchResult> results(threads_used);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_used; t++) {
+        size_t begin = opts.clients * t / threads_used;
+        size_t end = opts.clients * (t + 1) / threads_used;
+        threads.emplace_back(run_subscribers, std::ref(subs), begin, end, expected, frame_size, std::ref(results[t]));
+    }
+
+    std::string payload(payload_size, 'x');
+    uint64_t start = now_us();
+    for (size_t i = 0; i < opts.requests; i++) {
+        uint64_t sent = now_us();
+        memcpy(&payload[0], &sent, 8);
+        if (publisher.call({"publish", k_pubsub_channel, payload}, reply) || reply.tag != JSON::TAG_INT) {
+            fprintf(stderr, "publish failed\n");
+            return 1;
+        }
+        if ((size_t)reply.int_val != opts.clients) {
+            fprintf(stderr, "published to %lld subscribers, expected %zu\n", (long long)reply.int_val, opts.clients);
+            return 1;
+        }
+    }
+    uint64_t published = now_us() - start;
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    uint64_t delivered = now_us() - start;
+
+    std::vector<uint64_t> latencies;
+    for (BenchResult& r : results) {
+        if (r.failed) {
+            fprintf(stderr, "a subscriber stalled or failed\n");
+            return 1;
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double deliveries = (double)opts.requests * opts.clients;
+    printf("== pubsub: 1 publisher, %zu subscribers, %zu messages of %zuB\n",
+        opts.clients, opts.requests, payload_size);
+    printf("published/s:  %.0f\n", opts.requests / (published / 1e6));
+    printf("delivered/s:  %.0f (%.1f MB/s)\n", deliveries / (delivered / 1e6),
+        deliveries * frame_size / (delivered / 1e6) / (1 << 20));
+    printf("latency us:   p50=%llu p99=%llu p99.9=%llu max=%llu\n",
+        (unsigned long long)percentile(latencies, 0.50),
+        (unsigned long long)percentile(latencies, 0.99),
+        (unsigned long long)percentile(latencies, 0.999),
+        (unsigned long long)(latencies.empty() ? 0 : latencies.back()));
+    return 0;
+}
+
+static const size_t k_bitmap_bytes = 128 << 20;
+
+// times `calls` calls of cmd, each reading `bytes_read` bytes of bitmaps
+static bool bitmap_calls(RedisClient& client, const char* name, size_t calls,
+        const std::vector<std::string>& cmd, double bytes_read) {
+    std::vector<uint64_t> latencies;
+    Reply reply;
+    for (size_t i = 0; i < calls; i++) {
+        uint64_t call_start = now_us();
+        if (client.call(cmd, reply) || reply.tag != JSON::TAG_INT) {
+            fprintf(stderr, "%s failed: %s\n", name, reply.str.c_str());
+            return false;
+        }
+        latencies.push_back(now_us() - call_start);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    uint64_t p50 = percentile(latencies, 0.50);
+    printf("%-12s p50=%7.2f ms p99=%7.2f ms  %6.2f GB/s\n", name, p50 / 1e3,
+        percentile(latencies, 0.99) / 1e3, bytes_read / (p50 / 1e6) / 1e9);
+    return true;
+}
+
+// Two 128 MB bitmaps with a million random bits set each, and one with only
+// its last bit set for bitpos to scan all the way. The server's loops are
+// compared by switching bitmap-simd off for the second pass.
+static int bench_bitmap(const BenchOptions& opts) {
+    static const size_t k_random_bits = 1000000;
+    static const size_t k_batch = 1000;
+    const std::string last_bit = std::to_string((uint64_t)k_bitmap_bytes * 8 - 1);
+    size_t calls = std::min(opts.requests, (size_t)100);
+    RedisClient client;
+    Reply reply;
+    if (!connect_client(opts, client)) {
+        return 1;
+    }
+    std::mt19937_64 rng(1);
+    std::uniform_int_distribution<uint64_t> offset(0, (uint64_t)k_bitmap_bytes * 8 - 1);
+    const std::pair<const char*, size_t> bitmaps[] = {
+        {"bitmap:a", k_random_bits}, {"bitmap:b", k_random_bits}, {"bitmap:last", 0}};
+    for (const auto& bitmap : bitmaps) {
+        const char* key = bitmap.first;
+        client.call({"del", key}, reply);
+        if (client.call({"setbit", key, last_bit, "1"}, reply) || client.call({"persist", key}, reply)) {
+            return 1;
+        }
+        for (size_t base = 0; base < bitmap.second; base += k_batch) {
+            for (size_t i = 0; i < k_batch; i++) {
+                client.append_req({"setbit", key, std::to_string(offset(rng)), "1"});
+            }
+            if (client.flush()) {
+                return 1;
+            }
+            for (size_t i = 0; i < k_batch; i++) {
+                if (client.read_res(reply) || reply.tag == JSON::TAG_ERR) {
+                    fprintf(stderr, "setbit failed\n");
+                    return 1;
+                }
+            }
+        }
+    }
+    printf("== bitmap: %zu MB bitmaps, %zu calls each\n", k_bitmap_bytes >> 20, calls);
+    bool ok = true;
+    for (const char* simd : {"yes", "no"}) {
+        if (client.call({"config", "set", "bitmap-simd", simd}, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "config set bitmap-simd failed\n");
+            return 1;
+        }
+        print_server_info(opts, {"bitmap_impl"});
+        double size = (double)k_bitmap_bytes;
+        ok = ok && bitmap_calls(client, "bitcount", calls, {"bitcount", "bitmap:a"}, size)
+            && bitmap_calls(client, "bitpos", calls, {"bitpos", "bitmap:last", "1"}, size)
+            && bitmap_calls(client, "bitop and", calls, {"bitop", "and", "bitmap:dest", "bitmap:a", "bitmap:b"}, 2 * size)
+            && bitmap_calls(client, "bitop xor", calls, {"bitop", "xor", "bitmap:dest", "bitmap:a", "bitmap:b"}, 2 * size)
+            && bitmap_calls(client, "bitop not", calls, {"bitop", "not", "bitmap:dest", "bitmap:a"}, size);
+    }
+    client.call({"config", "set", "bitmap-simd", "yes"}, reply);
+    client.call({"mdel", "bitmap:a", "bitmap:b", "bitmap:last", "bitmap:dest"}, reply);
+    return ok ? 0 : 1;
+}
+
+// a numeric field of the server's info, -1 if it cannot be had
+static int64_t info_int(const Reply& info, const std::string& field) {
+    if (info.tag != JSON::TAG_ARR) {
+        return -1;
+    }
+    for (const Reply& line : info.arr) {
+        if (line.str.compare(0, field.size() + 1, field + ":") == 0) {
+            return atoll(line.str.c_str() + field.size() + 1);
+        }
+    }
+    return -1;
+}
+
+static int64_t server_info_int(RedisClient& client, const std::string& field) {
+    Reply reply;
+    if (client.call({"info"}, reply)) {
+        return -1;
+    }
+    return info_int(reply, field);
+}
+
+// sends cmd_prefix + ids [begin, end) in batches, returns the sum of the
+// integer replies
+template <typename MakeId>
+static bool call_batched(RedisClient& client, const std::vector<std::string>& cmd_prefix,
+        size_t begin, size_t end, MakeId make_id, int64_t& sum) {
+    static const size_t k_batch = 1000;
+    std::vector<std::string> cmd;
+    Reply reply;
+    sum = 0;
+    for (size_t base = begin; base < end; base += k_batch) {
+        cmd = cmd_prefix;
+        for (size_t i = base; i < std::min(end, base + k_batch); i++) {
+            cmd.push_back(make_id(i));
+        }
+        if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "%s failed: %s\n", cmd_prefix[0].c_str(), reply.str.c_str());
+            return false;
+        }
+        for (const Reply& r : reply.arr) {
+            sum += r.int_val;
+        }
+    }
+    return true;
+}
+
+// "Have we seen this id": -k ids stored as `msetex` markers and as items of
+// a Bloom filter with a 1% error rate. Compares the memory per id, measures
+// the filter's false positive rate on ids it never saw and times single and
+// batched checks against a get of the marker.
+static int bench_bloom(const BenchOptions& opts) {
+    static const size_t k_check_batch = 100;
+    const std::string filter = "bench:bloom";
+    auto seen = [](size_t i) { return "seen:" + std::to_string(i); };
+    auto unseen = [](size_t i) { return "unseen:" + std::to_string(i); };
+    RedisClient client;
+    Reply reply;
+    int64_t sum = 0;
+    if (!connect_client(opts, client)) {
+        return 1;
+    }
+    client.call({"del", filter}, reply);
+    int64_t start_memory = server_info_int(client, "used_memory");
+    std::vector<std::string> cmd;
+    for (size_t base = 0; base < opts.keyspace; base += 1000) {
+        cmd.assign({"msetex", "3600000"});
+        for (size_t i = base; i < std::min(opts.keyspace, base + 1000); i++) {
+            cmd.push_back(seen(i));
+            cmd.push_back("1");
+        }
+        if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "msetex failed\n");
+            return 1;
+        }
+    }
+    int64_t marker_memory = server_info_int(client, "used_memory");
+    if (client.call({"bf.reserve", filter, "0.01", std::to_string(opts.keyspace)}, reply)
+            || reply.tag == JSON::TAG_ERR || client.call({"persist", filter}, reply)
+            || !call_batched(client, {"bf.madd", filter}, 0, opts.keyspace, seen, sum)) {
+        fprintf(stderr, "bf.reserve failed: %s\n", reply.str.c_str());
+        return 1;
+    }
+    int64_t filter_memory = server_info_int(client, "used_memory");
+    int64_t false_positives = 0;
+    if (!call_batched(client, {"bf.mexists", filter}, 0, opts.keyspace, unseen, false_positives)) {
+        return 1;
+    }
+    printf("== bloom: %zu ids\n", opts.keyspace);
+    printf("set markers:   %.1f bytes per id\n", (double)(marker_memory - start_memory) / opts.keyspace);
+    printf("bloom filter:  %.2f bits per id, %.3f%% false positives\n",
+        8.0 * (filter_memory - marker_memory) / opts.keyspace, 100.0 * false_positives / opts.keyspace);
+
+    std::mt19937_64 rng(1);
+    std::uniform_int_distribution<size_t> pick(0, opts.keyspace - 1);
+    bool ok = bench_calls(client, "get marker", opts.requests, [&]() {
+            return std::vector<std::string>{"get", seen(pick(rng))};
+        })
+        && bench_calls(client, "bf.exists", opts.requests, [&]() {
+            return std::vector<std::string>{"bf.exists", filter, seen(pick(rng))};
+        })
+        && bench_calls(client, "bf.mexists x100", opts.requests / k_check_batch, [&]() {
+            std::vector<std::string> check{"bf.mexists", filter};
+            for (size_t i = 0; i < k_check_batch; i++) {
+                check.push_back(seen(pick(rng)));
+            }
+            return check;
+        });
+    call_batched(client, {"mdel"}, 0, opts.keyspace, seen, sum);
+    client.call({"del", filter}, reply);
+    return ok ? 0 : 1;
+}
+
+// Polls an info field until done(value) holds, false on timeout. The first
+// keep_hot keys are read in between so that they stay hot.
+template <typename Done>
+static bool wait_info(RedisClient& client, const std::string& field, Done done, uint64_t timeout_us,
+        size_t keep_hot) {
+    uint64_t start = now_us();
+    int64_t sum = 0;
+    while (!done(server_info_int(client, field))) {
+        if (now_us() - start > timeout_us
+                || (keep_hot > 0 && !call_batched(client, {"get"}, 0, keep_hot, bench_key, sum))) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return true;
+}
+
+// Tiered storage, on a server started with --tiered-dir: -k keys of -d
+// bytes, of which the first 10% keep being read while the others are left
+// to go cold and move to the value log. Reports the memory per key before
+// and after, the get latency of hot and cold keys, and how long compaction
+// takes to give the space back once most cold keys were overwritten.
+static int bench_tiered(const BenchOptions& opts) {
+    RedisClient client;
+    Reply reply;
+    if (!connect_client(opts, client)) {
+        return 1;
+    }
+    if (client.call({"config", "get", "tiered-dir"}, reply) || reply.tag != JSON::TAG_STR || reply.str.empty()) {
+        fprintf(stderr, "the server needs a --tiered-dir\n");
+        return 1;
+    }
+    client.call({"config", "get", "tiered-cold-ms"}, reply);
+    std::string cold_ms = reply.str;
+    size_t hot = std::max((size_t)1, opts.keyspace / 10);
+    size_t cold = opts.keyspace - hot;
+    int64_t start_memory = server_info_int(client, "used_memory");
+    if (client.call({"config", "set", "tiered-cold-ms", "3600000"}, reply) || !preload_keys(client, opts)) {
+        fprintf(stderr, "preload failed\n");
+        return 1;
+    }
+    int64_t loaded_memory = server_info_int(client, "used_memory");
+    printf("== tiered: %zu keys of %zu bytes, %zu hot\n", opts.keyspace, opts.value_size, hot);
+    printf("in memory:     %.1f bytes per key\n", (double)(loaded_memory - start_memory) / opts.keyspace);
+
+    uint64_t spill_start = now_us();
+    client.call({"config", "set", "tiered-cold-ms", "1000"}, reply);
+    bool spilled = wait_info(client, "tiered_keys",
+        [&](int64_t n) { return n >= (int64_t)cold; }, 120 * 1000000ULL, hot);
+    client.call({"config", "set", "tiered-cold-ms", "3600000"}, reply);
+    int64_t tiered_keys = server_info_int(client, "tiered_keys");
+    printf("tiered:        %.1f bytes per key, %lld keys moved in %.1f s\n",
+        (double)(server_info_int(client, "used_memory") - start_memory) / opts.keyspace,
+        (long long)tiered_keys, (now_us() - spill_start) / 1e6);
+    printf("value log:     %.1f MB live in %.1f MB of segments\n",
+        server_info_int(client, "tiered_live_bytes") / 1048576.0, server_info_int(client, "tiered_file_bytes") / 1048576.0);
+    if (!spilled) {
+        fprintf(stderr, "keys did not go cold in time\n");
+    }
+
+    std::mt19937_64 rng(1);
+    bool ok = bench_calls(client, "get hot", opts.requests, [&]() {
+            return std::vector<std::string>{"get", bench_key(rng() % hot)};
+        })
+        && bench_calls(client, "get cold", opts.requests, [&]() {
+            return std::vector<std::string>{"get", bench_key(hot + rng() % std::max(cold, (size_t)1))};
+        });
+
+    // overwriting most cold keys leaves their segments mostly garbage
+    int64_t reclaimed = server_info_int(client, "tiered_reclaimed_bytes");
+    int64_t file_bytes = server_info_int(client, "tiered_file_bytes");
+    std::string value(opts.value_size, 'y');
+    std::vector<std::string> cmd;
+    for (size_t base = hot; ok && base < opts.keyspace; base += 1000) {
+        cmd.assign({"msetex", "3600000"});
+        for (size_t i = base; i < std::min(opts.keyspace, base + 1000); i++) {
+            if (i % 4 != 0) {
+                cmd.push_back(bench_key(i));
+                cmd.push_back(value);
+            }
+        }
+        ok = cmd.size() == 2 || (!client.call(cmd, reply) && reply.tag != JSON::TAG_ERR);
+    }
+    // done once the log is back to about the live quarter plus the head
+    uint64_t compact_start = now_us();
+    int64_t segment_bytes = 64 << 20;
+    wait_info(client, "tiered_file_bytes",
+        [&](int64_t n) { return n <= file_bytes / 2 + segment_bytes; }, 60 * 1000000ULL, 0);
+    printf("compaction:    %.1f MB moved, %.1f MB of segments freed in %.1f s\n",
+        server_info_int(client, "tiered_compacted_bytes") / 1048576.0,
+        (server_info_int(client, "tiered_reclaimed_bytes") - reclaimed) / 1048576.0, (now_us() - compact_start) / 1e6);
+
+    client.call({"config", "set", "tiered-cold-ms", cold_ms}, reply);
+    int64_t deleted = 0;
+    call_batched(client, {"mdel"}, 0, opts.keyspace, bench_key, deleted);
+    return ok ? 0 : 1;
+}
+
+// Client side sharding over the -N nodes: -k keys loaded through a Router,
+// how evenly they spread, -c clients sharing the router for gets of 100
+// keys that each fan out to the nodes, and how many keys would move if a
+// node were added to the list.
+static int bench_router(const BenchOptions& opts) {
+    static const size_t k_load_batch = 10000;
+    static const size_t k_get_batch = 100;
+    std::vector<RouterNode> nodes;
+    if (!parse_router_nodes(opts.nodes, nodes)) {
+        fprintf(stderr, "the router workload needs -N host:port,...\n");
+        return 1;
+    }
+    Router router(nodes);
+    std::string value(opts.value_size, 'x');
+    std::vector<std::string> cmd;
+    Reply reply;
+    for (size_t base = 0; base < opts.keyspace; base += k_load_batch) {
+        cmd.assign({"msetex", "3600000"});
+        for (size_t i = base; i < std::min(opts.keyspace, base + k_load_batch); i++) {
+            cmd.push_back(bench_key(i));
+            cmd.push_back(value);
+        }
+        if (router.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "preload failed\n");
+            return 1;
+        }
+    }
+    printf("== router: %zu keys of %zu bytes over %zu nodes\n", opts.keyspace, opts.value_size, nodes.size());
+    for (size_t node = 0; node < nodes.size(); node++) {
+        int64_t keys = router.call_on(node, {"info"}, reply) ? -1 : info_int(reply, "keys");
+        printf("node %zu:        %lld keys, %.2f%% (even share %.2f%%)\n", node, (long long)keys,
+            100.0 * keys / opts.keyspace, 100.0 / nodes.size());
+    }
+
+    std::vector<BenchResult> results(opts.clients);
+    std::vector<std::thread> threads;
+    uint64_t start = now_us();
+    for (size_t c = 0; c < opts.clients; c++) {
+        threads.emplace_back([&, c]() {
+            std::mt19937_64 rng(c + 1);
+            std::vector<std::string> get;
+            Reply got;
+            size_t calls = std::max((size_t)1, opts.requests / k_get_batch);
+            for (size_t n = 0; n < calls; n++) {
+                get.assign(1, "get");
+                for (size_t i = 0; i < k_get_batch; i++) {
+                    get.push_back(bench_key(rng() % opts.keyspace));
+                }
+                uint64_t call_start = now_us();
+                if (router.call(get, got) || got.arr.size() != k_get_batch) {
+                    results[c].failed = true;
+                    return;
+                }
+                results[c].latencies_us.push_back(now_us() - call_start);
+                for (const Reply& r : got.arr) {
+                    (r.tag == JSON::TAG_STR ? results[c].hits : results[c].misses)++;
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    uint64_t elapsed = now_us() - start;
+    std::vector<uint64_t> latencies;
+    uint64_t misses = 0;
+    for (BenchResult& r : results) {
+        if (r.failed) {
+            fprintf(stderr, "a client failed\n");
+            return 1;
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        misses += r.misses;
+    }
+    printf("gets of %zu keys from %zu clients:\n", k_get_batch, opts.clients);
+    print_latencies(latencies, elapsed);
+    printf("keys/s:      %.0f, %llu misses\n", latencies.size() * k_get_batch / (elapsed / 1e6),
+        (unsigned long long)misses);
+
+    // jump hashing moves keys only onto the new node
+    size_t moved = 0;
+    size_t elsewhere = 0;
+    for (size_t i = 0; i < opts.keyspace; i++) {
+        std::string key = bench_key(i);
+        size_t before = router_node_of(key, nodes.size());
+        size_t after = router_node_of(key, nodes.size() + 1);
+        moved += before != after;
+        elsewhere += before != after && after != nodes.size();
+    }
+    printf("add a node:  %.2f%% of keys move (ideal %.2f%%), %zu to an old node\n",
+        100.0 * moved / opts.keyspace, 100.0 / (nodes.size() + 1), elsewhere);
+
+    for (size_t base = 0; base < opts.keyspace; base += k_load_batch) {
+        cmd.assign(1, "mdel");
+        for (size_t i = base; i < std::min(opts.keyspace, base + k_load_batch); i++) {
+            cmd.push_back(bench_key(i));
+        }
+        router.call(cmd, reply);
+    }
+    return 0;
+}
+
+// key counts of the nodes of a router
+static void print_node_keys(Router& router, size_t keyspace) {
+    Reply reply;
+    for (size_t node = 0; node < router.num_nodes(); node++) {
+        int64_t keys = router.call_on(node, {"info"}, reply) ? -1 : info_int(reply, "keys");
+        printf("node %zu:        %lld keys, %.2f%%\n", node, (long long)keys, 100.0 * keys / keyspace);
+    }
+}
+
+// Cluster mode on the -N nodes, fresh servers started with --cluster-enabled
+// yes: the slots are split evenly, -k keys are loaded through a Router that
+// follows the slot map, and then a quarter of the first node's slots move to
+// the second one, a slot at a time and k_migrate_batch keys per migrate,
+// while -c clients keep reading and writing through the router. Reports how
+// fast keys moved, the latency and redirects the clients saw meanwhile, and
+// checks that no key went missing.
+static int bench_cluster(const BenchOptions& opts) {
+    static const size_t k_load_batch = 10000;
+    static const size_t k_migrate_batch = 100;
+    std::vector<RouterNode> nodes;
+    if (!parse_router_nodes(opts.nodes, nodes) || nodes.size() < 2) {
+        fprintf(stderr, "the cluster workload needs -N host:port,host:port,...\n");
+        return 1;
+    }
+    Router router(nodes);
+    std::vector<std::string> addrs;
+    for (RouterNode& node : nodes) {
+        addrs.push_back(node.host + ":" + std::to_string(node.port));
+    }
+    Reply reply;
+    size_t n = nodes.size();
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n; j++) {
+            std::string first = std::to_string(j * k_cluster_slots / n);
+            std::string last = std::to_string((j + 1) * k_cluster_slots / n - 1);
+            std::vector<std::string> cmd = i == j
+                ? std::vector<std::string>{"cluster", "addslotsrange", first, last}
+                : std::vector<std::string>{"cluster", "setslotsrange", first, last, addrs[j]};
+            if (router.call_on(i, cmd, reply) || reply.tag == JSON::TAG_ERR) {
+                fprintf(stderr, "cluster setup failed: %s\n", reply.str.c_str());
+                return 1;
+            }
+        }
+    }
+    if (router.load_slots()) {
+        fprintf(stderr, "cannot load the slot map\n");
+        return 1;
+    }
+    std::string value(opts.value_size, 'x');
+    std::vector<std::string> cmd;
+    for (size_t base = 0; base < opts.keyspace; base += k_load_batch) {
+        cmd.assign({"msetex", "3600000"});
+        for (size_t i = base; i < std::min(opts.keyspace, base + k_load_batch); i++) {
+            cmd.push_back(bench_key(i));
+            cmd.push_back(value);
+        }
+        if (router.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+            fprintf(stderr, "preload failed: %s\n", reply.str.c_str());
+            return 1;
+        }
+    }
+    printf("== cluster: %zu keys of %zu bytes over %zu nodes\n", opts.keyspace, opts.value_size, n);
+    print_node_keys(router, opts.keyspace);
+
+    // the clients: nine gets to a write, every key always has a value
+    std::atomic<bool> done{false};
+    std::vector<BenchResult> results(opts.clients);
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < opts.clients; c++) {
+        threads.emplace_back([&, c]() {
+            std::mt19937_64 rng(c + 1);
+            Reply got;
+            while (!done.load()) {
+                std::string key = bench_key(rng() % opts.keyspace);
+                bool write = rng() % 10 == 0;
+                uint64_t call_start = now_us();
+                int32_t err = write ? router.call({"msetex", "3600000", key, value}, got) : router.call({"get", key}, got);
+                if (err || got.tag == JSON::TAG_ERR) {
+                    fprintf(stderr, "client call failed: %s\n", got.str.c_str());
+                    results[c].failed = true;
+                    return;
+                }
+                results[c].latencies_us.push_back(now_us() - call_start);
+                if (!write) {
+                    bool hit = got.arr.size() == 1 && got.arr[0].tag == JSON::TAG_STR;
+                    (hit ? results[c].hits : results[c].misses)++;
+                }
+            }
+        });
+    }
+
+    // the migration, driven the way a resharding tool would
+    uint16_t first_slot = 0;
+    uint16_t last_slot = (uint16_t)(k_cluster_slots / n / 4 - 1);
+    int64_t moved = 0;
+    bool ok = true;
+    uint64_t start = now_us();
+    std::string port = std::to_string(nodes[1].port);
+    for (uint32_t slot = first_slot; ok && slot <= last_slot; slot++) {
+        std::string s = std::to_string(slot);
+        ok = !router.call_on(1, {"cluster", "setslot", s, "importing", addrs[0]}, reply) && reply.tag != JSON::TAG_ERR
+            && !router.call_on(0, {"cluster", "setslot", s, "migrating", addrs[1]}, reply) && reply.tag != JSON::TAG_ERR;
+        while (ok) {
+            if (router.call_on(0, {"cluster", "getkeysinslot", s, std::to_string(k_migrate_batch)}, reply)
+                    || reply.tag != JSON::TAG_ARR) {
+                ok = false;
+                break;
+            }
+            if (reply.arr.empty()) {
+                break;
+            }
+            cmd.assign({"migrate", nodes[1].host, port, "5000"});
+            for (Reply& key : reply.arr) {
+                cmd.push_back(key.str);
+            }
+            ok = !router.call_on(0, cmd, reply) && reply.tag != JSON::TAG_ERR;
+            moved += reply.int_val;
+        }
+        // the target first, so that the source's MOVED leads somewhere
+        for (size_t i = 1; ok && i <= n; i++) {
+            ok = !router.call_on(i % n, {"cluster", "setslot", s, "node", addrs[1]}, reply) && reply.tag != JSON::TAG_ERR;
+        }
+        if (!ok) {
+            fprintf(stderr, "migrating slot %u failed: %s\n", slot, reply.str.c_str());
+        }
+    }
+    uint64_t elapsed = now_us() - start;
+    done = true;
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    printf("migration:   %u slots, %lld keys in %.2f s, %.0f keys/s\n", last_slot - first_slot + 1,
+        (long long)moved, elapsed / 1e6, moved / (elapsed / 1e6));
+
+    std::vector<uint64_t> latencies;
+    uint64_t misses = 0;
+    for (BenchResult& r : results) {
+        ok = ok && !r.failed;
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        misses += r.misses;
+    }
+    printf("clients during the migration:\n");
+    print_latencies(latencies, elapsed);
+    printf("misses:      %llu, redirects followed: %llu\n", (unsigned long long)misses,
+        (unsigned long long)router.redirects());
+
+    size_t found = 0;
+    for (size_t base = 0; base < opts.keyspace; base += k_load_batch) {
+        cmd.assign(1, "get");
+        for (size_t i = base; i < std::min(opts.keyspace, base + k_load_batch); i++) {
+            cmd.push_back(bench_key(i));
+        }
+        if (router.call(cmd, reply)) {
+            return 1;
+        }
+        for (Reply& r : reply.arr) {
+            found += r.tag == JSON::TAG_STR;
+        }
+    }
+    printf("after:       %zu of %zu keys found\n", found, opts.keyspace);
+    print_node_keys(router, opts.keyspace);
+    return ok && misses == 0 && found == opts.keyspace ? 0 : 1;
+}
+
+static std::string txn_key(size_t i) {
+    return "txn:" + std::to_string(i);
+}
+
+static bool reply_int(const Reply& reply, int64_t& out) {
+    const Reply& r = reply.tag == JSON::TAG_ARR && reply.arr.size() == 1 ? reply.arr[0] : reply;
+    if (r.tag == JSON::TAG_INT) {
+        out = r.int_val;
+        return true;
+    }
+    char* end = nullptr;
+    out = strtoll(r.str.c_str(), &end, 10);
+    return r.tag == JSON::TAG_STR && !r.str.empty() && *end == '\0';
+}
+
+// -n increments of random counters, each read, added to on the client and
+// written back: with plain get and set when optimistic is false, racing
+// the other clients, and otherwise as watch + get then multi + set + exec,
+// each pair pipelined, retried until exec goes through. result.misses
+// counts the retries.
+static void run_txn_client(const BenchOptions& opts, size_t idx, bool optimistic, BenchResult& result) {
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        result.failed = true;
+        return;
+    }
+    std::mt19937_64 rng(idx + 1);
+    std::uniform_int_distribution<size_t> pick(0, opts.keyspace - 1);
+    result.latencies_us.reserve(opts.requests);
+    Reply reply;
+    for (size_t i = 0; i < opts.requests; i++) {
+        std::string key = txn_key(pick(rng));
+        uint64_t start = now_us();
+        bool done = false;
+        while (!done) {
+            int64_t value = 0;
+            if (optimistic) {
+                client.append_req({"watch", key});
+            }
+            client.append_req({"get", key});
+            if (client.flush() || (optimistic && client.read_res(reply)) || client.read_res(reply)
+                    || !reply_int(reply, value)) {
+                result.failed = true;
+                return;
+            }
+            std::vector<std::string> set = {"set", key, std::to_string(value + 1), "3600000"};
+            if (!optimistic) {
+                if (client.call(set, reply) || reply.tag == JSON::TAG_ERR) {
+                    result.failed = true;
+                    return;
+                }
+                break;
+            }
+            client.append_req({"multi"});
+            client.append_req(set);
+            client.append_req({"exec"});
+            if (client.flush() || client.read_res(reply) || client.read_res(reply) || client.read_res(reply)
+                    || reply.tag == JSON::TAG_ERR) {
+                result.failed = true;
+                return;
+            }
+            done = reply.tag == JSON::TAG_ARR;     // nil when a counter changed under us
+            result.misses += !done;
+        }
+        result.latencies_us.push_back(now_us() - start);
+        result.hits++;
+    }
+}
+
+// one phase of bench_txn on counters reset to 0, one row of results
+static bool txn_phase(const BenchOptions& opts, RedisClient& client, const char* name, bool optimistic) {
+    std::vector<std::string> cmd = {"msetex", "3600000"};
+    for (size_t i = 0; i < opts.keyspace; i++) {
+        cmd.push_back(txn_key(i));
+        cmd.push_back("0");
+    }
+    Reply reply;
+    if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+        fprintf(stderr, "cannot reset the counters\n");
+        return false;
+    }
+    uint64_t start = now_us();
+    std::vector<BenchResult> results(opts.clients);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < opts.clients; i++) {
+        threads.emplace_back(run_txn_client, std::cref(opts), i, optimistic, std::ref(results[i]));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    uint64_t elapsed = now_us() - start;
+    std::vector<uint64_t> latencies;
+    uint64_t increments = 0, retries = 0;
+    for (BenchResult& r : results) {
+        if (r.failed) {
+            fprintf(stderr, "a client failed\n");
+            return false;
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        increments += r.hits;
+        retries += r.misses;
+    }
+    cmd.assign(1, "get");
+    for (size_t i = 0; i < opts.keyspace; i++) {
+        cmd.push_back(txn_key(i));
+    }
+    if (client.call(cmd, reply) || reply.tag != JSON::TAG_ARR) {
+        fprintf(stderr, "cannot read the counters\n");
+        return false;
+    }
+    int64_t total = 0;
+    for (Reply& r : reply.arr) {
+        int64_t value = 0;
+        total += reply_int(r, value) ? value : 0;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-22s %12.0f %8llu %8llu %10.3f %10lld\n", name, increments / (elapsed / 1e6),
+        (unsigned long long)percentile(latencies, 0.50), (unsigned long long)percentile(latencies, 0.99),
+        increments ? (double)retries / increments : 0.0, (long long)increments - total);
+    return true;
+}
+
+// Read-modify-write increments from -c clients over -k counters (a small
+// -k for contention), racing with get and set and then made safe with
+// watch and multi/exec. Reports the increment rate and latency, the exec
+// retries per increment and the increments lost to races, which should
+// only be nonzero for the first phase.
+static int bench_txn(const BenchOptions& opts) {
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        return 1;
+    }
+    printf("== txn: %zu clients x %zu increments of %zu counters\n", opts.clients, opts.requests, opts.keyspace);
+    printf("%-22s %12s %8s %8s %10s %10s\n", "phase", "incr/s", "p50 us", "p99 us", "retries", "lost");
+    bool ok = txn_phase(opts, client, "get + set", false)
+        && txn_phase(opts, client, "watch + multi/exec", true);
+    print_server_info(opts, {"transactions_executed", "transactions_aborted"});
+    return ok ? 0 : 1;
+}
+
+// Times ops operations, each a run of calls made by op(i, client) that
+// returns the number of calls it made or -1 on failure, and prints a row.
+template <typename Op>
+static bool compound_phase(RedisClient& client, const char* name, size_t ops, Op op) {
+    std::vector<uint64_t> latencies;
+    latencies.reserve(ops);
+    size_t calls = 0;
+    uint64_t start = now_us();
+    for (size_t i = 0; i < ops; i++) {
+        uint64_t op_start = now_us();
+        int32_t n = op(i, client);
+        if (n < 0) {
+            fprintf(stderr, "%s failed\n", name);
+            return false;
+        }
+        calls += (size_t)n;
+        latencies.push_back(now_us() - op_start);
+    }
+    uint64_t elapsed = now_us() - start;
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-24s %10.0f %8llu %8llu %10.2f\n", name, ops / (elapsed / 1e6),
+        (unsigned long long)percentile(latencies, 0.50), (unsigned long long)percentile(latencies, 0.99),
+        (double)calls / ops);
+    return true;
+}
+
+static std::string compound_key(const char* prefix, size_t i) {
+    return std::string(prefix) + std::to_string(i);
+}
+
+// Three patterns that took several commands before set had options and
+// getex/getdel existed, each done the old way and the new way by one
+// client: take a key if it is free with a ttl (get, then set on a miss;
+// set nx px), pop a value (get then del; getdel) and store a key without a
+// ttl (set then persist; set persist). Reports ops/s, latency and calls per op.
+static int bench_compound(const BenchOptions& opts) {
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        return 1;
+    }
+    std::string value(opts.value_size, 'x');
+    size_t ops = opts.requests;
+    Reply reply;
+    auto preload = [&](const char* prefix) {
+        for (size_t base = 0; base < ops; base += 1000) {
+            std::vector<std::string> cmd = {"msetex", "3600000"};
+            for (size_t i = base; i < std::min(ops, base + 1000); i++) {
+                cmd.push_back(compound_key(prefix, i));
+                cmd.push_back(value);
+            }
+            if (client.call(cmd, reply) || reply.tag == JSON::TAG_ERR) {
+                return false;
+            }
+        }
+        return true;
+    };
+    printf("== compound: %zu ops of each kind, value=%zuB\n", ops, opts.value_size);
+    printf("%-24s %10s %8s %8s %10s\n", "op", "ops/s", "p50 us", "p99 us", "calls/op");
+    bool ok = compound_phase(client, "get, set if missing", ops, [&](size_t i, RedisClient& c) {
+            std::string key = compound_key("cmp:lock:a:", i);
+            if (c.call({"get", key}, reply) || reply.tag != JSON::TAG_ARR || reply.arr.size() != 1) {
+                return -1;
+            }
+            if (reply.arr[0].tag != JSON::TAG_ERR) {
+                return 1;
+            }
+            return c.call({"set", key, value, "30000"}, reply) || reply.tag == JSON::TAG_ERR ? -1 : 2;
+        })
+        && compound_phase(client, "set nx px", ops, [&](size_t i, RedisClient& c) {
+            std::string key = compound_key("cmp:lock:b:", i);
+            return c.call({"set", key, value, "nx", "px", "30000"}, reply) || reply.tag != JSON::TAG_NIL ? -1 : 1;
+        })
+        && preload("cmp:pop:a:")
+        && compound_phase(client, "get, del", ops, [&](size_t i, RedisClient& c) {
+            std::string key = compound_key("cmp:pop:a:", i);
+            if (c.call({"get", key}, reply) || reply.tag != JSON::TAG_ARR) {
+                return -1;
+            }
+            return c.call({"del", key}, reply) || reply.tag == JSON::TAG_ERR ? -1 : 2;
+        })
+        && preload("cmp:pop:b:")
+        && compound_phase(client, "getdel", ops, [&](size_t i, RedisClient& c) {
+            std::string key = compound_key("cmp:pop:b:", i);
+            return c.call({"getdel", key}, reply) || reply.tag != JSON::TAG_STR ? -1 : 1;
+        })
+        && compound_phase(client, "set, persist", ops, [&](size_t i, RedisClient& c) {
+            std::string key = compound_key("cmp:keep:a:", i);
+            if (c.call({"set", key, value}, reply) || reply.tag == JSON::TAG_ERR) {
+                return -1;
+            }
+            return c.call({"persist", key}, reply) || reply.tag == JSON::TAG_ERR ? -1 : 2;
+        })
+        && compound_phase(client, "set persist", ops, [&](size_t i, RedisClient& c) {
+            std::string key = compound_key("cmp:keep:b:", i);
+            return c.call({"set", key, value, "persist"}, reply) || reply.tag == JSON::TAG_ERR ? -1 : 1;
+        });
+    for (const char* prefix : {"cmp:lock:a:", "cmp:lock:b:", "cmp:keep:a:", "cmp:keep:b:"}) {
+        std::vector<std::string> cmd = {"unlink"};
+        for (size_t i = 0; i < ops; i++) {
+            cmd.push_back(compound_key(prefix, i));
+        }
+        client.call(cmd, reply);
+    }
+    return ok ? 0 : 1;
+}
+
+// the byte at offset i of the values of bench_stream
+static char stream_byte(uint64_t i) {
+    return (char)((i * 2654435761u) >> 13);
+}
+
+// Large values: a k_big_value byte value goes up with stream_put and comes
+// back with stream_get (checked byte for byte) while the client generates
+// and checks it on the fly, so its memory stays at a few chunks. Then an
+// k_built_value byte value is built from k_piece byte pieces by rewriting
+// it whole each time (get, then set) and by append, and -n random 4 KB
+// pieces of the large value are overwritten with setrange and read with
+// getrange.
+static int bench_stream(const BenchOptions& opts) {
+    static const uint64_t k_big_value = 256 << 20;
+    static const size_t k_built_value = 8 << 20;
+    static const size_t k_piece = 64 << 10;
+    static const size_t k_patch = 4096;
+    RedisClient client;
+    if (!connect_client(opts, client)) {
+        return 1;
+    }
+    printf("== stream: %llu MB in %zu KB chunks, %zu in flight\n", (unsigned long long)(k_big_value >> 20),
+        k_stream_chunk >> 10, k_stream_window);
+    uint64_t sent = 0;
+    uint64_t total = 0;
+    std::string err;
+    uint64_t start = now_us();
+    int32_t rv = stream_put(client, "stream:big", [&](char* buf, size_t cap) {
+        size_t n = (size_t)std::min((uint64_t)cap, k_big_value - sent);
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = stream_byte(sent + i);
+        }
+        sent += n;
+        return n;
+    }, total, err);
+    uint64_t elapsed = now_us() - start;
+    if (rv) {
+        fprintf(stderr, "upload failed: %s\n", err.c_str());
+        return 1;
+    }
+    printf("upload:      %.0f MB/s\n", total / 1048576.0 / (elapsed / 1e6));
+    uint64_t received = 0;
+    bool same = true;
+    start = now_us();
+    rv = stream_get(client, "stream:big", [&](const char* data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            same = same && data[i] == stream_byte(received + i);
+        }
+        received += len;
+        return true;
+    }, total, err);
+    elapsed = now_us() - start;
+    if (rv || !same || total != k_big_value) {
+        fprintf(stderr, "download failed or differs: %s\n", err.c_str());
+        return 1;
+    }
+    printf("download:    %.0f MB/s\n", total / 1048576.0 / (elapsed / 1e6));
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("client max rss: %ld KB\n", usage.ru_maxrss);
+
+    Reply reply;
+    std::string piece(k_piece, 'x');
+    client.call({"unlink", "stream:built"}, reply);
+    start = now_us();
+    std::string value;
+    for (size_t len = 0; len < k_built_value; len += k_piece) {
+        if (client.call({"get", "stream:built"}, reply) || reply.tag != JSON::TAG_ARR) {
+            return 1;
+        }
+        value = reply.arr[0].tag == JSON::TAG_STR ? reply.arr[0].str : "";
+        value += piece;
+        if (client.call({"set", "stream:built", value}, reply) || reply.tag == JSON::TAG_ERR) {
+            return 1;
+        }
+    }
+    uint64_t rewrite_us = now_us() - start;
+    client.call({"unlink", "stream:built"}, reply);
+    start = now_us();
+    for (size_t len = 0; len < k_built_value; len += k_piece) {
+        if (client.call({"append", "stream:built", piece}, reply) || reply.tag != JSON::TAG_INT) {
+            return 1;
+        }
+    }
+    uint64_t append_us = now_us() - start;
+    printf("build %zu MB from %zu KB pieces: get + set %.1f ms, append %.1f ms\n", k_built_value >> 20,
+        k_piece >> 10, rewrite_us / 1e3, append_us / 1e3);
+
+    std::mt19937_64 rng(1);
+    std::string patch(k_patch, 'p');
+    size_t calls = std::min(opts.requests, (size_t)100000);
+    uint64_t setrange_us = 0, getrange_us = 0;
+    for (size_t i = 0; i < calls; i++) {
+        std::string offset = std::to_string(rng() % (k_big_value - k_patch));
+        uint64_t call_start = now_us();
+        if (client.call({"setrange", "stream:big", offset, patch}, reply) || reply.tag != JSON::TAG_INT) {
+            return 1;
+        }
+        setrange_us += now_us() - call_start;
+        call_start = now_us();
+        std::string last = std::to_string(std::stoull(offset) + k_patch - 1);
+        if (client.call({"getrange", "stream:big", offset, last}, reply) || reply.str != patch) {
+            fprintf(stderr, "getrange did not return the patch\n");
+            return 1;
+        }
+        getrange_us += now_us() - call_start;
+    }
+    printf("4 KB patches: setrange %.0f ops/s, getrange %.0f ops/s\n", calls / (setrange_us / 1e6),
+        calls / (getrange_us / 1e6));
+    print_server_info(opts, {"used_memory", "client_buffer_bytes"});
+    client.call({"unlink", "stream:big", "stream:built"}, reply);
+    return 0;
+}
+
+static int bench_zipf(const BenchOptions& opts) {
+    ZipfGenerator zipf(opts.keyspace, opts.zipf_theta);
+    std::vector<BenchResult> results(opts.clients);
+    std::vector<std::thread> threads;
+    uint64_t start = now_us();
+    for (size_t i = 0; i < opts.clients; i++) {
+        threads.emplace_back(run_zipf_client, std::cref(opts), std::cref(zipf), i, std::ref(results[i]));
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    uint64_t elapsed = now_us() - start;
+
+    std::vector<uint64_t> latencies;
+    uint64_t hits = 0, misses = 0;
+    for (BenchResult& r : results) {
+        if (r.failed) {
+            fprintf(stderr, "a client failed\n");
+            return 1;
+        }
+        latencies.insert(latencies.end(), r.latencies_us.begin(), r.latencies_us.end());
+        hits += r.hits;
+        misses += r.misses;
+    }
+    printf("== zipf cache-aside: keyspace=%zu theta=%.2f value=%zuB clients=%zu\n",
+        opts.keyspace, opts.zipf_theta, opts.value_size, opts.clients);
+    print_latencies(latencies, elapsed);
+    printf("hit ratio:   %.2f%% (%llu hits, %llu misses)\n",
+        hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+        (unsigned long long)hits, (unsigned long long)misses);
+    print_server_info(opts, {"used_memory", "maxmemory", "maxmemory_policy", "evicted_keys"});
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        const char* flag = argv[i];
+        const char* val = argv[i + 1];
+        if (!strcmp(flag, "-h")) {
+            opts.host = val;
+        } else if (!strcmp(flag, "-p")) {
+            opts.port = (uint16_t)atoi(val);
+        } else if (!strcmp(flag, "-u")) {
+            opts.unix_path = val;
+        } else if (!strcmp(flag, "-N")) {
+            opts.nodes = val;
+        } else if (!strcmp(flag, "-r")) {
+            opts.reader_port = (uint16_t)atoi(val);
+        } else if (!strcmp(flag, "-c")) {
+            opts.clients = std::max(1, atoi(val));
+        } else if (!strcmp(flag, "-n")) {
+            opts.requests = (size_t)atoll(val);
+        } else if (!strcmp(flag, "-k")) {
+            opts.keyspace = std::max(2LL, atoll(val));
+        } else if (!strcmp(flag, "-d")) {
+            opts.value_size = (size_t)atoll(val);
+        } else if (!strcmp(flag, "-s")) {
+            opts.zipf_theta = atof(val);
+        } else {
+            usage();
+        }
+    }
+    if (i + 1 != argc) {
+        usage();
+    }
+    std::string workload = argv[i];
+    if (workload == "zipf") {
+        if (opts.zipf_theta <= 0 || opts.zipf_theta >= 1) {
+            usage();
+        }
+        return bench_zipf(opts);
+    }
+    if (workload == "mget") {
+        return bench_mget(opts);
+    }
+    if (workload == "zset") {
+        return bench_zset(opts);
+    }
+    if (workload == "mixed") {
+        return bench_mixed(opts);
+    }
+    if (workload == "transport") {
+        return bench_transport(opts);
+    }
+    if (workload == "readers") {
+        return bench_readers(opts);
+    }
+    if (workload == "pubsub") {
+        return bench_pubsub(opts);
+    }
+    if (workload == "bitmap") {
+        return bench_bitmap(opts);
+    }
+    if (workload == "bloom") {
+        return bench_bloom(opts);
+    }
+    if (workload == "tiered") {
+        return bench_tiered(opts);
+    }
+    if (workload == "router") {
+        return bench_router(opts);
+    }
+    if (workload == "cluster") {
+        return bench_cluster(opts);
+    }
+    if (workload == "txn") {
+        return bench_txn(opts);
+    }
+    if (workload == "compound") {
+        return bench_compound(opts);
+    }
+    if (workload == "stream") {
+        return bench_stream(opts);
+    }
+    usage();
+}
@@ -1,163 +1,48 @@
-#include <assert.h>
 #include <cstdint>
 #include <cstdio>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <errno.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <netinet/ip.h>
+#include <iostream>
 #include <string>
 #include <vector>
-#include "headers/UtilTypes.h"
+#include "headers/RedisClient.h"
+#include "headers/Router.h"
 
 
-const size_t k_max_msg = 32<<10;
-
 static void msg(const char *msg) {
     fprintf(stderr, "%s\n", msg);
 }
 
-static void die(const char *msg) {
-    int err = errno;
-    fprintf(stderr, "[%d] %s\n", err, msg);
-    abort();
-}
-
-static int32_t read_full(int fd, char *buf, size_t n) {
-    while (n > 0) {
-        ssize_t rv = read(fd, buf, n);
-        if (rv <= 0) {
-            return -1;  // error, or unexpected EOF
-        }
-        assert((size_t)rv <= n);
-        n -= (size_t)rv;
-        buf += rv;
-    }
-    return 0;
-}
-
-static int32_t write_all(int fd, const char *buf, size_t n) {
-    while (n > 0) {
-        ssize_t rv = write(fd, buf, n);
-        if (rv <= 0) {
-            return -1;  // error
-        }
-        assert((size_t)rv <= n);
-        n -= (size_t)rv;
-        buf += rv;
-    }
-    return 0;
-}
-
-
-static int32_t send_req(int fd, const std::vector<std::string> &cmd) {
-    uint8_t wbuf[k_max_msg];
-    uint8_t *cur = wbuf;
-
-    *cur++ = (uint8_t)JSON::TAG_ARR;
-
-    uint32_t n = (uint32_t)cmd.size();
-    memcpy(cur, &n, 4);
-    cur += 4;
-
-    for (const std::string &s : cmd) {
-        *cur++ = (uint8_t)JSON::TAG_STR;
-        uint32_t len = (uint32_t)s.size();
-        memcpy(cur, &len, 4);
-        cur += 4;
-        memcpy(cur, s.data(), len);
-        cur += len;
-    }
-
-    size_t payload_len = (size_t)(cur - wbuf);
-    if (payload_len > k_max_msg) {
-        msg("send_req: too big");
-        return -1;
-    }
-
-    // Prepend total length (4 bytes) for TCP framing
-    char final_buf[4 + k_max_msg];
-    memcpy(final_buf, &payload_len, 4);
-    memcpy(final_buf + 4, wbuf, payload_len);
-
-    return write_all(fd, final_buf, 4 + payload_len);
-}
-
-static void decode_response(const uint8_t*& curr, const uint8_t* end) {
-    if (curr >= end) {
-        return;
-    }
-    JSON tag;
-    memcpy(&tag, curr, 1);
-    curr++;
-    switch (tag) {
+static void print_reply(const Reply& reply) {
+    switch (reply.tag) {
         case JSON::TAG_ARR: {
-            if (curr + 4 > end) {
-                msg("decode: bad str len");
-                return;
-            }
-            uint32_t arr_len;
-            memcpy(&arr_len, curr, 4);
-            curr += 4;
-            std::cout << "[array len=" << arr_len << "]" << std::endl;
-            for (uint32_t i = 0; i < arr_len; i++) {
-                decode_response(curr, end);
+            std::cout << "[array len=" << reply.arr.size() << "]" << std::endl;
+            for (const Reply& item : reply.arr) {
+                print_reply(item);
             }
             break;
         }
 
-        case JSON::TAG_ERR: {
-            if (curr + 4 > end) {
-                msg("decode: bad str len");
-                return;
-            }
-            uint32_t err_msg_len;
-            memcpy(&err_msg_len, curr, 4);
-            curr += 4;
-            if (curr + err_msg_len > end) {
-                msg("decode: bad str data");
-                return;
-            }
-            std::cout << "(str) " << std::string((const char*)curr, err_msg_len) << "\n";
-            curr += err_msg_len;
+        case JSON::TAG_ERR:
+        case JSON::TAG_STR: {
+            std::cout << "(str) " << reply.str << "\n";
             break;
         }
 
         case JSON::TAG_INT: {
-            if (curr + 8 > end) {
-                msg("decode: bad str len");
-                return;
-            }
-            int64_t val;
-            memcpy(&val, curr, 8);
-            std::cout << "(int) " << val << std::endl;
-            curr += 8;
+            std::cout << "(int) " << reply.int_val << std::endl;
             break;
         }
 
-        case JSON::TAG_NIL: {
-            std::cout << "(nil)" << std::endl;
+        case JSON::TAG_DBL: {
+            std::cout << "(dbl) " << reply.dbl_val << std::endl;
             break;
         }
 
-        case JSON::TAG_STR: {
-            if (curr + 4 > end) {
-                msg("decode: bad str len");
-                return;
-            }
-            uint32_t str_len;
-            memcpy(&str_len, curr, 4);
-            curr += 4;
-            if (curr + str_len > end) {
-                msg("decode: bad str data");
-                return;
-            }
-            std::cout << "(str) " << std::string((const char*)curr, str_len) << "\n";
-            curr += str_len;
+        case JSON::TAG_NIL: {
+            std::cout << "(nil)" << std::endl;
             break;
         }
         default: {
@@ -167,70 +52,125 @@ static void decode_response(const uint8_t*& curr, const uint8_t* end) {
     }
 }
 
-static int32_t read_res(int fd) {
-    char rbuf[k_max_msg];
-
-    // Read 4-byte length prefix (TCP framing)
-    if (read_full(fd, rbuf, 4)) {
-        msg("read_res: failed to read length");
-        return -1;
+// upload <key> <file> and download <key> <file>: a value of any size to or
+// from a file, "-" for stdin or stdout, in chunks (see stream_put)
+static int stream_file(RedisClient& client, bool upload, const std::string& key, const std::string& path) {
+    bool std_stream = path == "-";
+    FILE* file = std_stream ? (upload ? stdin : stdout) : fopen(path.c_str(), upload ? "rb" : "wb");
+    if (file == nullptr) {
+        perror(path.c_str());
+        return 1;
     }
-
-    uint32_t len = 0;
-    memcpy(&len, rbuf, 4);
-    if (len > k_max_msg) {
-        msg("read_res: too long");
-        return -1;
+    uint64_t total = 0;
+    std::string err;
+    int32_t rv = upload
+        ? stream_put(client, key, [file](char* buf, size_t cap) { return fread(buf, 1, cap, file); }, total, err)
+        : stream_get(client, key, [file](const char* data, size_t len) {
+            return fwrite(data, 1, len, file) == len;
+        }, total, err);
+    if ((!std_stream && fclose(file) != 0) || (std_stream && fflush(file) != 0)) {
+        perror(path.c_str());
+        return 1;
     }
-
-    // Read full payload
-    if (read_full(fd, &rbuf[4], len)) {
-        msg("read_res: failed to read payload");
-        return -1;
+    if (rv) {
+        fprintf(stderr, "%s failed after %llu bytes: %s\n", upload ? "upload" : "download",
+            (unsigned long long)total, err.c_str());
+        return 1;
     }
-
-    const uint8_t *cur = (uint8_t*)&rbuf[4];
-    const uint8_t *end = cur + len;
-
-    std::cout << "Server response:\n";
-    decode_response(cur, end);
-
-    if (cur != end)
-        msg("read_res: trailing bytes after decode");
-
+    fprintf(stderr, "%s %llu bytes\n", upload ? "uploaded" : "downloaded", (unsigned long long)total);
     return 0;
 }
 
-
+// usage: ./client [-h host] [-p port] [-u unix socket path] [-n node,node...] <command> [args...]
+// Options must come before the command; the unix socket wins over TCP. With
+// -n the command goes through a Router over the listed nodes instead, which
+// uses the slot map of the first node if it is in cluster mode. MOVED and
+// ASK redirects of a cluster node are followed. upload and download stream a
+// value between a key and a file and need a single server.
 int main(int argc, char **argv) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        die("socket()");
-    }
-
-    struct sockaddr_in addr = {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(1234);
-    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    int rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
-    if (rv) {
-        die("connect");
+    std::string host = "127.0.0.1";
+    uint16_t port = 1234;
+    const char* unix_path = nullptr;
+    const char* nodes_arg = nullptr;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (!strcmp(argv[i], "-h")) {
+            host = argv[i + 1];
+        } else if (!strcmp(argv[i], "-p")) {
+            port = (uint16_t)atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-u")) {
+            unix_path = argv[i + 1];
+        } else if (!strcmp(argv[i], "-n")) {
+            nodes_arg = argv[i + 1];
+        } else {
+            break;
+        }
     }
 
     std::vector<std::string> cmd;
-    for (int i = 1; i < argc; ++i) {
-        cmd.push_back(argv[i]);
+    for (int j = i; j < argc; ++j) {
+        cmd.push_back(argv[j]);
     }
-    int32_t err = send_req(fd, cmd);
-    if (err) {
-        goto L_DONE;
+    Reply reply;
+    if (nodes_arg != nullptr) {
+        std::vector<RouterNode> nodes;
+        if (!parse_router_nodes(nodes_arg, nodes)) {
+            msg("bad node list");
+            return 1;
+        }
+        if (!cmd.empty() && (cmd[0] == "subscribe" || cmd[0] == "psubscribe"
+                || cmd[0] == "upload" || cmd[0] == "download")) {
+            msg("subscriptions and streams are per server, use -h/-p");
+            return 1;
+        }
+        Router router(nodes);
+        router.load_slots();
+        if (cmd.empty() || router.call(cmd, reply)) {
+            msg("request failed");
+            return 1;
+        }
+        std::cout << "Server response:\n";
+        print_reply(reply);
+        return 0;
     }
-    err = read_res(fd);
+
+    RedisClient client;
+    int32_t err = unix_path != nullptr ? client.connect_unix(unix_path) : client.connect_tcp(host.c_str(), port);
     if (err) {
-        goto L_DONE;
+        msg("connect failed");
+        return 1;
+    }
+    if (cmd.size() == 3 && (cmd[0] == "upload" || cmd[0] == "download")) {
+        return stream_file(client, cmd[0] == "upload", cmd[1], cmd[2]);
+    }
+    if (client.call(cmd, reply)) {
+        msg("request failed");
+        return 1;
+    }
+    for (int hops = 0; hops < 5 && reply.tag == JSON::TAG_ERR; hops++) {
+        // "MOVED <slot> <ip:port>" or "ASK <slot> <ip:port>"
+        bool ask = reply.str.compare(0, 4, "ASK ") == 0;
+        size_t addr = reply.str.find(' ', reply.str.find(' ') + 1);
+        RouterNode node;
+        if ((!ask && reply.str.compare(0, 6, "MOVED ") != 0) || addr == std::string::npos
+                || !parse_router_node(reply.str.substr(addr + 1), node)) {
+            break;
+        }
+        std::cout << "-> redirected to " << reply.str.substr(addr + 1) << "\n";
+        client.close_conn();
+        if (client.connect_tcp(node.host.c_str(), node.port)
+                || (ask && client.call({"asking"}, reply)) || client.call(cmd, reply)) {
+            msg("request failed");
+            return 1;
+        }
+    }
+    std::cout << "Server response:\n";
+    print_reply(reply);
+    if (!cmd.empty() && (cmd[0] == "subscribe" || cmd[0] == "psubscribe")) {
+        // the other confirmations and then the messages, until the server hangs up
+        while (client.read_res(reply) == 0) {
+            print_reply(reply);
+        }
     }
-
-L_DONE:
-    close(fd);
     return 0;
 }
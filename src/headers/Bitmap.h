@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Bit level operations on string values. As in Redis, bit 0 is the most
+// significant bit of the first byte, and a string reads as zero bits past its
+// end. The loops over whole bitmaps have an AVX2 version, used when the CPU
+// has it, and a portable one working 64 bits at a time.
+
+// offsets go up to 2^32 - 1, a 512 MB value
+const uint64_t k_bitmap_max_bits = (uint64_t)1 << 32;
+
+enum BitOp {
+    BITOP_AND = 0,
+    BITOP_OR = 1,
+    BITOP_XOR = 2,
+};
+
+// the number of set bits among bits [first, last] of data
+uint64_t bitmap_count(const uint8_t* data, uint64_t first, uint64_t last);
+
+// the position of the first bit equal to bit among [first, last], or -1
+int64_t bitmap_find(const uint8_t* data, uint64_t first, uint64_t last, int bit);
+
+// dst[i] = dst[i] op src[i] for the first n bytes
+void bitmap_combine(BitOp op, uint8_t* dst, const uint8_t* src, size_t n);
+
+// flips the first n bytes of dst
+void bitmap_not(uint8_t* dst, size_t n);
+
+// Switches between the vector and the portable loops, for comparing them.
+// Vector loops are only used when the CPU has AVX2 either way.
+void bitmap_use_simd(bool enable);
+
+// the loops in use, "avx2" or "scalar"
+const char* bitmap_impl();
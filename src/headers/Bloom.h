@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scalable Bloom filter for membership checks at about 10 bits per item.
+//
+// Each layer is a split block Bloom filter, as in Parquet and Impala: the
+// hash of an item picks one 32 byte block and sets or tests one bit in each
+// of its eight 32 bit words. Blocks are aligned, so a probe touches a single
+// cache line whatever the error rate; the error rate only sets how many
+// blocks there are.
+//
+// Like in RedisBloom, a filter that reached its capacity grows by another
+// layer, expansion times larger and with half the error rate, which keeps
+// the overall error rate below twice the one asked for. A non scaling filter
+// refuses new items instead. Lookups probe every layer.
+const double k_bloom_default_error_rate = 0.01;
+const uint64_t k_bloom_default_capacity = 100;
+const uint32_t k_bloom_default_expansion = 2;
+const size_t k_bloom_max_layer_bytes = (size_t)1 << 30;
+
+struct BloomBlock {
+    uint32_t words[8];
+};
+
+struct BloomLayer {
+    void* alloc = nullptr;          // what blocks was carved out of
+    BloomBlock* blocks = nullptr;   // cache line aligned
+    uint64_t num_blocks = 0;
+    uint64_t capacity = 0;
+    uint64_t items = 0;
+};
+
+// bytes of a layer holding capacity items at this error rate
+size_t bloom_layer_bytes(double error_rate, uint64_t capacity);
+
+class BloomFilter {
+private:
+    std::vector<BloomLayer> layers;
+    double error_rate;          // of the newest layer
+    uint32_t expansion;         // 0 for a non scaling filter
+    uint64_t items = 0;
+    size_t bytes = 0;           // of all layers
+
+private:
+    BloomFilter(double error_rate, uint32_t expansion) : error_rate(error_rate), expansion(expansion) {}
+
+    bool add_layer(uint64_t capacity, double error_rate);
+
+public:
+    // error_rate in (0, 1), and a first layer that fits k_bloom_max_layer_bytes
+    BloomFilter(double error_rate, uint64_t capacity, uint32_t expansion);
+
+    ~BloomFilter();
+
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    static uint64_t hash(const uint8_t* data, size_t len);
+
+    // Adds the items with these hashes. results[i] is 1 if item i was not in
+    // the filter, 0 if it may have been and -1 if the filter is full. Blocks
+    // are prefetched a group of items ahead so that their misses overlap.
+    void add(const uint64_t* hashes, size_t n, int* results);
+
+    // results[i] is 1 if item i may be in the filter, 0 if it is not
+    void contains(const uint64_t* hashes, size_t n, int* results);
+
+    size_t mem_usage() {
+        return sizeof(BloomFilter) + layers.capacity() * sizeof(BloomLayer) + bytes;
+    }
+
+    // items the layers were sized for
+    uint64_t capacity();
+
+    // items added, not counting those that were found already
+    uint64_t size() {
+        return items;
+    }
+
+    size_t num_layers() {
+        return layers.size();
+    }
+
+    uint32_t expansion_rate() {
+        return expansion;
+    }
+
+    // the filter as bytes, for dump and restore
+    void serialize(std::string& out);
+
+    // a filter from serialize(), nullptr if data is not one
+    static BloomFilter* deserialize(const char* data, size_t len);
+};
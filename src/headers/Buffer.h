@@ -1,6 +1,22 @@
 #pragma  once
 #include <string>
 #include <iostream>
+#include <vector>
+
+// Storage for buffers of up to k_buffer_chunk_size bytes comes from a per
+// thread free list of fixed size chunks, so connections that only ever exchange small
+// messages reuse the same few chunks instead of each keeping a heap array.
+// Larger buffers are plain heap arrays. At most k_buffer_pool_max_free chunks
+// are kept around, the rest go back to the allocator.
+const size_t k_buffer_chunk_size = 16 * 1024;
+const size_t k_buffer_pool_max_free = 1024;
+
+struct BufferPoolStats {
+    size_t chunks_in_use = 0;
+    size_t chunks_free = 0;
+};
+
+BufferPoolStats buffer_pool_stats();
 
 class Buffer {
 public:
@@ -10,25 +26,47 @@ public:
     uint8_t* buffer_end;
 
 private:
-    void resize();
+    void resize(size_t min_capacity);
+
+    void release_storage();
 
     void msg(const std::string& s);
 
 public:
-    Buffer() : buffer_begin(nullptr), data_begin(nullptr), data_end(nullptr), buffer_end(nullptr) 
+    Buffer() : buffer_begin(nullptr), data_begin(nullptr), data_end(nullptr), buffer_end(nullptr)
     {
     }
 
     ~Buffer() {
-        delete[] buffer_begin;
+        release_storage();
     }
 
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
     void buffer_consume(int n);
 
     void buffer_append(const uint8_t *new_data, int n);
 
+    // makes room for at least n bytes after data_end, for reading into the
+    // buffer directly; commit() then accounts for the bytes written there
+    uint8_t* reserve(size_t n);
+
+    void commit(size_t n) {
+        data_end += n;
+    }
+
+    // gives the storage back once the buffer is empty and shrinks a mostly
+    // empty heap buffer, so a connection that once moved a large value does
+    // not keep that much memory for the rest of its life
+    void shrink();
+
     int size();
 
     bool empty();
-};
 
+    // bytes allocated, including the unused head and tail room
+    size_t capacity() {
+        return buffer_end - buffer_begin;
+    }
+};
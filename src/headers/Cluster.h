@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Cluster mode: the keys are spread over k_cluster_slots hash slots, each
+// owned by one server. A key's slot is CRC16 of the key, or of its first
+// non-empty {tag}, modulo 16384, as in Redis Cluster, so keys sharing a tag
+// share a slot and cluster aware Redis clients agree on where a key goes.
+//
+// A server serves the slots it owns and answers commands on other keys with
+// "MOVED <slot> <ip:port>" naming the owner. A slot moves to another server
+// while being served: the target marks it importing, the source marks it
+// migrating and then hands its keys over a batch at a time with `migrate`.
+// Meanwhile the source still serves the keys it has, and sends commands on
+// keys it no longer has to the target with "ASK <slot> <ip:port>", which
+// the target only accepts right after an `asking`. Once the source has no
+// keys left in it the slot is given to the target on both.
+//
+// There is no gossip between the servers: the slot map is the one the
+// servers were told with `cluster addslots` and `cluster setslot`, and a
+// tool moving slots tells every server.
+const uint32_t k_cluster_slots = 16384;
+const size_t k_cluster_max_nodes = 1024;
+
+uint16_t key_hash_slot(const char* key, size_t len);
+
+struct ClusterNode {
+    std::string ip;
+    uint16_t port = 0;
+    std::string addr;   // "ip:port", how the node is named in commands and redirects
+};
+
+// what to do with a command on a slot
+enum SlotRoute {
+    SLOT_SERVE,         // ours
+    SLOT_MIGRATING,     // ours, but keys we do not have are asked of the target
+    SLOT_MOVED,         // another node's
+    SLOT_UNASSIGNED,    // nobody's
+};
+
+// The slot map. The event loop changes it, reader threads read it without
+// locks: nodes are only ever appended and a node is fully written before a
+// slot can refer to it.
+class ClusterState {
+private:
+    std::unique_ptr<ClusterNode[]> nodes;   // nodes[0] is this server
+    std::atomic<size_t> num_nodes{0};
+    std::unique_ptr<std::atomic<int16_t>[]> owner;          // node per slot, -1 for none
+    std::unique_ptr<std::atomic<int16_t>[]> migrating_to;   // -1 when not migrating
+    std::unique_ptr<int16_t[]> importing_from;              // event loop only
+    size_t slots_owned = 0;
+
+public:
+    ClusterState() = default;
+
+    ClusterState(const ClusterState&) = delete;
+    ClusterState& operator=(const ClusterState&) = delete;
+
+    void init(const std::string& ip, uint16_t port);
+
+    bool enabled() const {
+        return nodes != nullptr;
+    }
+
+    // the node named addr ("ip:port"), added if unknown; -1 if addr is not
+    // an address or there is no room for another node
+    int16_t node_index(const std::string& addr);
+
+    const ClusterNode& node(int16_t idx) const {
+        return nodes[idx];
+    }
+
+    size_t known_nodes() const {
+        return num_nodes.load(std::memory_order_acquire);
+    }
+
+    int16_t slot_owner(uint16_t slot) const {
+        return owner[slot].load(std::memory_order_acquire);
+    }
+
+    int16_t slot_migrating_to(uint16_t slot) const {
+        return migrating_to[slot].load(std::memory_order_acquire);
+    }
+
+    int16_t slot_importing_from(uint16_t slot) const {
+        return importing_from[slot];
+    }
+
+    // the node to redirect to comes back in node for SLOT_MOVED and
+    // SLOT_MIGRATING. asking serves an importing slot.
+    SlotRoute route(uint16_t slot, bool asking, int16_t& node) const;
+
+    // gives the slot to node and ends any migration of it
+    void set_owner(uint16_t slot, int16_t node);
+
+    void set_migrating(uint16_t slot, int16_t node);
+
+    void set_importing(uint16_t slot, int16_t node);
+
+    size_t owned() const {
+        return slots_owned;
+    }
+
+    size_t migrating() const;
+
+    size_t importing() const;
+};
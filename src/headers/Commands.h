@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The commands the server knows. The request handlers still check their
+// exact arguments; the table is what the rest of the server learns about a
+// command without running it: whether it exists and takes that many
+// arguments (multi checks the commands it queues), where its keys are
+// (cluster routing and watch) and whether it writes them (watch).
+
+enum CommandFlag {
+    CMD_WRITE = 1,          // changes or deletes its keys
+    CMD_WRITE_FIRST = 2,    // changes only the first key, the destination of pfmerge and bitop
+    CMD_RESP_ONLY = 4,      // answered by do_resp_request alone
+    CMD_TRANSACTION = 8,    // run by do_transaction_command, never queued
+};
+
+// Argument counts include the name, max_args 0 for no limit. The keys are
+// cmd[first_key], cmd[first_key + key_step], ... up to cmd[last_key], or up
+// to the end when last_key is -1; first_key 0 for none, as in Redis's
+// command table.
+struct CommandSpec {
+    const char* name;
+    uint8_t min_args;
+    uint8_t max_args;
+    uint8_t first_key;
+    int8_t last_key;
+    uint8_t key_step;
+    uint8_t flags;
+};
+
+// nullptr for a command the server does not know
+const CommandSpec* command_spec(const std::string& name);
+
+// The key arguments of a command: cmd[first], cmd[first + step], ... up to
+// but not including cmd[end]. False for commands without keys.
+bool command_keys(const std::vector<std::string>& cmd, size_t& first, size_t& end, size_t& step);
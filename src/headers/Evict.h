@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum EvictionPolicy {
+    EVICT_NOEVICTION = 0,   // refuse writes once maxmemory is reached
+    EVICT_ALLKEYS_LRU = 1,  // evict the (approximately) least recently used key
+    EVICT_ALLKEYS_LFU = 2,  // evict the (approximately) least frequently used key
+    EVICT_VOLATILE_TTL = 3, // evict the key with the nearest expire time
+};
+
+bool parse_eviction_policy(const std::string& name, EvictionPolicy& out);
+const char* eviction_policy_name(EvictionPolicy policy);
+
+// Every Entry carries a 24 bit `lru` field. Under the LRU policies it holds a
+// clock with 100ms resolution (wraps after ~19 days), under LFU the top 16 bits
+// hold the last decrement time in minutes and the low 8 bits a logarithmic
+// access counter.
+const uint32_t k_lru_bits = 24;
+const uint32_t k_lru_clock_max = (1 << k_lru_bits) - 1;
+const uint32_t k_lru_clock_resolution_ms = 100;
+const uint8_t k_lfu_init_val = 5;
+const uint32_t k_lfu_log_factor = 10;
+const uint32_t k_lfu_decay_minutes = 1;
+
+uint32_t lru_clock();
+uint64_t lru_idle_ms(uint32_t lru);
+// time since the last access under LFU, to the minute
+uint64_t lfu_idle_ms(uint32_t lru);
+
+uint32_t lfu_init();
+uint32_t lfu_touch(uint32_t lru);
+uint8_t lfu_decayed_counter(uint32_t lru);
+
+struct EvictionCandidate {
+    uint64_t idle = 0;  // higher is a better candidate
+    std::string key;
+};
+
+// Small pool of the best eviction candidates seen across sampling rounds, kept
+// sorted by ascending idle score. Keys are copied so that a candidate deleted
+// by someone else in the meantime is simply skipped when popped.
+class EvictionPool {
+private:
+    static const size_t k_pool_size = 16;
+    EvictionCandidate pool[k_pool_size];
+    size_t count = 0;
+
+public:
+    void insert(uint64_t idle, const std::string& key);
+
+    bool pop_best(std::string& key);
+
+    void clear() {
+        count = 0;
+    }
+};
@@ -15,6 +15,11 @@ private:
     size_t mask = 0; 
     size_t cap = 0;
     const float max_load_factor = 0.75;
+    static const size_t k_batch_group = 16;
+    static const size_t k_random_walk = 1024;     // buckets hm_random looks at before giving up
+    // when set, old bucket arrays are handed over instead of deleted on resize
+    void (*retire_buckets)(HNode** buckets, size_t cap, void* arg) = nullptr;
+    void* retire_arg = nullptr;
 
 private:
     HNode** h_lookup(HNode* node, bool (*eq)(HNode*, HNode*));
@@ -23,13 +28,59 @@ private:
 
     void h_insert(HNode* node);
 
-    void h_resize();
+    void h_resize(size_t new_cap);
 public:
     HTable(size_t size);
 
+    ~HTable() {
+        delete [] htable;
+    }
+
+    HTable(const HTable&) = delete;
+    HTable& operator=(const HTable&) = delete;
+
     HNode* hm_delete(HNode* target, bool (*eq)(HNode*, HNode*));
 
     HNode* hm_lookup(HNode* target, bool (*eq)(HNode*, HNode*));
 
     void hm_insert(HNode* new_node);
+
+    void hm_reserve(size_t n);
+
+    void hm_lookup_batch(HNode** targets, size_t n, bool (*eq)(HNode*, HNode*), HNode** out);
+
+    // a random node, or nullptr when the table is empty or too sparse to
+    // find one quickly
+    HNode* hm_random();
+
+    size_t hm_scan(size_t cursor, void (*fn)(HNode*, void*), void* arg);
+
+    // exchanges the contents of two tables, O(1)
+    void hm_swap(HTable& other);
+
+    // For tables that reader threads walk without locks: the old bucket array
+    // of a resize goes to fn, which must keep it alive until no reader can
+    // still be in it. Stays with this table across hm_swap.
+    void hm_set_retire(void (*fn)(HNode** buckets, size_t cap, void* arg), void* arg) {
+        retire_buckets = fn;
+        retire_arg = arg;
+    }
+
+    // the bucket array and its mask for a lock-free reader; the pair is only
+    // consistent when no write happened while they were read
+    HNode** hm_buckets() {
+        return htable;
+    }
+
+    size_t hm_mask() {
+        return mask;
+    }
+
+    size_t hm_size() {
+        return size;
+    }
+
+    size_t hm_mem_usage() {
+        return cap * sizeof(HNode*);
+    }
 };
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// HyperLogLog cardinality estimates kept in an ordinary string value, in the
+// layout Redis uses: a 16 byte header ("HYLL", the encoding, a cached
+// cardinality) and then the registers, 2^14 of them with 6 bits each for a
+// standard error of 1.04 / sqrt(2^14) = 0.81%.
+//
+// - sparse: runs of equal registers as 1 or 2 byte opcodes, a few hundred
+//   bytes for small sets. Promoted to dense past k_hll_sparse_max_bytes or
+//   once a register needs more than 5 bits.
+// - dense: the registers bit packed, 12 KB. Its size never changes, so it
+//   can be updated in place.
+const size_t k_hll_precision = 14;
+const size_t k_hll_registers = (size_t)1 << k_hll_precision;
+const size_t k_hll_header_size = 16;
+const size_t k_hll_dense_size = k_hll_header_size + k_hll_registers * 6 / 8;
+const size_t k_hll_sparse_max_bytes = 3000;
+
+// true if s holds a well-formed HyperLogLog of either encoding
+bool hll_valid(const std::string& s);
+
+bool hll_is_dense(const std::string& hll);
+
+// an empty HyperLogLog, sparse
+std::string hll_new();
+
+// Counts an element, returns true if a register changed.
+bool hll_add(std::string& hll, const uint8_t* data, size_t len);
+
+// The estimated cardinality. The result is cached in the header until the
+// next change, which is why hll is not const.
+uint64_t hll_count(std::string& hll);
+
+// Raises each of the k_hll_registers bytes in regs to the register of hll,
+// the union of the two sets.
+void hll_merge(uint8_t* regs, const std::string& hll);
+
+// estimated cardinality of unpacked registers, e.g. the result of hll_merge
+uint64_t hll_count_registers(const uint8_t* regs);
+
+// a dense HyperLogLog holding the unpacked registers
+std::string hll_from_registers(const uint8_t* regs);
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Always-on hot key tracking. A random sample of the key accesses, about one
+// in sample_rate, goes into a count-min sketch with conservative update, and
+// the keys with the highest estimates are kept in a small min-heap. Every
+// k_hotkeys_decay_ms all counts are halved, so the estimates follow the
+// current access rate and a key that cooled down drops out of the heap.
+const size_t k_hotkeys_depth = 4;
+const size_t k_hotkeys_width = 2048;    // counters per row, a power of two
+const size_t k_hotkeys_top = 32;
+const uint64_t k_hotkeys_decay_ms = 2000;
+const uint64_t k_hotkeys_clock_every = 64;    // samples between decay checks
+const uint32_t k_hotkeys_default_sample_rate = 16;
+
+struct HotKey {
+    std::string key;
+    uint64_t hash_code = 0;
+    uint32_t count = 0;     // decayed estimate of sampled accesses
+};
+
+struct HotKeyRate {
+    std::string key;
+    double per_sec = 0;     // estimated accesses per second
+};
+
+class HotKeys {
+private:
+    uint32_t sketch[k_hotkeys_depth][k_hotkeys_width] = {};
+    std::vector<HotKey> heap;           // min-heap on count
+    uint32_t sample_rate = k_hotkeys_default_sample_rate;    // 0 turns tracking off
+    uint32_t countdown = 1;             // accesses until the next sample
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    uint64_t last_decay_ms = 0;
+    uint64_t samples = 0;
+
+private:
+    uint32_t next_countdown();
+
+    void record(const std::string& key);
+
+    void decay(uint64_t now_ms);
+
+    void sift_up(size_t i);
+
+    void sift_down(size_t i);
+
+public:
+    // counts an access to key; only the sampled ones cost more than a decrement
+    void access(const std::string& key) {
+        if (sample_rate == 0 || --countdown > 0) {
+            return;
+        }
+        countdown = next_countdown();
+        record(key);
+    }
+
+    // the tracked keys by descending access rate, at most limit of them
+    void top(std::vector<HotKeyRate>& out, size_t limit);
+
+    // changing the rate starts over, the old counts are in the old unit
+    void set_sample_rate(uint32_t rate);
+
+    uint32_t get_sample_rate() {
+        return sample_rate;
+    }
+
+    uint64_t sampled() {
+        return samples;
+    }
+
+    void clear();
+};
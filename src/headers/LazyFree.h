@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+struct LazyFreeJob {
+    LazyFreeJob* next;
+    void (*fn)(void*);
+    void* arg;
+    size_t bytes;       // memory the job releases, for the pending counter
+};
+
+// Background reclamation of values that were already detached from every
+// server structure. The event loop pushes jobs onto a lock-free stack (one CAS,
+// no lock unless the worker may be asleep) and a single worker thread takes the
+// whole stack at once and runs the free functions outside the loop.
+class LazyFreer {
+private:
+    std::atomic<LazyFreeJob*> head;
+    std::atomic<size_t> pending_bytes;
+    std::atomic<uint64_t> freed_jobs;
+    std::mutex sleep_mutex;             // only guards the worker going to sleep
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread worker;
+
+private:
+    void run();
+
+public:
+    LazyFreer();
+
+    // drains the remaining jobs before returning
+    ~LazyFreer();
+
+    LazyFreer(const LazyFreer&) = delete;
+    LazyFreer& operator=(const LazyFreer&) = delete;
+
+    void submit(void (*fn)(void*), void* arg, size_t bytes);
+
+    size_t pending() {
+        return pending_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t freed() {
+        return freed_jobs.load(std::memory_order_relaxed);
+    }
+};
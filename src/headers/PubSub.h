@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "HashTable.h"
+
+struct Conn;
+class Buffer;
+
+// A published message encoded for one wire format. It is built once per
+// publish and format, and the output queue of every subscriber that gets it
+// holds a reference, so a fan-out to n subscribers does not make n copies.
+// The bytes follow the header in the same allocation.
+struct SharedMessage {
+    size_t refs;
+    size_t size;
+
+    uint8_t* data() {
+        return (uint8_t*)(this + 1);
+    }
+};
+
+// a copy of the bytes in buf, holding one reference
+SharedMessage* message_new(Buffer& buf);
+
+void message_unref(SharedMessage* msg);
+
+static inline void message_ref(SharedMessage* msg) {
+    msg->refs++;
+}
+
+// bytes held by messages that are still queued somewhere
+size_t message_bytes_allocated();
+
+// A message waiting in a connection's output. Replies keep going to the
+// connection's write_buffer; position tells which of its bytes go out first.
+struct QueuedMessage {
+    SharedMessage* msg = nullptr;
+    size_t sent = 0;        // bytes of msg already written
+    uint64_t position = 0;  // write_buffer bytes, counted over the connection's life, that precede it
+};
+
+struct Channel;
+
+// one connection subscribed to one channel or pattern
+struct Subscription {
+    HNode node;             // in PubSub::subscriptions, keyed by conn and channel
+    Conn* conn = nullptr;
+    Channel* channel = nullptr;
+    size_t channel_idx = 0;     // position in channel->subscribers
+    size_t conn_idx = 0;        // position in conn->subscriptions
+};
+
+// a channel, or a pattern, with at least one subscriber
+struct Channel {
+    HNode node;             // in PubSub::channels or PubSub::pattern_index
+    std::string name;
+    bool is_pattern = false;
+    std::vector<Subscription*> subscribers;
+    size_t pattern_idx = 0;     // position in PubSub::patterns
+};
+
+// Who is subscribed to what. Channels and patterns go away with their last
+// subscriber. A publish looks up its channel in O(1) and has to match every
+// pattern, as in Redis.
+class PubSub {
+private:
+    HTable channels;
+    HTable pattern_index;
+    HTable subscriptions;
+    std::vector<Channel*> patterns;
+
+private:
+    Channel* find(HTable& table, const std::string& name);
+
+    Subscription* find_subscription(Conn* conn, Channel* channel);
+
+    void remove(Subscription* sub);
+
+public:
+    PubSub() : channels(4), pattern_index(4), subscriptions(4) {}
+
+    PubSub(const PubSub&) = delete;
+    PubSub& operator=(const PubSub&) = delete;
+
+    // false if conn was subscribed already
+    bool subscribe(Conn* conn, const std::string& name, bool pattern);
+
+    // false if conn was not subscribed
+    bool unsubscribe(Conn* conn, const std::string& name, bool pattern);
+
+    // drops all of conn's channel or pattern subscriptions, their names go to out
+    void unsubscribe_all(Conn* conn, bool pattern, std::vector<std::string>& out);
+
+    Channel* find_channel(const std::string& name) {
+        return find(channels, name);
+    }
+
+    const std::vector<Channel*>& pattern_list() {
+        return patterns;
+    }
+
+    size_t num_channels() {
+        return channels.hm_size();
+    }
+
+    size_t num_patterns() {
+        return patterns.size();
+    }
+};
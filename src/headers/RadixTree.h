@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "UtilTypes.h"
+
+// Adaptive radix tree (Leis et al., "The Adaptive Radix Tree: ARTful Indexing
+// for Main-Memory Databases") over Entry keys, kept in byte order.
+//
+// Inner nodes come in four sizes (4, 16, 48 and 256 children) and grow or
+// shrink as children are added and removed. Single child paths are
+// compressed into the node prefix; only the first k_art_max_prefix bytes are
+// stored and the rest are read from a leaf when needed. Leaves are the Entry
+// pointers themselves, tagged in the low bit, so the tree holds no copy of the
+// keys. A key that ends inside the tree (a prefix of other keys) is kept in
+// the `terminal` slot of the node where it ends.
+const uint32_t k_art_max_prefix = 12;
+
+struct ArtNode {
+    uint8_t type;
+    uint16_t num_children;
+    uint32_t prefix_len;
+    uint8_t prefix[k_art_max_prefix];
+    Entry* terminal;
+};
+
+class RadixTree {
+private:
+    void* root = nullptr;
+    size_t num_keys = 0;
+    size_t node_bytes = 0;
+
+private:
+    ArtNode* node_new(uint8_t type);
+
+    void node_free(ArtNode* node);
+
+    void free_subtree(void* n);
+
+    void** find_child(ArtNode* node, uint8_t byte);
+
+    void add_child(ArtNode* node, void** ref, uint8_t byte, void* child);
+
+    void remove_child(ArtNode* node, void** ref, uint8_t byte, void** child_ref);
+
+    void shrink(ArtNode* node, void** ref);
+
+    uint32_t prefix_mismatch(ArtNode* node, const std::string& key, size_t depth);
+
+    void insert_at(void** ref, Entry* e, size_t depth);
+
+    Entry* remove_at(void** ref, const std::string& key, size_t depth);
+
+    bool iterate_at(void* n, size_t depth, const std::string& start, bool bounded,
+                    bool (*fn)(Entry*, void*), void* arg);
+
+public:
+    RadixTree() {}
+
+    ~RadixTree();
+
+    RadixTree(const RadixTree&) = delete;
+    RadixTree& operator=(const RadixTree&) = delete;
+
+    void insert(Entry* e);
+
+    bool remove(const std::string& key);
+
+    // visits keys >= start in byte order until fn returns false
+    void iterate_from(const std::string& start, bool (*fn)(Entry*, void*), void* arg);
+
+    size_t size() {
+        return num_keys;
+    }
+
+    size_t mem_usage() {
+        return sizeof(RadixTree) + node_bytes;
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Synchronization between the writer (the event loop) and the reader threads
+// that serve get against the same keyspace. Readers never block the writer and
+// never take a lock:
+//
+// - SeqLock: the writer makes the counter odd while it changes the keyspace,
+//   a reader that saw it change (or odd) during a lookup starts over. That
+//   makes what a reader returns consistent.
+// - EpochReclaimer: memory the writer unlinks (entries, old bucket arrays,
+//   replaced value buffers) is only freed once no reader can still be looking
+//   at it. That makes what a reader touches valid, even when the lookup it is
+//   part of will be thrown away.
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+class SeqLock {
+private:
+    std::atomic<uint64_t> seq{0};
+
+public:
+    void write_begin() {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void write_end() {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // waits out a write in progress and returns the value to validate against
+    uint64_t read_begin() {
+        uint64_t s;
+        while ((s = seq.load(std::memory_order_acquire)) & 1) {
+            cpu_relax();
+        }
+        return s;
+    }
+
+    // true if a write started since read_begin, what was read must be dropped
+    bool read_retry(uint64_t s) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) != s;
+    }
+};
+
+struct RetiredObject {
+    void (*fn)(void*) = nullptr;    // frees arg
+    void* arg = nullptr;
+    size_t bytes = 0;
+    uint64_t epoch = 0;             // global epoch when it was unlinked
+};
+
+// Each reader publishes the global epoch it saw while it is inside a critical
+// section (0 outside). An object retired during epoch E can be freed once every
+// reader is either outside or has entered after the writer moved past E.
+class EpochReclaimer {
+private:
+    // one cache line per reader, so that readers entering and leaving do not
+    // bounce each other's line
+    struct Slot {
+        std::atomic<uint64_t> epoch{0};
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::atomic<uint64_t> global_epoch{1};
+    std::unique_ptr<Slot[]> slots;
+    size_t num_slots = 0;
+    std::vector<RetiredObject> retired;     // writer only
+    size_t retired_bytes = 0;
+
+public:
+    void init(size_t readers);
+
+    // reader side, slot is the reader's index
+    void enter(size_t slot) {
+        slots[slot].epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        // the keyspace reads that follow must not move before the store
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void exit(size_t slot) {
+        slots[slot].epoch.store(0, std::memory_order_release);
+    }
+
+    // writer side: arg is no longer reachable from the keyspace
+    void retire(void (*fn)(void*), void* arg, size_t bytes);
+
+    // moves the objects no reader can reach any more to out
+    void collect(std::vector<RetiredObject>& out);
+
+    size_t pending() {
+        return retired.size();
+    }
+
+    size_t pending_bytes() {
+        return retired_bytes;
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "UtilTypes.h"
+
+struct Reply {
+    JSON tag = JSON::TAG_NIL;
+    int64_t int_val = 0;
+    double dbl_val = 0;
+    std::string str;            // TAG_STR and TAG_ERR
+    std::vector<Reply> arr;     // TAG_ARR
+};
+
+// Blocking client for the length-prefixed tag protocol. Requests can be
+// pipelined: queue any number of them with append_req(), send them with
+// flush() and read the replies back in order with read_res().
+class RedisClient {
+private:
+    int fd = -1;
+    std::vector<uint8_t> wbuf;
+    std::vector<uint8_t> rbuf;
+    size_t rbuf_pos = 0;
+    uint64_t timeout_ms = 0;    // for connect, send and receive, 0 waits forever
+
+private:
+    int32_t fill(size_t n);
+
+    int32_t open_socket(int domain);
+
+public:
+    RedisClient() {}
+
+    ~RedisClient() {
+        close_conn();
+    }
+
+    RedisClient(const RedisClient&) = delete;
+    RedisClient& operator=(const RedisClient&) = delete;
+
+    // applies to connections made after the call
+    void set_timeout(uint64_t ms) {
+        timeout_ms = ms;
+    }
+
+    int32_t connect_tcp(const char* host, uint16_t port);
+
+    int32_t connect_unix(const char* path);
+
+    void close_conn();
+
+    void append_req(const std::vector<std::string>& cmd);
+
+    int32_t flush();
+
+    int32_t read_res(Reply& out);
+
+    int32_t call(const std::vector<std::string>& cmd, Reply& out);
+
+    // the socket, for callers that poll many clients at once; only valid to
+    // read from directly while nothing is buffered
+    int get_fd() {
+        return fd;
+    }
+};
+
+bool decode_reply(const uint8_t*& cur, const uint8_t* end, Reply& out);
+
+// Chunked transfer of values of any size up to the server's 512 MB string
+// limit, over a frame each k_stream_chunk bytes: up as a set of the first
+// chunk and appends of the rest, down as getrange calls. Up to
+// k_stream_window requests are in flight so the round trips overlap, and
+// neither side ever buffers more than that many chunks. Other clients see
+// the value grow while it goes up.
+const size_t k_stream_chunk = 1 << 20;
+const size_t k_stream_window = 8;
+
+// Stores the bytes source produces under key, without a ttl. source(buf, cap)
+// fills buf with up to cap bytes and returns how many, 0 at the end. -1 on a
+// connection error or an error reply, described in err; total is the
+// number of bytes sent. Fails if the key is evicted, expires or is deleted
+// while the value goes up, instead of storing what is left of it.
+int32_t stream_put(RedisClient& client, const std::string& key,
+    const std::function<size_t(char*, size_t)>& source, uint64_t& total, std::string& err);
+
+// Reads the value at key and hands its bytes to sink in order; sink returns
+// false to stop. Fails if the key is missing or the value gets shorter
+// while it comes down.
+int32_t stream_get(RedisClient& client, const std::string& key,
+    const std::function<bool(const char*, size_t)>& sink, uint64_t& total, std::string& err);
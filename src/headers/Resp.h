@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+
+// RESP (the Redis serialization protocol), so that standard Redis clients and
+// benchmarks can talk to the server. Requests are either arrays of bulk
+// strings (`*2\r\n$3\r\nget\r\n$1\r\na\r\n`) or inline commands
+// (`get a\r\n`). Replies are produced in RESP2 or, after `hello 3`, RESP3.
+
+enum Protocol {
+    PROTO_UNKNOWN = 0,  // nothing received yet
+    PROTO_BINARY = 1,   // the native length-prefixed tag format
+    PROTO_RESP2 = 2,
+    PROTO_RESP3 = 3,
+};
+
+// where an argument lies, relative to the start of the unconsumed input
+struct RespSlice {
+    size_t offset;
+    size_t len;
+};
+
+enum RespStatus {
+    RESP_INCOMPLETE = 0,    // need more input
+    RESP_DONE = 1,          // a whole request was parsed
+    RESP_ERROR = 2,         // malformed input, the connection should be closed
+};
+
+// Incremental request parser. It reads the input in place and only records
+// argument positions, which stay valid when the buffer grows or compacts. The
+// scan position is kept between calls, so a request arriving over many reads
+// (a large value, or a pipeline cut at an arbitrary byte) is looked at once.
+class RespParser {
+private:
+    size_t pos = 0;             // bytes of the current request already parsed
+    int64_t num_args = -1;      // -1 until the array header is parsed
+    int64_t bulk_len = -1;      // -1 until the next $len header is parsed
+    std::vector<RespSlice> args;
+
+private:
+    RespStatus parse_inline(const uint8_t* data, size_t size, size_t& consumed);
+
+public:
+    static const size_t k_max_inline = 64 * 1024;
+    static const size_t k_max_bulk = 512 << 20;
+    static const int64_t k_max_args = 1024 * 1024;
+
+    // data and size describe the unconsumed input. On RESP_DONE the request
+    // takes the first `consumed` bytes; call reset() once they are consumed.
+    RespStatus parse(const uint8_t* data, size_t size, size_t& consumed);
+
+    const std::vector<RespSlice>& arguments() {
+        return args;
+    }
+
+    // bytes still missing from the bulk string being received, 0 if unknown
+    size_t bytes_wanted(size_t size);
+
+    void reset();
+};
+
+// Wire format of the first bytes of a connection: a native frame always has
+// TAG_ARR in its fifth byte, which a RESP request cannot have there. Returns
+// PROTO_UNKNOWN until enough bytes arrived to tell.
+Protocol detect_protocol(const uint8_t* data, size_t size);
+
+void resp_write_simple(Buffer& out, const std::string& s);
+void resp_write_error(Buffer& out, const std::string& msg);
+void resp_write_bulk(Buffer& out, const uint8_t* data, size_t len);
+void resp_write_int(Buffer& out, int64_t val);
+void resp_write_double(Buffer& out, double val, Protocol proto);
+void resp_write_null(Buffer& out, Protocol proto);
+void resp_write_array(Buffer& out, size_t n);
+// RESP3 map, or a flat array of 2 * n items in RESP2
+void resp_write_map(Buffer& out, size_t n, Protocol proto);
+// RESP3 push (out of band data such as pub/sub messages), an array in RESP2
+void resp_write_push(Buffer& out, size_t n, Protocol proto);
+
+// Re-encodes one reply in the native tag format as RESP. Handlers report
+// success as TAG_NIL (+OK) and a missing key as the error "null" (a null).
+bool resp_transcode(const uint8_t*& cur, const uint8_t* end, Buffer& out, Protocol proto);
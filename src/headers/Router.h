@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "RedisClient.h"
+
+// Client side sharding over independent servers. Each key belongs to one
+// node, picked by jump consistent hashing (Lamping and Veach, "A Fast,
+// Minimal Memory, Consistent Hash Algorithm") of the key: the nodes get equal
+// shares, and appending a node to the list moves only the 1/n of the keys
+// that the new node takes over. As in Redis Cluster, a key containing
+// {tag} is placed by the tag alone, so keys sharing a tag stay together and
+// can be used in one multi-key command.
+//
+// The node list is the configuration: every client must list the same
+// nodes in the same order, and nodes are only ever added at the end.
+
+struct RouterNode {
+    std::string host;
+    uint16_t port = 0;
+    std::string unix_path;      // used instead of TCP when set
+};
+
+// "host:port", or a path with a slash for a unix socket
+bool parse_router_node(const std::string& s, RouterNode& out);
+
+// comma separated parse_router_node list
+bool parse_router_nodes(const std::string& s, std::vector<RouterNode>& out);
+
+// the hashed part of a key: the text of its first non-empty {tag}, if any
+void router_hash_slice(const std::string& key, const char*& data, size_t& len);
+
+// the node of key among num_nodes
+size_t router_node_of(const std::string& key, size_t num_nodes);
+
+// Where the keys of a command are and how the replies of the nodes they
+// map to combine into one.
+enum RouteMerge {
+    ROUTE_SINGLE,   // all keys on one node, or an error reply if not
+    ROUTE_ARRAY,    // split by node, array replies put back in key order
+    ROUTE_SUM,      // split by node, integer replies added up
+    ROUTE_STATUS,   // split by node, the first error or success
+    ROUTE_ALL,      // sent to every node, the first error or success
+};
+
+struct RouteSpec {
+    size_t first = 1;       // index of the first key, 0 for no keys
+    size_t step = 1;        // arguments per key: 2 for key value pairs
+    bool to_end = false;    // keys go on to the end, otherwise just one
+    RouteMerge merge = ROUTE_SINGLE;
+};
+
+RouteSpec route_spec(const std::vector<std::string>& cmd);
+
+// Routes commands to the nodes of their keys over pooled connections. A
+// command whose keys span nodes is split into one sub-command per node (and
+// per k_router_batch keys), all of them are written before any reply is
+// read so the nodes work on them at the same time, and the replies are
+// merged back in the order of the keys. Commands without keys go to the
+// first node. Safe to share between threads: each call takes connections
+// out of the pools and puts them back when done.
+//
+// After load_slots() the keys go by the slot map of a cluster instead (see
+// the server's Cluster.h): a key goes to the owner of its hash slot, split
+// commands are split by slot since a node refuses keys of several slots in
+// one command, and MOVED and ASK redirects are followed, MOVED updating the
+// map. Nodes the map or a redirect names are added to the node list.
+class Router {
+private:
+    struct Pool {
+        std::vector<std::unique_ptr<RedisClient>> idle;
+    };
+
+    // a sub-command of a split command and where its keys are in the command
+    struct SubCommand {
+        size_t node = 0;
+        std::vector<std::string> cmd;
+        std::vector<size_t> keys;
+        Reply reply;
+    };
+
+    std::vector<RouterNode> nodes;
+    std::vector<Pool> pools;
+    std::vector<size_t> slot_nodes;     // node per hash slot, empty unless using a cluster's map
+    std::mutex mutex;                   // guards all of the above
+    std::atomic<uint64_t> num_redirects{0};
+
+private:
+    size_t node_index(const RouterNode& node);
+
+    // the group of a key: its node, or its slot with a slot map
+    size_t group_of(const std::string& key);
+
+    size_t group_node(size_t group);
+
+    std::unique_ptr<RedisClient> acquire(size_t node);
+
+    void release(size_t node, std::unique_ptr<RedisClient> conn);
+
+    int32_t call_node(size_t node, const std::vector<std::string>& cmd, bool asking, Reply& out);
+
+    // call_node, following redirects from node on
+    int32_t call_redirected(size_t node, const std::vector<std::string>& cmd, Reply& out);
+
+    int32_t call_split(const std::vector<std::string>& cmd, const RouteSpec& spec, Reply& out);
+
+    int32_t call_all(const std::vector<std::string>& cmd, Reply& out);
+
+public:
+    explicit Router(const std::vector<RouterNode>& nodes);
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    size_t num_nodes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return nodes.size();
+    }
+
+    size_t node_of(const std::string& key) {
+        return group_node(group_of(key));
+    }
+
+    // Takes the slot map from `cluster slots` on the first node and routes
+    // by it from then on. -1 if the node cannot be reached or is not in
+    // cluster mode.
+    int32_t load_slots();
+
+    // redirects followed so far
+    uint64_t redirects() {
+        return num_redirects.load(std::memory_order_relaxed);
+    }
+
+    // -1 when a node cannot be reached or the connection breaks
+    int32_t call(const std::vector<std::string>& cmd, Reply& out);
+
+    // runs cmd on one node, for per node commands such as info
+    int32_t call_on(size_t node, const std::vector<std::string>& cmd, Reply& out) {
+        return call_node(node, cmd, false, out);
+    }
+};
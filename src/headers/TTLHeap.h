@@ -32,8 +32,15 @@ public:
         return heap.size();
     }
 
+    size_t mem_usage() {
+        return heap.capacity() * sizeof(HeapEntry);
+    }
+
     void add_heap_entry(const HeapEntry& heap_entry);
     void heap_delete();
+    void clear() {
+        std::vector<HeapEntry>().swap(heap);
+    }
     void expire_entry(size_t pos);
     void set_expire_time(size_t pos, uint64_t expire_time);
     HeapEntry& operator[](size_t pos) {
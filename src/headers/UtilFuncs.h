@@ -15,11 +15,29 @@ void die(const char *msg);
 Entry* get_entry(HNode* node);
 Entry* get_entry_from_heap_idx(size_t* heap_idx);
 Conn*  get_connection(Node* node);
+Conn*  get_ready_connection(Node* node);
 
 // hashing / equality
 uint64_t fnv_hash(const uint8_t *data, size_t len);
+// well mixed 64 bit hash, for sketches whose accuracy depends on it
+uint64_t murmur_hash64(const uint8_t* data, size_t len, uint64_t seed);
 bool eq(HNode* left, HNode* right);
 
 // time
 int64_t get_monotonic_msec();
 
+// memory accounting
+size_t string_mem_usage(const std::string& s);
+size_t entry_mem_usage(Entry* e);
+bool entry_owns_object(Entry* e);
+void entry_free_value(Entry* e);
+bool parse_memory(const std::string& s, size_t& out);
+
+// parsing
+bool parse_int(const std::string& s, int64_t& out);
+bool parse_canonical_int(const std::string& s, int64_t& out);
+bool parse_double(const std::string& s, double& out);
+
+// glob style matching: *, ?, [abc], [^a-z] and \ escapes
+bool glob_match(const char* pattern, size_t plen, const char* str, size_t slen);
+
@@ -1,9 +1,17 @@
 #pragma once
 #include <cstdint>
+#include <deque>
+#include <string>
 #include <vector>
 #include "HashTable.h"
 #include "DLL.h"
 #include "Buffer.h"
+#include "Resp.h"
+#include "PubSub.h"
+#include "ValueLog.h"
+
+class ZSet;
+class BloomFilter;
 
 
 enum {
@@ -27,15 +35,51 @@ struct Response {
     std::vector<uint8_t> data;
 };
 
+// a key under watch, see Server::do_transaction_command
+struct WatchedKey {
+    std::string key;
+    uint64_t hash_code = 0;
+    uint64_t version = 0;   // the key's Entry::version when watched, 0 if it did not exist
+};
+
 struct Conn {
     int fd = -1;
     bool want_read = false;
     bool want_write = false;
     bool want_close = false;
+    bool reading_paused = false;        // output above the soft limit, see process_requests
+    uint64_t output_hard_since_ms = 0;  // when the output went over the hard limit, 0 if under
+    bool ready = false;                 // in the ready queue with requests left to run
+    Protocol proto = PROTO_UNKNOWN;     // wire format, from the first bytes received
+    RespParser resp_parser;             // state of a partly received RESP request
     Buffer write_buffer;
     Buffer read_buffer;
+    // published messages interleaved with write_buffer, see handle_write
+    std::deque<QueuedMessage> out_messages;
+    size_t out_message_bytes = 0;       // unsent bytes of out_messages
+    uint64_t write_buffer_sent = 0;     // bytes of write_buffer written so far
+    bool flush_pending = false;         // in Server::pending_flush
+    std::vector<Subscription*> subscriptions;   // channels and patterns
     uint64_t last_active_ms = 0;
+    bool asking = false;                // cluster mode: the next command may use an importing slot
+    // transaction state: the commands queued since multi, parsed, and the
+    // keys whose change aborts exec
+    bool in_multi = false;
+    bool multi_failed = false;          // a command was refused while queuing, exec aborts
+    int32_t multi_slot = -1;            // cluster mode: the slot of the queued keys, -1 for none yet
+    std::vector<std::vector<std::string>> multi_queue;
+    std::vector<WatchedKey> watched;
     Node node;
+    Node ready_node;
+};
+
+enum ValueType {
+    VAL_STR = 0,    // value held in Entry::value
+    VAL_INT = 1,    // value held natively in Entry::int_val
+    VAL_DBL = 2,    // value held natively in Entry::dbl_val
+    VAL_ZSET = 3,   // sorted set owned through Entry::zset
+    VAL_BLOOM = 4,  // Bloom filter owned through Entry::bloom
+    VAL_DISK = 5,   // string tiered out to the value log at Entry::loc
 };
 
 struct HeapEntry {
@@ -46,7 +90,18 @@ struct HeapEntry {
 struct Entry {
     HNode node;
     size_t heap_idx;
+    uint32_t lru : 24;      // LRU clock or LFU counter, see Evict.h
+    uint32_t type : 8;      // ValueType
+    uint32_t slot_pos;      // cluster mode: index in the key list of its slot
+    uint64_t version;       // changes with every write to the key, see Server::key_version
     std::string key;
     std::string value;
+    union {
+        int64_t int_val;
+        double dbl_val;
+        ZSet* zset;
+        BloomFilter* bloom;
+        ValueLoc loc;
+    };
 };
 
@@ -0,0 +1,138 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Append-only store for the values of tiered keys, kept in files on local
+// disk instead of in memory. The log is a set of fixed size segments, each a
+// file mapped shared into the address space: appends copy into the mapping
+// and reads are served from it, so a value read often stays in the page
+// cache and one read rarely costs a disk read. Values that were overwritten
+// or deleted leave garbage behind, which compaction reclaims a segment at a
+// time by moving the live records of a mostly dead segment to the head and
+// dropping it.
+//
+// The log only spills memory: segment files are unlinked as soon as they are
+// created and nothing survives a restart.
+const size_t k_value_segment_bytes = 64 << 20;
+const uint32_t k_max_value_segments = 1 << 14;
+
+// where a value is, small enough to live in the Entry value union
+struct ValueLoc {
+    uint32_t segment;
+    uint32_t offset;
+};
+
+// the key is stored with the value so that compaction can find its entry
+struct ValueRecord {
+    uint32_t key_len;
+    uint32_t value_len;
+    // key and value bytes follow, the record is padded to 8 bytes
+};
+
+struct ValueSegment {
+    int fd = -1;
+    char* base = nullptr;   // the whole segment, mapped shared
+    size_t end = 0;         // bytes appended
+    size_t live = 0;        // bytes of records still in use
+};
+
+struct ValueLogStats {
+    uint64_t live_records = 0;
+    uint64_t live_bytes = 0;
+    uint64_t segments = 0;
+    uint64_t compacted_bytes = 0;   // live records moved by compaction
+    uint64_t reclaimed_bytes = 0;   // segment bytes given back
+};
+
+// Tells compaction whether the record of key at loc is still in use, and if
+// so where the entry keeps its location so it can be moved.
+typedef ValueLoc* (*ValueLiveFn)(const char* key, size_t key_len, ValueLoc loc, void* arg);
+
+class ValueLog {
+private:
+    std::string dir;
+    std::unique_ptr<ValueSegment*[]> segments;     // by id, nullptr when free
+    uint32_t num_ids = 0;               // ids handed out so far
+    std::vector<uint32_t> free_ids;
+    int64_t head = -1;                  // the segment appended to
+    uint64_t next_file = 0;             // names segment files
+    int64_t compacting = -1;            // the segment being compacted
+    size_t compact_offset = 0;          // its next record
+    ValueLogStats stats;
+    // when set, dropped segments are handed over instead of unmapped
+    void (*retire_segment)(ValueSegment* seg, void* arg) = nullptr;
+    void* retire_arg = nullptr;
+
+private:
+    bool add_segment();
+    void drop_segment(uint32_t id);
+    bool pick_victim();
+
+public:
+    ValueLog() = default;
+
+    ~ValueLog();
+
+    ValueLog(const ValueLog&) = delete;
+    ValueLog& operator=(const ValueLog&) = delete;
+
+    // creates the first segment in dir, false if it cannot
+    bool open(const std::string& dir);
+
+    bool is_open() {
+        return segments != nullptr;
+    }
+
+    // For logs that reader threads read without locks: dropped segments go
+    // to fn, which must keep them mapped until no reader can still be in one.
+    void set_retire(void (*fn)(ValueSegment* seg, void* arg), void* arg) {
+        retire_segment = fn;
+        retire_arg = arg;
+    }
+
+    static void free_segment(ValueSegment* seg);
+
+    static size_t record_size(size_t key_len, size_t value_len) {
+        return (sizeof(ValueRecord) + key_len + value_len + 7) & ~(size_t)7;
+    }
+
+    // false when the disk or the segment ids ran out
+    bool append(const char* key, size_t key_len, const char* data, size_t len, ValueLoc& loc);
+
+    // The value at loc. Reader threads call this without locks, in lookups
+    // that may have raced with the writer and read a loc that is now
+    // meaningless: a dropped segment stays mapped until retired, and the
+    // length is bounded by the segment so a stale record cannot send the
+    // caller outside of it. nullptr when there is no such segment.
+    const char* value(ValueLoc loc, size_t& len) const {
+        if (loc.segment >= k_max_value_segments || loc.offset > k_value_segment_bytes - sizeof(ValueRecord)) {
+            return nullptr;
+        }
+        const ValueSegment* seg = segments[loc.segment];
+        if (seg == nullptr) {
+            return nullptr;
+        }
+        const ValueRecord* rec = (const ValueRecord*)(seg->base + loc.offset);
+        size_t room = k_value_segment_bytes - loc.offset - sizeof(ValueRecord);
+        size_t key_len = rec->key_len < room ? rec->key_len : room;
+        len = rec->value_len < room - key_len ? rec->value_len : room - key_len;
+        return (const char*)(rec + 1) + key_len;
+    }
+
+    // the record at loc is no longer referenced
+    void release(ValueLoc loc);
+
+    // no record is referenced any more, after the keyspace was flushed
+    void release_all();
+
+    // Compacts up to about budget bytes of records, moving the live ones to
+    // the head. Returns false once no segment is worth compacting.
+    bool compact(size_t budget, ValueLiveFn live, void* arg);
+
+    const ValueLogStats& get_stats() {
+        return stats;
+    }
+};
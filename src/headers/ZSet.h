@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "HashTable.h"
+
+struct ZNode;
+
+struct ZLevel {
+    ZNode* forward;
+    uint32_t span;      // number of nodes this link skips over, used for ranks
+};
+
+// A member lives in a single allocation: the node header, its `level` skiplist
+// links and then the name bytes. The embedded HNode links it into the
+// member -> node hash index, so a score lookup never touches the skiplist.
+struct ZNode {
+    HNode hnode;
+    double score;
+    ZNode* backward;
+    uint32_t name_len;
+    uint32_t level;
+
+    ZLevel* levels() {
+        return (ZLevel*)(this + 1);
+    }
+
+    const char* name() {
+        return (const char*)(levels() + level);
+    }
+};
+
+struct ZRangeSpec {
+    double min;
+    double max;
+    bool min_exclusive = false;
+    bool max_exclusive = false;
+};
+
+// Sorted set: a skiplist with spans ordered by (score, name) for O(log n)
+// rank and range queries, plus a hash index for O(1) score lookups.
+class ZSet {
+private:
+    static const int k_max_level = 32;
+    HTable index;
+    ZNode* header;
+    ZNode* tail = nullptr;
+    size_t length = 0;
+    int level = 1;
+    size_t node_bytes = 0;
+    uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+private:
+    int random_level();
+
+    ZNode* node_new(int level, double score, const char* name, size_t len);
+
+    void node_free(ZNode* node);
+
+    void zsl_insert(ZNode* node);
+
+    void zsl_unlink(ZNode* node);
+
+public:
+    ZSet();
+
+    ~ZSet();
+
+    ZSet(const ZSet&) = delete;
+    ZSet& operator=(const ZSet&) = delete;
+
+    // returns true if the member was added, false if only its score changed
+    bool add(const std::string& name, double score);
+
+    bool remove(const std::string& name);
+
+    ZNode* lookup(const std::string& name);
+
+    // 0 based rank of a member of this set
+    size_t rank(ZNode* node);
+
+    // node at a 0 based rank, nullptr when out of range
+    ZNode* by_rank(size_t rank);
+
+    // first node whose score falls inside the range, nullptr if none does
+    ZNode* first_in_range(const ZRangeSpec& range);
+
+    static bool score_gte_min(double score, const ZRangeSpec& range);
+
+    static bool score_lte_max(double score, const ZRangeSpec& range);
+
+    static ZNode* next(ZNode* node) {
+        return node->levels()[0].forward;
+    }
+
+    size_t size() {
+        return length;
+    }
+
+    size_t mem_usage() {
+        return sizeof(ZSet) + node_bytes + index.hm_mem_usage();
+    }
+};
@@ -14,8 +14,16 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/ip.h>
+#include <atomic>
+#include <cmath>
+#include <initializer_list>
+#include <memory>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include "headers/Buffer.h"
 #include "headers/HashTable.h"
@@ -23,22 +31,206 @@
 #include "headers/UtilFuncs.h"
 #include "headers/DLL.h"
 #include "headers/TTLHeap.h"
+#include "headers/Evict.h"
+#include "headers/ZSet.h"
+#include "headers/RadixTree.h"
+#include "headers/LazyFree.h"
+#include "headers/HotKeys.h"
+#include "headers/Rcu.h"
+#include "headers/PubSub.h"
+#include "headers/Hll.h"
+#include "headers/Bitmap.h"
+#include "headers/Bloom.h"
+#include "headers/ValueLog.h"
+#include "headers/Cluster.h"
+#include "headers/Commands.h"
+#include "headers/RedisClient.h"
 
 static const std::string KEY_NOT_FOUND_ERROR = "key not found";
 static const std::string NULL_MESSAGE = "null";
 static const std::string INVALID_TTL = "ttl cannot be negative";
+static const std::string INVALID_EXPIRE_TIME = "invalid expire time";
 static const std::string EXPIRE_PERSISTENT_NODE_ERR = "cannot expire persistent entry";
+static const std::string OOM_ERROR = "command not allowed when used memory > 'maxmemory'";
+static const std::string INVALID_CONFIG = "invalid config parameter or value";
+static const std::string NOT_AN_INTEGER = "value is not an integer or out of range";
+static const std::string NOT_A_FLOAT = "value is not a valid float";
+static const std::string INCR_OVERFLOW = "increment or decrement would overflow";
+static const std::string WRONG_TYPE = "operation against a key holding the wrong kind of value";
+static const std::string SYNTAX_ERROR = "syntax error";
+static const std::string PREFIX_INDEX_DISABLED = "prefix index is disabled";
+static const std::string READER_GET_ONLY = "reader connections only serve get";
+static const std::string INVALID_HLL = "key is not a valid HyperLogLog string value";
+static const std::string BIT_OFFSET_ERROR = "bit offset is not an integer or out of range";
+static const std::string BIT_VALUE_ERROR = "bit is not an integer or out of range";
+static const std::string BITOP_NOT_SOURCES = "bitop not takes a single source key";
+static const std::string BLOOM_KEY_EXISTS = "key already exists";
+static const std::string BLOOM_FULL = "non scaling filter is full";
+static const std::string BLOOM_ERROR_RATE = "error rate must be between 0 and 1";
+static const std::string BLOOM_CAPACITY = "capacity must be positive and fit a 1 GB filter";
+static const std::string BLOOM_EXPANSION = "expansion must be a positive integer";
+static const std::string CLUSTER_DISABLED = "this instance has cluster support disabled";
+static const std::string CROSS_SLOT = "CROSSSLOT keys in request don't hash to the same slot";
+static const std::string TRY_AGAIN = "TRYAGAIN multiple keys request during rehashing of slot";
+static const std::string SLOT_NOT_SERVED = "CLUSTERDOWN hash slot not served";
+static const std::string INVALID_SLOT = "invalid or out of range slot";
+static const std::string INVALID_NODE = "invalid node address";
+static const std::string SLOT_BUSY = "slot is owned by another node";
+static const std::string SLOT_NOT_MINE = "slot is not owned by this node";
+static const std::string SLOT_HAS_KEYS = "slot still holds keys, migrate them first";
+static const std::string BUSY_KEY = "BUSYKEY target key name already exists";
+static const std::string BAD_PAYLOAD = "payload is not a valid dump";
+static const std::string MIGRATE_IO_ERROR = "IOERR error or timeout talking to the target node";
+static const std::string STRING_TOO_LONG = "string exceeds maximum allowed size (512 MB)";
+static const std::string OFFSET_OUT_OF_RANGE = "offset is out of range";
+static const std::string MULTI_NESTED = "MULTI calls can not be nested";
+static const std::string EXEC_WITHOUT_MULTI = "EXEC without MULTI";
+static const std::string DISCARD_WITHOUT_MULTI = "DISCARD without MULTI";
+static const std::string WATCH_IN_MULTI = "WATCH inside MULTI is not allowed";
+static const std::string NOT_IN_MULTI = "command not allowed inside a transaction";
+static const std::string EXEC_ABORTED = "EXECABORT Transaction discarded because of previous errors.";
+static const std::string UNKNOWN_COMMAND = "unknown command or wrong number of arguments";
+static const std::string SUBSCRIBED_ONLY = "only (p)subscribe, (p)unsubscribe and ping are allowed while subscribed";
+
+struct ServerConfig {
+    uint16_t port = 1234;       // 0 disables the TCP listener
+    std::string unixsocket;     // path of the unix socket listener, empty for none
+    size_t maxmemory = 0;   // 0 means no limit
+    EvictionPolicy maxmemory_policy = EVICT_NOEVICTION;
+    size_t maxmemory_samples = 5;
+    bool prefix_index = false;
+    // reads pause while a client has more output pending than the soft limit
+    // and resume once it drains to half of it. A client that stays above the
+    // hard limit for hard_seconds is disconnected. 0 disables a limit.
+    size_t output_soft_limit = 1 << 20;
+    size_t output_hard_limit = 64 << 20;
+    uint64_t output_hard_seconds = 5;
+    // work a connection may do per event loop turn before yielding to the
+    // others, counted in keys (a plain command costs 1). 0 means no limit.
+    size_t command_budget = 128;
+    // one in this many key accesses is sampled for hot key tracking, 0 is off
+    uint32_t hotkeys_sample_rate = k_hotkeys_default_sample_rate;
+    // threads serving get on reader_port next to the event loop, 0 for none
+    size_t reader_threads = 0;
+    uint16_t reader_port = 0;
+    // bitmap commands use AVX2 loops where the CPU has them
+    bool bitmap_simd = true;
+    // Tiered storage, on when tiered_dir is set: string values of at least
+    // tiered_min_value bytes move to a value log in tiered_dir once unused
+    // for tiered_cold_ms, or right away from tiered_large_value bytes on.
+    std::string tiered_dir;
+    size_t tiered_min_value = 64;
+    size_t tiered_large_value = 1 << 20;
+    uint64_t tiered_cold_ms = 60000;
+    // cluster mode, see Cluster.h. The announced ip and the port name this
+    // server in redirects.
+    bool cluster_enabled = false;
+    std::string cluster_announce_ip = "127.0.0.1";
+};
+
+// the options of set past the value, and of getex
+struct SetOptions {
+    bool nx = false;        // only if the key does not exist
+    bool xx = false;        // only if it does
+    bool get = false;       // reply with the old value
+    bool keep_ttl = false;  // leave the ttl as it is
+    bool has_ttl = false;   // a ttl option was given
+    uint64_t ttl = 0;       // ms, 0 for none
+};
+
+// the optional start, end and unit arguments of bitcount and bitpos
+struct BitRange {
+    int64_t start = 0;
+    int64_t end = -1;
+    bool has_end = false;
+    bool bits = false;      // start and end count bits, not bytes
+};
+
+struct ServerStats {
+    uint64_t expired_keys = 0;
+    uint64_t evicted_keys = 0;
+    uint64_t keyspace_hits = 0;
+    uint64_t keyspace_misses = 0;
+    uint64_t output_limit_disconnections = 0;
+    uint64_t transactions_executed = 0;
+    uint64_t transactions_aborted = 0;     // a watched key changed
+};
+
+// counters of one reader thread, each only written by its own thread
+struct ReaderStats {
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> keyspace_hits{0};
+    std::atomic<uint64_t> keyspace_misses{0};
+    std::atomic<uint64_t> retries{0};       // lookups redone because the writer got in between
+    std::atomic<uint64_t> connections{0};
+};
+
+static void stat_add(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
 
 class Server {
 private:
     HTable htable;
     DLL dll;
+    DLL ready_queue;    // connections with buffered requests left over, oldest at the tail
     TTLHeap entry_heap;
+    ServerConfig config;
+    ServerStats stats;
+    EvictionPool eviction_pool;
+    RadixTree* prefix_index = nullptr;  // ordered key index, only when enabled
+    LazyFreer lazy_freer;
+    HotKeys hot_keys;
+    PubSub pubsub;
+    std::vector<int> pending_flush;     // subscribers that got messages this loop turn
+    // reader threads, see reader_loop
+    SeqLock keyspace_seq;
+    EpochReclaimer reclaimer;
+    bool readers_running = false;
+    std::atomic<bool> readers_stop{false};
+    std::vector<std::thread> readers;
+    std::unique_ptr<ReaderStats[]> reader_stats;
+    std::vector<RetiredObject> reclaimable;     // scratch space for reclaim_retired
+    int reader_fd = -1;
+    static const size_t k_reader_output_limit = 1 << 20;    // reads pause above this much pending output
+    size_t entries_memory = 0;      // bytes held by entries, keys and values
+    std::vector<Entry> lookup_probes;       // scratch space for lookup_entries
+    std::vector<HNode*> lookup_targets;
+    std::vector<HNode*> lookup_results;
+    ValueLog value_log;     // values of tiered keys, see tier_values
+    uint64_t tier_next_ms = 0;
+    size_t tier_cursor = 0;
+    std::vector<Entry*> tier_candidates;
+    ClusterState cluster;
+    std::unique_ptr<std::vector<Entry*>[]> slot_entries;   // cluster mode: the keys of each slot
+    size_t slot_entries_memory = 0;
+    std::unique_ptr<RedisClient> migrate_conn;      // kept for the next migrate to the same node
+    std::string migrate_addr;
+    uint64_t migrate_used_ms = 0;
+    uint64_t key_version = 0;       // last Entry::version handed out
+    size_t watching_conns = 0;      // connections with watched keys; versions only move while nonzero
+    bool values_as_text = false;    // while serving RESP: numeric values go out as bulk strings
+    size_t used_memory_peak = 0;
     static const size_t k_max_msg = 32 << 20;
     static const size_t k_max_args = 200 * 1000;
+    static const size_t k_min_read = 4 * 1024;     // smallest free space we read into
     static const uint64_t k_tcp_idle_timeout = 5000;
     static const uint64_t k_default_entry_timeout = 25000;
-    int fd;
+    static const size_t k_max_evictions_per_write = 16;
+    static const size_t k_max_eviction_rounds = 16;
+    static const int64_t k_default_scan_count = 10;
+    static const size_t k_lazyfree_threshold = 64 * 1024;   // bytes, larger values are freed in the background
+    static const int k_max_write_iov = 64;
+    static const size_t k_string_greedy_growth = 1 << 20;   // see entry_grow_string
+    static const size_t k_max_string_len = k_bitmap_max_bits / 8;  // append, setrange and setbit
+    static const uint64_t k_tier_interval_ms = 100;
+    static const uint64_t k_tier_step_ms = 5;      // time tiering may take per interval
+    static const size_t k_tier_scan_buckets = 256;
+    static const size_t k_compact_batch = 1 << 20;
+    static const uint64_t k_migrate_conn_idle_ms = k_tcp_idle_timeout / 2;    // before the target drops it
+    int tcp_fd = -1;
+    int unix_fd = -1;
+    bool listening = false;     // listener settings are fixed from here on
 private:
     void fd_set_nb(int connfd) {
         errno = 0;
@@ -58,6 +250,12 @@ private:
     }
 
 
+    void to_lower(std::string& s) {
+        for (char& c : s) {
+            c = (char)tolower((unsigned char)c);
+        }
+    }
+
     void buf_append(Buffer& buffer, const uint8_t* data, size_t len) {
         buffer.buffer_append(data, (int) len);
     }
@@ -110,21 +308,27 @@ private:
         write_1b_tag(buffer, JSON::TAG_NIL);
     }
 
-    // application callback when the listening socket is ready
-    Conn *handle_accept() {
+    // application callback when a listening socket is ready. TCP and unix
+    // socket clients get the same Conn and go through the same loop.
+    Conn *handle_accept(int listen_fd) {
         // accept
-        struct sockaddr_in client_addr = {};
+        struct sockaddr_storage client_addr = {};
         socklen_t addrlen = sizeof(client_addr);
-        int connfd = accept(fd, (struct sockaddr *)&client_addr, &addrlen);
+        int connfd = accept(listen_fd, (struct sockaddr *)&client_addr, &addrlen);
         if (connfd < 0) {
             msg_errno("accept() error");
             return NULL;
         }
-        uint32_t ip = client_addr.sin_addr.s_addr;
-        fprintf(stderr, "new client from %u.%u.%u.%u:%u\n",
-            ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, ip >> 24,
-            ntohs(client_addr.sin_port)
-        );
+        if (client_addr.ss_family == AF_INET) {
+            struct sockaddr_in* in_addr = (struct sockaddr_in*)&client_addr;
+            uint32_t ip = in_addr->sin_addr.s_addr;
+            fprintf(stderr, "new client from %u.%u.%u.%u:%u\n",
+                ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, ip >> 24,
+                ntohs(in_addr->sin_port)
+            );
+        } else {
+            fprintf(stderr, "new client on %s\n", config.unixsocket.c_str());
+        }
 
         fd_set_nb(connfd);
 
@@ -161,13 +365,16 @@ private:
         if (start >= end) {
             return -1;
         }
-        JSON tag;
-        memcpy(&tag, data, 1);
+        uint8_t tag = *start;
         start++;
         if (tag != JSON::TAG_ARR) {
             msg("Expected ARR");
             return -1;
         }
+        if (start + 4 > end) {
+            msg("parse_req: unexpected end of data");
+            return -1;
+        }
         uint32_t arr_len;
         memcpy(&arr_len, start, 4);
         start += 4;
@@ -179,7 +386,7 @@ private:
             if (start >= end) {
                 return -1;
             }
-            memcpy(&tag, start, 1);
+            tag = *start;
             start++;
             if (tag != JSON::TAG_STR) {
                 msg("Expected String");
@@ -206,45 +413,307 @@ private:
         return 0;
     }
 
-    bool try_one_request(Conn *conn) {
+    // Takes the next native frame off the read buffer. Returns 1 with the
+    // request in cmd and its length in consumed, 0 if it is not complete yet
+    // and -1 if the connection has to be closed.
+    int read_binary_request(Conn* conn, std::vector<std::string>& cmd, size_t& consumed) {
         if (conn->read_buffer.size() < 4) {
-            return false;   // want read
+            return 0;
         }
         uint32_t len = 0;
         memcpy(&len, conn->read_buffer.data_begin, 4);
         if (len > k_max_msg) {
             msg("too long");
-            conn->want_close = true;
-            return false;   // want close
+            return -1;
         }
         if (4 + len > (uint32_t)conn->read_buffer.size()) {
-            return false;   // want read
+            return 0;
         }
-        uint8_t* data_begin = conn->read_buffer.data_begin;
-        const uint8_t *request = data_begin + 4;
-
-        std::vector<std::string> cmd;
+        const uint8_t *request = conn->read_buffer.data_begin + 4;
         if (parse_req(request, len, cmd) < 0) {
             msg("bad request");
-            conn->want_close = true;
-            return false;   // want close
+            return -1;
+        }
+        consumed = 4 + len;
+        return 1;
+    }
+
+    // the RESP counterpart of read_binary_request; the parser keeps its place
+    // in a partly received request between calls
+    int read_resp_request(Conn* conn, std::vector<std::string>& cmd, size_t& consumed) {
+        const uint8_t* data = conn->read_buffer.data_begin;
+        RespStatus status = conn->resp_parser.parse(data, conn->read_buffer.size(), consumed);
+        if (status == RESP_INCOMPLETE) {
+            return 0;
+        }
+        if (status == RESP_ERROR) {
+            msg("bad RESP request");
+            return -1;
+        }
+        const std::vector<RespSlice>& args = conn->resp_parser.arguments();
+        cmd.reserve(args.size());
+        for (const RespSlice& arg : args) {
+            cmd.emplace_back(reinterpret_cast<const char*>(data + arg.offset), arg.len);
+        }
+        conn->resp_parser.reset();
+        return 1;
+    }
+
+    // runs one buffered request and charges its cost (the number of keys or
+    // arguments it carries, at least 1) to budget
+    bool try_one_request(Conn *conn, size_t& budget) {
+        if (conn->proto == PROTO_UNKNOWN) {
+            conn->proto = detect_protocol(conn->read_buffer.data_begin, conn->read_buffer.size());
+            if (conn->proto == PROTO_UNKNOWN) {
+                return false;   // want read
+            }
+        }
+        std::vector<std::string> cmd;
+        size_t consumed = 0;
+        int rv = conn->proto == PROTO_BINARY
+            ? read_binary_request(conn, cmd, consumed)
+            : read_resp_request(conn, cmd, consumed);
+        if (rv <= 0) {
+            conn->want_close = rv < 0;
+            return false;   // want read or want close
+        }
+        size_t cost = cmd.size() > 1 ? cmd.size() - 1 : 1;     // an empty request costs one too
+        budget -= std::min(cost, budget);
+        if (!cmd.empty()) {
+            normalize_command(cmd);
+        }
+        if (cmd.empty()) {
+            // an empty RESP line or array gets no reply
+        } else if (!conn->in_multi && do_pubsub_command(conn, cmd)) {
+            // replies written in place
+        } else if (!conn->subscriptions.empty() && conn->proto != PROTO_RESP3) {
+            // the replies of other commands could not be told apart from messages
+            write_conn_err(conn, SUBSCRIBED_ONLY);
+        } else if (cluster.enabled() && do_cluster_redirect(conn, cmd)) {
+            // asking, or a redirect written in place
+        } else if (do_transaction_command(conn, cmd)) {
+            // multi, exec, discard, (un)watch, or a command queued by multi
+        } else if (conn->proto == PROTO_BINARY) {
+            Buffer temp_buffer;
+            keyspace_write_begin();
+            do_request(cmd, temp_buffer);
+            touch_written_keys(cmd);
+            keyspace_write_end();
+            send_frame(temp_buffer, conn->write_buffer);
+        } else {
+            keyspace_write_begin();
+            do_resp_request(conn, cmd, conn->write_buffer);
+            touch_written_keys(cmd);
+            keyspace_write_end();
         }
-        Buffer temp_buffer;
-        do_request(cmd, temp_buffer);
-        send_frame(temp_buffer, conn->write_buffer);
-        buf_consume(conn->read_buffer, 4 + len);
+        used_memory_peak = std::max(used_memory_peak, used_memory());
+        buf_consume(conn->read_buffer, consumed);
         return true;
     }
 
+    // Every command the loop runs is a potential keyspace write as far as the
+    // reader threads are concerned; they retry lookups that overlap one.
+    void keyspace_write_begin() {
+        if (readers_running) {
+            keyspace_seq.write_begin();
+        }
+    }
+
+    void keyspace_write_end() {
+        if (readers_running) {
+            keyspace_seq.write_end();
+        }
+    }
+
+    // command names are case-insensitive, as are the subcommands that
+    // Redis clients commonly send in upper case
+    void normalize_command(std::vector<std::string>& cmd) {
+        to_lower(cmd[0]);
+        if (cmd.size() >= 2 && (cmd[0] == "config" || cmd[0] == "flushall" || cmd[0] == "bitop")) {
+            to_lower(cmd[1]);
+        }
+    }
+
     void send_frame(Buffer& temp_buffer, Buffer& write_buffer) {
         uint32_t data_len = (uint32_t)temp_buffer.size();
         write_buffer.buffer_append((uint8_t*)&data_len, 4);
         write_buffer.buffer_append(temp_buffer.data_begin, data_len);
     }
 
+    // an error reply written straight to the connection, in its protocol
+    void write_conn_err(Conn* conn, const std::string& err) {
+        if (conn->proto == PROTO_BINARY) {
+            Buffer reply;
+            write_err(reply, (const uint8_t*)err.data(), err.size());
+            send_frame(reply, conn->write_buffer);
+        } else {
+            resp_write_error(conn->write_buffer, err);
+        }
+    }
+
+    void write_conn_ok(Conn* conn) {
+        if (conn->proto == PROTO_BINARY) {
+            Buffer reply;
+            write_success(reply);
+            send_frame(reply, conn->write_buffer);
+        } else {
+            resp_write_simple(conn->write_buffer, "OK");
+        }
+    }
+
+    // Runs the buffered requests until the input runs dry, the connection's
+    // command budget for this loop turn is spent or the pending output crosses
+    // the soft limit.
+    //
+    // Past the soft limit the remaining requests stay unparsed in the read
+    // buffer and the socket is not polled for reads until handle_write drains
+    // the output below the low water mark, so a client that pipelines faster
+    // than it reads cannot grow our memory. When only the budget ran out the
+    // connection goes to the back of the ready queue and continues on a later
+    // turn, after every other connection had its share.
+    void process_requests(Conn* conn) {
+        size_t budget = config.command_budget == 0 ? (size_t)-1 : config.command_budget;
+        while (!conn->reading_paused && budget > 0 && try_one_request(conn, budget)) {
+            if (config.output_soft_limit != 0 && conn_output_size(conn) >= config.output_soft_limit) {
+                conn->reading_paused = true;
+            }
+        }
+        bool has_more = budget == 0 && !conn->reading_paused && !conn->want_close
+            && conn->read_buffer.size() > 0;
+        if (has_more && !conn->ready) {
+            ready_queue.insert(&conn->ready_node);
+            conn->ready = true;
+        } else if (!has_more && conn->ready) {
+            ready_queue.remove(&conn->ready_node);
+            conn->ready = false;
+        }
+        // a queued connection already has input to get through, reading more
+        // would only grow its buffer
+        conn->want_read = !conn->reading_paused && !conn->ready;
+        conn->want_write = conn_output_size(conn) > 0;
+        conn->read_buffer.shrink();
+        check_output_limit(conn);
+    }
+
+    // gives every connection that was waiting in the ready queue at the start
+    // of this loop turn one more budget of requests
+    void run_ready_connections(std::vector<Conn*>& fd2conn) {
+        if (ready_queue.tail->prev == ready_queue.head) {
+            return;
+        }
+        Node* last = ready_queue.head->next;  // newest entry when the pass starts
+        while (true) {
+            Node* node = ready_queue.tail->prev;
+            bool is_last = node == last;
+            Conn* conn = get_ready_connection(node);
+            ready_queue.remove(node);   // requeued at the front if it still has work
+            conn->ready = false;
+            touch_connection(conn);
+            process_requests(conn);
+            if (conn_output_size(conn) > 0 && !conn->want_close) {
+                handle_write(conn);
+            }
+            if (conn->want_close) {
+                conn_destroy(conn, fd2conn);
+            }
+            if (is_last) {
+                break;
+            }
+        }
+    }
+
+    // moves the connection to the front of the idle list
+    void touch_connection(Conn* conn) {
+        conn->last_active_ms = get_monotonic_msec();
+        dll.remove(&conn->node);
+        dll.insert(&conn->node);
+    }
+
+    void check_output_limit(Conn* conn) {
+        if (config.output_hard_limit == 0 || conn_output_size(conn) <= config.output_hard_limit) {
+            conn->output_hard_since_ms = 0;
+            return;
+        }
+        uint64_t now = get_monotonic_msec();
+        if (conn->output_hard_since_ms == 0) {
+            conn->output_hard_since_ms = now;
+        }
+        if (now - conn->output_hard_since_ms >= config.output_hard_seconds * 1000) {
+            msg("output buffer over the hard limit, closing client");
+            conn->want_close = true;
+            stats.output_limit_disconnections++;
+        }
+    }
+
+    // replies pending in write_buffer plus queued messages
+    size_t conn_output_size(Conn* conn) {
+        return (size_t)conn->write_buffer.size() + conn->out_message_bytes;
+    }
+
+    // Writes as much of the output as one writev takes: the write_buffer
+    // bytes up to the first queued message, that message straight from its
+    // shared buffer, the write_buffer bytes up to the next one and so on.
+    ssize_t write_output(Conn* conn) {
+        if (conn->out_messages.empty()) {
+            return write(conn->fd, conn->write_buffer.data_begin, conn->write_buffer.size());
+        }
+        struct iovec iov[k_max_write_iov];
+        int n = 0;
+        uint8_t* buf = conn->write_buffer.data_begin;
+        uint64_t pos = conn->write_buffer_sent;
+        size_t queued = 0;
+        for (QueuedMessage& q : conn->out_messages) {
+            if (n + 2 > k_max_write_iov) {
+                break;
+            }
+            if (q.position > pos) {
+                iov[n].iov_base = buf;
+                iov[n].iov_len = (size_t)(q.position - pos);
+                buf += iov[n].iov_len;
+                pos = q.position;
+                n++;
+            }
+            iov[n].iov_base = q.msg->data() + q.sent;
+            iov[n].iov_len = q.msg->size - q.sent;
+            n++;
+            queued++;
+        }
+        if (queued == conn->out_messages.size() && buf < conn->write_buffer.data_end) {
+            iov[n].iov_base = buf;
+            iov[n].iov_len = conn->write_buffer.data_end - buf;
+            n++;
+        }
+        return writev(conn->fd, iov, n);
+    }
+
+    // takes the n bytes just written off the output, in the order write_output sent them
+    void consume_output(Conn* conn, size_t n) {
+        while (n > 0 && !conn->out_messages.empty()) {
+            QueuedMessage& q = conn->out_messages.front();
+            size_t ahead = std::min((size_t)(q.position - conn->write_buffer_sent), n);
+            buf_consume(conn->write_buffer, ahead);
+            conn->write_buffer_sent += ahead;
+            n -= ahead;
+            if (q.position > conn->write_buffer_sent) {
+                return;     // n ran out before the message
+            }
+            size_t part = std::min(q.msg->size - q.sent, n);
+            q.sent += part;
+            conn->out_message_bytes -= part;
+            n -= part;
+            if (q.sent < q.msg->size) {
+                return;
+            }
+            message_unref(q.msg);
+            conn->out_messages.pop_front();
+        }
+        buf_consume(conn->write_buffer, n);
+        conn->write_buffer_sent += n;
+    }
+
     void handle_write(Conn *conn) {
-        assert(conn->write_buffer.size() > 0);
-        ssize_t rv = write(conn->fd, conn->write_buffer.data_begin, conn->write_buffer.size());
+        assert(conn_output_size(conn) > 0);
+        ssize_t rv = write_output(conn);
         if (rv < 0 && errno == EAGAIN) {
             return;
         }
@@ -254,19 +723,32 @@ private:
             return;
         }
 
-        buf_consume(conn->write_buffer, (size_t)rv);
+        consume_output(conn, (size_t)rv);
+        conn->write_buffer.shrink();
 
-        if (conn->write_buffer.size() == 0) {
-            conn->want_read = true;
-            conn->want_write = false;
+        if (conn->reading_paused && conn_output_size(conn) <= config.output_soft_limit / 2) {
+            conn->reading_paused = false;
+            process_requests(conn);
+            return;
         }
+        conn->want_write = conn_output_size(conn) > 0;
+        check_output_limit(conn);
     }
 
     // application callback when the socket is readable
     void handle_read(Conn *conn) {
-        uint8_t buf[64 * 1024];
-        ssize_t rv = read(conn->fd, buf, sizeof(buf));
+        // read straight into the free space of the connection buffer, which
+        // is a pooled chunk unless a large request is being assembled. The
+        // RESP header of a large value tells its size, so room for the rest
+        // of it is made at once.
+        size_t wanted = k_min_read;
+        if (conn->proto == PROTO_RESP2 || conn->proto == PROTO_RESP3) {
+            wanted = std::max(wanted, conn->resp_parser.bytes_wanted(conn->read_buffer.size()));
+        }
+        uint8_t* tail = conn->read_buffer.reserve(wanted);
+        ssize_t rv = read(conn->fd, tail, conn->read_buffer.buffer_end - tail);
         if (rv < 0 && errno == EAGAIN) {
+            conn->read_buffer.shrink();
             return; // actually not ready
         }
         if (rv < 0) {
@@ -283,260 +765,3880 @@ private:
             conn->want_close = true;
             return;
         }
-        buf_append(conn->read_buffer, buf, (size_t)rv);
+        conn->read_buffer.commit((size_t)rv);
 
-        while (try_one_request(conn)) {}
+        process_requests(conn);
 
-        if (conn->write_buffer.size() > 0) {    // has a response
-            conn->want_read = false;
-            conn->want_write = true;
+        if (conn_output_size(conn) > 0 && !conn->want_close) {    // has a response
             return handle_write(conn);
         } 
     }
 
-    void do_get_multi(std::vector<std::string>& keys, Buffer& write_buffer) {
-        write_arr(write_buffer, keys.size());
-        for (std::string& key: keys)  {
-            std::cout << "GETTING KEY: " << key << std::endl;
-            uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
-            Entry e;
-            e.key = key;
-            e.node.hash_code = hash_code;
-            HNode* result = htable.hm_lookup(&e.node, &eq);
-            if (result == nullptr) {
-                write_err(write_buffer, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
-                continue;
-            }
-            Entry* entry = get_entry(result);
-            std::string& value = entry->value;
-            write_string(write_buffer, (uint8_t*)value.data(), value.size());
+    size_t used_memory() {
+        size_t index_memory = prefix_index == nullptr ? 0 : prefix_index->mem_usage();
+        return entries_memory + htable.hm_mem_usage() + entry_heap.mem_usage() + index_memory + slot_entries_memory;
+    }
+
+    uint32_t initial_lru() {
+        if (config.maxmemory_policy == EVICT_ALLKEYS_LFU) {
+            return lfu_init();
         }
+        return lru_clock();
     }
 
-    void do_delete(std::string& key, Buffer& buffer) {
-        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
+    void touch_entry(Entry* e) {
+        if (config.maxmemory_policy == EVICT_ALLKEYS_LFU) {
+            e->lru = lfu_touch(e->lru);
+        } else {
+            e->lru = lru_clock();
+        }
+    }
+
+    // plain lookup, does not count as an access
+    Entry* find_entry(const std::string& key, uint64_t hash_code) {
         Entry e;
         e.key = key;
         e.node.hash_code = hash_code;
-        HNode* result = htable.hm_delete(&e.node, &eq);
+        HNode* result = htable.hm_lookup(&e.node, &eq);
         if (result == nullptr) {
-            write_err(buffer, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
-            return;
+            return nullptr;
         }
-        Entry* result_entry = get_entry(result);
-        entry_heap.expire_entry(result_entry->heap_idx);
-        delete result_entry;
-        write_success(buffer);
+        return get_entry(result);
     }
 
-    void set_heap_entry_ttl(Entry* e, uint64_t ttl) {
-        uint64_t expire_time = get_monotonic_msec() + ttl;
-        if (ttl == (uint64_t)0) {
-            entry_heap.expire_entry(e->heap_idx);
-            e->heap_idx = -1;
-            return;
-        }
-        if (e->heap_idx < entry_heap.heap_size()) {
-            entry_heap.set_expire_time(e->heap_idx, expire_time);
-        } else {
-            HeapEntry* new_entry = new HeapEntry();
-            new_entry->expire_time = expire_time;
-            new_entry->heap_idx_ref = &e->heap_idx;
-            entry_heap.add_heap_entry(*new_entry);
+    // lookup for commands that only deal with the key or replace the value
+    // whole, a tiered value stays on disk
+    Entry* lookup_key(const std::string& key, uint64_t hash_code) {
+        Entry* entry = find_entry(key, hash_code);
+        if (entry != nullptr) {
+            touch_entry(entry);
         }
+        return entry;
     }
 
-    void do_set(std::string& key, std::string& value, Buffer& out, uint64_t ttl = k_default_entry_timeout) {
-        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
-        Entry e;
-        e.key=key;
-        e.node.hash_code = hash_code;
-        HNode* existing_node = htable.hm_lookup(&e.node, &eq);
-        if (existing_node != nullptr) {
-            Entry* existing_entry = get_entry(existing_node);
-            existing_entry->value = value;
-            set_heap_entry_ttl(existing_entry, ttl);
-            write_success(out);
-        } else{
-            Entry* new_entry = new Entry();
-            HNode* new_node = new HNode();
-            new_node->hash_code = hash_code;
-            new_entry->key = key;
-            new_entry->value = value;
-            new_entry->node = *new_node;
-            new_entry->heap_idx = entry_heap.heap_size();
-            htable.hm_insert(&new_entry->node);
-            set_heap_entry_ttl(new_entry, ttl);
-            write_success(out);
-        }
+    Entry* lookup_key(const std::string& key) {
+        return lookup_key(key, fnv_hash((uint8_t*)key.data(), key.size()));
     }
-    
-    void do_persist(std::string& key, Buffer& out) {
-        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
-        Entry e;
-        e.key = key;
-        e.node.hash_code = hash_code;
-        HNode* existing_node = htable.hm_lookup(&e.node, &eq);
-        if (existing_node == nullptr) {
-            write_err(out, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
-            return;
+
+    // lookup for commands that work on the value, which is brought back
+    // into memory if it was tiered; get reads it where it is instead
+    Entry* lookup_entry(const std::string& key, uint64_t hash_code) {
+        Entry* entry = lookup_key(key, hash_code);
+        if (entry != nullptr && entry->type == VAL_DISK) {
+            entry_load(entry);
         }
-        Entry* existing_entry = get_entry(existing_node);
-        entry_heap.expire_entry(existing_entry->heap_idx);
-        existing_entry -> heap_idx = -1;
-        write_success(out);
+        return entry;
     }
 
-    void do_set_expire(std::string& key, uint64_t ttl, Buffer& out) {
-        uint64_t hash_code = fnv_hash((uint8_t*) key.data(), key.size());
-        Entry e;
-        e.node.hash_code = hash_code;
-        e.key = key;
-        HNode* existing_node =  htable.hm_lookup(&e.node, &eq);
-        if (existing_node == nullptr) {
-            write_err(out, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
-            return;
+    Entry* lookup_entry(const std::string& key) {
+        return lookup_entry(key, fnv_hash((uint8_t*)key.data(), key.size()));
+    }
+
+    // Batched lookup for multi-key commands: hashes keys[first..] up front and
+    // lets the table overlap the bucket and entry cache misses. The keys are
+    // borrowed for the duration of the call and handed back untouched.
+    void lookup_entries(std::vector<std::string>& keys, size_t first, std::vector<Entry*>& out) {
+        size_t n = keys.size() - first;
+        if (lookup_probes.size() < n) {
+            lookup_probes.resize(n);
         }
-        Entry* existing_entry = get_entry(existing_node);
-        if (existing_entry->heap_idx == (size_t)-1) {
-            write_err(out, (uint8_t*)EXPIRE_PERSISTENT_NODE_ERR.data(), EXPIRE_PERSISTENT_NODE_ERR.size());
-            return;
+        lookup_targets.resize(n);
+        lookup_results.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            Entry& probe = lookup_probes[i];
+            probe.key.swap(keys[first + i]);
+            probe.node.hash_code = fnv_hash((uint8_t*)probe.key.data(), probe.key.size());
+            lookup_targets[i] = &probe.node;
         }
-        set_heap_entry_ttl(existing_entry, ttl);
-        write_success(out);
-    }
-    
-    void do_request(std::vector<std::string> &cmd, Buffer& out) {
-        if (cmd.size() >= 2  && cmd[0] == "get") {
-            std::vector<std::string> keys;
-            for (size_t i = 1; i < cmd.size(); i++) {
-                keys.push_back(cmd[i]);
-            }
-            do_get_multi(keys, out);
-        } else if (cmd.size() == 3 && cmd[0] == "set") {
-            std::string& key = cmd[1];
-            std::string& value = cmd[2];
-            do_set(key, value, out);
-        } else if (cmd.size() == 2 && cmd[0] == "del") {
-            std::string& key = cmd[1];
-            do_delete(key, out);
-        } else if (cmd.size() == 3 && cmd[0] == "expire") {
-            std::string& key = cmd[1];
-            int64_t new_ttl= std::stoll(cmd[2]);
-            if (new_ttl <= 0) {
-                write_err(out, (uint8_t*)INVALID_TTL.data(), INVALID_TTL.size());
-                return;
-            }
-            do_set_expire(key, (uint64_t)new_ttl, out);
-        } else if (cmd.size() == 4 && cmd[0] == "set") {
-            std::string& key = cmd[1];
-            std::string& value = cmd[2];
-            int64_t ttl = std::stoll(cmd[3]);
-            if (ttl <= 0) {
-                write_err(out, (uint8_t*)INVALID_TTL.data(), INVALID_TTL.size());
-                return;
+        htable.hm_lookup_batch(lookup_targets.data(), n, &eq, lookup_results.data());
+        out.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            keys[first + i].swap(lookup_probes[i].key);
+            out[i] = lookup_results[i] == nullptr ? nullptr : get_entry(lookup_results[i]);
+            if (out[i] != nullptr) {
+                touch_entry(out[i]);
             }
-            do_set(key, value, out, ttl);
-        } else if (cmd.size() == 2 && cmd[0] == "persist") {
-            std::string& key = cmd[1];
-            do_persist(key, out);
-        } else {
-            write_err(out);
         }
     }
 
-    int determine_timeout() {
-        uint64_t curr_time = get_monotonic_msec();
-        uint64_t min_expire_time = (uint64_t)-1;
-        if (dll.tail->prev != dll.head) {
-            Node* node = dll.tail->prev;
-            Conn* e = get_connection(node);
-            uint64_t expiry_time = e->last_active_ms + k_tcp_idle_timeout;
-            min_expire_time = expiry_time; 
-        }
-        if (entry_heap.heap_size() > 0) {
-            HeapEntry& first_entry = entry_heap.top();
-            uint64_t expiry_time = first_entry.expire_time;
-            min_expire_time = std::min(min_expire_time, expiry_time);
+    // integers are kept natively instead of as text
+    void entry_encode_value(Entry* e, const std::string& value) {
+        int64_t int_val = 0;
+        if (parse_canonical_int(value, int_val)) {
+            entry_drop_string(e);
+            e->type = VAL_INT;
+            e->int_val = int_val;
+        } else {
+            if (value.size() > e->value.capacity()) {
+                entry_drop_string(e);   // instead of letting the assignment free it
+            }
+            e->type = VAL_STR;
+            e->value = value;
         }
+    }
 
-        if (min_expire_time == (uint64_t)-1) {
-            return -1;
+    void entry_set_value(Entry* e, const std::string& value) {
+        entries_memory -= entry_mem_usage(e);
+        if (entry_owns_object(e)) {
+            entry_free_value(e);
+        } else if (e->type == VAL_DISK) {
+            value_log.release(e->loc);
         }
-        if (min_expire_time >= curr_time) {
-            return (int)(min_expire_time - curr_time);
-        }
-        return 0;
+        entry_encode_value(e, value);
+        entries_memory += entry_mem_usage(e);
     }
 
-    void handle_expired_connections(std::vector<Conn*>& fd2conn) {
-        // removes old tcp connections 
-        uint64_t curr_time = get_monotonic_msec();
-        Node* node = dll.tail->prev;
-        while (node != dll.head) {
-            Conn* connection = get_connection(node);
-            Node* prev_node = node->prev;
-            if (connection->last_active_ms + k_tcp_idle_timeout > curr_time) {
-                return;
-            }
-            conn_destroy(connection, fd2conn);
-            node = prev_node;
-        }
+    void entry_set_int(Entry* e, int64_t value) {
+        entries_memory -= entry_mem_usage(e);
+        entry_drop_string(e);
+        e->type = VAL_INT;
+        e->int_val = value;
+        entries_memory += entry_mem_usage(e);
+    }
 
-        // removes old entries from entry_heap
-        while (entry_heap.heap_size() > 0) {
-            HeapEntry& entry = entry_heap.top();
-            if (entry.expire_time > curr_time) {
+    void entry_set_double(Entry* e, double value) {
+        entries_memory -= entry_mem_usage(e);
+        entry_drop_string(e);
+        e->type = VAL_DBL;
+        e->dbl_val = value;
+        entries_memory += entry_mem_usage(e);
+    }
+
+    // the text of a double value, as get shows it over RESP
+    static std::string double_text(double val) {
+        char num[32];
+        return std::string(num, snprintf(num, sizeof(num), "%.17g", val));
+    }
+
+    // Integers and doubles keep their type for binary clients. RESP clients
+    // expect a bulk string from anything returning a value, so there they
+    // go out as text; only counter commands reply with integers.
+    void write_value(Buffer& out, Entry* e) {
+        if (values_as_text && (e->type == VAL_INT || e->type == VAL_DBL)) {
+            std::string text = e->type == VAL_INT ? std::to_string(e->int_val) : double_text(e->dbl_val);
+            write_string(out, (const uint8_t*)text.data(), text.size());
+            return;
+        }
+        switch (e->type) {
+            case VAL_INT:
+                write_int64(out, e->int_val);
+                break;
+            case VAL_DBL:
+                write_double(out, e->dbl_val);
+                break;
+            case VAL_ZSET:
+            case VAL_BLOOM:
+                write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+                break;
+            case VAL_DISK: {
+                size_t len = 0;
+                const char* data = value_log.value(e->loc, len);
+                write_string(out, (const uint8_t*)data, len);
                 break;
             }
-            Entry* e = get_entry_from_heap_idx(entry.heap_idx_ref);
-            htable.hm_delete(&e->node, &eq);
-            entry_heap.expire_entry(e->heap_idx);
-            delete e;
+            default:
+                write_string(out, (uint8_t*)e->value.data(), e->value.size());
+                break;
         }
     }
 
-    void conn_destroy(Conn* connection, std::vector<Conn*>& fd2conn) {
-        (void)close(connection->fd);
-        fd2conn[connection->fd] = NULL;
-        dll.remove(&connection->node);
-        delete connection;
+    static void free_entry(Entry* e) {
+        entry_free_value(e);
+        delete e;
     }
 
-public:
-    Server() : htable(4) {}
+    static void free_entry_job(void* arg) {
+        free_entry((Entry*)arg);
+    }
 
-    void run_server() {
-        // the listening socket
-        fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (fd < 0) {
-            die("socket()");
+    static void free_table_callback(HNode* node, void* arg) {
+        (void)arg;
+        free_entry(get_entry(node));
+    }
+
+    static void free_table_job(void* arg) {
+        HTable* table = (HTable*)arg;
+        size_t cursor = 0;
+        do {
+            cursor = table->hm_scan(cursor, &free_table_callback, nullptr);
+        } while (cursor != 0);
+        delete table;
+    }
+
+    static void free_index_job(void* arg) {
+        delete (RadixTree*)arg;
+    }
+
+    // Frees memory that was unlinked from the keyspace, on the lazy free
+    // thread when lazy is set. With reader threads running it is retired
+    // instead, a reader may still be looking at it; reclaim_retired frees it
+    // once they all moved on.
+    void dispose(void (*fn)(void*), void* arg, size_t bytes, bool lazy) {
+        if (readers_running) {
+            reclaimer.retire(fn, arg, bytes);
+        } else if (lazy) {
+            lazy_freer.submit(fn, arg, bytes);
+        } else {
+            fn(arg);
         }
-        int val = 1;
-        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    }
+
+    void reclaim_retired() {
+        reclaimer.collect(reclaimable);
+        for (RetiredObject& obj : reclaimable) {
+            if (obj.bytes >= k_lazyfree_threshold) {
+                lazy_freer.submit(obj.fn, obj.arg, obj.bytes);
+            } else {
+                obj.fn(obj.arg);
+            }
+        }
+        reclaimable.clear();
+    }
+
+    static void free_string_job(void* arg) {
+        delete (std::string*)arg;
+    }
+
+    static void free_buckets_job(void* arg) {
+        delete [] (HNode**)arg;
+    }
+
+    static void retire_buckets(HNode** buckets, size_t cap, void* arg) {
+        Server* server = (Server*)arg;
+        server->reclaimer.retire(&free_buckets_job, buckets, cap * sizeof(HNode*));
+    }
+
+    // Releases the string storage of an entry. A reader thread may be copying
+    // out of that buffer, so with readers running it is retired, not freed.
+    // The buffer of a short string is part of the entry and stays put.
+    void entry_drop_string(Entry* e) {
+        const char* data = e->value.data();
+        bool inline_buffer = data >= (const char*)&e->value && data < (const char*)(&e->value + 1);
+        if (readers_running && !inline_buffer) {
+            std::string* old = new std::string();
+            old->swap(e->value);
+            reclaimer.retire(&free_string_job, old, old->capacity());
+            return;
+        }
+        std::string().swap(e->value);
+    }
+
+    // moves the string value of e to the value log, false if the log is full
+    bool entry_spill(Entry* e) {
+        ValueLoc loc;
+        if (!value_log.append(e->key.data(), e->key.size(), e->value.data(), e->value.size(), loc)) {
+            return false;
+        }
+        entries_memory -= entry_mem_usage(e);
+        entry_drop_string(e);
+        e->type = VAL_DISK;
+        e->loc = loc;
+        entries_memory += entry_mem_usage(e);
+        return true;
+    }
+
+    // brings a tiered value back into memory, reading it from the page
+    // cache or, if it was paged out, from disk
+    void entry_load(Entry* e) {
+        size_t len = 0;
+        const char* data = value_log.value(e->loc, len);
+        std::string value(data, len);
+        value_log.release(e->loc);
+        entries_memory -= entry_mem_usage(e);
+        e->type = VAL_STR;
+        e->value.swap(value);   // the empty value kept no storage to retire
+        entries_memory += entry_mem_usage(e);
+    }
+
+    std::vector<Entry*>& slot_keys(Entry* e) {
+        return slot_entries[key_hash_slot(e->key.data(), e->key.size())];
+    }
+
+    void slot_index_add(Entry* e) {
+        std::vector<Entry*>& keys = slot_keys(e);
+        slot_entries_memory -= keys.capacity() * sizeof(Entry*);
+        e->slot_pos = (uint32_t)keys.size();
+        keys.push_back(e);
+        slot_entries_memory += keys.capacity() * sizeof(Entry*);
+    }
+
+    // the last key of the slot takes the place of e
+    void slot_index_remove(Entry* e) {
+        std::vector<Entry*>& keys = slot_keys(e);
+        Entry* last = keys.back();
+        keys[e->slot_pos] = last;
+        last->slot_pos = e->slot_pos;
+        keys.pop_back();
+    }
+
+    // detaches the entry from the table, the ttl heap, the prefix index and
+    // the slot index without freeing it, returns the bytes it holds
+    size_t entry_unlink(Entry* e) {
+        htable.hm_delete(&e->node, &eq);
+        if (e->type == VAL_DISK) {
+            value_log.release(e->loc);
+        }
+        entry_heap.expire_entry(e->heap_idx);
+        if (prefix_index != nullptr) {
+            prefix_index->remove(e->key);
+        }
+        if (slot_entries != nullptr) {
+            slot_index_remove(e);
+        }
+        size_t bytes = entry_mem_usage(e);
+        entries_memory -= bytes;
+        return bytes;
+    }
+
+    // unlinks the entry and frees it, in the background when it is large
+    // enough that freeing inline would stall the loop
+    void entry_delete(Entry* e) {
+        size_t bytes = entry_unlink(e);
+        dispose(&free_entry_job, e, bytes, bytes >= k_lazyfree_threshold);
+    }
+
+    uint64_t eviction_score(Entry* e) {
+        if (config.maxmemory_policy == EVICT_ALLKEYS_LFU) {
+            return 255 - lfu_decayed_counter(e->lru);
+        }
+        return lru_idle_ms(e->lru);
+    }
+
+    // evicts a single key according to the configured policy, returns false
+    // when there is nothing left that the policy allows us to evict
+    bool evict_one() {
+        if (config.maxmemory_policy == EVICT_VOLATILE_TTL) {
+            if (entry_heap.heap_size() == 0) {
+                return false;
+            }
+            entry_delete(get_entry_from_heap_idx(entry_heap.top().heap_idx_ref));
+            stats.evicted_keys++;
+            return true;
+        }
+        for (size_t round = 0; round < k_max_eviction_rounds; round++) {
+            // sample a few keys into the pool, then evict the best candidate
+            // that still exists
+            for (size_t i = 0; i < config.maxmemory_samples; i++) {
+                HNode* node = htable.hm_random();
+                if (node == nullptr) {
+                    continue;   // an empty or very sparse table
+                }
+                Entry* e = get_entry(node);
+                eviction_pool.insert(eviction_score(e), e->key);
+            }
+            std::string key;
+            while (eviction_pool.pop_best(key)) {
+                Entry* e = find_entry(key, fnv_hash((uint8_t*)key.data(), key.size()));
+                if (e != nullptr) {
+                    entry_delete(e);
+                    stats.evicted_keys++;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // called before commands that may grow memory. Eviction is incremental:
+    // at most k_max_evictions_per_write keys are freed per write, so a single
+    // command never stalls the loop even when far above the limit.
+    bool ensure_memory(Buffer& out) {
+        if (config.maxmemory == 0 || used_memory() <= config.maxmemory) {
+            return true;
+        }
+        if (config.maxmemory_policy != EVICT_NOEVICTION) {
+            size_t evicted = 0;
+            while (evicted < k_max_evictions_per_write && used_memory() > config.maxmemory) {
+                if (!evict_one()) {
+                    break;
+                }
+                evicted++;
+            }
+            if (evicted > 0) {
+                return true;
+            }
+        }
+        write_err(out, (uint8_t*)OOM_ERROR.data(), OOM_ERROR.size());
+        return false;
+    }
+
+    void do_get_multi(std::vector<std::string>& cmd, size_t first, Buffer& write_buffer) {
+        std::vector<Entry*> entries;
+        for (size_t i = first; i < cmd.size(); i++) {
+            hot_keys.access(cmd[i]);
+        }
+        lookup_entries(cmd, first, entries);
+        write_arr(write_buffer, entries.size());
+        for (Entry* entry : entries)  {
+            if (entry == nullptr) {
+                stats.keyspace_misses++;
+                write_err(write_buffer, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+                continue;
+            }
+            stats.keyspace_hits++;
+            write_value(write_buffer, entry);
+        }
+    }
+
+    void do_delete(std::string& key, Buffer& buffer) {
+        Entry* result_entry = lookup_key(key);
+        if (result_entry == nullptr) {
+            write_err(buffer, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
+            return;
+        }
+        entry_delete(result_entry);
+        write_success(buffer);
+    }
+
+    void set_heap_entry_ttl(Entry* e, uint64_t ttl) {
+        uint64_t expire_time = get_monotonic_msec() + ttl;
+        if (ttl == (uint64_t)0) {
+            entry_heap.expire_entry(e->heap_idx);
+            e->heap_idx = -1;
+            return;
+        }
+        if (e->heap_idx < entry_heap.heap_size()) {
+            entry_heap.set_expire_time(e->heap_idx, expire_time);
+        } else {
+            HeapEntry new_entry;
+            new_entry.expire_time = expire_time;
+            new_entry.heap_idx_ref = &e->heap_idx;
+            entry_heap.add_heap_entry(new_entry);
+        }
+    }
+
+    // inserts the key or overwrites its value, resetting the ttl either way
+    Entry* upsert_entry(std::string& key, uint64_t hash_code, std::string& value, uint64_t ttl) {
+        return entry_store(lookup_key(key, hash_code), key, hash_code, value, ttl, false);
+    }
+
+    // Stores value under key, in existing when the caller already looked the
+    // key up and found it. The ttl is set to ttl (0 for none) unless keep_ttl,
+    // which leaves a new key without one.
+    Entry* entry_store(Entry* existing, std::string& key, uint64_t hash_code, std::string& value,
+            uint64_t ttl, bool keep_ttl) {
+        if (existing != nullptr) {
+            entry_set_value(existing, value);
+            if (!keep_ttl) {
+                set_heap_entry_ttl(existing, ttl);
+            }
+            return existing;
+        }
+        Entry* new_entry = new Entry();
+        entry_encode_value(new_entry, value);
+        entry_link_new(new_entry, key, hash_code, keep_ttl ? 0 : ttl);
+        return new_entry;
+    }
+
+    // inserts a freshly allocated entry whose value is already set
+    void entry_link_new(Entry* new_entry, std::string& key, uint64_t hash_code, uint64_t ttl) {
+        new_entry->node.hash_code = hash_code;
+        new_entry->key = key;
+        new_entry->heap_idx = entry_heap.heap_size();
+        new_entry->lru = initial_lru();
+        new_entry->version = ++key_version;
+        htable.hm_insert(&new_entry->node);
+        if (prefix_index != nullptr) {
+            prefix_index->insert(new_entry);
+        }
+        if (slot_entries != nullptr) {
+            slot_index_add(new_entry);
+        }
+        entries_memory += entry_mem_usage(new_entry);
+        set_heap_entry_ttl(new_entry, ttl);
+    }
+
+    void do_set(std::string& key, std::string& value, Buffer& out, uint64_t ttl = k_default_entry_timeout) {
+        hot_keys.access(key);
+        upsert_entry(key, fnv_hash((uint8_t*)key.data(), key.size()), value, ttl);
+        write_success(out);
+    }
+
+    // A ttl option of set or getex at cmd[i]: ex <seconds>, px <ms> or
+    // persist, or keepttl for set. Writes the error if it is not one.
+    bool parse_ttl_option(std::vector<std::string>& cmd, size_t& i, SetOptions& opts, bool allow_keep,
+            Buffer& out) {
+        std::string opt = cmd[i];
+        to_lower(opt);
+        bool ok = !opts.has_ttl;
+        if ((opt == "ex" || opt == "px") && i + 1 < cmd.size() && ok) {
+            int64_t n = 0;
+            const std::string* err = nullptr;
+            if (!parse_int(cmd[++i], n)) {
+                err = &NOT_AN_INTEGER;
+            } else if (n <= 0) {
+                err = &INVALID_TTL;
+            } else if (opt == "ex" && n > INT64_MAX / 1000) {
+                err = &INVALID_EXPIRE_TIME;
+            }
+            if (err != nullptr) {
+                write_err(out, (uint8_t*)err->data(), err->size());
+                return false;
+            }
+            opts.ttl = opt == "ex" ? (uint64_t)n * 1000 : (uint64_t)n;
+        } else if (opt == "persist") {
+            opts.ttl = 0;
+        } else if (opt == "keepttl" && allow_keep) {
+            opts.keep_ttl = true;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return false;
+        }
+        opts.has_ttl = true;
+        return true;
+    }
+
+    // set key value [ttl] [nx|xx] [get] [ex s|px ms|persist|keepttl]. A plain
+    // number right after the value is a ttl in ms, as it always was, and
+    // without any the key gets the default ttl like with a plain set.
+    bool parse_set_options(std::vector<std::string>& cmd, SetOptions& opts, Buffer& out) {
+        opts.ttl = k_default_entry_timeout;
+        size_t i = 3;
+        int64_t ttl = 0;
+        if (i < cmd.size() && parse_int(cmd[i], ttl)) {
+            if (ttl <= 0) {
+                write_err(out, (uint8_t*)INVALID_TTL.data(), INVALID_TTL.size());
+                return false;
+            }
+            opts.ttl = (uint64_t)ttl;
+            opts.has_ttl = true;
+            i++;
+        }
+        for (; i < cmd.size(); i++) {
+            std::string opt = cmd[i];
+            to_lower(opt);
+            if (opt == "nx" || opt == "xx") {
+                (opt == "nx" ? opts.nx : opts.xx) = true;
+                if (opts.nx && opts.xx) {
+                    write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+                    return false;
+                }
+            } else if (opt == "get") {
+                opts.get = true;
+            } else if (!parse_ttl_option(cmd, i, opts, true, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // set with options, on a single lookup of the key: the entry it finds
+    // decides nx and xx, supplies the old value to get and is written in
+    // place. Replies OK, or the old value with get; null when nx or xx held
+    // the write back (and get found nothing).
+    void do_set_options(std::string& key, std::string& value, const SetOptions& opts, Buffer& out) {
+        hot_keys.access(key);
+        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
+        Entry* e = lookup_key(key, hash_code);
+        if (opts.get && e != nullptr && (e->type == VAL_ZSET || e->type == VAL_BLOOM)) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        bool write = !(opts.nx && e != nullptr) && !(opts.xx && e == nullptr);
+        if (opts.get && e != nullptr) {
+            write_value(out, e);    // before the overwrite frees a tiered record
+        } else if (opts.get || !write) {
+            write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+        } else {
+            write_success(out);
+        }
+        if (write) {
+            entry_store(e, key, hash_code, value, opts.ttl, opts.keep_ttl);
+        }
+    }
+
+    // getex key [ex s|px ms|persist]: get that also sets or clears the ttl
+    void do_getex(std::vector<std::string>& cmd, Buffer& out) {
+        SetOptions opts;
+        for (size_t i = 2; i < cmd.size(); i++) {
+            if (!parse_ttl_option(cmd, i, opts, false, out)) {
+                return;
+            }
+        }
+        std::string& key = cmd[1];
+        hot_keys.access(key);
+        Entry* e = lookup_key(key);
+        if (e == nullptr) {
+            stats.keyspace_misses++;
+            write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+            return;
+        }
+        stats.keyspace_hits++;
+        write_value(out, e);
+        if (opts.has_ttl && e->type != VAL_ZSET && e->type != VAL_BLOOM) {
+            set_heap_entry_ttl(e, opts.ttl);
+        }
+    }
+
+    // getdel key: the value, and the key deleted. Keys of other types are
+    // left alone, as get would fail on them.
+    void do_getdel(std::string& key, Buffer& out) {
+        hot_keys.access(key);
+        Entry* e = lookup_key(key);
+        if (e == nullptr) {
+            stats.keyspace_misses++;
+            write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+            return;
+        }
+        stats.keyspace_hits++;
+        write_value(out, e);
+        if (e->type != VAL_ZSET && e->type != VAL_BLOOM) {
+            entry_delete(e);
+        }
+    }
+
+    // cmd[first..] holds key value pairs. Existing keys are found with one
+    // batched lookup, the table is grown once for the missing ones and the
+    // whole batch gets a single reply.
+    void do_mset(std::vector<std::string>& cmd, size_t first, uint64_t ttl, Buffer& out) {
+        std::vector<std::string> keys;
+        keys.reserve((cmd.size() - first) / 2);
+        for (size_t i = first; i < cmd.size(); i += 2) {
+            keys.push_back(std::move(cmd[i]));
+        }
+        std::vector<Entry*> entries;
+        lookup_entries(keys, 0, entries);
+        size_t missing = 0;
+        for (Entry* entry : entries) {
+            missing += entry == nullptr;
+        }
+        htable.hm_reserve(missing);
+        for (size_t i = 0; i < keys.size(); i++) {
+            std::string& value = cmd[first + 2 * i + 1];
+            if (entries[i] != nullptr) {
+                entry_set_value(entries[i], value);
+                set_heap_entry_ttl(entries[i], ttl);
+            } else {
+                // looked up again in case the key repeats within the batch
+                upsert_entry(keys[i], fnv_hash((uint8_t*)keys[i].data(), keys[i].size()), value, ttl);
+            }
+        }
+        for (size_t i = 0; i < keys.size(); i++) {
+            cmd[first + 2 * i] = std::move(keys[i]);
+        }
+        write_success(out);
+    }
+
+    // missing keys start from 0 and get the default ttl, like a plain set
+    Entry* lookup_or_create_counter(std::string& key) {
+        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
+        Entry* entry = lookup_entry(key, hash_code);
+        if (entry == nullptr) {
+            std::string zero = "0";
+            entry = upsert_entry(key, hash_code, zero, k_default_entry_timeout);
+        }
+        return entry;
+    }
+
+    void do_incrby(std::string& key, int64_t delta, Buffer& out) {
+        Entry* entry = lookup_or_create_counter(key);
+        if (entry_owns_object(entry)) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        int64_t current = 0;
+        if (entry->type == VAL_INT) {
+            current = entry->int_val;
+        } else if (entry->type != VAL_STR || !parse_int(entry->value, current)) {
+            write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+            return;
+        }
+        int64_t result = 0;
+        if (__builtin_add_overflow(current, delta, &result)) {
+            write_err(out, (uint8_t*)INCR_OVERFLOW.data(), INCR_OVERFLOW.size());
+            return;
+        }
+        entry_set_int(entry, result);
+        write_int64(out, result);
+    }
+
+    void do_incrbyfloat(std::string& key, double delta, Buffer& out) {
+        Entry* entry = lookup_or_create_counter(key);
+        if (entry_owns_object(entry)) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        double current = 0;
+        if (entry->type == VAL_INT) {
+            current = (double)entry->int_val;
+        } else if (entry->type == VAL_DBL) {
+            current = entry->dbl_val;
+        } else if (!parse_double(entry->value, current)) {
+            write_err(out, (uint8_t*)NOT_A_FLOAT.data(), NOT_A_FLOAT.size());
+            return;
+        }
+        double result = current + delta;
+        if (std::isinf(result)) {
+            write_err(out, (uint8_t*)INCR_OVERFLOW.data(), INCR_OVERFLOW.size());
+            return;
+        }
+        entry_set_double(entry, result);
+        write_double(out, result);
+    }
+
+    // finds the sorted set at key. Returns nullptr both when the key is missing
+    // and when it holds another type, in which case an error has been written.
+    Entry* lookup_zset(std::string& key, Buffer& out, bool& wrong_type) {
+        Entry* entry = lookup_entry(key);
+        wrong_type = entry != nullptr && entry->type != VAL_ZSET;
+        if (wrong_type) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return nullptr;
+        }
+        return entry;
+    }
+
+    // Finds the HyperLogLog at key. Returns nullptr both when the key is
+    // missing and when it holds something else, in which case an error has
+    // been written.
+    Entry* lookup_hll(const std::string& key, Buffer& out, bool& invalid) {
+        Entry* entry = lookup_entry(key);
+        invalid = entry != nullptr && (entry->type != VAL_STR || !hll_valid(entry->value));
+        if (invalid) {
+            const std::string& err = entry_owns_object(entry) ? WRONG_TYPE : INVALID_HLL;
+            write_err(out, (uint8_t*)err.data(), err.size());
+            return nullptr;
+        }
+        return entry;
+    }
+
+    // replies 1 if the estimate may have changed, which includes creating the key
+    void do_pfadd(std::vector<std::string>& cmd, Buffer& out) {
+        bool invalid = false;
+        Entry* entry = lookup_hll(cmd[1], out, invalid);
+        if (invalid) {
+            return;
+        }
+        bool changed = false;
+        if (entry == nullptr) {
+            std::string hll = hll_new();
+            for (size_t i = 2; i < cmd.size(); i++) {
+                hll_add(hll, (const uint8_t*)cmd[i].data(), cmd[i].size());
+            }
+            entry = new Entry();
+            entry_encode_value(entry, hll);
+            entry_link_new(entry, cmd[1], fnv_hash((uint8_t*)cmd[1].data(), cmd[1].size()), k_default_entry_timeout);
+            changed = true;
+        } else if (hll_is_dense(entry->value)) {
+            // a dense one keeps its size, its registers change in place
+            for (size_t i = 2; i < cmd.size(); i++) {
+                changed |= hll_add(entry->value, (const uint8_t*)cmd[i].data(), cmd[i].size());
+            }
+        } else {
+            std::string hll = entry->value;
+            for (size_t i = 2; i < cmd.size(); i++) {
+                changed |= hll_add(hll, (const uint8_t*)cmd[i].data(), cmd[i].size());
+            }
+            if (changed) {
+                entry_set_value(entry, hll);
+            }
+        }
+        write_int64(out, changed ? 1 : 0);
+    }
+
+    // the estimate for one key, or for the union of several
+    void do_pfcount(std::vector<std::string>& cmd, Buffer& out) {
+        bool invalid = false;
+        if (cmd.size() == 2) {
+            Entry* entry = lookup_hll(cmd[1], out, invalid);
+            if (!invalid) {
+                write_int64(out, entry == nullptr ? 0 : (int64_t)hll_count(entry->value));
+            }
+            return;
+        }
+        std::vector<uint8_t> regs(k_hll_registers, 0);
+        for (size_t i = 1; i < cmd.size(); i++) {
+            Entry* entry = lookup_hll(cmd[i], out, invalid);
+            if (invalid) {
+                return;
+            }
+            if (entry != nullptr) {
+                hll_merge(regs.data(), entry->value);
+            }
+        }
+        write_int64(out, (int64_t)hll_count_registers(regs.data()));
+    }
+
+    // stores the union of dest and the sources at dest, dense; an existing
+    // dest keeps its ttl
+    void do_pfmerge(std::vector<std::string>& cmd, Buffer& out) {
+        std::vector<uint8_t> regs(k_hll_registers, 0);
+        Entry* dest = nullptr;
+        for (size_t i = 1; i < cmd.size(); i++) {
+            bool invalid = false;
+            Entry* entry = lookup_hll(cmd[i], out, invalid);
+            if (invalid) {
+                return;
+            }
+            if (entry != nullptr) {
+                hll_merge(regs.data(), entry->value);
+            }
+            if (i == 1) {
+                dest = entry;
+            }
+        }
+        std::string merged = hll_from_registers(regs.data());
+        if (dest != nullptr) {
+            entry_set_value(dest, merged);
+        } else {
+            dest = new Entry();
+            entry_encode_value(dest, merged);
+            entry_link_new(dest, cmd[1], fnv_hash((uint8_t*)cmd[1].data(), cmd[1].size()), k_default_entry_timeout);
+        }
+        write_success(out);
+    }
+
+    // The bytes of a string value, with integers and doubles formatted into
+    // scratch the way get shows them over RESP. nullptr for a sorted set.
+    const std::string* entry_bytes(Entry* e, std::string& scratch) {
+        switch (e->type) {
+            case VAL_STR:
+                return &e->value;
+            case VAL_INT:
+                scratch = std::to_string(e->int_val);
+                return &scratch;
+            case VAL_DBL:
+                scratch = double_text(e->dbl_val);
+                return &scratch;
+            default:
+                return nullptr;
+        }
+    }
+
+    // stores an integer or double as the equivalent string, for commands
+    // that edit the bytes of a value
+    void entry_make_string(Entry* e) {
+        std::string scratch;
+        if (e->type == VAL_STR || entry_bytes(e, scratch) == nullptr) {
+            return;
+        }
+        entries_memory -= entry_mem_usage(e);
+        e->type = VAL_STR;
+        e->value.swap(scratch);     // numbers keep no string storage to retire
+        entries_memory += entry_mem_usage(e);
+    }
+
+    // Zero pads the string value of e to at least len bytes. Within its
+    // capacity the string grows in place; past it the capacity doubles, or
+    // once past k_string_greedy_growth grows by a quarter (and at least that
+    // much), so a value built up bit by bit or appended to in chunks is only
+    // copied a logarithmic number of times with at most a quarter unused.
+    // The old buffer is retired, a reader thread may be copying it.
+    void entry_grow_string(Entry* e, size_t len) {
+        if (len <= e->value.size()) {
+            return;
+        }
+        entries_memory -= entry_mem_usage(e);
+        if (len <= e->value.capacity()) {
+            e->value.resize(len);
+        } else {
+            std::string grown;
+            size_t greedy = k_string_greedy_growth;     // std::max takes a reference, the constant has no storage
+            grown.reserve(len < greedy ? len * 2 : len + std::max(len / 4, greedy));
+            grown.append(e->value);
+            grown.resize(len);
+            entry_drop_string(e);
+            e->value.swap(grown);
+        }
+        entries_memory += entry_mem_usage(e);
+    }
+
+    // replaces the value of e with the bytes of value, taking its storage
+    void entry_take_string(Entry* e, std::string& value) {
+        entries_memory -= entry_mem_usage(e);
+        if (entry_owns_object(e)) {
+            entry_free_value(e);
+        }
+        entry_drop_string(e);
+        e->type = VAL_STR;
+        e->value.swap(value);
+        entries_memory += entry_mem_usage(e);
+    }
+
+    // The bytes of a string value wherever they are: a tiered value is read
+    // from the value log in place. nullptr for a sorted set or a filter.
+    const char* entry_string_view(Entry* e, std::string& scratch, size_t& len) {
+        if (e->type == VAL_DISK) {
+            return value_log.value(e->loc, len);
+        }
+        const std::string* bytes = entry_bytes(e, scratch);
+        if (bytes == nullptr) {
+            return nullptr;
+        }
+        len = bytes->size();
+        return bytes->data();
+    }
+
+    // The string at key for an in place edit, brought back into memory if it
+    // was tiered and turned from a number into its text. Returns nullptr both
+    // when the key is missing and when it holds another type, in which case
+    // an error has been written.
+    Entry* lookup_string(const std::string& key, uint64_t hash_code, Buffer& out, bool& wrong_type) {
+        Entry* e = lookup_entry(key, hash_code);
+        wrong_type = e != nullptr && entry_owns_object(e);
+        if (wrong_type) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return nullptr;
+        }
+        if (e != nullptr) {
+            entry_make_string(e);
+        }
+        return e;
+    }
+
+    // an empty string at key, with the default ttl
+    Entry* string_create(std::string& key, uint64_t hash_code) {
+        Entry* e = new Entry();
+        e->type = VAL_STR;
+        entry_link_new(e, key, hash_code, k_default_entry_timeout);
+        return e;
+    }
+
+    // append key value: the new length. The string grows geometrically (see
+    // entry_grow_string), so a value built from many appends is copied a
+    // logarithmic number of times instead of on every append.
+    void do_append(std::string& key, std::string& value, Buffer& out) {
+        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
+        bool wrong_type = false;
+        Entry* e = lookup_string(key, hash_code, out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        size_t len = e == nullptr ? 0 : e->value.size();
+        if (len + value.size() > k_max_string_len) {
+            write_err(out, (uint8_t*)STRING_TOO_LONG.data(), STRING_TOO_LONG.size());
+            return;
+        }
+        if (e == nullptr) {
+            e = string_create(key, hash_code);
+        }
+        entry_grow_string(e, len + value.size());
+        memcpy(&e->value[len], value.data(), value.size());
+        write_int64(out, (int64_t)e->value.size());
+    }
+
+    void do_strlen(std::string& key, Buffer& out) {
+        Entry* e = lookup_key(key);
+        size_t len = 0;
+        std::string scratch;
+        if (e != nullptr && entry_string_view(e, scratch, len) == nullptr) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        write_int64(out, (int64_t)len);
+    }
+
+    // getrange key start end: the bytes from start to end inclusive, negative
+    // offsets counting from the end, as in Redis. A tiered value is read
+    // from the value log without loading the rest of it.
+    void do_getrange(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t start = 0, end = 0;
+        if (!parse_int(cmd[2], start) || !parse_int(cmd[3], end)) {
+            write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+            return;
+        }
+        Entry* e = lookup_key(cmd[1]);
+        size_t len = 0;
+        std::string scratch;
+        const char* data = e == nullptr ? "" : entry_string_view(e, scratch, len);
+        if (data == nullptr) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        int64_t n = (int64_t)len;
+        if (start < 0 && end < 0 && start > end) {
+            n = 0;
+        }
+        start = std::max(start < 0 ? start + n : start, (int64_t)0);
+        end = std::min(std::max(end < 0 ? end + n : end, (int64_t)0), n - 1);
+        if (n == 0 || start > end) {
+            write_string(out, (const uint8_t*)"", 0);
+            return;
+        }
+        write_string(out, (const uint8_t*)data + start, (size_t)(end - start + 1));
+    }
+
+    // setrange key offset value: overwrites the bytes from offset on, zero
+    // padding the string up to it; the new length. An empty value on a
+    // missing key creates nothing.
+    void do_setrange(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t offset = 0;
+        std::string& value = cmd[3];
+        if (!parse_int(cmd[2], offset) || offset < 0) {
+            write_err(out, (uint8_t*)OFFSET_OUT_OF_RANGE.data(), OFFSET_OUT_OF_RANGE.size());
+            return;
+        }
+        if ((uint64_t)offset + value.size() > k_max_string_len) {
+            write_err(out, (uint8_t*)STRING_TOO_LONG.data(), STRING_TOO_LONG.size());
+            return;
+        }
+        std::string& key = cmd[1];
+        uint64_t hash_code = fnv_hash((uint8_t*)key.data(), key.size());
+        bool wrong_type = false;
+        Entry* e = lookup_string(key, hash_code, out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        if (e == nullptr && value.empty()) {
+            write_int64(out, 0);
+            return;
+        }
+        if (e == nullptr) {
+            e = string_create(key, hash_code);
+        }
+        if (!value.empty()) {
+            entry_grow_string(e, (size_t)offset + value.size());
+            memcpy(&e->value[offset], value.data(), value.size());
+        }
+        write_int64(out, (int64_t)e->value.size());
+    }
+
+    // parses a bit offset for setbit and getbit
+    bool parse_bit_offset(const std::string& s, uint64_t& offset, Buffer& out) {
+        int64_t n = 0;
+        if (!parse_int(s, n) || n < 0 || (uint64_t)n >= k_bitmap_max_bits) {
+            write_err(out, (uint8_t*)BIT_OFFSET_ERROR.data(), BIT_OFFSET_ERROR.size());
+            return false;
+        }
+        offset = (uint64_t)n;
+        return true;
+    }
+
+    // Parses [start [end [byte|bit]]] from cmd[first..]. bitcount takes
+    // start and end together, bitpos also takes start alone.
+    bool parse_bit_range(std::vector<std::string>& cmd, size_t first, BitRange& range, Buffer& out) {
+        size_t n = cmd.size() - first;
+        if (n > 3) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return false;
+        }
+        if ((n >= 1 && !parse_int(cmd[first], range.start))
+                || (n >= 2 && !parse_int(cmd[first + 1], range.end))) {
+            write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+            return false;
+        }
+        range.has_end = n >= 2;
+        if (n == 3) {
+            std::string unit = cmd[first + 2];
+            to_lower(unit);
+            if (unit != "byte" && unit != "bit") {
+                write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+                return false;
+            }
+            range.bits = unit == "bit";
+        }
+        return true;
+    }
+
+    // The inclusive bit range that range selects in a value of len bytes,
+    // negative positions counting back from the end as in Redis. false when
+    // it holds no bits.
+    static bool resolve_bit_range(const BitRange& range, uint64_t len, uint64_t& first, uint64_t& last) {
+        int64_t total = (int64_t)(range.bits ? len * 8 : len);
+        int64_t start = range.start < 0 ? range.start + total : range.start;
+        int64_t end = range.end < 0 ? range.end + total : range.end;
+        start = std::max(start, (int64_t)0);
+        end = std::min(std::max(end, (int64_t)0), total - 1);
+        if (total == 0 || start > end) {
+            return false;
+        }
+        first = range.bits ? (uint64_t)start : (uint64_t)start * 8;
+        last = range.bits ? (uint64_t)end : (uint64_t)end * 8 + 7;
+        return true;
+    }
+
+    // replies with the previous bit; the value grows as needed
+    void do_setbit(std::vector<std::string>& cmd, Buffer& out) {
+        uint64_t offset = 0;
+        int64_t bit = 0;
+        if (!parse_bit_offset(cmd[2], offset, out)) {
+            return;
+        }
+        if (!parse_int(cmd[3], bit) || (bit != 0 && bit != 1)) {
+            write_err(out, (uint8_t*)BIT_VALUE_ERROR.data(), BIT_VALUE_ERROR.size());
+            return;
+        }
+        Entry* entry = lookup_entry(cmd[1]);
+        if (entry != nullptr && entry_owns_object(entry)) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        if (entry == nullptr) {
+            entry = new Entry();
+            entry->type = VAL_STR;
+            entry_link_new(entry, cmd[1], fnv_hash((uint8_t*)cmd[1].data(), cmd[1].size()), k_default_entry_timeout);
+        } else {
+            entry_make_string(entry);
+        }
+        entry_grow_string(entry, offset / 8 + 1);
+        uint8_t* byte = (uint8_t*)&entry->value[offset / 8];
+        uint8_t mask = (uint8_t)(0x80 >> (offset % 8));
+        bool previous = (*byte & mask) != 0;
+        *byte = bit ? (*byte | mask) : (*byte & ~mask);
+        write_int64(out, previous ? 1 : 0);
+    }
+
+    void do_getbit(std::vector<std::string>& cmd, Buffer& out) {
+        uint64_t offset = 0;
+        if (!parse_bit_offset(cmd[2], offset, out)) {
+            return;
+        }
+        Entry* entry = lookup_entry(cmd[1]);
+        std::string scratch;
+        const std::string* bytes = entry == nullptr ? &scratch : entry_bytes(entry, scratch);
+        if (bytes == nullptr) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        bool set = offset / 8 < bytes->size() && ((uint8_t)(*bytes)[offset / 8] & (0x80 >> (offset % 8)));
+        write_int64(out, set ? 1 : 0);
+    }
+
+    // set bits in the whole value or in a range of it
+    void do_bitcount(std::vector<std::string>& cmd, Buffer& out) {
+        BitRange range;
+        if (cmd.size() == 3) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        if (!parse_bit_range(cmd, 2, range, out)) {
+            return;
+        }
+        Entry* entry = lookup_entry(cmd[1]);
+        std::string scratch;
+        const std::string* bytes = entry == nullptr ? &scratch : entry_bytes(entry, scratch);
+        if (bytes == nullptr) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        uint64_t first = 0, last = 0;
+        uint64_t count = 0;
+        if (resolve_bit_range(range, bytes->size(), first, last)) {
+            count = bitmap_count((const uint8_t*)bytes->data(), first, last);
+        }
+        write_int64(out, (int64_t)count);
+    }
+
+    // The first bit equal to the given one, -1 if there is none. Without an
+    // end the value reads as padded with zero bits, so a 0 is always found.
+    void do_bitpos(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t bit = 0;
+        if (!parse_int(cmd[2], bit) || (bit != 0 && bit != 1)) {
+            write_err(out, (uint8_t*)BIT_VALUE_ERROR.data(), BIT_VALUE_ERROR.size());
+            return;
+        }
+        BitRange range;
+        if (!parse_bit_range(cmd, 3, range, out)) {
+            return;
+        }
+        Entry* entry = lookup_entry(cmd[1]);
+        std::string scratch;
+        const std::string* bytes = entry == nullptr ? &scratch : entry_bytes(entry, scratch);
+        if (bytes == nullptr) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return;
+        }
+        if (entry == nullptr) {
+            write_int64(out, bit ? -1 : 0);
+            return;
+        }
+        uint64_t first = 0, last = 0;
+        int64_t pos = -1;
+        if (resolve_bit_range(range, bytes->size(), first, last)) {
+            pos = bitmap_find((const uint8_t*)bytes->data(), first, last, (int)bit);
+            if (pos < 0 && bit == 0 && !range.has_end) {
+                pos = (int64_t)last + 1;
+            }
+        }
+        write_int64(out, pos);
+    }
+
+    // Stores and, or, xor of the sources, or not of a single one, at dest
+    // and replies with its length. Shorter sources read as zero padded; dest
+    // is deleted when every source is empty. Like set, it resets the ttl.
+    void do_bitop(std::vector<std::string>& cmd, Buffer& out) {
+        const std::string& name = cmd[1];
+        bool invert = name == "not";
+        BitOp op = name == "and" ? BITOP_AND : name == "or" ? BITOP_OR : BITOP_XOR;
+        if (!invert && name != "and" && name != "or" && name != "xor") {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        if (invert && cmd.size() != 4) {
+            write_err(out, (uint8_t*)BITOP_NOT_SOURCES.data(), BITOP_NOT_SOURCES.size());
+            return;
+        }
+        size_t num_sources = cmd.size() - 3;
+        std::vector<std::string> scratch(num_sources);
+        std::vector<const std::string*> sources(num_sources);
+        size_t len = 0;
+        for (size_t i = 0; i < num_sources; i++) {
+            Entry* entry = lookup_entry(cmd[3 + i]);
+            sources[i] = entry == nullptr ? &scratch[i] : entry_bytes(entry, scratch[i]);
+            if (sources[i] == nullptr) {
+                write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+                return;
+            }
+            len = std::max(len, sources[i]->size());
+        }
+        Entry* dest = lookup_entry(cmd[2]);
+        if (len == 0) {
+            if (dest != nullptr) {
+                entry_delete(dest);
+            }
+            write_int64(out, 0);
+            return;
+        }
+        // A dest string that is not a source and has about the right size
+        // is overwritten in place, the usual case of a result recomputed
+        // into the same key, which saves allocating and faulting in as much
+        // memory again as the result.
+        bool in_place = dest != nullptr && dest->type == VAL_STR
+            && dest->value.capacity() >= len && dest->value.capacity() / 2 <= len;
+        for (size_t i = 0; in_place && i < num_sources; i++) {
+            in_place = sources[i] != &dest->value;
+        }
+        std::string result;
+        if (in_place) {
+            entries_memory -= entry_mem_usage(dest);
+        } else {
+            result.reserve(len);
+        }
+        std::string& target = in_place ? dest->value : result;
+        target.assign(*sources[0]);
+        target.resize(len);
+        uint8_t* dst = (uint8_t*)&target[0];
+        for (size_t i = 1; i < num_sources; i++) {
+            const std::string& src = *sources[i];
+            bitmap_combine(op, dst, (const uint8_t*)src.data(), src.size());
+            if (op == BITOP_AND) {
+                memset(dst + src.size(), 0, len - src.size());
+            }
+        }
+        if (invert) {
+            bitmap_not(dst, len);
+        }
+        if (in_place) {
+            entries_memory += entry_mem_usage(dest);
+            set_heap_entry_ttl(dest, k_default_entry_timeout);
+        } else if (dest != nullptr) {
+            entry_take_string(dest, result);
+            set_heap_entry_ttl(dest, k_default_entry_timeout);
+        } else {
+            dest = new Entry();
+            dest->type = VAL_STR;
+            dest->value.swap(result);
+            entry_link_new(dest, cmd[2], fnv_hash((uint8_t*)cmd[2].data(), cmd[2].size()), k_default_entry_timeout);
+        }
+        write_int64(out, (int64_t)len);
+    }
+
+    // finds the Bloom filter at key. Returns nullptr both when the key is
+    // missing and when it holds another type, in which case an error has been
+    // written.
+    Entry* lookup_bloom(const std::string& key, Buffer& out, bool& wrong_type) {
+        Entry* entry = lookup_entry(key);
+        wrong_type = entry != nullptr && entry->type != VAL_BLOOM;
+        if (wrong_type) {
+            write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+            return nullptr;
+        }
+        return entry;
+    }
+
+    Entry* bloom_create(std::string& key, double error_rate, uint64_t capacity, uint32_t expansion) {
+        Entry* entry = new Entry();
+        entry->type = VAL_BLOOM;
+        entry->bloom = new BloomFilter(error_rate, capacity, expansion);
+        entry_link_new(entry, key, fnv_hash((uint8_t*)key.data(), key.size()), k_default_entry_timeout);
+        return entry;
+    }
+
+    // bf.reserve key error_rate capacity [expansion n] [nonscaling]
+    void do_bf_reserve(std::vector<std::string>& cmd, Buffer& out) {
+        double error_rate = 0;
+        int64_t capacity = 0;
+        int64_t expansion = k_bloom_default_expansion;
+        bool nonscaling = false;
+        if (!parse_double(cmd[2], error_rate) || !(error_rate > 0 && error_rate < 1)) {
+            write_err(out, (uint8_t*)BLOOM_ERROR_RATE.data(), BLOOM_ERROR_RATE.size());
+            return;
+        }
+        if (!parse_int(cmd[3], capacity) || capacity <= 0
+                || bloom_layer_bytes(error_rate, (uint64_t)capacity) > k_bloom_max_layer_bytes) {
+            write_err(out, (uint8_t*)BLOOM_CAPACITY.data(), BLOOM_CAPACITY.size());
+            return;
+        }
+        for (size_t i = 4; i < cmd.size(); i++) {
+            std::string option = cmd[i];
+            to_lower(option);
+            if (option == "nonscaling") {
+                nonscaling = true;
+            } else if (option == "expansion" && i + 1 < cmd.size()) {
+                if (!parse_int(cmd[++i], expansion) || expansion <= 0 || expansion > UINT32_MAX) {
+                    write_err(out, (uint8_t*)BLOOM_EXPANSION.data(), BLOOM_EXPANSION.size());
+                    return;
+                }
+            } else {
+                write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+                return;
+            }
+        }
+        if (lookup_key(cmd[1]) != nullptr) {
+            write_err(out, (uint8_t*)BLOOM_KEY_EXISTS.data(), BLOOM_KEY_EXISTS.size());
+            return;
+        }
+        bloom_create(cmd[1], error_rate, (uint64_t)capacity, nonscaling ? 0 : (uint32_t)expansion);
+        write_success(out);
+    }
+
+    static void bloom_hashes(std::vector<std::string>& cmd, size_t first, std::vector<uint64_t>& out) {
+        out.resize(cmd.size() - first);
+        for (size_t i = first; i < cmd.size(); i++) {
+            out[i - first] = BloomFilter::hash((const uint8_t*)cmd[i].data(), cmd[i].size());
+        }
+    }
+
+    // Adds the items at cmd[2..], creating a filter with the default error
+    // rate and capacity if there is none. bf.add replies with 1 if the item
+    // was new and 0 if it may have been there already, bf.madd with an array
+    // of those.
+    void do_bf_add(std::vector<std::string>& cmd, bool multi, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_bloom(cmd[1], out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        if (entry == nullptr) {
+            entry = bloom_create(cmd[1], k_bloom_default_error_rate, k_bloom_default_capacity, k_bloom_default_expansion);
+        }
+        std::vector<uint64_t> hashes;
+        bloom_hashes(cmd, 2, hashes);
+        std::vector<int> results(hashes.size());
+        size_t before = entry_mem_usage(entry);
+        entry->bloom->add(hashes.data(), hashes.size(), results.data());
+        entries_memory = entries_memory - before + entry_mem_usage(entry);
+        if (multi) {
+            write_arr(out, results.size());
+        }
+        for (int result : results) {
+            if (result < 0) {
+                write_err(out, (uint8_t*)BLOOM_FULL.data(), BLOOM_FULL.size());
+            } else {
+                write_int64(out, result);
+            }
+        }
+    }
+
+    // 1 for each item at cmd[2..] that may be in the filter, 0 for the others
+    void do_bf_exists(std::vector<std::string>& cmd, bool multi, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_bloom(cmd[1], out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        std::vector<uint64_t> hashes;
+        bloom_hashes(cmd, 2, hashes);
+        std::vector<int> results(hashes.size(), 0);
+        if (entry != nullptr) {
+            entry->bloom->contains(hashes.data(), hashes.size(), results.data());
+        }
+        if (multi) {
+            write_arr(out, results.size());
+        }
+        for (int result : results) {
+            write_int64(out, result);
+        }
+    }
+
+    // the fields RedisBloom reports, with the size in bytes
+    void do_bf_info(std::string& key, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_bloom(key, out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        if (entry == nullptr) {
+            write_err(out, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
+            return;
+        }
+        BloomFilter* bloom = entry->bloom;
+        const std::pair<std::string, uint64_t> fields[] = {
+            {"Capacity", bloom->capacity()},
+            {"Size", bloom->mem_usage()},
+            {"Number of filters", bloom->num_layers()},
+            {"Number of items inserted", bloom->size()},
+            {"Expansion rate", bloom->expansion_rate()},
+        };
+        write_arr(out, 2 * (sizeof(fields) / sizeof(fields[0])));
+        for (const auto& field : fields) {
+            write_string(out, (const uint8_t*)field.first.data(), field.first.size());
+            write_int64(out, (int64_t)field.second);
+        }
+    }
+
+    void do_zadd(std::vector<std::string>& cmd, Buffer& out) {
+        // parse every score first so that a bad one leaves the set untouched
+        std::vector<double> scores;
+        for (size_t i = 2; i < cmd.size(); i += 2) {
+            double score = 0;
+            if (!parse_double(cmd[i], score)) {
+                write_err(out, (uint8_t*)NOT_A_FLOAT.data(), NOT_A_FLOAT.size());
+                return;
+            }
+            scores.push_back(score);
+        }
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(cmd[1], out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        if (entry == nullptr) {
+            entry = new Entry();
+            entry->type = VAL_ZSET;
+            entry->zset = new ZSet();
+            entry_link_new(entry, cmd[1], fnv_hash((uint8_t*)cmd[1].data(), cmd[1].size()), k_default_entry_timeout);
+        }
+        size_t before = entry_mem_usage(entry);
+        int64_t added = 0;
+        for (size_t i = 0; i < scores.size(); i++) {
+            added += entry->zset->add(cmd[3 + 2 * i], scores[i]);
+        }
+        entries_memory = entries_memory - before + entry_mem_usage(entry);
+        write_int64(out, added);
+    }
+
+    void do_zrem(std::vector<std::string>& cmd, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(cmd[1], out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        int64_t removed = 0;
+        if (entry != nullptr) {
+            size_t before = entry_mem_usage(entry);
+            for (size_t i = 2; i < cmd.size(); i++) {
+                removed += entry->zset->remove(cmd[i]);
+            }
+            entries_memory = entries_memory - before + entry_mem_usage(entry);
+            if (entry->zset->size() == 0) {
+                entry_delete(entry);
+            }
+        }
+        write_int64(out, removed);
+    }
+
+    void do_zscore(std::string& key, std::string& member, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(key, out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        ZNode* node = entry == nullptr ? nullptr : entry->zset->lookup(member);
+        if (node == nullptr) {
+            write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+            return;
+        }
+        write_double(out, node->score);
+    }
+
+    void do_zrank(std::string& key, std::string& member, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(key, out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        ZNode* node = entry == nullptr ? nullptr : entry->zset->lookup(member);
+        if (node == nullptr) {
+            write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+            return;
+        }
+        write_int64(out, (int64_t)entry->zset->rank(node));
+    }
+
+    void do_zcard(std::string& key, Buffer& out) {
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(key, out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        write_int64(out, entry == nullptr ? 0 : (int64_t)entry->zset->size());
+    }
+
+    void write_znodes(Buffer& out, ZNode* node, size_t count, bool with_scores) {
+        write_arr(out, with_scores ? 2 * count : count);
+        for (size_t i = 0; i < count; i++, node = ZSet::next(node)) {
+            write_string(out, (uint8_t*)node->name(), node->name_len);
+            if (with_scores) {
+                write_double(out, node->score);
+            }
+        }
+    }
+
+    // zrange key start stop [withscores], ranks may be negative
+    void do_zrange(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t start = 0, stop = 0;
+        std::string opt = cmd.size() == 5 ? cmd[4] : "";
+        to_lower(opt);
+        bool with_scores = opt == "withscores";
+        if (!parse_int(cmd[2], start) || !parse_int(cmd[3], stop) || (cmd.size() == 5 && !with_scores)) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(cmd[1], out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        int64_t n = entry == nullptr ? 0 : (int64_t)entry->zset->size();
+        if (start < 0) {
+            start = std::max((int64_t)0, start + n);
+        }
+        if (stop < 0) {
+            stop += n;
+        }
+        stop = std::min(stop, n - 1);
+        if (start > stop) {
+            write_arr(out, 0);
+            return;
+        }
+        write_znodes(out, entry->zset->by_rank((size_t)start), (size_t)(stop - start + 1), with_scores);
+    }
+
+    bool parse_score_bound(const std::string& s, double& out, bool& exclusive) {
+        exclusive = !s.empty() && s[0] == '(';
+        return parse_double(exclusive ? s.substr(1) : s, out);
+    }
+
+    // zrangebyscore key min max [withscores] [limit offset count]
+    void do_zrangebyscore(std::vector<std::string>& cmd, Buffer& out) {
+        ZRangeSpec range;
+        bool with_scores = false;
+        int64_t offset = 0, count = -1;
+        bool ok = parse_score_bound(cmd[2], range.min, range.min_exclusive)
+            && parse_score_bound(cmd[3], range.max, range.max_exclusive);
+        for (size_t i = 4; ok && i < cmd.size(); i++) {
+            std::string opt = cmd[i];
+            to_lower(opt);
+            if (opt == "withscores") {
+                with_scores = true;
+            } else if (opt == "limit" && i + 2 < cmd.size()) {
+                ok = parse_int(cmd[i + 1], offset) && parse_int(cmd[i + 2], count) && offset >= 0;
+                i += 2;
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        bool wrong_type = false;
+        Entry* entry = lookup_zset(cmd[1], out, wrong_type);
+        if (wrong_type) {
+            return;
+        }
+        ZNode* node = entry == nullptr ? nullptr : entry->zset->first_in_range(range);
+        if (node != nullptr && offset > 0) {
+            // skip the offset by rank instead of walking it
+            node = entry->zset->by_rank(entry->zset->rank(node) + (size_t)offset);
+        }
+        size_t matched = 0;
+        for (ZNode* x = node; x != nullptr && ZSet::score_lte_max(x->score, range); x = ZSet::next(x)) {
+            if (count >= 0 && matched == (size_t)count) {
+                break;
+            }
+            matched++;
+        }
+        write_znodes(out, node, matched, with_scores);
+    }
+
+    struct ScanContext {
+        const std::string* pattern;
+        std::vector<Entry*> matched;
+        size_t visited = 0;
+    };
+
+    static void scan_callback(HNode* node, void* arg) {
+        ScanContext* ctx = (ScanContext*)arg;
+        Entry* entry = get_entry(node);
+        ctx->visited++;
+        if (ctx->pattern == nullptr
+                || glob_match(ctx->pattern->data(), ctx->pattern->size(), entry->key.data(), entry->key.size())) {
+            ctx->matched.push_back(entry);
+        }
+    }
+
+    // hotkeys [count n]: the most accessed keys with their estimated accesses
+    // per second, as key, rate pairs
+    void do_hotkeys(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t limit = (int64_t)k_hotkeys_top;
+        std::string opt = cmd.size() == 3 ? cmd[1] : "";
+        to_lower(opt);
+        if (opt == "count") {
+            if (!parse_int(cmd[2], limit) || limit <= 0) {
+                write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+                return;
+            }
+        } else if (cmd.size() != 1) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        std::vector<HotKeyRate> hot;
+        hot_keys.top(hot, (size_t)limit);
+        write_arr(out, 2 * hot.size());
+        for (HotKeyRate& rate : hot) {
+            write_string(out, (uint8_t*)rate.key.data(), rate.key.size());
+            write_double(out, rate.per_sec);
+        }
+    }
+
+    // scan cursor [match pattern] [count n]
+    // Walks buckets until about `count` keys were looked at, never more than
+    // 10 * count buckets, and replies with [next cursor, [matching keys...]].
+    // The pattern is applied here so only matching keys are sent back.
+    void do_scan(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t cursor = 0;
+        int64_t count = k_default_scan_count;
+        ScanContext ctx;
+        ctx.pattern = nullptr;
+        bool ok = parse_int(cmd[1], cursor) && cursor >= 0;
+        for (size_t i = 2; ok && i < cmd.size(); i += 2) {
+            std::string opt = cmd[i];
+            to_lower(opt);
+            if (i + 1 >= cmd.size()) {
+                ok = false;
+            } else if (opt == "match") {
+                ctx.pattern = &cmd[i + 1];
+            } else if (opt == "count") {
+                ok = parse_int(cmd[i + 1], count) && count > 0;
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        size_t next = (size_t)cursor;
+        size_t max_buckets = (size_t)count * 10;
+        for (size_t buckets = 0; buckets < max_buckets && ctx.visited < (size_t)count; buckets++) {
+            next = htable.hm_scan(next, &scan_callback, &ctx);
+            if (next == 0) {
+                break;
+            }
+        }
+        write_arr(out, 2);
+        write_int64(out, (int64_t)next);
+        write_arr(out, ctx.matched.size());
+        for (Entry* entry : ctx.matched) {
+            write_string(out, (uint8_t*)entry->key.data(), entry->key.size());
+        }
+    }
+
+    static void index_build_callback(HNode* node, void* arg) {
+        ((RadixTree*)arg)->insert(get_entry(node));
+    }
+
+    void prefix_index_enable(bool enable) {
+        if (!enable) {
+            delete prefix_index;
+            prefix_index = nullptr;
+            return;
+        }
+        if (prefix_index != nullptr) {
+            return;
+        }
+        prefix_index = new RadixTree();
+        size_t cursor = 0;
+        do {
+            cursor = htable.hm_scan(cursor, &index_build_callback, prefix_index);
+        } while (cursor != 0);
+    }
+
+    struct PrefixContext {
+        const std::string* prefix;  // stop at the first key without it
+        const std::string* end;     // or at the first key >= end
+        size_t limit;
+        std::vector<Entry*> matched;
+    };
+
+    static bool prefix_callback(Entry* e, void* arg) {
+        PrefixContext* ctx = (PrefixContext*)arg;
+        if (ctx->prefix != nullptr && e->key.compare(0, ctx->prefix->size(), *ctx->prefix) != 0) {
+            return false;
+        }
+        if (ctx->end != nullptr && !ctx->end->empty() && e->key >= *ctx->end) {
+            return false;
+        }
+        ctx->matched.push_back(e);
+        return ctx->matched.size() < ctx->limit;
+    }
+
+    // parses an optional trailing `limit n` at cmd[first]
+    bool parse_limit(std::vector<std::string>& cmd, size_t first, size_t& limit) {
+        limit = (size_t)-1;
+        if (cmd.size() == first) {
+            return true;
+        }
+        if (cmd.size() != first + 2) {
+            return false;
+        }
+        std::string opt = cmd[first];
+        to_lower(opt);
+        int64_t n = 0;
+        if (opt != "limit" || !parse_int(cmd[first + 1], n) || n <= 0) {
+            return false;
+        }
+        limit = (size_t)n;
+        return true;
+    }
+
+    void write_keys(Buffer& out, std::vector<Entry*>& entries) {
+        write_arr(out, entries.size());
+        for (Entry* entry : entries) {
+            write_string(out, (uint8_t*)entry->key.data(), entry->key.size());
+        }
+    }
+
+    // prefix.keys prefix [limit n]
+    // Keys starting with prefix in byte order. The walk starts at the first
+    // key >= prefix and stops at the first key outside it, so the cost follows
+    // the number of results rather than the size of the keyspace.
+    void do_prefix_keys(std::vector<std::string>& cmd, Buffer& out) {
+        PrefixContext ctx;
+        ctx.prefix = &cmd[1];
+        ctx.end = nullptr;
+        if (!parse_limit(cmd, 2, ctx.limit)) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        prefix_index->iterate_from(cmd[1], &prefix_callback, &ctx);
+        write_keys(out, ctx.matched);
+    }
+
+    // prefix.range start end [limit n]
+    // Keys in [start, end) in byte order, an empty end means no upper bound.
+    void do_prefix_range(std::vector<std::string>& cmd, Buffer& out) {
+        PrefixContext ctx;
+        ctx.prefix = nullptr;
+        ctx.end = &cmd[2];
+        if (!parse_limit(cmd, 3, ctx.limit)) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        prefix_index->iterate_from(cmd[1], &prefix_callback, &ctx);
+        write_keys(out, ctx.matched);
+    }
+
+    // prefix.del prefix, replies with the number of deleted keys
+    void do_prefix_del(std::string& prefix, Buffer& out) {
+        PrefixContext ctx;
+        ctx.prefix = &prefix;
+        ctx.end = nullptr;
+        ctx.limit = (size_t)-1;
+        prefix_index->iterate_from(prefix, &prefix_callback, &ctx);
+        for (Entry* entry : ctx.matched) {
+            entry_delete(entry);
+        }
+        write_int64(out, (int64_t)ctx.matched.size());
+    }
+
+    // unlink key1 ... keyn
+    // Like mdel, but every value is freed by the background thread whatever
+    // its size. Replies with the number of keys removed.
+    void do_unlink(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t unlinked = 0;
+        for (size_t i = 1; i < cmd.size(); i++) {
+            Entry* entry = lookup_key(cmd[i]);
+            if (entry != nullptr) {
+                dispose(&free_entry_job, entry, entry_unlink(entry), true);
+                unlinked++;
+            }
+        }
+        write_int64(out, unlinked);
+    }
+
+    // flushall [async]
+    // The keyspace is swapped for an empty table in O(1); the old table, its
+    // entries and the old prefix index are then freed inline or handed to
+    // the background thread as a whole.
+    void do_flushall(bool async, Buffer& out) {
+        HTable* old_table = new HTable(4);
+        old_table->hm_swap(htable);
+        entry_heap.clear();
+        eviction_pool.clear();
+        RadixTree* old_index = prefix_index;
+        if (prefix_index != nullptr) {
+            prefix_index = new RadixTree();
+        }
+        size_t bytes = entries_memory + old_table->hm_mem_usage();
+        entries_memory = 0;
+        if (value_log.is_open()) {
+            value_log.release_all();
+        }
+        if (slot_entries != nullptr) {
+            slot_entries.reset(new std::vector<Entry*>[k_cluster_slots]);
+            slot_entries_memory = 0;
+        }
+        dispose(&free_table_job, old_table, bytes, async);
+        if (async && old_index != nullptr) {
+            lazy_freer.submit(&free_index_job, old_index, old_index->mem_usage());
+        } else {
+            delete old_index;   // readers do not use the index
+        }
+        write_success(out);
+    }
+
+    void do_mdel(std::vector<std::string>& cmd, size_t first, Buffer& out) {
+        int64_t deleted = 0;
+        for (size_t i = first; i < cmd.size(); i++) {
+            Entry* entry = lookup_key(cmd[i]);
+            if (entry != nullptr) {
+                entry_delete(entry);
+                deleted++;
+            }
+        }
+        write_int64(out, deleted);
+    }
+    
+    void do_persist(std::string& key, Buffer& out) {
+        Entry* existing_entry = lookup_key(key);
+        if (existing_entry == nullptr) {
+            write_err(out, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
+            return;
+        }
+        entry_heap.expire_entry(existing_entry->heap_idx);
+        existing_entry -> heap_idx = -1;
+        write_success(out);
+    }
+
+    void do_set_expire(std::string& key, uint64_t ttl, Buffer& out) {
+        Entry* existing_entry = lookup_key(key);
+        if (existing_entry == nullptr) {
+            write_err(out, (uint8_t*)KEY_NOT_FOUND_ERROR.data(), KEY_NOT_FOUND_ERROR.size());
+            return;
+        }
+        if (existing_entry->heap_idx == (size_t)-1) {
+            write_err(out, (uint8_t*)EXPIRE_PERSISTENT_NODE_ERR.data(), EXPIRE_PERSISTENT_NODE_ERR.size());
+            return;
+        }
+        set_heap_entry_ttl(existing_entry, ttl);
+        write_success(out);
+    }
+
+    // Serialized value for dump, restore and migrate: the ValueType byte and
+    // then the string bytes, the 8 byte integer or double, (score, length,
+    // member) triples of a sorted set or the filter of BloomFilter::serialize.
+    // A tiered string is dumped straight from the value log.
+    void entry_dump(Entry* e, std::string& out) {
+        out.clear();
+        switch (e->type) {
+            case VAL_INT:
+            case VAL_DBL:
+                out.push_back((char)e->type);
+                out.append((const char*)&e->int_val, 8);
+                break;
+            case VAL_ZSET:
+                out.push_back((char)VAL_ZSET);
+                for (ZNode* node = e->zset->by_rank(0); node != nullptr; node = ZSet::next(node)) {
+                    out.append((const char*)&node->score, 8);
+                    out.append((const char*)&node->name_len, 4);
+                    out.append(node->name(), node->name_len);
+                }
+                break;
+            case VAL_BLOOM:
+                out.push_back((char)VAL_BLOOM);
+                e->bloom->serialize(out);
+                break;
+            case VAL_DISK: {
+                size_t len = 0;
+                const char* data = value_log.value(e->loc, len);
+                out.push_back((char)VAL_STR);
+                out.append(data, len);
+                break;
+            }
+            default:
+                out.push_back((char)VAL_STR);
+                out.append(e->value);
+                break;
+        }
+    }
+
+    // a new unlinked entry holding the value of an entry_dump payload,
+    // nullptr if the payload is not one
+    Entry* entry_undump(const std::string& payload) {
+        if (payload.empty()) {
+            return nullptr;
+        }
+        const char* cur = payload.data() + 1;
+        const char* end = payload.data() + payload.size();
+        std::unique_ptr<Entry> e(new Entry());
+        e->type = (uint8_t)payload[0];
+        switch (e->type) {
+            case VAL_STR:
+                e->value.assign(cur, end);
+                break;
+            case VAL_INT:
+            case VAL_DBL:
+                if (end - cur != 8) {
+                    return nullptr;
+                }
+                memcpy(&e->int_val, cur, 8);
+                break;
+            case VAL_ZSET: {
+                e->zset = new ZSet();
+                while (cur < end) {
+                    double score = 0;
+                    uint32_t len = 0;
+                    if (end - cur < 12) {
+                        entry_free_value(e.get());
+                        return nullptr;
+                    }
+                    memcpy(&score, cur, 8);
+                    memcpy(&len, cur + 8, 4);
+                    cur += 12;
+                    if ((size_t)(end - cur) < len) {
+                        entry_free_value(e.get());
+                        return nullptr;
+                    }
+                    e->zset->add(std::string(cur, len), score);
+                    cur += len;
+                }
+                break;
+            }
+            case VAL_BLOOM:
+                e->bloom = BloomFilter::deserialize(cur, (size_t)(end - cur));
+                if (e->bloom == nullptr) {
+                    return nullptr;
+                }
+                break;
+            default:
+                return nullptr;
+        }
+        return e.release();
+    }
+
+    // the ttl left on e in ms, 0 for a key that does not expire
+    uint64_t entry_ttl_left(Entry* e) {
+        if (e->heap_idx >= entry_heap.heap_size()) {
+            return 0;
+        }
+        uint64_t now = (uint64_t)get_monotonic_msec();
+        uint64_t expire_time = entry_heap[e->heap_idx].expire_time;
+        return expire_time > now ? expire_time - now : 1;
+    }
+
+    // dump key
+    void do_dump(std::string& key, Buffer& out) {
+        Entry* entry = lookup_key(key);
+        if (entry == nullptr) {
+            write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+            return;
+        }
+        std::string payload;
+        entry_dump(entry, payload);
+        write_string(out, (const uint8_t*)payload.data(), payload.size());
+    }
+
+    // restore key ttl payload [replace], with a ttl in ms and 0 for none.
+    // restore-asking is the same command, sent by migrate to a node that is
+    // still importing the slot.
+    void do_restore(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t ttl = 0;
+        if (!parse_int(cmd[2], ttl) || ttl < 0) {
+            write_err(out, (uint8_t*)INVALID_TTL.data(), INVALID_TTL.size());
+            return;
+        }
+        bool replace = false;
+        if (cmd.size() == 5) {
+            std::string option = cmd[4];
+            to_lower(option);
+            if (option != "replace") {
+                write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+                return;
+            }
+            replace = true;
+        }
+        uint64_t hash_code = fnv_hash((uint8_t*)cmd[1].data(), cmd[1].size());
+        Entry* existing = lookup_key(cmd[1], hash_code);
+        if (existing != nullptr && !replace) {
+            write_err(out, (uint8_t*)BUSY_KEY.data(), BUSY_KEY.size());
+            return;
+        }
+        Entry* entry = entry_undump(cmd[3]);
+        if (entry == nullptr) {
+            write_err(out, (uint8_t*)BAD_PAYLOAD.data(), BAD_PAYLOAD.size());
+            return;
+        }
+        if (existing != nullptr) {
+            entry_delete(existing);
+        }
+        entry_link_new(entry, cmd[1], hash_code, (uint64_t)ttl);
+        write_success(out);
+    }
+
+    // The connection migrate sends over, reused while the target has not
+    // dropped it for being idle. nullptr if the target cannot be reached.
+    RedisClient* migrate_connect(const std::string& host, uint16_t port, uint64_t timeout_ms) {
+        std::string addr = host + ":" + std::to_string(port);
+        uint64_t now = (uint64_t)get_monotonic_msec();
+        if (migrate_conn != nullptr && (migrate_addr != addr || now - migrate_used_ms > k_migrate_conn_idle_ms)) {
+            migrate_conn.reset();
+        }
+        if (migrate_conn == nullptr) {
+            std::unique_ptr<RedisClient> conn(new RedisClient());
+            conn->set_timeout(timeout_ms);
+            if (conn->connect_tcp(host.c_str(), port)) {
+                return nullptr;
+            }
+            migrate_conn = std::move(conn);
+            migrate_addr = addr;
+        }
+        migrate_used_ms = now;
+        return migrate_conn.get();
+    }
+
+    // migrate host port timeout key [key ...]
+    // Moves keys to another node: each one goes over as a restore-asking of
+    // its dump with the ttl it has left, all of them in one pipelined batch,
+    // and is deleted here once the target has it. Like MIGRATE in Redis this
+    // blocks the loop for the round trip, which is what keeps a key from
+    // changing on its way over. Missing keys are skipped; replies the number
+    // of keys moved, or the first error of the target after deleting the
+    // keys it did take.
+    void do_migrate(std::vector<std::string>& cmd, Buffer& out) {
+        int64_t port = 0;
+        int64_t timeout = 0;
+        if (!parse_int(cmd[2], port) || port <= 0 || port > 65535 || !parse_int(cmd[3], timeout) || timeout < 0) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        std::vector<Entry*> moving;
+        std::vector<std::string> restore(4);
+        restore[0] = "restore-asking";
+        RedisClient* conn = nullptr;
+        for (size_t i = 4; i < cmd.size(); i++) {
+            Entry* entry = find_entry(cmd[i], fnv_hash((uint8_t*)cmd[i].data(), cmd[i].size()));
+            if (entry == nullptr) {
+                continue;
+            }
+            if (conn == nullptr && (conn = migrate_connect(cmd[1], (uint16_t)port, (uint64_t)timeout)) == nullptr) {
+                write_err(out, (uint8_t*)MIGRATE_IO_ERROR.data(), MIGRATE_IO_ERROR.size());
+                return;
+            }
+            restore[1] = cmd[i];
+            restore[2] = std::to_string(entry_ttl_left(entry));
+            entry_dump(entry, restore[3]);
+            conn->append_req(restore);
+            moving.push_back(entry);
+        }
+        if (conn != nullptr && conn->flush()) {
+            migrate_conn.reset();
+            write_err(out, (uint8_t*)MIGRATE_IO_ERROR.data(), MIGRATE_IO_ERROR.size());
+            return;
+        }
+        int64_t moved = 0;
+        std::string err;
+        Reply reply;
+        for (Entry* entry : moving) {
+            if (conn->read_res(reply)) {
+                // whether the rest made it is unknown, they stay here
+                migrate_conn.reset();
+                err = MIGRATE_IO_ERROR;
+                break;
+            }
+            if (reply.tag == JSON::TAG_ERR) {
+                if (err.empty()) {
+                    err = reply.str;
+                }
+                continue;
+            }
+            entry_delete(entry);
+            moved++;
+        }
+        if (!err.empty()) {
+            write_err(out, (uint8_t*)err.data(), err.size());
+            return;
+        }
+        write_int64(out, moved);
+    }
+
+    bool parse_slot(const std::string& s, uint16_t& slot, Buffer& out) {
+        int64_t n = 0;
+        if (!parse_int(s, n) || n < 0 || n >= (int64_t)k_cluster_slots) {
+            write_err(out, (uint8_t*)INVALID_SLOT.data(), INVALID_SLOT.size());
+            return false;
+        }
+        slot = (uint16_t)n;
+        return true;
+    }
+
+    // cluster slots, as in Redis: the runs of slots with the same owner,
+    // each as [first, last, [ip, port]]
+    void do_cluster_slots(Buffer& out) {
+        std::vector<std::pair<uint16_t, uint16_t>> runs;
+        for (uint32_t slot = 0; slot < k_cluster_slots; slot++) {
+            int16_t owner = cluster.slot_owner((uint16_t)slot);
+            if (owner < 0) {
+                continue;
+            }
+            if (!runs.empty() && runs.back().second == slot - 1 && cluster.slot_owner(runs.back().first) == owner) {
+                runs.back().second = (uint16_t)slot;
+            } else {
+                runs.push_back(std::make_pair((uint16_t)slot, (uint16_t)slot));
+            }
+        }
+        write_arr(out, runs.size());
+        for (std::pair<uint16_t, uint16_t>& run : runs) {
+            const ClusterNode& node = cluster.node(cluster.slot_owner(run.first));
+            write_arr(out, 3);
+            write_int64(out, run.first);
+            write_int64(out, run.second);
+            write_arr(out, 2);
+            write_string(out, (const uint8_t*)node.ip.data(), node.ip.size());
+            write_int64(out, node.port);
+        }
+    }
+
+    // cluster setslot slot importing|migrating|node addr, or setslot slot stable
+    void do_cluster_setslot(std::vector<std::string>& cmd, Buffer& out) {
+        uint16_t slot = 0;
+        if (!parse_slot(cmd[2], slot, out)) {
+            return;
+        }
+        std::string action = cmd[3];
+        to_lower(action);
+        if (action == "stable" && cmd.size() == 4) {
+            cluster.set_migrating(slot, -1);
+            cluster.set_importing(slot, -1);
+            write_success(out);
+            return;
+        }
+        if (cmd.size() != 5 || (action != "importing" && action != "migrating" && action != "node")) {
+            write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+            return;
+        }
+        int16_t node = cluster.node_index(cmd[4]);
+        if (node < 0) {
+            write_err(out, (uint8_t*)INVALID_NODE.data(), INVALID_NODE.size());
+            return;
+        }
+        bool mine = cluster.slot_owner(slot) == 0;
+        if (action == "importing") {
+            if (mine || node == 0) {
+                write_err(out, (uint8_t*)SYNTAX_ERROR.data(), SYNTAX_ERROR.size());
+                return;
+            }
+            cluster.set_importing(slot, node);
+        } else if (action == "migrating") {
+            if (!mine || node == 0) {
+                write_err(out, (uint8_t*)SLOT_NOT_MINE.data(), SLOT_NOT_MINE.size());
+                return;
+            }
+            cluster.set_migrating(slot, node);
+        } else {
+            if (mine && node != 0 && !slot_entries[slot].empty()) {
+                write_err(out, (uint8_t*)SLOT_HAS_KEYS.data(), SLOT_HAS_KEYS.size());
+                return;
+            }
+            cluster.set_owner(slot, node);
+        }
+        write_success(out);
+    }
+
+    // cluster keyslot|slots|addslots|addslotsrange|setslot|setslotsrange|
+    // countkeysinslot|getkeysinslot ...
+    // Without gossip every node is told the whole slot map: its own slots
+    // with addslots, the others' with setslot ... node or setslotsrange.
+    void do_cluster(std::vector<std::string>& cmd, Buffer& out) {
+        std::string sub = cmd[1];
+        to_lower(sub);
+        if (sub == "keyslot" && cmd.size() == 3) {
+            write_int64(out, key_hash_slot(cmd[2].data(), cmd[2].size()));
+            return;
+        }
+        if (!cluster.enabled()) {
+            write_err(out, (uint8_t*)CLUSTER_DISABLED.data(), CLUSTER_DISABLED.size());
+            return;
+        }
+        if (sub == "slots" && cmd.size() == 2) {
+            do_cluster_slots(out);
+        } else if ((sub == "addslots" && cmd.size() >= 3)
+                || (sub == "addslotsrange" && cmd.size() >= 4 && cmd.size() % 2 == 0)) {
+            // every slot is checked before any is taken
+            std::vector<uint16_t> slots;
+            for (size_t i = 2; i < cmd.size(); i += sub == "addslots" ? 1 : 2) {
+                uint16_t first = 0, last = 0;
+                if (!parse_slot(cmd[i], first, out) || !parse_slot(cmd[sub == "addslots" ? i : i + 1], last, out)) {
+                    return;
+                }
+                for (uint32_t slot = first; slot <= last; slot++) {
+                    if (cluster.slot_owner((uint16_t)slot) > 0) {
+                        write_err(out, (uint8_t*)SLOT_BUSY.data(), SLOT_BUSY.size());
+                        return;
+                    }
+                    slots.push_back((uint16_t)slot);
+                }
+            }
+            for (uint16_t slot : slots) {
+                cluster.set_owner(slot, 0);
+            }
+            write_success(out);
+        } else if (sub == "setslot" && cmd.size() >= 4) {
+            do_cluster_setslot(cmd, out);
+        } else if (sub == "setslotsrange" && cmd.size() == 5) {
+            uint16_t first = 0, last = 0;
+            if (!parse_slot(cmd[2], first, out) || !parse_slot(cmd[3], last, out)) {
+                return;
+            }
+            int16_t node = cluster.node_index(cmd[4]);
+            if (node < 0) {
+                write_err(out, (uint8_t*)INVALID_NODE.data(), INVALID_NODE.size());
+                return;
+            }
+            for (uint32_t slot = first; slot <= last && node != 0; slot++) {
+                if (cluster.slot_owner((uint16_t)slot) == 0 && !slot_entries[slot].empty()) {
+                    write_err(out, (uint8_t*)SLOT_HAS_KEYS.data(), SLOT_HAS_KEYS.size());
+                    return;
+                }
+            }
+            for (uint32_t slot = first; slot <= last; slot++) {
+                cluster.set_owner((uint16_t)slot, node);
+            }
+            write_success(out);
+        } else if (sub == "countkeysinslot" && cmd.size() == 3) {
+            uint16_t slot = 0;
+            if (parse_slot(cmd[2], slot, out)) {
+                write_int64(out, (int64_t)slot_entries[slot].size());
+            }
+        } else if (sub == "getkeysinslot" && cmd.size() == 4) {
+            uint16_t slot = 0;
+            int64_t count = 0;
+            if (!parse_slot(cmd[2], slot, out)) {
+                return;
+            }
+            if (!parse_int(cmd[3], count) || count < 0) {
+                write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+                return;
+            }
+            std::vector<Entry*>& keys = slot_entries[slot];
+            size_t n = std::min(keys.size(), (size_t)count);
+            write_arr(out, n);
+            for (size_t i = 0; i < n; i++) {
+                write_string(out, (const uint8_t*)keys[i]->key.data(), keys[i]->key.size());
+            }
+        } else {
+            write_err(out);
+        }
+    }
+
+    // A pub/sub push: kind, the items (nullptr for a nil) and, unless it is
+    // negative, a count. Binary clients get it as a frame of its own, RESP3
+    // clients as a push.
+    void write_push(Buffer& out, Protocol proto, const char* kind,
+                    std::initializer_list<const std::string*> items, int64_t count) {
+        size_t n = 1 + items.size() + (count >= 0 ? 1 : 0);
+        if (proto != PROTO_BINARY) {
+            resp_write_push(out, n, proto);
+            resp_write_bulk(out, (const uint8_t*)kind, strlen(kind));
+            for (const std::string* item : items) {
+                if (item == nullptr) {
+                    resp_write_null(out, proto);
+                } else {
+                    resp_write_bulk(out, (const uint8_t*)item->data(), item->size());
+                }
+            }
+            if (count >= 0) {
+                resp_write_int(out, count);
+            }
+            return;
+        }
+        Buffer frame;
+        write_arr(frame, n);
+        write_string(frame, (const uint8_t*)kind, strlen(kind));
+        for (const std::string* item : items) {
+            if (item == nullptr) {
+                write_1b_tag(frame, JSON::TAG_NIL);
+            } else {
+                write_string(frame, (const uint8_t*)item->data(), item->size());
+            }
+        }
+        if (count >= 0) {
+            write_int64(frame, count);
+        }
+        send_frame(frame, out);
+    }
+
+    // (p)subscribe and (p)unsubscribe, and ping for a subscribed RESP2 or
+    // binary client; false for any other command. As in Redis every channel
+    // gets a reply of its own, with the number of subscriptions left after it.
+    bool do_pubsub_command(Conn* conn, std::vector<std::string>& cmd) {
+        bool pattern = cmd[0] == "psubscribe" || cmd[0] == "punsubscribe";
+        Buffer& out = conn->write_buffer;
+        if ((cmd[0] == "subscribe" || cmd[0] == "psubscribe") && cmd.size() >= 2) {
+            for (size_t i = 1; i < cmd.size(); i++) {
+                pubsub.subscribe(conn, cmd[i], pattern);
+                write_push(out, conn->proto, cmd[0].c_str(), {&cmd[i]}, conn->subscriptions.size());
+            }
+        } else if (cmd[0] == "unsubscribe" || cmd[0] == "punsubscribe") {
+            if (cmd.size() >= 2) {
+                for (size_t i = 1; i < cmd.size(); i++) {
+                    pubsub.unsubscribe(conn, cmd[i], pattern);
+                    write_push(out, conn->proto, cmd[0].c_str(), {&cmd[i]}, conn->subscriptions.size());
+                }
+                return true;
+            }
+            // without arguments, from everything of that kind
+            std::vector<std::string> names;
+            pubsub.unsubscribe_all(conn, pattern, names);
+            if (names.empty()) {
+                write_push(out, conn->proto, cmd[0].c_str(), {nullptr}, conn->subscriptions.size());
+            }
+            for (size_t i = 0; i < names.size(); i++) {
+                size_t left = conn->subscriptions.size() + names.size() - i - 1;
+                write_push(out, conn->proto, cmd[0].c_str(), {&names[i]}, left);
+            }
+        } else if (cmd[0] == "ping" && cmd.size() <= 2 && !conn->subscriptions.empty()
+                && conn->proto != PROTO_RESP3) {
+            std::string empty;
+            write_push(out, conn->proto, "pong", {cmd.size() == 2 ? &cmd[1] : &empty}, -1);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Appends msg to conn's output behind the replies buffered so far, by reference.
+    void queue_message(Conn* conn, SharedMessage* msg) {
+        message_ref(msg);
+        QueuedMessage queued;
+        queued.msg = msg;
+        queued.position = conn->write_buffer_sent + conn->write_buffer.size();
+        conn->out_messages.push_back(queued);
+        conn->out_message_bytes += msg->size;
+        conn->want_write = true;
+        check_output_limit(conn);
+        if (!conn->flush_pending) {
+            conn->flush_pending = true;
+            pending_flush.push_back(conn->fd);
+        }
+    }
+
+    // sends one published message to the subscribers of a channel or pattern
+    size_t fan_out(Channel* channel, const std::string* pattern, const std::string& name,
+                   const std::string& payload) {
+        // encoded once for each wire format that the subscribers use
+        SharedMessage* encoded[PROTO_RESP3 + 1] = {};
+        size_t receivers = 0;
+        for (Subscription* sub : channel->subscribers) {
+            Conn* conn = sub->conn;
+            if (conn->want_close) {
+                continue;
+            }
+            SharedMessage*& msg = encoded[conn->proto];
+            if (msg == nullptr) {
+                Buffer buf;
+                if (pattern != nullptr) {
+                    write_push(buf, conn->proto, "pmessage", {pattern, &name, &payload}, -1);
+                } else {
+                    write_push(buf, conn->proto, "message", {&name, &payload}, -1);
+                }
+                msg = message_new(buf);
+            }
+            queue_message(conn, msg);
+            receivers++;
+        }
+        for (SharedMessage* msg : encoded) {
+            if (msg != nullptr) {
+                message_unref(msg);
+            }
+        }
+        return receivers;
+    }
+
+    // replies with the number of subscribers that got the message
+    void do_publish(std::string& name, std::string& payload, Buffer& out) {
+        size_t receivers = 0;
+        if (Channel* channel = pubsub.find_channel(name)) {
+            receivers += fan_out(channel, nullptr, name, payload);
+        }
+        for (Channel* pattern : pubsub.pattern_list()) {
+            if (glob_match(pattern->name.data(), pattern->name.size(), name.data(), name.size())) {
+                receivers += fan_out(pattern, &pattern->name, name, payload);
+            }
+        }
+        write_int64(out, (int64_t)receivers);
+    }
+
+    void info_lines(std::vector<std::string>& lines) {
+        used_memory_peak = std::max(used_memory_peak, used_memory());
+        lines.push_back("used_memory:" + std::to_string(used_memory()));
+        lines.push_back("used_memory_peak:" + std::to_string(used_memory_peak));
+        lines.push_back("maxmemory:" + std::to_string(config.maxmemory));
+        lines.push_back(std::string("maxmemory_policy:") + eviction_policy_name(config.maxmemory_policy));
+        lines.push_back("keys:" + std::to_string(htable.hm_size()));
+        lines.push_back("expires:" + std::to_string(entry_heap.heap_size()));
+        lines.push_back("expired_keys:" + std::to_string(stats.expired_keys));
+        lines.push_back("evicted_keys:" + std::to_string(stats.evicted_keys));
+        lines.push_back("keyspace_hits:" + std::to_string(stats.keyspace_hits));
+        lines.push_back("keyspace_misses:" + std::to_string(stats.keyspace_misses));
+        size_t clients = 0;
+        size_t paused = 0;
+        size_t ready = 0;
+        size_t buffer_bytes = 0;
+        size_t output_pending = 0;
+        for (Node* node = dll.head->next; node != dll.tail; node = node->next) {
+            Conn* conn = get_connection(node);
+            clients++;
+            paused += conn->reading_paused;
+            ready += conn->ready;
+            buffer_bytes += conn->read_buffer.capacity() + conn->write_buffer.capacity();
+            output_pending += conn_output_size(conn);
+        }
+        lines.push_back("connected_clients:" + std::to_string(clients));
+        lines.push_back("clients_reading_paused:" + std::to_string(paused));
+        lines.push_back("clients_ready:" + std::to_string(ready));
+        lines.push_back("client_buffer_bytes:" + std::to_string(buffer_bytes));
+        lines.push_back("client_output_pending_bytes:" + std::to_string(output_pending));
+        BufferPoolStats pool = buffer_pool_stats();
+        lines.push_back("buffer_pool_chunks_in_use:" + std::to_string(pool.chunks_in_use));
+        lines.push_back("buffer_pool_free_bytes:" + std::to_string(pool.chunks_free * k_buffer_chunk_size));
+        lines.push_back("output_limit_disconnections:" + std::to_string(stats.output_limit_disconnections));
+        lines.push_back("lazyfree_pending_bytes:" + std::to_string(lazy_freer.pending()));
+        lines.push_back("lazyfreed_objects:" + std::to_string(lazy_freer.freed()));
+        lines.push_back("hotkeys_sampled_accesses:" + std::to_string(hot_keys.sampled()));
+        lines.push_back("pubsub_channels:" + std::to_string(pubsub.num_channels()));
+        lines.push_back("pubsub_patterns:" + std::to_string(pubsub.num_patterns()));
+        lines.push_back("pubsub_message_bytes:" + std::to_string(message_bytes_allocated()));
+        lines.push_back(std::string("bitmap_impl:") + bitmap_impl());
+        lines.push_back("watching_clients:" + std::to_string(watching_conns));
+        lines.push_back("transactions_executed:" + std::to_string(stats.transactions_executed));
+        lines.push_back("transactions_aborted:" + std::to_string(stats.transactions_aborted));
+        lines.push_back(std::string("cluster_enabled:") + (cluster.enabled() ? "1" : "0"));
+        if (cluster.enabled()) {
+            lines.push_back("cluster_slots_owned:" + std::to_string(cluster.owned()));
+            lines.push_back("cluster_slots_migrating:" + std::to_string(cluster.migrating()));
+            lines.push_back("cluster_slots_importing:" + std::to_string(cluster.importing()));
+            lines.push_back("cluster_known_nodes:" + std::to_string(cluster.known_nodes()));
+            lines.push_back("cluster_slot_index_bytes:" + std::to_string(slot_entries_memory));
+        }
+        if (readers_running) {
+            uint64_t requests = 0, hits = 0, misses = 0, retries = 0, connections = 0;
+            for (size_t i = 0; i < config.reader_threads; i++) {
+                requests += reader_stats[i].requests.load(std::memory_order_relaxed);
+                hits += reader_stats[i].keyspace_hits.load(std::memory_order_relaxed);
+                misses += reader_stats[i].keyspace_misses.load(std::memory_order_relaxed);
+                retries += reader_stats[i].retries.load(std::memory_order_relaxed);
+                connections += reader_stats[i].connections.load(std::memory_order_relaxed);
+            }
+            lines.push_back("reader_threads:" + std::to_string(config.reader_threads));
+            lines.push_back("reader_connections:" + std::to_string(connections));
+            lines.push_back("reader_requests:" + std::to_string(requests));
+            lines.push_back("reader_keyspace_hits:" + std::to_string(hits));
+            lines.push_back("reader_keyspace_misses:" + std::to_string(misses));
+            lines.push_back("reader_retries:" + std::to_string(retries));
+            lines.push_back("rcu_retired_objects:" + std::to_string(reclaimer.pending()));
+            lines.push_back("rcu_retired_bytes:" + std::to_string(reclaimer.pending_bytes()));
+        }
+        if (value_log.is_open()) {
+            const ValueLogStats& vs = value_log.get_stats();
+            lines.push_back("tiered_keys:" + std::to_string(vs.live_records));
+            lines.push_back("tiered_live_bytes:" + std::to_string(vs.live_bytes));
+            lines.push_back("tiered_file_bytes:" + std::to_string(vs.segments * k_value_segment_bytes));
+            lines.push_back("tiered_compacted_bytes:" + std::to_string(vs.compacted_bytes));
+            lines.push_back("tiered_reclaimed_bytes:" + std::to_string(vs.reclaimed_bytes));
+        }
+        if (prefix_index != nullptr) {
+            size_t index_keys = prefix_index->size();
+            size_t index_bytes = prefix_index->mem_usage();
+            lines.push_back("prefix_index_keys:" + std::to_string(index_keys));
+            lines.push_back("prefix_index_bytes:" + std::to_string(index_bytes));
+            lines.push_back("prefix_index_bytes_per_key:" + std::to_string(index_keys == 0 ? 0 : index_bytes / index_keys));
+        }
+    }
+
+    void do_info(Buffer& out) {
+        std::vector<std::string> lines;
+        info_lines(lines);
+        write_arr(out, lines.size());
+        for (std::string& line : lines) {
+            write_string(out, (uint8_t*)line.data(), line.size());
+        }
+    }
+
+    void do_config_get(std::string& name, Buffer& out) {
+        std::string value;
+        if (!config_get(name, value)) {
+            write_err(out, (uint8_t*)INVALID_CONFIG.data(), INVALID_CONFIG.size());
+            return;
+        }
+        write_string(out, (uint8_t*)value.data(), value.size());
+    }
+
+    void do_config_set(std::string& name, std::string& value, Buffer& out) {
+        if (!config_set(name, value)) {
+            write_err(out, (uint8_t*)INVALID_CONFIG.data(), INVALID_CONFIG.size());
+            return;
+        }
+        write_success(out);
+    }
+    
+    std::string cluster_redirect(const char* kind, uint16_t slot, int16_t node) {
+        return std::string(kind) + " " + std::to_string(slot) + " " + cluster.node(node).addr;
+    }
+
+    // Where the keys of cmd are served, in cluster mode. err is set when
+    // the command cannot run here whatever the keys hold; for SLOT_MIGRATING
+    // the caller checks which keys it still has. Reader threads call this as
+    // well, never asking.
+    SlotRoute cluster_route(const std::vector<std::string>& cmd, bool asking, uint16_t& slot,
+            int16_t& node, std::string& err) {
+        size_t first = 0, end = 0, step = 0;
+        if (!command_keys(cmd, first, end, step)) {
+            return SLOT_SERVE;
+        }
+        slot = key_hash_slot(cmd[first].data(), cmd[first].size());
+        for (size_t i = first + step; i < end; i += step) {
+            if (key_hash_slot(cmd[i].data(), cmd[i].size()) != slot) {
+                err = CROSS_SLOT;
+                return SLOT_UNASSIGNED;
+            }
+        }
+        SlotRoute route = cluster.route(slot, asking, node);
+        if (route == SLOT_MOVED) {
+            err = cluster_redirect("MOVED", slot, node);
+        } else if (route == SLOT_UNASSIGNED) {
+            err = SLOT_NOT_SERVED;
+        }
+        return route;
+    }
+
+    // The error for a command whose keys are not served here, left empty if
+    // they are. In a migrating slot the keys we still have are served,
+    // commands on keys that are gone (or about to be created) are asked of
+    // the target, and multi-key commands with some of each have to wait for
+    // the migration to move on.
+    void cluster_check(const std::vector<std::string>& cmd, bool asking, std::string& err) {
+        uint16_t slot = 0;
+        int16_t node = -1;
+        SlotRoute route = cluster_route(cmd, asking, slot, node, err);
+        if (route == SLOT_MIGRATING) {
+            size_t first = 0, end = 0, step = 0;
+            command_keys(cmd, first, end, step);
+            size_t keys = 0;
+            size_t missing = 0;
+            for (size_t i = first; i < end; i += step) {
+                keys++;
+                missing += find_entry(cmd[i], fnv_hash((uint8_t*)cmd[i].data(), cmd[i].size())) == nullptr;
+            }
+            if (missing == keys) {
+                err = cluster_redirect("ASK", slot, node);
+            } else if (missing > 0) {
+                err = TRY_AGAIN;
+            }
+        }
+    }
+
+    // Cluster mode check of a command before it runs or is queued by multi.
+    // Replies and returns true when the command is `asking` or its keys are
+    // not served here, which also dooms a transaction being queued.
+    bool do_cluster_redirect(Conn* conn, std::vector<std::string>& cmd) {
+        if (cmd[0] == "asking" && cmd.size() == 1) {
+            conn->asking = true;
+            write_conn_ok(conn);
+            return true;
+        }
+        bool asking = conn->asking || cmd[0] == "restore-asking";
+        conn->asking = false;
+        std::string err;
+        cluster_check(cmd, asking, err);
+        if (err.empty()) {
+            return false;
+        }
+        if (conn->in_multi) {
+            conn->multi_failed = true;
+        }
+        write_conn_err(conn, err);
+        return true;
+    }
+
+    // Gives the keys a write command changed new versions, so that the
+    // transactions watching them abort. Deleted keys need nothing: a watched
+    // key that is gone, or was created again since, no longer has the
+    // version its watch saw. Free while no connection watches anything.
+    void touch_written_keys(const std::vector<std::string>& cmd) {
+        if (watching_conns == 0) {
+            return;
+        }
+        const CommandSpec* spec = command_spec(cmd[0]);
+        size_t first = 0, end = 0, step = 0;
+        if (spec == nullptr || !(spec->flags & (CMD_WRITE | CMD_WRITE_FIRST)) || !command_keys(cmd, first, end, step)) {
+            return;
+        }
+        if (spec->flags & CMD_WRITE_FIRST) {
+            end = first + 1;
+        }
+        for (size_t i = first; i < end; i += step) {
+            Entry* e = find_entry(cmd[i], fnv_hash((uint8_t*)cmd[i].data(), cmd[i].size()));
+            if (e != nullptr) {
+                e->version = ++key_version;
+            }
+        }
+    }
+
+    void do_watch(Conn* conn, std::vector<std::string>& cmd) {
+        if (conn->watched.empty()) {
+            watching_conns++;
+        }
+        for (size_t i = 1; i < cmd.size(); i++) {
+            WatchedKey watched;
+            watched.key.swap(cmd[i]);
+            watched.hash_code = fnv_hash((uint8_t*)watched.key.data(), watched.key.size());
+            Entry* e = find_entry(watched.key, watched.hash_code);
+            watched.version = e == nullptr ? 0 : e->version;
+            conn->watched.push_back(std::move(watched));
+        }
+        write_conn_ok(conn);
+    }
+
+    void unwatch_all(Conn* conn) {
+        if (!conn->watched.empty()) {
+            watching_conns--;
+            conn->watched.clear();
+        }
+    }
+
+    bool watched_keys_unchanged(Conn* conn) {
+        for (WatchedKey& watched : conn->watched) {
+            Entry* e = find_entry(watched.key, watched.hash_code);
+            if ((e == nullptr ? 0 : e->version) != watched.version) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // leaves multi, dropping the queue and the watches
+    void end_transaction(Conn* conn) {
+        conn->in_multi = false;
+        conn->multi_failed = false;
+        conn->multi_slot = -1;
+        conn->multi_queue.clear();
+        unwatch_all(conn);
+    }
+
+    // Queues a command behind multi, as parsed: the argument strings move
+    // into the queue and exec runs them from there. Commands exec could not
+    // run, or whose keys are in another slot than the queued ones in cluster
+    // mode, are refused and doom the transaction.
+    void multi_queue_command(Conn* conn, std::vector<std::string>& cmd) {
+        const std::string& name = cmd[0];
+        if (name == "subscribe" || name == "psubscribe" || name == "unsubscribe" || name == "punsubscribe") {
+            conn->multi_failed = true;
+            write_conn_err(conn, NOT_IN_MULTI);
+            return;
+        }
+        // RESP del is mdel, see do_resp_request
+        const CommandSpec* spec = command_spec(conn->proto != PROTO_BINARY && name == "del" ? "mdel" : name);
+        if (spec == nullptr || cmd.size() < spec->min_args || (spec->max_args > 0 && cmd.size() > spec->max_args)
+                || ((spec->flags & CMD_RESP_ONLY) && conn->proto == PROTO_BINARY) || (spec->flags & CMD_TRANSACTION)) {
+            conn->multi_failed = true;
+            write_conn_err(conn, UNKNOWN_COMMAND);
+            return;
+        }
+        size_t first = 0, end = 0, step = 0;
+        if (cluster.enabled() && command_keys(cmd, first, end, step)) {
+            int32_t slot = key_hash_slot(cmd[first].data(), cmd[first].size());
+            if (conn->multi_slot >= 0 && slot != conn->multi_slot) {
+                conn->multi_failed = true;
+                write_conn_err(conn, CROSS_SLOT);
+                return;
+            }
+            conn->multi_slot = slot;
+        }
+        conn->multi_queue.push_back(std::move(cmd));
+        if (conn->proto == PROTO_BINARY) {
+            Buffer reply;
+            write_string(reply, (const uint8_t*)"QUEUED", 6);
+            send_frame(reply, conn->write_buffer);
+        } else {
+            resp_write_simple(conn->write_buffer, "QUEUED");
+        }
+    }
+
+    // Runs the queued commands back to back in one keyspace write section,
+    // so neither other clients nor the reader threads see the transaction
+    // half done, and replies with an array of their replies. If a watched
+    // key changed since watch nothing runs and the reply is nil.
+    void do_exec(Conn* conn) {
+        if (!conn->in_multi) {
+            write_conn_err(conn, EXEC_WITHOUT_MULTI);
+            return;
+        }
+        std::string err;
+        if (conn->multi_failed) {
+            err = EXEC_ABORTED;
+        }
+        // the slot may have moved since the commands were queued
+        for (size_t i = 0; err.empty() && cluster.enabled() && i < conn->multi_queue.size(); i++) {
+            cluster_check(conn->multi_queue[i], false, err);
+        }
+        bool unchanged = err.empty() && watched_keys_unchanged(conn);
+        std::vector<std::vector<std::string>> queue;
+        queue.swap(conn->multi_queue);
+        end_transaction(conn);
+        if (!err.empty()) {
+            write_conn_err(conn, err);
+            return;
+        }
+        bool binary = conn->proto == PROTO_BINARY;
+        if (!unchanged) {
+            stats.transactions_aborted++;
+            if (binary) {
+                Buffer reply;
+                write_1b_tag(reply, JSON::TAG_NIL);
+                send_frame(reply, conn->write_buffer);
+            } else {
+                resp_write_null(conn->write_buffer, conn->proto);
+            }
+            return;
+        }
+        stats.transactions_executed++;
+        Buffer frame;   // binary clients get all the replies in one frame
+        if (binary) {
+            write_arr(frame, queue.size());
+        } else {
+            resp_write_array(conn->write_buffer, queue.size());
+        }
+        keyspace_write_begin();
+        for (std::vector<std::string>& cmd : queue) {
+            if (binary) {
+                do_request(cmd, frame);
+            } else {
+                do_resp_request(conn, cmd, conn->write_buffer);
+            }
+            touch_written_keys(cmd);
+        }
+        keyspace_write_end();
+        if (binary) {
+            send_frame(frame, conn->write_buffer);
+        }
+    }
+
+    // Transactions. multi makes the connection queue its commands instead
+    // of running them until exec runs them all at once or discard drops
+    // them. watch is optimistic: it notes the versions of some keys and
+    // exec runs nothing if any of them changed meanwhile, so a client reads,
+    // computes and writes without holding anything up. False for commands
+    // to run right away.
+    bool do_transaction_command(Conn* conn, std::vector<std::string>& cmd) {
+        const std::string& name = cmd[0];
+        if (name == "multi" && cmd.size() == 1) {
+            if (conn->in_multi) {
+                write_conn_err(conn, MULTI_NESTED);
+                return true;
+            }
+            conn->in_multi = true;
+            write_conn_ok(conn);
+        } else if (name == "exec" && cmd.size() == 1) {
+            do_exec(conn);
+        } else if (name == "discard" && cmd.size() == 1) {
+            if (!conn->in_multi) {
+                write_conn_err(conn, DISCARD_WITHOUT_MULTI);
+                return true;
+            }
+            end_transaction(conn);
+            write_conn_ok(conn);
+        } else if (name == "watch" && cmd.size() >= 2) {
+            if (conn->in_multi) {
+                write_conn_err(conn, WATCH_IN_MULTI);
+                return true;
+            }
+            do_watch(conn, cmd);
+        } else if (conn->in_multi) {
+            multi_queue_command(conn, cmd);
+        } else if (name == "unwatch" && cmd.size() == 1) {
+            unwatch_all(conn);
+            write_conn_ok(conn);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // hello [2|3]: switches the connection between RESP2 and RESP3 and
+    // describes the server
+    void do_hello(Conn* conn, std::vector<std::string>& cmd, Buffer& out) {
+        if (cmd.size() >= 2) {
+            int64_t version = 0;
+            if (!parse_int(cmd[1], version) || (version != 2 && version != 3)) {
+                std::string err = "-NOPROTO unsupported protocol version\r\n";
+                out.buffer_append((const uint8_t*)err.data(), err.size());
+                return;
+            }
+            conn->proto = version == 3 ? PROTO_RESP3 : PROTO_RESP2;
+        }
+        const char* mode = cluster.enabled() ? "cluster" : "standalone";
+        const char* fields[] = {"server", "miniredis", "version", "1.0.0", "mode", mode, "role", "master"};
+        resp_write_map(out, 5, conn->proto);
+        for (const char* field : fields) {
+            resp_write_bulk(out, (const uint8_t*)field, strlen(field));
+        }
+        resp_write_bulk(out, (const uint8_t*)"proto", 5);
+        resp_write_int(out, conn->proto == PROTO_RESP3 ? 3 : 2);
+    }
+
+    // the commands that only concern the connection, which reader threads
+    // answer as well; false if cmd is not one of them
+    bool do_resp_connection_command(Conn* conn, std::vector<std::string>& cmd, Buffer& out) {
+        if (cmd[0] == "ping" && cmd.size() <= 2) {
+            if (cmd.size() == 1) {
+                resp_write_simple(out, "PONG");
+            } else {
+                resp_write_bulk(out, (const uint8_t*)cmd[1].data(), cmd[1].size());
+            }
+        } else if (cmd[0] == "hello" && cmd.size() <= 2) {
+            do_hello(conn, cmd, out);
+        } else if (cmd[0] == "command") {
+            resp_write_array(out, 0);   // k_commands has no Redis style docs, clients fall back to defaults
+        } else if (cmd[0] == "select" && cmd.size() == 2) {
+            if (cmd[1] == "0") {
+                resp_write_simple(out, "OK");
+            } else {
+                resp_write_error(out, "DB index is out of range");
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Runs a request from a RESP client. Connection commands that only Redis
+    // clients send, and commands whose Redis reply has a different shape than
+    // ours, are handled here; the rest goes through do_request and its reply
+    // is re-encoded as RESP.
+    void do_resp_request(Conn* conn, std::vector<std::string>& cmd, Buffer& out) {
+        Protocol proto = conn->proto;
+        if (do_resp_connection_command(conn, cmd, out)) {
+            return;
+        } else if (cmd[0] == "info" && cmd.size() <= 2) {
+            std::vector<std::string> lines;
+            info_lines(lines);
+            std::string text;
+            for (std::string& line : lines) {
+                text += line + "\r\n";
+            }
+            resp_write_bulk(out, (const uint8_t*)text.data(), text.size());
+            return;
+        } else if (cmd[0] == "config" && cmd.size() == 3 && cmd[1] == "get") {
+            // a map of the matching parameters, empty when there is none
+            std::string value;
+            bool found = config_get(cmd[2], value);
+            resp_write_map(out, found ? 1 : 0, proto);
+            if (found) {
+                resp_write_bulk(out, (const uint8_t*)cmd[2].data(), cmd[2].size());
+                resp_write_bulk(out, (const uint8_t*)value.data(), value.size());
+            }
+            return;
+        }
+
+        // get with one key returns the value itself, del returns a count
+        bool single_get = cmd[0] == "get" && cmd.size() == 2;
+        if (cmd[0] == "mget") {
+            cmd[0] = "get";
+        } else if (cmd[0] == "del") {
+            cmd[0] = "mdel";
+        }
+        Buffer reply;
+        bool was_text = values_as_text;     // exec runs its commands through here again
+        values_as_text = true;
+        do_request(cmd, reply);
+        values_as_text = was_text;
+        const uint8_t* cur = reply.data_begin;
+        const uint8_t* end = reply.data_end;
+        if (single_get && cur < end && *cur == JSON::TAG_ARR) {
+            cur += 5;
+        } else if (cmd[0] == "scan" && cur < end && *cur == JSON::TAG_ARR) {
+            // the cursor goes out as a string
+            int64_t cursor = 0;
+            memcpy(&cursor, cur + 6, 8);
+            std::string cursor_str = std::to_string(cursor);
+            resp_write_array(out, 2);
+            resp_write_bulk(out, (const uint8_t*)cursor_str.data(), cursor_str.size());
+            cur += 14;
+        }
+        if (!resp_transcode(cur, end, out, proto)) {
+            resp_write_error(out, "internal error");
+        }
+    }
+
+    // Runs a command listed in k_commands (Commands.cpp); the others get
+    // the unknown command error without going through the chain below.
+    void do_request(std::vector<std::string> &cmd, Buffer& out) {
+        if (command_spec(cmd[0]) == nullptr) {
+            write_err(out);
+        } else if (cmd.size() >= 2  && cmd[0] == "get") {
+            do_get_multi(cmd, 1, out);
+        } else if (cmd.size() == 3 && cmd[0] == "set") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            std::string& key = cmd[1];
+            std::string& value = cmd[2];
+            do_set(key, value, out);
+        } else if (cmd.size() == 2 && cmd[0] == "del") {
+            std::string& key = cmd[1];
+            do_delete(key, out);
+        } else if (cmd.size() == 3 && cmd[0] == "expire") {
+            std::string& key = cmd[1];
+            int64_t new_ttl = 0;
+            if (!parse_int(cmd[2], new_ttl)) {
+                write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+                return;
+            }
+            if (new_ttl <= 0) {
+                write_err(out, (uint8_t*)INVALID_TTL.data(), INVALID_TTL.size());
+                return;
+            }
+            do_set_expire(key, (uint64_t)new_ttl, out);
+        } else if (cmd.size() >= 4 && cmd[0] == "set") {
+            SetOptions opts;
+            if (!parse_set_options(cmd, opts, out) || !ensure_memory(out)) {
+                return;
+            }
+            do_set_options(cmd[1], cmd[2], opts, out);
+        } else if (cmd.size() == 3 && cmd[0] == "append") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_append(cmd[1], cmd[2], out);
+        } else if (cmd.size() == 2 && cmd[0] == "strlen") {
+            do_strlen(cmd[1], out);
+        } else if (cmd.size() == 4 && cmd[0] == "getrange") {
+            do_getrange(cmd, out);
+        } else if (cmd.size() == 4 && cmd[0] == "setrange") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_setrange(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "getex") {
+            do_getex(cmd, out);
+        } else if (cmd.size() == 2 && cmd[0] == "getdel") {
+            do_getdel(cmd[1], out);
+        } else if (cmd.size() >= 3 && cmd.size() % 2 == 1 && cmd[0] == "mset") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_mset(cmd, 1, k_default_entry_timeout, out);
+        } else if (cmd.size() >= 4 && cmd.size() % 2 == 0 && cmd[0] == "msetex") {
+            int64_t ttl = 0;
+            if (!parse_int(cmd[1], ttl) || ttl <= 0) {
+                write_err(out, (uint8_t*)INVALID_TTL.data(), INVALID_TTL.size());
+                return;
+            }
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_mset(cmd, 2, (uint64_t)ttl, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "unlink") {
+            do_unlink(cmd, out);
+        } else if (cmd.size() == 1 && cmd[0] == "flushall") {
+            do_flushall(false, out);
+        } else if (cmd.size() == 2 && cmd[0] == "flushall" && cmd[1] == "async") {
+            do_flushall(true, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "mdel") {
+            do_mdel(cmd, 1, out);
+        } else if ((cmd.size() == 2 && (cmd[0] == "incr" || cmd[0] == "decr"))
+                || (cmd.size() == 3 && (cmd[0] == "incrby" || cmd[0] == "decrby"))) {
+            int64_t delta = 1;
+            if (cmd.size() == 3 && !parse_int(cmd[2], delta)) {
+                write_err(out, (uint8_t*)NOT_AN_INTEGER.data(), NOT_AN_INTEGER.size());
+                return;
+            }
+            if (cmd[0][0] == 'd') {
+                if (delta == INT64_MIN) {
+                    write_err(out, (uint8_t*)INCR_OVERFLOW.data(), INCR_OVERFLOW.size());
+                    return;
+                }
+                delta = -delta;
+            }
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_incrby(cmd[1], delta, out);
+        } else if (cmd.size() == 3 && cmd[0] == "incrbyfloat") {
+            double delta = 0;
+            if (!parse_double(cmd[2], delta) || std::isinf(delta)) {
+                write_err(out, (uint8_t*)NOT_A_FLOAT.data(), NOT_A_FLOAT.size());
+                return;
+            }
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_incrbyfloat(cmd[1], delta, out);
+        } else if (cmd.size() >= 4 && cmd.size() % 2 == 0 && cmd[0] == "zadd") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_zadd(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "pfadd") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_pfadd(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "pfcount") {
+            do_pfcount(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "pfmerge") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_pfmerge(cmd, out);
+        } else if (cmd.size() == 4 && cmd[0] == "setbit") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_setbit(cmd, out);
+        } else if (cmd.size() == 3 && cmd[0] == "getbit") {
+            do_getbit(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "bitcount") {
+            do_bitcount(cmd, out);
+        } else if (cmd.size() >= 3 && cmd[0] == "bitpos") {
+            do_bitpos(cmd, out);
+        } else if (cmd.size() >= 4 && cmd[0] == "bitop") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_bitop(cmd, out);
+        } else if (cmd.size() >= 4 && cmd[0] == "bf.reserve") {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_bf_reserve(cmd, out);
+        } else if ((cmd.size() == 3 && cmd[0] == "bf.add") || (cmd.size() >= 3 && cmd[0] == "bf.madd")) {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_bf_add(cmd, cmd[0] == "bf.madd", out);
+        } else if ((cmd.size() == 3 && cmd[0] == "bf.exists") || (cmd.size() >= 3 && cmd[0] == "bf.mexists")) {
+            do_bf_exists(cmd, cmd[0] == "bf.mexists", out);
+        } else if (cmd.size() == 2 && cmd[0] == "bf.info") {
+            do_bf_info(cmd[1], out);
+        } else if (cmd.size() >= 3 && cmd[0] == "zrem") {
+            do_zrem(cmd, out);
+        } else if (cmd.size() == 3 && cmd[0] == "zscore") {
+            do_zscore(cmd[1], cmd[2], out);
+        } else if (cmd.size() == 3 && cmd[0] == "zrank") {
+            do_zrank(cmd[1], cmd[2], out);
+        } else if (cmd.size() == 2 && cmd[0] == "zcard") {
+            do_zcard(cmd[1], out);
+        } else if ((cmd.size() == 4 || cmd.size() == 5) && cmd[0] == "zrange") {
+            do_zrange(cmd, out);
+        } else if (cmd.size() >= 4 && cmd[0] == "zrangebyscore") {
+            do_zrangebyscore(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "scan") {
+            do_scan(cmd, out);
+        } else if (!cmd.empty() && cmd[0].compare(0, 7, "prefix.") == 0 && prefix_index == nullptr) {
+            write_err(out, (uint8_t*)PREFIX_INDEX_DISABLED.data(), PREFIX_INDEX_DISABLED.size());
+        } else if (cmd.size() >= 2 && cmd[0] == "prefix.keys") {
+            do_prefix_keys(cmd, out);
+        } else if (cmd.size() >= 3 && cmd[0] == "prefix.range") {
+            do_prefix_range(cmd, out);
+        } else if (cmd.size() == 2 && cmd[0] == "prefix.del") {
+            do_prefix_del(cmd[1], out);
+        } else if (cmd.size() == 2 && cmd[0] == "persist") {
+            std::string& key = cmd[1];
+            do_persist(key, out);
+        } else if (cmd.size() == 1 && cmd[0] == "info") {
+            do_info(out);
+        } else if (cmd.size() == 3 && cmd[0] == "publish") {
+            do_publish(cmd[1], cmd[2], out);
+        } else if (!cmd.empty() && cmd[0] == "hotkeys") {
+            do_hotkeys(cmd, out);
+        } else if (cmd.size() >= 2 && cmd[0] == "cluster") {
+            do_cluster(cmd, out);
+        } else if (cmd.size() == 2 && cmd[0] == "dump") {
+            do_dump(cmd[1], out);
+        } else if ((cmd.size() == 4 || cmd.size() == 5) && (cmd[0] == "restore" || cmd[0] == "restore-asking")) {
+            if (!ensure_memory(out)) {
+                return;
+            }
+            do_restore(cmd, out);
+        } else if (cmd.size() >= 5 && cmd[0] == "migrate") {
+            do_migrate(cmd, out);
+        } else if (cmd.size() == 3 && cmd[0] == "config" && cmd[1] == "get") {
+            do_config_get(cmd[2], out);
+        } else if (cmd.size() == 4 && cmd[0] == "config" && cmd[1] == "set") {
+            do_config_set(cmd[2], cmd[3], out);
+        } else {
+            write_err(out);
+        }
+    }
+
+    int determine_timeout() {
+        uint64_t curr_time = get_monotonic_msec();
+        uint64_t min_expire_time = (uint64_t)-1;
+        if (ready_queue.tail->prev != ready_queue.head) {
+            return 0;   // queued requests are waiting, only check for new events
+        }
+        if (dll.tail->prev != dll.head) {
+            Node* node = dll.tail->prev;
+            Conn* e = get_connection(node);
+            uint64_t expiry_time = e->last_active_ms + k_tcp_idle_timeout;
+            min_expire_time = expiry_time; 
+        }
+        if (entry_heap.heap_size() > 0) {
+            HeapEntry& first_entry = entry_heap.top();
+            uint64_t expiry_time = first_entry.expire_time;
+            min_expire_time = std::min(min_expire_time, expiry_time);
+        }
+        if (value_log.is_open()) {
+            min_expire_time = std::min(min_expire_time, tier_next_ms);
+        }
+
+        if (min_expire_time == (uint64_t)-1) {
+            return -1;
+        }
+        if (min_expire_time >= curr_time) {
+            return (int)(min_expire_time - curr_time);
+        }
+        return 0;
+    }
+
+    void handle_expired_connections(std::vector<Conn*>& fd2conn) {
+        // removes old tcp connections 
+        uint64_t curr_time = get_monotonic_msec();
+        Node* node = dll.tail->prev;
+        while (node != dll.head) {
+            Conn* connection = get_connection(node);
+            Node* prev_node = node->prev;
+            if (connection->last_active_ms + k_tcp_idle_timeout > curr_time) {
+                break;
+            }
+            if (!connection->subscriptions.empty()) {
+                touch_connection(connection);   // waiting for messages is not idling
+            } else {
+                conn_destroy(connection, fd2conn);
+            }
+            node = prev_node;
+        }
+
+        // removes old entries from entry_heap
+        if (entry_heap.heap_size() == 0 || entry_heap.top().expire_time > curr_time) {
+            return;
+        }
+        keyspace_write_begin();
+        while (entry_heap.heap_size() > 0) {
+            HeapEntry& entry = entry_heap.top();
+            if (entry.expire_time > curr_time) {
+                break;
+            }
+            Entry* e = get_entry_from_heap_idx(entry.heap_idx_ref);
+            entry_delete(e);
+            stats.expired_keys++;
+        }
+        keyspace_write_end();
+    }
+
+    uint64_t entry_idle_ms(Entry* e) {
+        if (config.maxmemory_policy == EVICT_ALLKEYS_LFU) {
+            return lfu_idle_ms(e->lru);
+        }
+        return lru_idle_ms(e->lru);
+    }
+
+    static void tier_scan_callback(HNode* node, void* arg) {
+        Server* server = (Server*)arg;
+        Entry* e = get_entry(node);
+        size_t size = e->value.size();
+        if (e->type == VAL_STR && size >= server->config.tiered_min_value
+                && (size >= server->config.tiered_large_value
+                    || server->entry_idle_ms(e) >= server->config.tiered_cold_ms)) {
+            server->tier_candidates.push_back(e);
+        }
+    }
+
+    // where the entry owning the record of key at loc keeps it, nullptr if
+    // the record is garbage
+    static ValueLoc* tier_live_record(const char* key, size_t key_len, ValueLoc loc, void* arg) {
+        Server* server = (Server*)arg;
+        Entry* e = server->find_entry(std::string(key, key_len), fnv_hash((const uint8_t*)key, key_len));
+        if (e == nullptr || e->type != VAL_DISK || e->loc.segment != loc.segment || e->loc.offset != loc.offset) {
+            return nullptr;
+        }
+        return &e->loc;
+    }
+
+    static void free_segment_job(void* arg) {
+        ValueLog::free_segment((ValueSegment*)arg);
+    }
+
+    static void retire_segment(ValueSegment* seg, void* arg) {
+        ((Server*)arg)->dispose(&free_segment_job, seg, 0, false);
+    }
+
+    // Tiering runs every k_tier_interval_ms between requests, like expiry:
+    // for up to k_tier_step_ms it walks the table a slice at a time moving
+    // cold and large values to the value log, then for as long again it
+    // compacts the log. Each slice is a keyspace write of its own so reader
+    // threads are only held up for one slice at a time.
+    void tier_values() {
+        uint64_t now = get_monotonic_msec();
+        if (now < tier_next_ms) {
+            return;
+        }
+        tier_next_ms = now + k_tier_interval_ms;
+        uint64_t deadline = now + k_tier_step_ms;
+        bool log_full = false;
+        do {
+            keyspace_write_begin();
+            for (size_t i = 0; i < k_tier_scan_buckets; i++) {
+                tier_cursor = htable.hm_scan(tier_cursor, &tier_scan_callback, this);
+                if (tier_cursor == 0) {
+                    break;  // a full pass per interval at most
+                }
+            }
+            for (Entry* e : tier_candidates) {
+                if (!entry_spill(e)) {
+                    log_full = true;
+                    break;
+                }
+            }
+            tier_candidates.clear();
+            keyspace_write_end();
+        } while (!log_full && tier_cursor != 0 && (uint64_t)get_monotonic_msec() < deadline);
+        bool more = true;
+        deadline = (uint64_t)get_monotonic_msec() + k_tier_step_ms;
+        while (more && (uint64_t)get_monotonic_msec() < deadline) {
+            keyspace_write_begin();
+            more = value_log.compact(k_compact_batch, &tier_live_record, this);
+            keyspace_write_end();
+        }
+    }
+
+    // Writes the messages published during this loop turn right away rather
+    // than polling the subscribers for POLLOUT first, which would cost a
+    // second pass over all connections per publish. Several messages queued
+    // to a subscriber in one turn go out in one writev. Subscribers that went
+    // over the output limit are closed here. The fds cannot have been reused
+    // since they were queued, accepting only happens at the top of the loop.
+    void flush_subscribers(std::vector<Conn*>& fd2conn) {
+        for (size_t i = 0; i < pending_flush.size(); i++) {
+            Conn* conn = fd2conn[pending_flush[i]];
+            if (conn == nullptr) {
+                continue;   // closed since
+            }
+            conn->flush_pending = false;
+            if (!conn->want_close && conn_output_size(conn) > 0) {
+                handle_write(conn);
+            }
+            if (conn->want_close) {
+                conn_destroy(conn, fd2conn);
+            }
+        }
+        pending_flush.clear();
+    }
+
+    void conn_destroy(Conn* connection, std::vector<Conn*>& fd2conn) {
+        end_transaction(connection);
+        std::vector<std::string> channels;
+        pubsub.unsubscribe_all(connection, false, channels);
+        pubsub.unsubscribe_all(connection, true, channels);
+        for (QueuedMessage& queued : connection->out_messages) {
+            message_unref(queued.msg);
+        }
+        (void)close(connection->fd);
+        fd2conn[connection->fd] = NULL;
+        dll.remove(&connection->node);
+        if (connection->ready) {
+            ready_queue.remove(&connection->ready_node);
+        }
+        delete connection;
+    }
+
+public:
+    Server() : htable(4) {}
+
+    ~Server() {
+        readers_stop = true;
+        for (std::thread& reader : readers) {
+            reader.join();
+        }
+    }
+
+    bool config_set(const std::string& name, const std::string& value) {
+        if (name == "reader-threads" || name == "reader-port") {
+            int64_t n = 0;
+            if (listening || !parse_int(value, n) || n < 0 || n > 65535) {
+                return false;   // only at startup
+            }
+            if (name == "reader-threads") {
+                config.reader_threads = (size_t)n;
+            } else {
+                config.reader_port = (uint16_t)n;
+            }
+            return true;
+        }
+        if (name == "tiered-dir") {
+            if (listening) {
+                return false;   // only at startup
+            }
+            config.tiered_dir = value;
+            return true;
+        }
+        if (name == "tiered-min-value") {
+            return parse_memory(value, config.tiered_min_value);
+        }
+        if (name == "cluster-enabled" || name == "cluster-announce-ip") {
+            if (listening) {
+                return false;   // only at startup
+            }
+            if (name == "cluster-announce-ip") {
+                config.cluster_announce_ip = value;
+                return !value.empty();
+            }
+            if (value != "yes" && value != "no") {
+                return false;
+            }
+            config.cluster_enabled = value == "yes";
+            return true;
+        }
+        if (name == "tiered-large-value") {
+            return parse_memory(value, config.tiered_large_value);
+        }
+        if (name == "tiered-cold-ms") {
+            int64_t ms = 0;
+            if (!parse_int(value, ms) || ms < 0) {
+                return false;
+            }
+            config.tiered_cold_ms = (uint64_t)ms;
+            return true;
+        }
+        if (name == "port" || name == "unixsocket") {
+            if (listening) {
+                return false;   // only at startup
+            }
+            if (name == "unixsocket") {
+                config.unixsocket = value;
+                return value.size() < sizeof(((struct sockaddr_un*)0)->sun_path);
+            }
+            int64_t port = 0;
+            if (!parse_int(value, port) || port < 0 || port > 65535) {
+                return false;
+            }
+            config.port = (uint16_t)port;
+            return true;
+        }
+        if (name == "maxmemory") {
+            return parse_memory(value, config.maxmemory);
+        }
+        if (name == "maxmemory-policy") {
+            eviction_pool.clear();
+            return parse_eviction_policy(value, config.maxmemory_policy);
+        }
+        if (name == "maxmemory-samples") {
+            int64_t samples = 0;
+            if (!parse_int(value, samples) || samples <= 0) {
+                return false;
+            }
+            config.maxmemory_samples = (size_t)samples;
+            return true;
+        }
+        if (name == "client-output-soft-limit") {
+            return parse_memory(value, config.output_soft_limit);
+        }
+        if (name == "client-output-hard-limit") {
+            return parse_memory(value, config.output_hard_limit);
+        }
+        if (name == "client-output-hard-seconds") {
+            int64_t seconds = 0;
+            if (!parse_int(value, seconds) || seconds < 0) {
+                return false;
+            }
+            config.output_hard_seconds = (uint64_t)seconds;
+            return true;
+        }
+        if (name == "client-command-budget") {
+            int64_t budget = 0;
+            if (!parse_int(value, budget) || budget < 0) {
+                return false;
+            }
+            config.command_budget = (size_t)budget;
+            return true;
+        }
+        if (name == "hotkeys-sample-rate") {
+            int64_t rate = 0;
+            if (!parse_int(value, rate) || rate < 0 || rate > UINT32_MAX) {
+                return false;
+            }
+            config.hotkeys_sample_rate = (uint32_t)rate;
+            hot_keys.set_sample_rate(config.hotkeys_sample_rate);
+            return true;
+        }
+        if (name == "prefix-index") {
+            if (value != "yes" && value != "no") {
+                return false;
+            }
+            config.prefix_index = value == "yes";
+            prefix_index_enable(config.prefix_index);
+            return true;
+        }
+        if (name == "bitmap-simd") {
+            if (value != "yes" && value != "no") {
+                return false;
+            }
+            config.bitmap_simd = value == "yes";
+            bitmap_use_simd(config.bitmap_simd);
+            return true;
+        }
+        return false;
+    }
+
+    bool config_get(const std::string& name, std::string& out) {
+        if (name == "port") {
+            out = std::to_string(config.port);
+        } else if (name == "unixsocket") {
+            out = config.unixsocket;
+        } else if (name == "maxmemory") {
+            out = std::to_string(config.maxmemory);
+        } else if (name == "maxmemory-policy") {
+            out = eviction_policy_name(config.maxmemory_policy);
+        } else if (name == "maxmemory-samples") {
+            out = std::to_string(config.maxmemory_samples);
+        } else if (name == "client-output-soft-limit") {
+            out = std::to_string(config.output_soft_limit);
+        } else if (name == "client-output-hard-limit") {
+            out = std::to_string(config.output_hard_limit);
+        } else if (name == "client-output-hard-seconds") {
+            out = std::to_string(config.output_hard_seconds);
+        } else if (name == "client-command-budget") {
+            out = std::to_string(config.command_budget);
+        } else if (name == "hotkeys-sample-rate") {
+            out = std::to_string(config.hotkeys_sample_rate);
+        } else if (name == "reader-threads") {
+            out = std::to_string(config.reader_threads);
+        } else if (name == "reader-port") {
+            out = std::to_string(config.reader_port);
+        } else if (name == "prefix-index") {
+            out = config.prefix_index ? "yes" : "no";
+        } else if (name == "bitmap-simd") {
+            out = config.bitmap_simd ? "yes" : "no";
+        } else if (name == "tiered-dir") {
+            out = config.tiered_dir;
+        } else if (name == "tiered-min-value") {
+            out = std::to_string(config.tiered_min_value);
+        } else if (name == "tiered-large-value") {
+            out = std::to_string(config.tiered_large_value);
+        } else if (name == "tiered-cold-ms") {
+            out = std::to_string(config.tiered_cold_ms);
+        } else if (name == "cluster-enabled") {
+            out = config.cluster_enabled ? "yes" : "no";
+        } else if (name == "cluster-announce-ip") {
+            out = config.cluster_announce_ip;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    int listen_tcp(uint16_t port) {
+        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            die("socket()");
+        }
+        int val = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
 
         struct sockaddr_in addr = {};
         addr.sin_family = AF_INET;
-        addr.sin_port = htons(1234);
+        addr.sin_port = htons(port);
         addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
+        int rv = bind(listen_fd, (const sockaddr *)&addr, sizeof(addr));
         if (rv) {
             die("bind()");
         }
 
-        fd_set_nb(fd);
+        fd_set_nb(listen_fd);
 
-        rv = listen(fd, SOMAXCONN);
+        rv = listen(listen_fd, SOMAXCONN);
         if (rv) {
             die("listen()");
         }
+        return listen_fd;
+    }
+
+    // a stale socket file left by a previous run is removed before binding
+    int listen_unix() {
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            die("socket()");
+        }
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, config.unixsocket.data(), config.unixsocket.size());
+        unlink(config.unixsocket.c_str());
+        int rv = bind(listen_fd, (const sockaddr *)&addr, sizeof(addr));
+        if (rv) {
+            die("bind() unix socket");
+        }
+
+        fd_set_nb(listen_fd);
+
+        rv = listen(listen_fd, SOMAXCONN);
+        if (rv) {
+            die("listen() unix socket");
+        }
+        return listen_fd;
+    }
+
+    // Looks the key up without locks and appends its value to out in the
+    // format of do_get_multi. The lookup is redone whenever the writer ran a
+    // command in the meantime: the bucket array and mask are only used once
+    // validated together, the entry fields are copied out and validated
+    // before the value is copied, and the copy is dropped if it may be torn.
+    // Whatever a lookup that is thrown away touched is kept alive by the
+    // epoch the caller holds. as_text is write_value's values_as_text.
+    bool reader_lookup(const std::string& key, bool as_text, ReaderStats& rs, Buffer& out) {
+        uint64_t hash_code = fnv_hash((const uint8_t*)key.data(), key.size());
+        while (true) {
+            uint64_t seq = keyspace_seq.read_begin();
+            HNode** buckets = htable.hm_buckets();
+            size_t mask = htable.hm_mask();
+            if (keyspace_seq.read_retry(seq)) {
+                stat_add(rs.retries);
+                continue;
+            }
+            Entry* found = nullptr;
+            bool changed = false;
+            size_t steps = 0;
+            for (HNode* node = buckets[hash_code & mask]; node != nullptr; node = node->next) {
+                // a chain being rewritten may lead anywhere, not only on
+                if (++steps % 64 == 0 && keyspace_seq.read_retry(seq)) {
+                    changed = true;
+                    break;
+                }
+                if (node->hash_code == hash_code && get_entry(node)->key == key) {
+                    found = get_entry(node);
+                    break;
+                }
+            }
+            if (changed || found == nullptr) {
+                if (changed || keyspace_seq.read_retry(seq)) {
+                    stat_add(rs.retries);
+                    continue;
+                }
+                stat_add(rs.keyspace_misses);
+                write_err(out, (uint8_t*)NULL_MESSAGE.data(), NULL_MESSAGE.size());
+                return false;
+            }
+            uint32_t type = found->type;
+            const char* data = found->value.data();
+            size_t len = found->value.size();
+            int64_t int_val = found->int_val;
+            if (type == VAL_DISK) {
+                ValueLoc loc;
+                memcpy(&loc, &int_val, sizeof(loc));
+                data = value_log.value(loc, len);
+            }
+            if (keyspace_seq.read_retry(seq)) {
+                stat_add(rs.retries);
+                continue;
+            }
+            size_t mark = out.size();
+            double dbl_val;
+            memcpy(&dbl_val, &int_val, sizeof(dbl_val));
+            std::string text;
+            if (as_text && (type == VAL_INT || type == VAL_DBL)) {
+                text = type == VAL_INT ? std::to_string(int_val) : double_text(dbl_val);
+                type = VAL_STR;
+                data = text.data();
+                len = text.size();
+            }
+            switch (type) {
+                case VAL_INT:
+                    write_int64(out, int_val);
+                    break;
+                case VAL_DBL:
+                    write_double(out, dbl_val);
+                    break;
+                case VAL_ZSET:
+                case VAL_BLOOM:
+                    write_err(out, (uint8_t*)WRONG_TYPE.data(), WRONG_TYPE.size());
+                    break;
+                default:
+                    write_string(out, (const uint8_t*)data, len);
+                    break;
+            }
+            if (keyspace_seq.read_retry(seq)) {
+                out.data_end = out.data_begin + mark;
+                stat_add(rs.retries);
+                continue;
+            }
+            stat_add(rs.keyspace_hits);
+            return true;
+        }
+    }
+
+    // runs one buffered request of a reader connection, like try_one_request
+    bool reader_one_request(Conn* conn, ReaderStats& rs) {
+        if (conn->proto == PROTO_UNKNOWN) {
+            conn->proto = detect_protocol(conn->read_buffer.data_begin, conn->read_buffer.size());
+            if (conn->proto == PROTO_UNKNOWN) {
+                return false;
+            }
+        }
+        std::vector<std::string> cmd;
+        size_t consumed = 0;
+        int rv = conn->proto == PROTO_BINARY
+            ? read_binary_request(conn, cmd, consumed)
+            : read_resp_request(conn, cmd, consumed);
+        if (rv <= 0) {
+            conn->want_close = rv < 0;
+            return false;
+        }
+        stat_add(rs.requests);
+        if (!cmd.empty()) {
+            normalize_command(cmd);
+        }
+        bool is_get = cmd.size() >= 2 && (cmd[0] == "get" || cmd[0] == "mget");
+        Buffer reply;
+        SlotRoute route = SLOT_SERVE;
+        std::string redirect;
+        if (is_get && cluster.enabled()) {
+            // as in do_cluster_redirect, except that a migrating slot is
+            // looked up first and the reply swapped for a redirect after
+            uint16_t slot = 0;
+            int16_t node = -1;
+            route = cluster_route(cmd, false, slot, node, redirect);
+            if (route == SLOT_MIGRATING) {
+                redirect = cluster_redirect("ASK", slot, node);
+            }
+        }
+        if (is_get && (route == SLOT_SERVE || route == SLOT_MIGRATING)) {
+            write_arr(reply, cmd.size() - 1);
+            size_t missing = 0;
+            for (size_t i = 1; i < cmd.size(); i++) {
+                missing += !reader_lookup(cmd[i], conn->proto != PROTO_BINARY, rs, reply);
+            }
+            if (route == SLOT_MIGRATING && missing > 0) {
+                reply.data_end = reply.data_begin;
+                is_get = false;
+                const std::string& err = missing == cmd.size() - 1 ? redirect : TRY_AGAIN;
+                write_err(reply, (const uint8_t*)err.data(), err.size());
+            }
+        } else if (is_get) {
+            is_get = false;
+            write_err(reply, (const uint8_t*)redirect.data(), redirect.size());
+        } else if (!cmd.empty() && conn->proto != PROTO_BINARY
+                && do_resp_connection_command(conn, cmd, conn->write_buffer)) {
+            buf_consume(conn->read_buffer, consumed);
+            return true;
+        } else if (!cmd.empty()) {
+            write_err(reply, (uint8_t*)READER_GET_ONLY.data(), READER_GET_ONLY.size());
+        }
+        if (cmd.empty()) {
+            // no reply, as in try_one_request
+        } else if (conn->proto == PROTO_BINARY) {
+            send_frame(reply, conn->write_buffer);
+        } else {
+            const uint8_t* cur = reply.data_begin;
+            if (is_get && cmd[0] == "get" && cmd.size() == 2) {
+                cur += 5;   // get with one key returns the value itself
+            }
+            resp_transcode(cur, reply.data_end, conn->write_buffer, conn->proto);
+        }
+        buf_consume(conn->read_buffer, consumed);
+        return true;
+    }
+
+    void reader_write(Conn* conn) {
+        ssize_t rv = write(conn->fd, conn->write_buffer.data_begin, conn->write_buffer.size());
+        if (rv < 0 && errno != EAGAIN) {
+            conn->want_close = true;
+            return;
+        }
+        if (rv > 0) {
+            buf_consume(conn->write_buffer, (size_t)rv);
+        }
+        conn->write_buffer.shrink();
+    }
+
+    void reader_read(Conn* conn, size_t id) {
+        uint8_t* tail = conn->read_buffer.reserve(k_min_read);
+        ssize_t rv = read(conn->fd, tail, conn->read_buffer.buffer_end - tail);
+        if (rv < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (rv <= 0) {
+            conn->want_close = true;
+            return;
+        }
+        conn->read_buffer.commit((size_t)rv);
+        reader_process(conn, id);
+    }
+
+    // Answers the buffered requests of a reader connection until the pending
+    // output reaches k_reader_output_limit. The epoch is held for the whole
+    // batch of requests, not across the socket calls.
+    void reader_process(Conn* conn, size_t id) {
+        ReaderStats& rs = reader_stats[id];
+        bool more = true;
+        while (more) {
+            reclaimer.enter(id);
+            while (conn->write_buffer.size() < (int)k_reader_output_limit && reader_one_request(conn, rs)) {
+            }
+            reclaimer.exit(id);
+            // stopped at the limit, go on if the socket takes the output
+            more = conn->write_buffer.size() >= (int)k_reader_output_limit;
+            if (conn->write_buffer.size() > 0 && !conn->want_close) {
+                reader_write(conn);
+            }
+            more = more && !conn->want_close && conn->write_buffer.size() < (int)k_reader_output_limit;
+        }
+        conn->read_buffer.shrink();
+        // paused while the client does not read its replies
+        conn->want_read = conn->write_buffer.size() < (int)k_reader_output_limit;
+        conn->want_write = conn->write_buffer.size() > 0;
+    }
+
+    // Event loop of reader thread id. The reader threads share the reader
+    // port's listening socket and each serves the connections it accepted:
+    // get against the keyspace (see reader_lookup), plus the RESP connection
+    // commands. Everything else is refused, writes go to the main port.
+    void reader_loop(size_t id) {
+        std::vector<Conn*> conns;
+        std::vector<struct pollfd> poll_args;
+        while (!readers_stop.load(std::memory_order_relaxed)) {
+            poll_args.clear();
+            struct pollfd listen_pfd = {reader_fd, POLLIN, 0};
+            poll_args.push_back(listen_pfd);
+            for (Conn* conn : conns) {
+                struct pollfd pfd = {conn->fd, POLLERR, 0};
+                if (conn->want_read) {
+                    pfd.events |= POLLIN;
+                }
+                if (conn->want_write) {
+                    pfd.events |= POLLOUT;
+                }
+                poll_args.push_back(pfd);
+            }
+            // the timeout only bounds how long a stop request waits
+            int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), 100);
+            if (rv < 0 && errno != EINTR) {
+                die("poll");
+            }
+            if (rv <= 0) {
+                continue;
+            }
+            size_t num_conns = conns.size();
+            if (poll_args[0].revents) {
+                // another reader may have taken the connection already
+                int connfd = accept(reader_fd, NULL, NULL);
+                if (connfd >= 0) {
+                    fd_set_nb(connfd);
+                    Conn* conn = new Conn();
+                    conn->fd = connfd;
+                    conn->want_read = true;
+                    conns.push_back(conn);
+                    stat_add(reader_stats[id].connections);
+                }
+            }
+            size_t kept = 0;
+            for (size_t i = 0; i < num_conns; i++) {
+                Conn* conn = conns[i];
+                uint32_t ready = poll_args[i + 1].revents;
+                if (ready & POLLIN) {
+                    reader_read(conn, id);
+                }
+                if ((ready & POLLOUT) && !conn->want_close) {
+                    reader_write(conn);
+                    conn->want_write = conn->write_buffer.size() > 0;
+                    if (!conn->want_read && conn->write_buffer.size() < (int)k_reader_output_limit / 2) {
+                        reader_process(conn, id);   // run what waited for the output to drain
+                    }
+                }
+                if ((ready & POLLERR) || conn->want_close) {
+                    (void)close(conn->fd);
+                    delete conn;
+                    stat_add(reader_stats[id].connections, (uint64_t)-1);
+                    continue;
+                }
+                conns[kept++] = conn;
+            }
+            for (size_t i = num_conns; i < conns.size(); i++) {
+                conns[kept++] = conns[i];
+            }
+            conns.resize(kept);
+        }
+        for (Conn* conn : conns) {
+            (void)close(conn->fd);
+            delete conn;
+        }
+    }
+
+    // From here on every keyspace change is bracketed by keyspace_seq and
+    // freed memory goes through the reclaimer, see dispose.
+    void start_readers() {
+        reader_fd = listen_tcp(config.reader_port);
+        reclaimer.init(config.reader_threads);
+        reader_stats.reset(new ReaderStats[config.reader_threads]);
+        htable.hm_set_retire(&retire_buckets, this);
+        readers_running = true;
+        for (size_t i = 0; i < config.reader_threads; i++) {
+            readers.emplace_back(&Server::reader_loop, this, i);
+        }
+    }
+
+    void run_server() {
+        // the listening sockets
+        listening = true;
+        if (config.port != 0) {
+            tcp_fd = listen_tcp(config.port);
+        }
+        if (!config.unixsocket.empty()) {
+            unix_fd = listen_unix();
+        }
+        if (tcp_fd < 0 && unix_fd < 0) {
+            fprintf(stderr, "no listener: set a port or a unixsocket\n");
+            exit(1);
+        }
+        if (!config.tiered_dir.empty()) {
+            if (!value_log.open(config.tiered_dir)) {
+                fprintf(stderr, "cannot create the value log in %s\n", config.tiered_dir.c_str());
+                exit(1);
+            }
+            value_log.set_retire(&retire_segment, this);
+        }
+        if (config.cluster_enabled) {
+            if (config.port == 0) {
+                fprintf(stderr, "cluster mode needs a port to announce\n");
+                exit(1);
+            }
+            cluster.init(config.cluster_announce_ip, config.port);
+            slot_entries.reset(new std::vector<Entry*>[k_cluster_slots]);
+        }
+        if (config.reader_threads > 0) {
+            if (config.reader_port == 0) {
+                fprintf(stderr, "reader-threads needs a reader-port\n");
+                exit(1);
+            }
+            start_readers();
+        }
 
         std::vector<Conn *> fd2conn;
         std::vector<struct pollfd> poll_args;
         while (true) {
             poll_args.clear();
-            struct pollfd pfd = {fd, POLLIN, 0};
-            poll_args.push_back(pfd);
+            for (int listen_fd : {tcp_fd, unix_fd}) {
+                if (listen_fd >= 0) {
+                    struct pollfd pfd = {listen_fd, POLLIN, 0};
+                    poll_args.push_back(pfd);
+                }
+            }
+            size_t num_listeners = poll_args.size();
             for (Conn *conn : fd2conn) {
                 if (!conn) {
                     continue;
@@ -559,8 +4661,11 @@ public:
                 die("poll");
             }
 
-            if (poll_args[0].revents) {
-                if (Conn *conn = handle_accept()) {
+            for (size_t i = 0; i < num_listeners; ++i) {
+                if (poll_args[i].revents == 0) {
+                    continue;
+                }
+                if (Conn *conn = handle_accept(poll_args[i].fd)) {
                     if (fd2conn.size() <= (size_t)conn->fd) {
                         fd2conn.resize(conn->fd + 1);
                     }
@@ -569,22 +4674,20 @@ public:
                 }
             }
 
-            for (size_t i = 1; i < poll_args.size(); ++i) {
+            for (size_t i = num_listeners; i < poll_args.size(); ++i) {
                 uint32_t ready = poll_args[i].revents;
                 if (ready == 0) {
                     continue;
                 }
 
                 Conn *conn = fd2conn[poll_args[i].fd];
-                conn->last_active_ms = get_monotonic_msec();
-                dll.remove(&conn->node);
-                dll.insert(&conn->node);
+                touch_connection(conn);
                 if (ready & POLLIN) {
                     assert(conn->want_read);
                     handle_read(conn);  // application logic
                 }
-                if (ready & POLLOUT) {
-                    assert(conn->want_write);
+                // handle_read may already have drained the output this turn
+                if ((ready & POLLOUT) && conn->want_write && conn_output_size(conn) > 0) {
                     handle_write(conn); // application logic
                 }
 
@@ -592,12 +4695,29 @@ public:
                     conn_destroy(conn, fd2conn);
                 }
             }
+            run_ready_connections(fd2conn);
             handle_expired_connections(fd2conn);
+            if (value_log.is_open()) {
+                tier_values();
+            }
+            flush_subscribers(fd2conn);
+            if (readers_running) {
+                reclaim_retired();
+            }
         }
     }
 };
 
-int main() {
+// options are given as `--name value` pairs, e.g.
+//     ./server --maxmemory 100mb --maxmemory-policy allkeys-lru
+//     ./server --port 0 --unixsocket /tmp/miniredis.sock
+int main(int argc, char **argv) {
     Server s;
+    for (int i = 1; i < argc; i += 2) {
+        if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc || !s.config_set(argv[i] + 2, argv[i + 1])) {
+            fprintf(stderr, "bad option: %s\n", argv[i]);
+            return 1;
+        }
+    }
     s.run_server();
 }